@@ -0,0 +1,431 @@
+/* The access list of acl.c on the host. Same result lines as the
+ * benchmarks, timed in nanoseconds, each sample the mean of a batch of
+ * lookups:
+ *
+ *   acl_<n>_hit_binary   binary search for keys on a list of n
+ *   acl_<n>_hit          interpolation search for the same keys
+ *   acl_<n>_miss_search  interpolation search for keys not on the list
+ *   acl_<n>_miss         acl_lookup() of those, most stop at the Bloom filter
+ *
+ * with the keys read per search on the bench-info lines. Host time is no
+ * measure of the Cortex-M3, the keys read are: each one is a flash read on
+ * the target. Lists of 10k and 50k keys are beyond the ACL_MAX_KEYS of a
+ * bank and show how the searches scale.
+ *
+ * Then the Bloom filter false positive rate over bits a key and hash
+ * counts, and the firmware sizes. Last, the flash side on RAM pages: loads,
+ * updates through several merges and a power cut at every flash operation,
+ * once with the operation left half done and once before it started. After
+ * each cut the list is mounted and must be the one before or after the
+ * operation cut short. Exits non zero if anything fails. */
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "acl.h"
+#include "bench.h"
+
+#define LOOKUPS 1024
+#define RUNS 64
+#define MAX_KEYS 50000
+#define BLOOM_KEYS 8192
+#define BLOOM_TESTS 200000
+/* Keys of the flash workload, more than a bank holds */
+#define UNIVERSE 600
+#define CUT_UPDATES 150
+/* Keys a load request carries, as PROTO_MAX_ACL_KEYS */
+#define LOAD_BATCH 30
+
+static const uint32_t sizes[] = {1000, 10000, 50000};
+
+static uint64_t keys[MAX_KEYS];
+static uint64_t hits[LOOKUPS];
+static uint64_t misses[LOOKUPS];
+static uint32_t bloom[16384];
+static acl_delta_t deltas[ACL_DELTA_MAX];
+static acl_t acl;
+static uint32_t random_state = 11;
+static volatile uint32_t sink;
+static int failures;
+
+/* xorshift32, the low bits of an LCG repeat too soon for 50k UIDs */
+static uint32_t next_random(void) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+static uint32_t nanos(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* A random UID, one in four single size */
+static uint64_t random_key(void) {
+	uint8_t uid[7];
+	uint8_t size = next_random() % 4 ? 7 : 4;
+	for (uint8_t i = 0; i < size; i++) {
+		uid[i] = next_random();
+	}
+	return acl_key(uid, size);
+}
+
+static int compare_keys(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* `n` sorted distinct keys */
+static void make_keys(uint64_t *out, uint32_t n) {
+	uint32_t have = 0;
+	while (have < n) {
+		while (have < n) {
+			out[have++] = random_key();
+		}
+		qsort(out, n, sizeof(out[0]), compare_keys);
+		have = 1;
+		for (uint32_t i = 1; i < n; i++) {
+			if (out[i] != out[have - 1]) {
+				out[have++] = out[i];
+			}
+		}
+	}
+}
+
+static void report(const bench_result_t *r) {
+	char line[BENCH_LINE_MAX];
+	bench_format(line, sizeof(line), r, "ns");
+	printf("%s", line);
+}
+
+/* Runs of LOOKUPS searches, returns the keys read per search in hundredths */
+static uint32_t time_search(const char *name, uint32_t n, const uint64_t *of,
+							bool interpolate) {
+	bench_result_t r = {.name = name};
+	uint32_t probes = 0;
+
+	for (uint32_t run = 0; run < RUNS; run++) {
+		uint32_t start = nanos();
+		for (uint32_t i = 0; i < LOOKUPS; i++) {
+			sink += acl_search(keys, n, of[i], interpolate, &probes);
+		}
+		bench_add_sample(&r, (nanos() - start) / LOOKUPS);
+	}
+	report(&r);
+	return (uint64_t)probes * 100 / (RUNS * LOOKUPS);
+}
+
+static void lookups(uint32_t n) {
+	char names[4][BENCH_LINE_MAX];
+	bench_result_t r;
+
+	make_keys(keys, n);
+	for (uint32_t i = 0; i < LOOKUPS; i++) {
+		hits[i] = keys[next_random() % n];
+		uint32_t probes = 0;
+		do {
+			misses[i] = random_key();
+		} while (acl_search(keys, n, misses[i], false, &probes) >= 0);
+	}
+	snprintf(names[0], sizeof(names[0]), "acl_%u_hit_binary", n);
+	snprintf(names[1], sizeof(names[1]), "acl_%u_hit", n);
+	snprintf(names[2], sizeof(names[2]), "acl_%u_miss_search", n);
+	snprintf(names[3], sizeof(names[3]), "acl_%u_miss", n);
+	uint32_t binary = time_search(names[0], n, hits, false);
+	uint32_t interp = time_search(names[1], n, hits, true);
+	uint32_t miss = time_search(names[2], n, misses, true);
+
+	/* The firmware's 8 bits a key, rounded up to a power of two words */
+	uint32_t words = 1;
+	while (words * 32 < n * 8) {
+		words *= 2;
+	}
+	acl_init(&acl, bloom, words, ACL_BLOOM_HASHES, deltas, ACL_DELTA_MAX);
+	acl_set_keys(&acl, keys, n);
+	r = (bench_result_t){.name = names[3]};
+	for (uint32_t run = 0; run < RUNS; run++) {
+		uint32_t start = nanos();
+		for (uint32_t i = 0; i < LOOKUPS; i++) {
+			sink += acl_lookup(&acl, misses[i]);
+		}
+		bench_add_sample(&r, (nanos() - start) / LOOKUPS);
+	}
+	report(&r);
+	printf("bench-info acl n=%u probes_binary=%u.%02u probes_interp=%u.%02u "
+		   "probes_miss=%u.%02u bloom_bits=%u bloom_rejects=%u%%\n",
+		   n, binary / 100, binary % 100, interp / 100, interp % 100,
+		   miss / 100, miss % 100, words * 32,
+		   acl.bloom_rejects * 100 / acl.lookups);
+	if (acl.allowed) {
+		fprintf(stderr, "acl_%u: a key not on the list allowed\n", n);
+		failures++;
+	}
+	for (uint32_t i = 0; i < LOOKUPS; i++) {
+		if (!acl_lookup(&acl, hits[i])) {
+			fprintf(stderr, "acl_%u: a key on the list denied\n", n);
+			failures++;
+			break;
+		}
+	}
+}
+
+/* Share of keys not on a list of `n` that pass the filter, in hundredths of
+ * a percent */
+static uint32_t false_positives(uint32_t n, uint32_t words, uint8_t hashes) {
+	uint32_t passed = 0, tested = 0, probes = 0;
+
+	make_keys(keys, n);
+	acl_init(&acl, bloom, words, hashes, deltas, ACL_DELTA_MAX);
+	acl_set_keys(&acl, keys, n);
+	while (tested < BLOOM_TESTS) {
+		uint64_t key = random_key();
+		if (acl_search(keys, n, key, true, &probes) >= 0) {
+			continue;
+		}
+		passed += acl_bloom_test(&acl, key);
+		tested++;
+	}
+	return (uint64_t)passed * 10000 / tested;
+}
+
+static void bloom_rates(void) {
+	static const uint8_t bits_per_key[] = {2, 4, 8, 16};
+	static const uint8_t hash_counts[] = {1, 2, 3, 4, 6};
+
+	for (uint8_t b = 0; b < sizeof(bits_per_key); b++) {
+		for (uint8_t h = 0; h < sizeof(hash_counts); h++) {
+			uint32_t fp = false_positives(
+				BLOOM_KEYS, BLOOM_KEYS * bits_per_key[b] / 32, hash_counts[h]);
+			printf("bench-info acl_bloom keys=%u bits_per_key=%u hashes=%u "
+				   "fp=%u.%02u%%\n",
+				   BLOOM_KEYS, bits_per_key[b], hash_counts[h], fp / 100,
+				   fp % 100);
+		}
+	}
+	uint32_t fp = false_positives(ACL_MAX_KEYS, ACL_BLOOM_WORDS,
+								  ACL_BLOOM_HASHES);
+	printf("bench-info acl_bloom firmware keys=%u bits=%u hashes=%u "
+		   "fp=%u.%02u%%\n",
+		   ACL_MAX_KEYS, ACL_BLOOM_WORDS * 32, ACL_BLOOM_HASHES, fp / 100,
+		   fp % 100);
+}
+
+/* RAM flash behind the hooks of acl.h, with the half-word programming rule
+ * of the STM32F1 and a power cut after `budget` operations, a page erase
+ * or a half-word each: the operation is left half done, or untouched with
+ * `cut_before`, then cut is jumped to */
+static uint64_t flash[ACL_DELTA_BANK + 1][ACL_BANK_SIZE / 8];
+static uint32_t budget;
+static bool cut_before;
+static uint32_t flash_ops;
+static jmp_buf cut;
+
+static int power_fails(void) {
+	flash_ops++;
+	return budget && !--budget;
+}
+
+bool acl_flash_erase(uint8_t bank) {
+	uint8_t pages = bank == ACL_DELTA_BANK ? 1 : ACL_BANK_PAGES;
+	for (uint8_t i = 0; i < pages; i++) {
+		uint8_t *p = (uint8_t *)flash[bank] + i * ACL_PAGE_SIZE;
+		if (power_fails()) {
+			for (uint16_t k = 0; k < ACL_PAGE_SIZE && !cut_before; k++) {
+				p[k] |= next_random();
+			}
+			longjmp(cut, 1);
+		}
+		memset(p, 0xff, ACL_PAGE_SIZE);
+	}
+	return true;
+}
+
+bool acl_flash_program(uint8_t bank, uint16_t offset, const void *data,
+					   uint16_t len) {
+	uint8_t *p = (uint8_t *)flash[bank] + offset;
+	const uint8_t *bytes = data;
+
+	for (uint16_t i = 0; i < len; i += 2) {
+		uint16_t half, old;
+		memcpy(&half, bytes + i, sizeof(half));
+		if (half == 0xffff) {
+			continue;
+		}
+		memcpy(&old, p + i, sizeof(old));
+		if (old != 0xffff) {
+			return false;
+		}
+		if (power_fails()) {
+			if (!cut_before) {
+				half |= next_random();
+				memcpy(p + i, &half, sizeof(half));
+			}
+			longjmp(cut, 1);
+		}
+		memcpy(p + i, &half, sizeof(half));
+	}
+	return true;
+}
+
+const uint8_t *acl_flash_bank(uint8_t bank) {
+	return (const uint8_t *)flash[bank];
+}
+
+/* The flash workload: a load, updates, another load, more updates. What the
+ * list should hold is model, the operation in flight may go either way. */
+static uint64_t universe[UNIVERSE];
+static uint8_t model[UNIVERSE];
+static uint8_t inflight[UNIVERSE];
+static uint8_t loading;
+
+static acl_status_t load(uint16_t every) {
+	uint64_t batch[LOAD_BATCH];
+	uint16_t n = 0;
+	acl_status_t status;
+
+	memset(inflight, 0, sizeof(inflight));
+	for (uint16_t u = 0; u < UNIVERSE; u += every) {
+		inflight[u] = 1;
+	}
+	loading = 1;
+	if ((status = acl_load_begin(&acl)) != ACL_OK) {
+		return status;
+	}
+	for (uint16_t u = 0; u < UNIVERSE; u++) {
+		if (inflight[u]) {
+			batch[n++] = universe[u];
+		}
+		if (n == LOAD_BATCH || (u == UNIVERSE - 1 && n)) {
+			if ((status = acl_load_keys(&acl, batch, n)) != ACL_OK) {
+				return status;
+			}
+			n = 0;
+		}
+	}
+	if ((status = acl_load_commit(&acl)) == ACL_OK) {
+		memcpy(model, inflight, sizeof(model));
+	}
+	loading = 0;
+	return status;
+}
+
+static acl_status_t update(uint32_t op) {
+	uint16_t u = (op * 2654435761u >> 8) % UNIVERSE;
+	acl_op_t change = op * 40503u >> 7 & 1 ? ACL_ADD : ACL_REMOVE;
+
+	memcpy(inflight, model, sizeof(inflight));
+	inflight[u] = change == ACL_ADD;
+	acl_status_t status = acl_update(&acl, universe[u], change);
+	if (status == ACL_OK) {
+		model[u] = inflight[u];
+	}
+	return status;
+}
+
+/* Operation `op` of the workload, CUT_OPS in all */
+#define CUT_OPS (2 * CUT_UPDATES + 2)
+
+static void run_op(uint32_t op) {
+	acl_status_t status;
+
+	if (op == 0) {
+		status = load(3);
+	} else if (op == CUT_UPDATES + 1) {
+		status = load(7);
+	} else {
+		status = update(op);
+	}
+	if (status != ACL_OK && status != ACL_FULL) {
+		fprintf(stderr, "flash: operation %u failed with %d\n", op, status);
+		failures++;
+	}
+}
+
+/* Mounts as after a reset, 1 when the list matches neither the model nor
+ * the operation in flight */
+static int recover(void) {
+	int before = 1, after = 1;
+
+	acl_mount(&acl);
+	for (uint16_t u = 0; u < UNIVERSE; u++) {
+		bool allowed = acl_lookup(&acl, universe[u]);
+		before &= allowed == model[u];
+		after &= allowed == inflight[u];
+	}
+	if (!before && !after) {
+		return 1;
+	}
+	if (after) {
+		memcpy(model, inflight, sizeof(model));
+	}
+	memcpy(inflight, model, sizeof(inflight));
+	loading = 0;
+	return 0;
+}
+
+/* Runs the workload with the power failing at flash operation `at`, then
+ * to the end. `was_cut` tells whether it failed at all. */
+static int cut_case(uint32_t at, int *was_cut) {
+	volatile uint32_t op = 0;
+
+	memset(flash, 0xff, sizeof(flash));
+	memset(model, 0, sizeof(model));
+	memset(inflight, 0, sizeof(inflight));
+	acl_init(&acl, bloom, ACL_BLOOM_WORDS, ACL_BLOOM_HASHES, deltas,
+			 ACL_DELTA_MAX);
+	acl_mount(&acl);
+	*was_cut = 0;
+	flash_ops = 0;
+	budget = at;
+	if (setjmp(cut)) {
+		budget = 0;
+		*was_cut = 1;
+		if (recover()) {
+			fprintf(stderr, "cut %s %u, operation %u\n",
+					cut_before ? "before" : "at", at, op);
+			return 1;
+		}
+		op++;
+	}
+	for (; op < CUT_OPS; op++) {
+		run_op(op);
+	}
+	budget = 0;
+	return recover();
+}
+
+static void flash_cuts(void) {
+	uint32_t cases = 0, at;
+	int was_cut = 1;
+
+	make_keys(universe, UNIVERSE);
+	for (at = 1; was_cut; at++) {
+		for (uint8_t before = 0; before < 2; before++) {
+			cut_before = before;
+			if (cut_case(at, &was_cut)) {
+				failures++;
+			}
+			cases += was_cut;
+		}
+	}
+	/* The last case ran without a cut */
+	printf("acl flash ops=%u generation=%u power cuts=%u\n", flash_ops,
+		   acl.generation, cases);
+}
+
+int main(void) {
+	printf("bench-begin board=host hz=1000000000\n");
+	for (uint8_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		lookups(sizes[i]);
+	}
+	printf("bench-end\n");
+	bloom_rates();
+	flash_cuts();
+	printf("acl failures=%d\n", failures);
+	return failures != 0;
+}
@@ -0,0 +1,137 @@
+/* Host variant of the benchmarks: runs the target independent cases of the
+ * firmware suite and prints the same result lines, timed in nanoseconds. */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "bench.h"
+#include "frame.h"
+#include "metrics.h"
+#include "uid_cache.h"
+
+static uint8_t data[64];
+static uint8_t enc[FRAME_MAX_ENCODED];
+static uint8_t raw[FRAME_MAX_ENCODED];
+static size_t enc_len;
+static char text[32];
+static volatile uint32_t sink;
+
+static uint32_t nanos(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void bench_frame_crc16(void) { sink = frame_crc16(data, sizeof(data)); }
+
+static void bench_frame_pack(void) { sink = frame_pack(data, 32, enc); }
+
+static void bench_frame_unpack(void) {
+	/* Without the delimiter */
+	sink = frame_unpack(enc, enc_len - 1, raw);
+}
+
+static void bench_metric_inc(void) { metric_inc(METRIC_card_reads); }
+
+/* Spread over the buckets */
+static void bench_metric_observe(void) {
+	metric_observe(METRIC_echo_us, sink++ * 97);
+}
+
+static void bench_format_distance(void) {
+	sink = snprintf(text, sizeof(text), "Distance: %lu mm.\n",
+					(unsigned long)(sink & 0xfff));
+}
+
+/* UID cache at the load limit of each capacity. find looks up a cached UID,
+ * insert adds a new one and so includes the scan for the entry to evict. */
+static const uint16_t uid_capacities[] = {8, 32, 128};
+static uid_cache_entry_t uid_slots[128];
+static uid_cache_t uid_cache;
+static uint32_t uid_next;
+static uint32_t uid_hit;
+
+static void make_uid(uint32_t n, uint8_t *uid) {
+	uint32_t v = n * 2654435761u;
+	for (uint8_t i = 0; i < 4; i++) {
+		uid[i] = v >> (8 * i);
+	}
+}
+
+static void uid_setup(uint16_t capacity) {
+	uint8_t uid[4];
+
+	uid_cache_init(&uid_cache, uid_slots, capacity, 1u << 30, 1u << 30, NULL,
+				   NULL);
+	for (uid_next = 0; uid_next < uid_cache.limit; uid_next++) {
+		make_uid(uid_next, uid);
+		uid_cache_seen(&uid_cache, uid, sizeof(uid), uid_next);
+	}
+	uid_hit = 0;
+}
+
+static void bench_uid_find(void) {
+	uint8_t uid[4];
+	make_uid(uid_next - 1 - uid_hit++ % uid_cache.limit, uid);
+	sink = uid_cache_find(&uid_cache, uid, sizeof(uid)) != NULL;
+}
+
+static void bench_uid_insert(void) {
+	uint8_t uid[4];
+	make_uid(uid_next, uid);
+	sink = uid_cache_seen(&uid_cache, uid, sizeof(uid), uid_next++);
+}
+
+static void bench_uid_cache(bench_result_t *r, uint8_t i, bool insert,
+							uint32_t overhead) {
+	/* Still referenced by r when it is reported */
+	static char name[24];
+
+	uid_setup(uid_capacities[i]);
+	snprintf(name, sizeof(name), "uid_cache_%s_%u", insert ? "insert" : "find",
+			 uid_capacities[i]);
+	bench_measure(r, name, insert ? bench_uid_insert : bench_uid_find,
+				  BENCH_RUNS, nanos, overhead);
+}
+
+static const struct {
+	const char *name;
+	void (*fn)(void);
+} cases[] = {
+	{"frame_crc16_64", bench_frame_crc16},
+	{"frame_pack_32", bench_frame_pack},
+	{"frame_unpack_32", bench_frame_unpack},
+	{"format_distance", bench_format_distance},
+	{"metric_inc", bench_metric_inc},
+	{"metric_observe", bench_metric_observe},
+};
+
+int main(void) {
+	bench_result_t r;
+	char line[BENCH_LINE_MAX];
+	uint32_t overhead = bench_overhead(nanos);
+
+	for (size_t i = 0; i < sizeof(data); i++) {
+		data[i] = i * 37 + 1;
+	}
+	enc_len = frame_pack(data, 32, enc);
+
+	printf("bench-begin board=host hz=1000000000\n");
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		bench_measure(&r, cases[i].name, cases[i].fn, BENCH_RUNS, nanos,
+					  overhead);
+		bench_format(line, sizeof(line), &r, "ns");
+		fputs(line, stdout);
+	}
+	for (size_t i = 0; i < sizeof(uid_capacities) / sizeof(uid_capacities[0]);
+		 i++) {
+		for (int insert = 0; insert <= 1; insert++) {
+			bench_uid_cache(&r, i, insert, overhead);
+			bench_format(line, sizeof(line), &r, "ns");
+			fputs(line, stdout);
+		}
+	}
+	printf("bench-end\n");
+	return 0;
+}
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""Compares two captures of benchmark output, e.g. the ITM dump of `make
+bench` from two builds, or two runs of a host benchmark.
+
+    host/bench_compare.py old.txt new.txt [--fail-over PCT]
+
+Prints one line per result found in both captures:
+
+    <name> <mean old> -> <new> <change> max <old> -> <new> [p50 .. p99 ..]
+
+p50 and p99 come from the hist lines (see include/bench.h) and are the upper
+edge of the bin the percentile falls in, ">hi" when it is above the last
+bin. Results in only one capture are listed at the end. With --fail-over the
+exit status is 1 if any mean grew by more than PCT percent.
+"""
+
+import argparse
+import re
+import sys
+
+LINE = re.compile(r"^(bench|hist) (\S+) (.*)$")
+
+
+def parse(path):
+    results, hists = {}, {}
+    with open(path, errors="replace") as f:
+        for line in f:
+            m = LINE.match(line.strip())
+            if not m:
+                continue
+            fields = dict(kv.split("=", 1) for kv in m.group(3).split() if "=" in kv)
+            if m.group(1) == "bench":
+                if int(fields.get("runs", 0)):
+                    results[m.group(2)] = fields
+            else:
+                hists[m.group(2)] = fields
+    return results, hists
+
+
+def percentile(hist, pct):
+    lo, width = int(hist["lo"]), int(hist["width"])
+    bins = [int(n) for n in hist["bins"].split(",")]
+    counts = [int(hist["below"])] + bins + [int(hist["above"])]
+    total = sum(counts)
+    if not total:
+        return "-"
+    seen = 0
+    for i, n in enumerate(counts):
+        seen += n
+        if seen * 100 >= total * pct:
+            if i == 0:
+                return "<%d" % lo
+            if i == len(counts) - 1:
+                return ">%d" % (lo + width * len(bins))
+            return str(lo + width * i)
+    return "-"
+
+
+def spread(hists, name):
+    if name not in hists:
+        return ""
+    h = hists[name]
+    return " p50 %s p99 %s" % (percentile(h, 50), percentile(h, 99))
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("old")
+    parser.add_argument("new")
+    parser.add_argument("--fail-over", type=float, metavar="PCT")
+    args = parser.parse_args()
+
+    old, old_hists = parse(args.old)
+    new, new_hists = parse(args.new)
+    worse = []
+    for name, n in new.items():
+        if name not in old:
+            continue
+        o = old[name]
+        before, after = int(o["mean"]), int(n["mean"])
+        change = (after - before) * 100.0 / before if before else 0.0
+        print(
+            "%-32s %8s -> %-8s %+7.1f%% max %s -> %s%s%s"
+            % (
+                name,
+                before,
+                after,
+                change,
+                o["max"],
+                n["max"],
+                spread(old_hists, name) and " |" + spread(old_hists, name),
+                spread(new_hists, name) and " ->" + spread(new_hists, name),
+            )
+        )
+        if args.fail_over is not None and change > args.fail_over:
+            worse.append(name)
+    for name in sorted(set(old) ^ set(new)):
+        print("%-32s only in %s" % (name, args.old if name in old else args.new))
+    if worse:
+        print("slower by more than %g%%: %s" % (args.fail_over, " ".join(worse)),
+              file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
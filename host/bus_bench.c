@@ -0,0 +1,85 @@
+/* Wire time per MFRC522 register transaction over the bus this is built for
+ * (-D MFRC522_BUS_UART, -D MFRC522_BUS_I2C, or SPI), against the model in
+ * mfrc522_sim.c. Same result lines as the benchmarks, but the clock is the
+ * simulated wire time: the numbers are what the bus itself costs at
+ * SIM_SPI_HZ, MFRC522_UART_BAUD or SIM_I2C_HZ, without CPU time. */
+
+#include <stdio.h>
+
+#include "bench.h"
+#include "mfrc522_sim.h"
+
+/* Register addresses, mfrc522.h needs the target headers */
+#define COMMAND_REG 0x01
+#define CMD_SOFT_RESET 0x0f
+#define FIFO_DATA_REG 0x09
+#define FIFO_LEVEL_REG 0x0a
+#define BIT_FRAMING_REG 0x0d
+#define VERSION_REG 0x37
+
+static uint8_t data[16];
+static volatile uint8_t sink;
+
+static uint32_t wire_ns(void) { return sim_ns; }
+
+static void bench_read_reg(void) { sink = mfrc522_bus_read(VERSION_REG); }
+
+static void bench_write_reg(void) { mfrc522_bus_write(FIFO_LEVEL_REG, 0x80); }
+
+/* Read-modify-write, as MFRC522_SetBitMask() */
+static void bench_set_bits(void) {
+	mfrc522_bus_write(BIT_FRAMING_REG,
+					  mfrc522_bus_read(BIT_FRAMING_REG) | 0x80);
+}
+
+static void bench_write_fifo(void) {
+	mfrc522_bus_write_burst(FIFO_DATA_REG, sizeof(data), data);
+}
+
+static void bench_read_fifo(void) {
+	mfrc522_bus_read_burst(FIFO_DATA_REG, sizeof(data), data);
+}
+
+static const struct {
+	const char *name;
+	void (*fn)(void);
+} cases[] = {
+	{"read_reg", bench_read_reg},	{"write_reg", bench_write_reg},
+	{"set_bits", bench_set_bits},	{"write_fifo16", bench_write_fifo},
+	{"read_fifo16", bench_read_fifo},
+};
+
+int main(void) {
+	bench_result_t r;
+	char name[32];
+	char line[BENCH_LINE_MAX];
+
+	/* Power up and a soft reset, as MFRC522_Init() and MFRC522_Reset() */
+	sim_reset();
+	mfrc522_bus_init();
+	mfrc522_bus_write(COMMAND_REG, CMD_SOFT_RESET);
+	mfrc522_bus_reset();
+	mfrc522_bus_read(COMMAND_REG);
+	mfrc522_bus_init();
+	if (mfrc522_bus_read(VERSION_REG) != SIM_VERSION || sim_errors) {
+		fprintf(stderr, "%s: no sensible answer from the model\n",
+				MFRC522_BUS_NAME);
+		return 1;
+	}
+
+	printf("bench-begin board=sim hz=1000000000 bus=%s\n", MFRC522_BUS_NAME);
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		snprintf(name, sizeof(name), "%s_%s", MFRC522_BUS_NAME,
+				 cases[i].name);
+		bench_measure(&r, name, cases[i].fn, BENCH_RUNS, wire_ns, 0);
+		bench_format(line, sizeof(line), &r, "ns");
+		printf("%s", line);
+	}
+	printf("bench-end\n");
+	if (sim_errors) {
+		fprintf(stderr, "%s: %u bytes garbled on the wire\n",
+				MFRC522_BUS_NAME, sim_errors);
+		return 1;
+	}
+	return 0;
+}
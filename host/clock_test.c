@@ -0,0 +1,158 @@
+/* src/clock.c on the RCC model of target/opencm3.c, which takes a new PLL
+ * multiplier only with the PLL stopped, as the chip does. After every
+ * switch of the governor, and in every listener:
+ *
+ *   SYSCLK is what rcc_ahb_frequency says, and that of the profile
+ *   the flash never ran with fewer wait states than SYSCLK needs
+ *   no PLL setup was ignored
+ *
+ * over boosts, holds and the drop back to CLOCK_LOW, in random order. A
+ * hold or boost taken in an interrupt, as the USB reset and resume
+ * callbacks of cdc_stream.c take them, only requests the switch: no
+ * listener runs in an interrupt, and the next clock_idle() switches.
+ * Exits non zero on a failure. */
+
+#include <libopencm3/cm3/scb.h>
+#include <libopencm3/stm32/rcc.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "board.h"
+#include "clock.h"
+#include "idle.h"
+
+#define STEPS 20000
+/* VECTACTIVE of USB_LP_CAN_RX0, IRQ 20 */
+#define USB_VECTOR (16 + 20)
+
+static uint32_t random_state = 0x2545f491;
+static int failures;
+static uint32_t now;
+static uint32_t listener_calls;
+static uint32_t listener_wrong;
+static uint32_t listener_in_isr;
+
+uint32_t idle_now(void) { return now; }
+
+static uint32_t next_random(void) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+static void check(bool ok, const char *what) {
+	if (!ok && failures++ < 10) {
+		fprintf(stderr, "%s: sysclk=%u ahb=%u ws=%u\n", what,
+				target_sysclk_hz, rcc_ahb_frequency, target_flash_ws);
+	}
+}
+
+static void listener(void) {
+	listener_calls++;
+	listener_wrong += target_sysclk_hz != rcc_ahb_frequency;
+	listener_in_isr += (SCB_ICSR & SCB_ICSR_VECTACTIVE) != 0;
+}
+
+static void check_clock(const char *what) {
+	static const struct rcc_clock_scale *const want[CLOCK_PROFILES] = {
+		[CLOCK_LOW] = BOARD_CLOCK_LOW,
+		[CLOCK_HIGH] = BOARD_CLOCK_HIGH,
+	};
+	check(target_sysclk_hz == rcc_ahb_frequency &&
+			  rcc_ahb_frequency == want[clock_profile()]->ahb_frequency,
+		  what);
+	check(!target_flash_violations, "flash wait states too few");
+	check(!target_rcc_pll_ignored, "PLL setup ignored");
+	check(!listener_wrong, "a listener saw the old clock");
+	check(!listener_in_isr, "a listener ran in an interrupt");
+}
+
+/* Past the boost */
+static void expire(void) { now += IDLE_MS(CLOCK_BOOST_MS) + 1; }
+
+static void test_switches(void) {
+	target_rcc_reset();
+	clock_init();
+	clock_register(listener);
+	check(clock_profile() == CLOCK_HIGH, "init: not CLOCK_HIGH");
+	check_clock("init");
+
+	expire();
+	clock_idle();
+	check(clock_profile() == CLOCK_LOW, "idle: not CLOCK_LOW");
+	check_clock("idle");
+	clock_boost();
+	check(clock_profile() == CLOCK_HIGH, "boost: not CLOCK_HIGH");
+	check_clock("boost");
+
+	clock_hold();
+	expire();
+	clock_idle();
+	check(clock_profile() == CLOCK_HIGH, "hold: dropped");
+	clock_release();
+	clock_idle();
+	check(clock_profile() == CLOCK_LOW, "release: not CLOCK_LOW");
+	check_clock("release");
+
+	/* A USB resume in CLOCK_LOW */
+	uint32_t calls = listener_calls;
+	SCB_ICSR = USB_VECTOR;
+	clock_hold();
+	SCB_ICSR = 0;
+	check(clock_profile() == CLOCK_LOW && listener_calls == calls,
+		  "hold in an interrupt: switched there");
+	clock_idle();
+	check(clock_profile() == CLOCK_HIGH, "hold in an interrupt: not made");
+	check_clock("hold in an interrupt");
+	clock_release();
+	expire();
+	clock_idle();
+}
+
+static void test_random(void) {
+	uint8_t holds = 0;
+
+	for (uint32_t step = 0; step < STEPS; step++) {
+		SCB_ICSR = next_random() % 2 ? USB_VECTOR : 0;
+		switch (next_random() % 4) {
+		case 0:
+			clock_boost();
+			break;
+		case 1:
+			if (holds < 3) {
+				clock_hold();
+				holds++;
+			}
+			break;
+		case 2:
+			if (holds) {
+				clock_release();
+				holds--;
+			}
+			break;
+		default:
+			SCB_ICSR = 0;
+			now += next_random() % (2 * IDLE_MS(CLOCK_BOOST_MS));
+			clock_idle();
+			check(!holds || clock_profile() == CLOCK_HIGH,
+				  "random: held but not CLOCK_HIGH");
+			break;
+		}
+		SCB_ICSR = 0;
+		check_clock("random");
+	}
+}
+
+int main(void) {
+	test_switches();
+	test_random();
+
+	clock_stats_t st;
+	clock_get_stats(&st);
+	printf("bench-info clock switches_low=%u switches_high=%u listeners=%u\n",
+		   st.switches[CLOCK_LOW], st.switches[CLOCK_HIGH], listener_calls);
+	check(st.switches[CLOCK_LOW] > STEPS / 100, "too few switches");
+	printf("clock failures=%d\n", failures);
+	return failures != 0;
+}
@@ -0,0 +1,231 @@
+/* src/mfrc522.c itself on the register model of mfrc522_sim.c, over the bus
+ * this is built for (-D MFRC522_BUS_UART, -D MFRC522_BUS_I2C, or SPI). The
+ * driver is compiled as for the bluepill, with the target/ stand-ins and
+ * target/mfrc522_port.h routing its bus hooks into the model. The clock is
+ * the simulated wire and air time, so the numbers are modelled time of the
+ * bus and the card, without CPU time:
+ *
+ *   read_fifo64      MFRC522_ReadArrayFromReg() of a full FIFO
+ *   stream_N         PCD_TransceiveStream() of N bytes to the selected card
+ *                    and N bytes echoed back, the FIFO topped up and drained
+ *                    on the watermark alerts
+ *   select_full_N    WUPA and MFRC522_Select() for an N byte UID
+ *   select_known_N   MFRC522_SelectKnown() with the UID known
+ *   select_miss_N    MFRC522_SelectKnown() with the UID of a card that is
+ *                    not in the field while another is: the first SELECT
+ *                    times out, then the full path
+ *
+ * with a bench-info line per UID size of the time select_known saves and
+ * select_miss costs against select_full.
+ * Every call is checked: a status other than STATUS_OK, a wrong UID or a
+ * damaged echo fails the run. Then the timeouts of PCD_SetTimeoutUs() on
+ * an empty field, on bench-info lines: the default one, the frame waiting
+ * time of ISO 14443-4 at FWI 14 stretched by waiting time extensions of 2
+ * and 7, which need a larger prescaler, and one past PCD_TIMEOUT_MAX_US.
+ * Each must run out no earlier than asked for, clamped, and no more than
+ * TIMEOUT_SLACK_US later. Exits non zero on a failure. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "mfrc522.h"
+#include "mfrc522_port.h"
+
+#define STREAM_MAX 250
+/* ISO 14443-4 frame waiting time at FWI 14, 256 * 16 / fc * 2^14 */
+#define FWT_FWI14_US 4949031
+/* Two ticks of the largest prescaler, the frame and the last poll */
+#define TIMEOUT_SLACK_US 2000
+
+static const uint8_t uids[][10] = {
+	{0x3a, 0x91, 0x5c, 0x07},
+	{0x04, 0x9a, 0x3c, 0x52, 0xe1, 0x6f, 0x80},
+	{0x08, 0x11, 0x27, 0x3c, 0x45, 0x5e, 0x6a, 0x7f, 0x81, 0x9b},
+};
+static const uint8_t uid_sizes[] = {4, 7, 10};
+
+static int failures;
+static uint8_t out[STREAM_MAX];
+static uint8_t back[STREAM_MAX];
+static uint16_t stream_len;
+static uint8_t card;
+
+static void log_write(void *ctx, const char *data, uint16_t len) {
+	(void)ctx;
+	fwrite(data, 1, len, stderr);
+}
+
+const fmt_sink_t fmt_log = {log_write, 0};
+
+static void check(bool ok, const char *what) {
+	if (!ok && failures++ < 10) {
+		fprintf(stderr, "%s: %s\n", MFRC522_BUS_NAME, what);
+	}
+}
+
+static void fill_fifo(void) {
+	MFRC522_WriteCharToReg(FIFOLevelReg, 0x80);
+	MFRC522_WriteArrayToReg(FIFODataReg, PCD_FIFO_SIZE, out);
+}
+
+static void read_fifo(void) {
+	MFRC522_ReadArrayFromReg(FIFODataReg, PCD_FIFO_SIZE, back);
+	check(!memcmp(out, back, PCD_FIFO_SIZE), "read_fifo: wrong data");
+}
+
+static MFRC522_Status select_full(MFRC522_UID_t *uid) {
+	uint8_t atqa[2];
+	uint8_t atqaLen = sizeof(atqa);
+	MFRC522_Status status = PICC_WakeupA(atqa, &atqaLen);
+	return status == STATUS_OK ? MFRC522_Select(uid) : status;
+}
+
+static void enter_card(void) { sim_card_enter(uids[card], uid_sizes[card]); }
+
+static void check_uid(const MFRC522_UID_t *uid, MFRC522_Status status) {
+	check(status == STATUS_OK, "select: failed");
+	check(uid->size == uid_sizes[card] &&
+			  !memcmp(uid->uid, uids[card], uid->size),
+		  "select: wrong UID");
+}
+
+static void select_unknown(void) {
+	MFRC522_UID_t uid = {.size = 0};
+	check_uid(&uid, select_full(&uid));
+}
+
+static void select_known(void) {
+	MFRC522_UID_t uid = {.size = uid_sizes[card]};
+	memcpy(uid.uid, uids[card], uid.size);
+	check_uid(&uid, MFRC522_SelectKnown(&uid));
+}
+
+/* Known from an earlier tap, but another card of the same UID size is in
+ * the field */
+static void select_miss(void) {
+	MFRC522_UID_t uid = {.size = uid_sizes[card]};
+	memcpy(uid.uid, uids[card], uid.size);
+	uid.uid[uid.size - 1] ^= 0x5a;
+	check_uid(&uid, MFRC522_SelectKnown(&uid));
+}
+
+/* The card selected and active, ready for the echo */
+static void select_card(void) {
+	MFRC522_UID_t uid = {.size = 0};
+	enter_card();
+	check(select_full(&uid) == STATUS_OK, "stream: no card selected");
+}
+
+static void stream(void) {
+	uint16_t backLen = sizeof(back);
+	uint8_t validBits;
+
+	PCD_StartTransceive();
+	MFRC522_Status status =
+		PCD_TransceiveStream(out, stream_len, back, &backLen, &validBits);
+	check(status == STATUS_OK, "stream: failed");
+	check(backLen == stream_len && !memcmp(out, back, backLen),
+		  "stream: damaged echo");
+}
+
+/* A frame to an empty field, the timer has to end the wait */
+static void check_timeout(uint32_t us) {
+	uint8_t frame[2] = {PICC_CMD_MF_READ, 4};
+	uint16_t backLen = sizeof(back);
+	uint8_t validBits;
+	uint32_t want = us < PCD_TIMEOUT_MAX_US ? us : PCD_TIMEOUT_MAX_US;
+
+	PCD_SetTimeoutUs(us);
+	uint64_t start = sim_ns;
+	PCD_StartTransceive();
+	MFRC522_Status status =
+		PCD_TransceiveStream(frame, sizeof(frame), back, &backLen, &validBits);
+	uint32_t waited = (sim_ns - start) / 1000;
+	printf("bench-info %s timeout asked_us=%u waited_us=%u\n",
+		   MFRC522_BUS_NAME, us, waited);
+	check(status == STATUS_TIMEOUT, "timeout: no STATUS_TIMEOUT");
+	check(waited >= want && waited - want <= TIMEOUT_SLACK_US,
+		  "timeout: wrong length");
+}
+
+static void timeouts(void) {
+	sim_card_leave();
+	check_timeout(PCD_TIMEOUT_US);
+	check_timeout(FWT_FWI14_US * 2);
+	check_timeout(FWT_FWI14_US * 7);
+	check_timeout(FWT_FWI14_US * 59);
+	/* Back to the 25 us ticks */
+	check_timeout(PCD_TIMEOUT_US);
+	check(sim_peek(TPrescalerReg) == PCD_TIMER_PRESCALER,
+		  "timeout: prescaler not restored");
+	PCD_SetTimeoutUs(PCD_TIMEOUT_US);
+}
+
+/* Returns the mean */
+static uint32_t time_case(const char *name, void (*setup)(void),
+						  void (*fn)(void)) {
+	bench_result_t r = {.name = name};
+	char line[BENCH_LINE_MAX];
+
+	for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+		setup();
+		uint64_t start = sim_ns;
+		fn();
+		bench_add_sample(&r, sim_ns - start);
+	}
+	bench_format(line, sizeof(line), &r, "ns");
+	printf("%s", line);
+	return r.total / r.runs;
+}
+
+int main(void) {
+	static const uint16_t stream_lens[] = {16, 64, STREAM_MAX};
+	char name[32];
+
+	for (uint16_t i = 0; i < sizeof(out); i++) {
+		out[i] = i * 37 + 1;
+	}
+	sim_reset();
+	mfrc522_bus_init();
+	MFRC522_Reset();
+	MFRC522_Init();
+	if (MFRC522_ReadCharFromReg(VersionReg) != SIM_VERSION || sim_errors) {
+		fprintf(stderr, "%s: no sensible answer from the model\n",
+				MFRC522_BUS_NAME);
+		return 1;
+	}
+
+	printf("bench-begin board=sim hz=1000000000 bus=%s\n", MFRC522_BUS_NAME);
+	snprintf(name, sizeof(name), "%s_read_fifo64", MFRC522_BUS_NAME);
+	time_case(name, fill_fifo, read_fifo);
+	for (uint8_t i = 0; i < sizeof(stream_lens) / sizeof(stream_lens[0]);
+		 i++) {
+		stream_len = stream_lens[i];
+		snprintf(name, sizeof(name), "%s_stream_%u", MFRC522_BUS_NAME,
+				 stream_len);
+		time_case(name, select_card, stream);
+	}
+	for (card = 0; card < sizeof(uid_sizes); card++) {
+		uint8_t size = uid_sizes[card];
+		snprintf(name, sizeof(name), "%s_select_full_%u", MFRC522_BUS_NAME,
+				 size);
+		uint32_t full = time_case(name, enter_card, select_unknown);
+		snprintf(name, sizeof(name), "%s_select_known_%u", MFRC522_BUS_NAME,
+				 size);
+		uint32_t known = time_case(name, enter_card, select_known);
+		snprintf(name, sizeof(name), "%s_select_miss_%u", MFRC522_BUS_NAME,
+				 size);
+		uint32_t miss = time_case(name, enter_card, select_miss);
+		printf("bench-info %s select uid=%u saved_pct=%u miss_cost_pct=%u\n",
+			   MFRC522_BUS_NAME, size,
+			   (uint32_t)(100 - (uint64_t)known * 100 / full),
+			   (uint32_t)((uint64_t)miss * 100 / full - 100));
+	}
+	printf("bench-end\n");
+	timeouts();
+	check(pbuf_available() == PBUF_COUNT, "a frame buffer leaked");
+	check(!sim_errors, "bytes garbled on the wire");
+	printf("driver %s failures=%d\n", MFRC522_BUS_NAME, failures);
+	return failures != 0;
+}
@@ -0,0 +1,199 @@
+/* Replays scripted card taps through the READ_PICC loop of main.c with
+ * uid_cache.c and checks the events it reports. Time is in milliseconds,
+ * each pattern runs once more across the 32 bit wrap. The reader model: a
+ * card answers REQA from the poll after it enters the field until it is
+ * halted, WUPA while it is in the field, and leaving the field resets it. */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "uid_cache.h"
+
+/* As in main.c */
+#define POLL_MS 20
+#define CHECK_MS 250
+#define TTL_MS (CHECK_MS * 5 / 2)
+#define DWELL_MS 2000
+
+#define MAX_CARDS 12
+#define MAX_TAPS 3
+#define RUN_MS 12000
+
+typedef struct {
+	uint32_t from, to;
+} tap_t;
+
+typedef struct {
+	const char *name;
+	uint16_t capacity;
+	uint8_t cards;
+	tap_t taps[MAX_CARDS][MAX_TAPS];
+	/* Per card */
+	uint8_t arrivals[MAX_CARDS];
+	uint8_t dwells[MAX_CARDS];
+	bool evicts;
+} pattern_t;
+
+static const pattern_t patterns[] = {
+	{"short_tap", 8, 1, {{{100, 400}}}, {1}, {0}, false},
+	{"long_dwell", 8, 1, {{{100, 7100}}}, {1}, {3}, false},
+	/* Lifted off for 100 ms and back, one tap */
+	{"retap_within_ttl", 8, 1, {{{100, 400}, {500, 800}}}, {1}, {0}, false},
+	{"retap_after_ttl", 8, 1, {{{100, 400}, {1500, 1800}}}, {2}, {0}, false},
+	{"two_cards",
+	 8,
+	 2,
+	 {{{100, 2600}}, {{1000, 1300}, {3000, 3200}}},
+	 {1, 2},
+	 {1, 0},
+	 false},
+	/* More short taps within one ttl than the 6 entries a capacity of 8
+	 * holds: the oldest are evicted early, each still reported once */
+	{"overflow",
+	 8,
+	 10,
+	 {{{100, 150}},
+	  {{200, 250}},
+	  {{300, 350}},
+	  {{400, 450}},
+	  {{500, 550}},
+	  {{600, 650}},
+	  {{700, 750}},
+	  {{800, 850}},
+	  {{900, 950}},
+	  {{1000, 1050}}},
+	 {1, 1, 1, 1, 1, 1, 1, 1, 1, 1},
+	 {0},
+	 true},
+};
+
+static uint32_t epoch;
+static const pattern_t *cur;
+static uint8_t departures[MAX_CARDS];
+static uint32_t worst_delay;
+static int errors;
+
+static void make_uid(uint8_t card, uint8_t *uid) {
+	uid[0] = 0x04;
+	uid[1] = card;
+	uid[2] = 0x5a ^ card;
+	uid[3] = 0xc3;
+}
+
+static bool in_field(uint8_t card, uint32_t t) {
+	for (uint8_t i = 0; i < MAX_TAPS; i++) {
+		const tap_t *tap = &cur->taps[card][i];
+		if (tap->to && t >= tap->from && t < tap->to) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void departed(const uid_cache_entry_t *e, void *ctx) {
+	uint32_t now = *(const uint32_t *)ctx - epoch;
+	uint8_t card = e->uid[1];
+
+	departures[card]++;
+	if (in_field(card, now)) {
+		return;
+	}
+	/* Last tap that ended by now */
+	uint32_t end = 0;
+	for (uint8_t i = 0; i < MAX_TAPS; i++) {
+		uint32_t to = cur->taps[card][i].to;
+		if (to && to <= now && to > end) {
+			end = to;
+		}
+	}
+	if (now - end > worst_delay) {
+		worst_delay = now - end;
+	}
+}
+
+static int run(const pattern_t *p) {
+	uid_cache_entry_t slots[128];
+	uid_cache_t cache;
+	uint8_t arrivals[MAX_CARDS] = {0}, dwells[MAX_CARDS] = {0};
+	bool halted[MAX_CARDS] = {0}, was_in[MAX_CARDS] = {0};
+	uint32_t now = epoch, next_check = epoch;
+	int fail = 0;
+
+	cur = p;
+	memset(departures, 0, sizeof(departures));
+	worst_delay = 0;
+	uid_cache_init(&cache, slots, p->capacity, TTL_MS, DWELL_MS, departed,
+				   &now);
+
+	for (uint32_t t = 0; t < RUN_MS; t += POLL_MS) {
+		now = epoch + t;
+		bool wake = (int32_t)(now - next_check) >= 0;
+		if (wake) {
+			next_check = now + CHECK_MS;
+		}
+		for (uint8_t c = 0; c < p->cards; c++) {
+			bool in = in_field(c, t);
+			if (!in || !was_in[c]) {
+				halted[c] = false;
+			}
+			was_in[c] = in;
+			if (!in || (halted[c] && !wake)) {
+				continue;
+			}
+			uint8_t uid[4];
+			make_uid(c, uid);
+			switch (uid_cache_seen(&cache, uid, sizeof(uid), now)) {
+			case UID_CACHE_ARRIVAL:
+				arrivals[c]++;
+				break;
+			case UID_CACHE_DWELL:
+				dwells[c]++;
+				break;
+			case UID_CACHE_REPEAT:
+				break;
+			}
+			halted[c] = true;
+		}
+		uid_cache_expire(&cache, now);
+	}
+
+	for (uint8_t c = 0; c < p->cards; c++) {
+		if (arrivals[c] != p->arrivals[c] || dwells[c] != p->dwells[c] ||
+			departures[c] != arrivals[c]) {
+			fprintf(stderr,
+					"%s card %u: arrivals=%u/%u dwells=%u/%u departures=%u\n",
+					p->name, c, arrivals[c], p->arrivals[c], dwells[c],
+					p->dwells[c], departures[c]);
+			fail = 1;
+		}
+	}
+	if (cache.used || (cache.evictions != 0) != p->evicts) {
+		fprintf(stderr, "%s: used=%u evictions=%lu\n", p->name, cache.used,
+				(unsigned long)cache.evictions);
+		fail = 1;
+	}
+	/* Seen last on a check up to CHECK_MS before leaving, gone a ttl later,
+	 * noticed on the next poll */
+	if (worst_delay > TTL_MS + POLL_MS) {
+		fprintf(stderr, "%s: departure %lu ms after leaving\n", p->name,
+				(unsigned long)worst_delay);
+		fail = 1;
+	}
+	printf("dwell %s epoch=%08lx departure_delay_max=%lu evictions=%lu %s\n",
+		   p->name, (unsigned long)epoch, (unsigned long)worst_delay,
+		   (unsigned long)cache.evictions, fail ? "FAIL" : "ok");
+	return fail;
+}
+
+int main(void) {
+	static const uint32_t epochs[] = {0, 0xfffff000u};
+
+	for (size_t e = 0; e < sizeof(epochs) / sizeof(epochs[0]); e++) {
+		epoch = epochs[e];
+		for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+			errors += run(&patterns[i]);
+		}
+	}
+	return errors != 0;
+}
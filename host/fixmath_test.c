@@ -0,0 +1,334 @@
+/* The fixed point helpers of fixmath.h against double precision, and their
+ * host time next to the float code and divisions they replace:
+ *
+ *   q16_mul, fix_map            largest error in output steps over random
+ *                               and edge inputs, rounding included
+ *   hcsr04_echo_to_mm           largest error in mm over -40 to 85 C and
+ *                               echoes up to 65 ms, the old integer
+ *                               conversion alongside
+ *   fix_prescaler               equal to the nearest division, saturated
+ *   fix_div                     exact for every divisor and dividend tried
+ *   fix_sat_*                   the saturation edge cases
+ *   adc_sampler_*_from          VDDA, external mV and temperature from ideal
+ *                               readings over VDDA 2.0 to 3.6 V, and a
+ *                               known Vrefint reading at 3.3 V
+ *
+ * then bench lines in picoseconds a call, batches of CALLS calls. These are
+ * host times; `make bench` has the Cortex-M3 cycles. Exits non zero if
+ * anything is off. */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "adc_sampler.h"
+#include "bench.h"
+#include "fixmath.h"
+#include "hc-sr04.h"
+
+#define SAMPLES 1000000
+#define DIV_DIVISORS 200000
+#define DIV_DIVIDENDS 64
+#define RUNS 64
+#define CALLS 4096
+
+/* Both fold at compile time, else this does not build */
+static const fix_map_t adc_to_cdeg = FIX_MAP(0, 4095, -4000, 12500);
+static const fix_div_t by_1356 = FIX_DIV(1356);
+
+static uint32_t random_state = 0x2545f491;
+static int failures;
+static volatile uint32_t sink;
+static volatile float fsink;
+static uint32_t in[CALLS];
+
+static uint32_t next_random(void) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+static uint32_t nanos(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void check(bool ok, const char *what) {
+	if (!ok) {
+		fprintf(stderr, "%s\n", what);
+		failures++;
+	}
+}
+
+/* Reports the largest error, fails above `limit` */
+static void accuracy(const char *name, double err, double limit) {
+	printf("accuracy %s max_err=%.3f limit=%.3f\n", name, err, limit);
+	check(err <= limit, name);
+}
+
+static void test_mul(void) {
+	double err = 0;
+
+	for (uint32_t i = 0; i < SAMPLES; i++) {
+		/* Products within range, from tiny to large */
+		q16_t a = (int32_t)next_random() >> (next_random() % 24);
+		q16_t b = (int32_t)next_random() >> (8 + next_random() % 24);
+		double ref = (double)a * b / Q16_ONE;
+		if (fabs(ref) >= INT32_MAX) {
+			continue;
+		}
+		double e = fabs(q16_mul(a, b) - ref);
+		err = e > err ? e : err;
+	}
+	accuracy("q16_mul", err, 0.5);
+
+	check(q16_mul(Q16(1.5), Q16(-2.25)) == Q16(-3.375), "q16_mul 1.5*-2.25");
+	check(q16_mul(Q16_MAX, Q16(2)) == Q16_MAX, "q16_mul saturates up");
+	check(q16_mul(Q16_MAX, Q16(-2)) == Q16_MIN, "q16_mul saturates down");
+	check(q16_to_int(Q16(2.5)) == 3 && q16_to_int(Q16(-2.25)) == -2,
+		  "q16_to_int rounds");
+	check(q16_from_int(40000) == Q16_MAX && q16_from_int(-40000) == Q16_MIN,
+		  "q16_from_int saturates");
+	check(q16_scale(1000, FIX_RATIO(1, 3)) == 333, "q16_scale 1000/3");
+}
+
+/* Map of [a, b] onto [c, d] at every x for short inputs, else at random */
+static double map_error(int32_t a, int32_t b, int32_t c, int32_t d) {
+	fix_map_t m = FIX_MAP(a, b, c, d);
+	int32_t lo = a < b ? a : b;
+	uint32_t span = a < b ? (uint32_t)b - a : (uint32_t)a - b;
+	double err = 0;
+
+	for (uint32_t i = 0; i <= span && i < SAMPLES; i++) {
+		int32_t x = lo + (int32_t)(span < SAMPLES ? i : next_random() % span);
+		double ref = c + ((double)x - a) * ((double)d - c) / ((double)b - a);
+		double e = fabs(fix_map(&m, x) - ref);
+		err = e > err ? e : err;
+	}
+	return err;
+}
+
+static void test_map(void) {
+	double err = 0, e;
+
+	/* ADC counts to centi-degrees, percent to timer compare, a reversed
+	 * range, and wide ones */
+	e = map_error(0, 4095, -4000, 12500);
+	err = e > err ? e : err;
+	e = map_error(0, 100, 0, 71999);
+	err = e > err ? e : err;
+	e = map_error(1000, -1000, 0, 255);
+	err = e > err ? e : err;
+	e = map_error(0, 65535, 0, 1000000);
+	err = e > err ? e : err;
+	accuracy("fix_map", err, 1.0);
+
+	/* Wide input spans against a narrow output are what the Q16.16 slope
+	 * gives up: |x - a| / 2^17 steps */
+	e = map_error(-1000000, 1000000, 0, 100);
+	accuracy("fix_map_wide", e, 0.5 + 2000000.0 / (1 << 17));
+
+	check(fix_map(&adc_to_cdeg, 0) == -4000 &&
+			  fix_map(&adc_to_cdeg, 4095) == 12500,
+		  "fix_map end points");
+	check(fix_map(&(fix_map_t)FIX_MAP(0, 100, -10, 10), 50) == 0,
+		  "fix_map middle");
+	check(fix_map(&(fix_map_t)FIX_MAP(0, 1, 0, 2), INT32_MAX) == INT32_MAX,
+		  "fix_map saturates");
+}
+
+static uint32_t echo_to_mm_old(uint32_t echo_us, int32_t temp_cdeg) {
+	return echo_us * (hcsr04_sound_speed(temp_cdeg) / 100) / 20000;
+}
+
+static void test_echo(void) {
+	double err = 0, err_old = 0;
+
+	for (int32_t t = -4000; t <= 8500; t += 25) {
+		for (uint32_t echo = 0; echo <= 65000; echo += 13) {
+			double ref = echo * (double)hcsr04_sound_speed(t) / 2000000;
+			double e = fabs(hcsr04_echo_to_mm(echo, t) - ref);
+			err = e > err ? e : err;
+			e = fabs(echo_to_mm_old(echo, t) - ref);
+			err_old = e > err_old ? e : err_old;
+		}
+	}
+	accuracy("echo_to_mm", err, 1.0);
+	accuracy("echo_to_mm_old", err_old, INFINITY);
+}
+
+/* The ideal reading of `v` volts at `vdda` volts */
+static uint16_t adc_code(double v, double vdda) {
+	return (uint16_t)lround(v / vdda * ADC_SAMPLER_FULL_SCALE);
+}
+
+static void test_adc(void) {
+	double err_vdda = 0, err_mv = 0, err_cdeg = 0;
+
+	for (uint32_t mv = 2000; mv <= 3600; mv++) {
+		double vdda = mv / 1000.0;
+		uint16_t vref = adc_code(1.2, vdda);
+		double e = fabs(adc_sampler_vdda_from(vref) - (double)mv);
+		err_vdda = e > err_vdda ? e : err_vdda;
+		for (uint32_t in = 0; in <= mv; in += 7) {
+			uint16_t value = adc_code(in / 1000.0, vdda);
+			e = fabs(adc_sampler_mv_from(value, vref) - (double)in);
+			err_mv = e > err_mv ? e : err_mv;
+		}
+		for (int32_t t = -4000; t <= 8500; t += 50) {
+			double vsense = 1.43 - (t - 2500) / 100.0 * 0.0043;
+			uint16_t temp = adc_code(vsense, vdda);
+			e = fabs(adc_sampler_cdeg_from(temp, vref) - (double)t);
+			err_cdeg = e > err_cdeg ? e : err_cdeg;
+		}
+	}
+	accuracy("adc_vdda_mv", err_vdda, 2.0);
+	accuracy("adc_ext_mv", err_mv, 2.0);
+	accuracy("adc_temperature_cdeg", err_cdeg, 15.0);
+	/* 1.20 V of Vrefint read at VDDA 3.3 V */
+	check(adc_sampler_vdda_from(5957) == 3300, "adc: Vrefint at 3.3 V");
+}
+
+static void test_prescaler(void) {
+	for (uint32_t i = 0; i < SAMPLES; i++) {
+		uint32_t hz = next_random() % 200000000 + 1;
+		uint32_t tick = next_random() % 2000000 + 1;
+		double ref = floor((double)hz / tick + 0.5) - 1;
+		ref = ref < 0 ? 0 : ref > 0xffff ? 0xffff : ref;
+		if (fix_prescaler(hz, tick) != ref) {
+			fprintf(stderr, "fix_prescaler(%u, %u) = %u\n", hz, tick,
+					fix_prescaler(hz, tick));
+			failures++;
+			return;
+		}
+	}
+	check(fix_prescaler(72000000, 1000000) == 71 &&
+			  fix_prescaler(36000000, 1000) == 35999 &&
+			  fix_prescaler(72000000, 1000) == 0xffff &&
+			  fix_prescaler(1000, 1000000) == 0,
+		  "fix_prescaler clocks");
+}
+
+static bool div_exact(uint32_t d) {
+	fix_div_t r = fix_div_init(d);
+	uint32_t edge[] = {0, 1, d - 1, d, d + 1, 2 * d - 1, UINT32_MAX,
+					   UINT32_MAX - 1, UINT32_MAX / d * d};
+
+	for (uint8_t i = 0; i < sizeof(edge) / sizeof(edge[0]); i++) {
+		if (fix_div(&r, edge[i]) != edge[i] / d) {
+			fprintf(stderr, "fix_div %u / %u\n", edge[i], d);
+			return false;
+		}
+	}
+	for (uint8_t i = 0; i < DIV_DIVIDENDS; i++) {
+		uint32_t n = next_random();
+		if (fix_div(&r, n) != n / d) {
+			fprintf(stderr, "fix_div %u / %u\n", n, d);
+			return false;
+		}
+	}
+	return true;
+}
+
+static void test_div(void) {
+	uint32_t divisors = 0;
+	bool ok = true;
+
+	for (uint32_t d = 1; ok && d <= DIV_DIVISORS; d++, divisors++) {
+		ok = div_exact(d);
+	}
+	for (uint8_t s = 1; ok && s < 32; s++, divisors += 3) {
+		ok = div_exact(1u << s) && div_exact((1u << s) - 1) &&
+			 div_exact((1u << s) + 1);
+	}
+	for (uint32_t i = 0; ok && i < DIV_DIVISORS; i++, divisors++) {
+		ok = div_exact(next_random() | 1) && div_exact(UINT32_MAX - i);
+		divisors++;
+	}
+	printf("accuracy fix_div divisors=%u exact=%s\n", divisors,
+		   ok ? "yes" : "no");
+	check(ok, "fix_div");
+	check(fix_div(&by_1356, 13560000) == 10000, "FIX_DIV constant");
+}
+
+static void test_saturation(void) {
+	check(fix_sat_add(INT32_MAX, 1) == INT32_MAX &&
+			  fix_sat_add(INT32_MIN, -1) == INT32_MIN &&
+			  fix_sat_add(-5, 3) == -2,
+		  "fix_sat_add");
+	check(fix_sat_sub(INT32_MIN, 1) == INT32_MIN &&
+			  fix_sat_sub(INT32_MAX, -1) == INT32_MAX &&
+			  fix_sat_sub(0, INT32_MIN) == INT32_MAX,
+		  "fix_sat_sub");
+	check(fix_sat32((int64_t)1 << 40) == INT32_MAX &&
+			  fix_sat32(-((int64_t)1 << 40)) == INT32_MIN,
+		  "fix_sat32");
+	check(fix_sat_u16(-1) == 0 && fix_sat_u16(70000) == 0xffff,
+		  "fix_sat_u16");
+}
+
+static float mix_float(float x, float a, float b, float c, float d) {
+	return (x * d - x * c - a * d + b * c) / (b - a);
+}
+
+static void time_case(const char *name, int kind) {
+	bench_result_t r = {.name = name};
+	fix_div_t by = fix_div_init(in[0] | 1);
+
+	for (uint32_t run = 0; run < RUNS; run++) {
+		uint32_t start = nanos();
+		for (uint32_t i = 0; i < CALLS; i++) {
+			switch (kind) {
+			case 0:
+				fsink = mix_float(in[i] & 0xfff, 0, 4095, -4000, 12500);
+				break;
+			case 1:
+				sink = fix_map(&adc_to_cdeg, in[i] & 0xfff);
+				break;
+			case 2:
+				sink = q16_mul(in[i], in[i ^ 1] >> 12);
+				break;
+			case 3:
+				sink = in[i] / (in[0] | 1);
+				break;
+			case 4:
+				sink = fix_div(&by, in[i]);
+				break;
+			case 5:
+				sink = hcsr04_echo_to_mm(in[i] & 0x7fff, 2150);
+				break;
+			}
+		}
+		bench_add_sample(&r, (uint64_t)(nanos() - start) * 1000 / CALLS);
+	}
+	char line[BENCH_LINE_MAX];
+	bench_format(line, sizeof(line), &r, "ps");
+	printf("%s", line);
+}
+
+int main(void) {
+	test_mul();
+	test_map();
+	test_echo();
+	test_adc();
+	test_prescaler();
+	test_div();
+	test_saturation();
+
+	for (uint32_t i = 0; i < CALLS; i++) {
+		in[i] = next_random();
+	}
+	printf("bench-begin board=host hz=1000000000\n");
+	time_case("mix_float", 0);
+	time_case("fix_map", 1);
+	time_case("q16_mul", 2);
+	time_case("udiv", 3);
+	time_case("fix_div", 4);
+	time_case("echo_to_mm", 5);
+	printf("bench-end\n");
+	printf("fixmath failures=%d\n", failures);
+	return failures != 0;
+}
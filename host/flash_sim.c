@@ -0,0 +1,132 @@
+#include <string.h>
+
+#include "flash_sim.h"
+
+#define PROGRAM_NS 52500
+#define ERASE_NS 20000000
+
+uint32_t flash_sim_ns;
+uint32_t flash_sim_programmed;
+uint32_t flash_sim_erases[FLASHLOG_PAGES];
+uint32_t flash_sim_budget;
+jmp_buf flash_sim_cut;
+
+/* Words, so that the pages are aligned as in flash */
+static uint32_t flash[FLASHLOG_PAGES][FLASHLOG_PAGE_SIZE / 4];
+static uint64_t acl_banks[ACL_DELTA_BANK + 1][ACL_BANK_SIZE / 8];
+static uint32_t crc_table[256];
+static uint32_t random_state = 1;
+
+static uint32_t next_random(void) {
+	random_state = random_state * 1664525 + 1013904223;
+	return random_state >> 8;
+}
+
+/* True when this operation is the one the power fails in */
+static int power_fails(void) {
+	return flash_sim_budget && !--flash_sim_budget;
+}
+
+void flash_sim_reset(void) {
+	memset(flash, 0xff, sizeof(flash));
+	memset(acl_banks, 0xff, sizeof(acl_banks));
+	memset(flash_sim_erases, 0, sizeof(flash_sim_erases));
+	flash_sim_ns = 0;
+	flash_sim_programmed = 0;
+	flash_sim_budget = 0;
+}
+
+/* Both page sizes are 1 KB */
+static void erase(uint8_t *p) {
+	flash_sim_ns += ERASE_NS;
+	if (power_fails()) {
+		for (uint16_t i = 0; i < FLASHLOG_PAGE_SIZE; i++) {
+			p[i] |= next_random();
+		}
+		longjmp(flash_sim_cut, 1);
+	}
+	memset(p, 0xff, FLASHLOG_PAGE_SIZE);
+}
+
+static bool program(uint8_t *p, const void *data, uint16_t len) {
+	const uint8_t *bytes = data;
+
+	for (uint16_t i = 0; i < len; i += 2) {
+		uint16_t half, old;
+		memcpy(&half, bytes + i, sizeof(half));
+		if (half == 0xffff) {
+			continue;
+		}
+		memcpy(&old, p + i, sizeof(old));
+		flash_sim_ns += PROGRAM_NS;
+		if (old != 0xffff && half != 0) {
+			return false;
+		}
+		if (power_fails()) {
+			/* Some of the zero bits made it */
+			half |= next_random();
+			memcpy(p + i, &half, sizeof(half));
+			longjmp(flash_sim_cut, 1);
+		}
+		memcpy(p + i, &half, sizeof(half));
+		flash_sim_programmed++;
+	}
+	return true;
+}
+
+bool flashlog_flash_erase(uint16_t page) {
+	erase((uint8_t *)flash[page]);
+	flash_sim_erases[page]++;
+	return true;
+}
+
+bool flashlog_flash_program(uint16_t page, uint16_t offset, const void *data,
+							uint16_t len) {
+	return program((uint8_t *)flash[page] + offset, data, len);
+}
+
+const uint8_t *flashlog_flash_page(uint16_t page) {
+	return (const uint8_t *)flash[page];
+}
+
+bool acl_flash_erase(uint8_t bank) {
+	uint8_t pages = bank == ACL_DELTA_BANK ? 1 : ACL_BANK_PAGES;
+	for (uint8_t i = 0; i < pages; i++) {
+		erase((uint8_t *)acl_banks[bank] + i * ACL_PAGE_SIZE);
+	}
+	return true;
+}
+
+bool acl_flash_program(uint8_t bank, uint16_t offset, const void *data,
+					   uint16_t len) {
+	return program((uint8_t *)acl_banks[bank] + offset, data, len);
+}
+
+const uint8_t *acl_flash_bank(uint8_t bank) {
+	return (const uint8_t *)acl_banks[bank];
+}
+
+uint32_t flashlog_crc(const void *words, uint16_t n) {
+	const uint8_t *bytes = words;
+	uint32_t crc = 0xffffffff;
+
+	if (!crc_table[1]) {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i << 24;
+			for (uint8_t b = 0; b < 8; b++) {
+				c = c & 0x80000000 ? (c << 1) ^ 0x04c11db7 : c << 1;
+			}
+			crc_table[i] = c;
+		}
+	}
+	/* Each word most significant byte first, as the unit shifts it in */
+	for (uint16_t w = 0; w < n; w++) {
+		uint32_t word;
+		memcpy(&word, bytes + 4 * w, sizeof(word));
+		for (int8_t shift = 24; shift >= 0; shift -= 8) {
+			uint8_t index = (crc >> 24) ^ (word >> shift);
+			crc = (crc << 8) ^ crc_table[index];
+		}
+	}
+	return crc;
+}
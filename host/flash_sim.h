@@ -0,0 +1,29 @@
+#pragma once
+
+#include <setjmp.h>
+#include <stdint.h>
+
+#include "acl.h"
+#include "flashlog.h"
+
+/* Host model of the STM32F1 flash and CRC unit behind the hooks of
+ * flashlog.h, and of acl.h for its banks. Programming a half-word that is
+ * not erased fails as with PGERR; time is added up from the typical
+ * datasheet figures, 52.5 us a half-word and 20 ms a page erase.
+ *
+ * Power loss: with a budget set, the operation that uses it up is left half
+ * done, a half-word with only some of its bits programmed or a page with
+ * only some bits erased, and flash_sim_cut is jumped to. */
+
+/* Simulated time in nanoseconds since flash_sim_reset(), wraps at 2^32 */
+extern uint32_t flash_sim_ns;
+/* Half-words programmed, 0xffff ones are skipped as in the firmware port */
+extern uint32_t flash_sim_programmed;
+/* Of the flashlog.h pages */
+extern uint32_t flash_sim_erases[FLASHLOG_PAGES];
+/* Program and erase operations left before the power fails, 0 for never */
+extern uint32_t flash_sim_budget;
+extern jmp_buf flash_sim_cut;
+
+/* Every page erased, the counters cleared and no budget */
+void flash_sim_reset(void);
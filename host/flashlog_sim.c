@@ -0,0 +1,296 @@
+/* The flash record log of flashlog.c on the flash model in flash_sim.c.
+ * Same result lines as the benchmarks; the clock is the simulated time, so
+ * the numbers are modelled flash time, not CPU time:
+ *
+ *   flashlog_append_16  one 16 byte card event, a page erase included
+ *                       whenever the append opens a page
+ *   flashlog_ack        one acknowledgement record
+ *
+ * then the write amplification and wear of a long run, the capacity with
+ * the host away, and a power cut at every flash operation of a workload,
+ * two more cuts at random points after each recovery. After each cut the
+ * log is mounted and replayed: nothing acknowledged may come back beyond
+ * what was acknowledged, every record appended since must, unchanged and in
+ * order. Exits non zero if anything fails. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "flash_sim.h"
+
+#define EVENT_SIZE 16
+#define STEADY_EVENTS 20000
+#define STEADY_ACK_EVERY 8
+/* Workload of the power cut cases */
+#define CUT_OPS 300
+#define CUT_PHASES 3
+#define MAX_SEQ 2048
+
+static flashlog_t flog;
+static uint32_t random_state = 7;
+static int failures;
+
+/* What the log has to give back: every record appended with FLASHLOG_OK */
+static struct {
+	uint8_t len[MAX_SEQ];
+	uint8_t data[MAX_SEQ][FLASHLOG_MAX_DATA];
+	uint32_t acked;
+	/* The operation the power failed in */
+	uint32_t ack_inflight;
+	uint32_t append_inflight;
+	uint8_t inflight_len;
+	uint8_t inflight_data[FLASHLOG_MAX_DATA];
+} model;
+
+static uint32_t sim_clock(void) { return flash_sim_ns; }
+
+static uint32_t next_random(void) {
+	random_state = random_state * 1664525 + 1013904223;
+	return random_state >> 8;
+}
+
+static void report(const bench_result_t *r) {
+	char line[BENCH_LINE_MAX];
+	bench_format(line, sizeof(line), r, "us");
+	printf("%s", line);
+}
+
+/* Sustained traffic acknowledged in batches, as with the host attached */
+static void steady(void) {
+	bench_result_t append = {.name = "flashlog_append_16"};
+	bench_result_t ack = {.name = "flashlog_ack"};
+	uint8_t event[EVENT_SIZE];
+	uint32_t seq = 0;
+
+	flash_sim_reset();
+	flashlog_mount(&flog);
+	for (uint32_t i = 0; i < STEADY_EVENTS; i++) {
+		memset(event, i, sizeof(event));
+		uint32_t start = sim_clock();
+		if (flashlog_append(&flog, event, sizeof(event), &seq) !=
+			FLASHLOG_OK) {
+			fprintf(stderr, "steady: append %u failed\n", i);
+			failures++;
+			return;
+		}
+		bench_add_sample(&append, (sim_clock() - start) / 1000);
+		if (i % STEADY_ACK_EVERY == STEADY_ACK_EVERY - 1) {
+			start = sim_clock();
+			if (flashlog_ack(&flog, seq) != FLASHLOG_OK) {
+				fprintf(stderr, "steady: ack %u failed\n", seq);
+				failures++;
+				return;
+			}
+			bench_add_sample(&ack, (sim_clock() - start) / 1000);
+		}
+	}
+	report(&append);
+	report(&ack);
+
+	uint32_t lo = UINT32_MAX, hi = 0, erases = 0;
+	for (uint16_t p = 0; p < FLASHLOG_PAGES; p++) {
+		lo = flash_sim_erases[p] < lo ? flash_sim_erases[p] : lo;
+		hi = flash_sim_erases[p] > hi ? flash_sim_erases[p] : hi;
+		erases += flash_sim_erases[p];
+	}
+	uint32_t payload = STEADY_EVENTS * EVENT_SIZE;
+	/* Write amplification: bytes programmed and bytes erased for every
+	 * payload byte, in hundredths */
+	printf("bench-info flashlog events=%u size=%u ack_every=%u "
+		   "wa_program=%u.%02u wa_erase=%u.%02u erases_min=%u erases_max=%u\n",
+		   STEADY_EVENTS, EVENT_SIZE, STEADY_ACK_EVERY,
+		   flash_sim_programmed * 2 / payload,
+		   flash_sim_programmed * 200 / payload % 100,
+		   erases * FLASHLOG_PAGE_SIZE / payload,
+		   (uint32_t)((uint64_t)erases * FLASHLOG_PAGE_SIZE * 100 / payload %
+					  100),
+		   lo, hi);
+	if (hi - lo > 1) {
+		fprintf(stderr, "steady: page erases %u to %u\n", lo, hi);
+		failures++;
+	}
+}
+
+/* With the host away the log fills up, then drains once it comes back */
+static void offline(void) {
+	uint8_t event[EVENT_SIZE] = {0};
+	uint8_t out[FLASHLOG_MAX_DATA];
+	flashlog_cursor_t c;
+	uint32_t stored = 0, seq, replayed = 0;
+	uint16_t len;
+
+	flash_sim_reset();
+	flashlog_mount(&flog);
+	/* More than fits, an append that overwrote the oldest would go on */
+	while (stored < FLASHLOG_PAGES * FLASHLOG_PAGE_SIZE / EVENT_SIZE) {
+		memcpy(event, &stored, sizeof(stored));
+		flashlog_status_t status =
+			flashlog_append(&flog, event, sizeof(event), &seq);
+		if (status == FLASHLOG_FULL) {
+			break;
+		}
+		if (status != FLASHLOG_OK) {
+			fprintf(stderr, "offline: append failed with %d\n", status);
+			failures++;
+			return;
+		}
+		stored++;
+	}
+
+	/* As after a reboot */
+	flashlog_mount(&flog);
+	flashlog_replay(&flog, &c);
+	len = sizeof(out);
+	while (flashlog_next(&flog, &c, out, &len, &seq) == FLASHLOG_OK) {
+		uint32_t n;
+		memcpy(&n, out, sizeof(n));
+		if (len != EVENT_SIZE || n != replayed || seq != replayed + 1) {
+			fprintf(stderr, "offline: record %u came back as %u\n", replayed,
+					n);
+			failures++;
+			return;
+		}
+		replayed++;
+		len = sizeof(out);
+	}
+	if (flashlog_ack(&flog, seq) != FLASHLOG_OK ||
+		flashlog_append(&flog, event, sizeof(event), &seq) != FLASHLOG_OK ||
+		flashlog_pending(&flog) != 1) {
+		fprintf(stderr, "offline: no room after the ack\n");
+		failures++;
+	}
+	printf("bench-info flashlog offline capacity=%u replayed=%u torn=%u\n",
+		   stored, replayed, flog.torn);
+	if (replayed != stored) {
+		failures++;
+	}
+}
+
+/* Operation `op` of the cut workload: mostly appends of 1 to 40 bytes, and
+ * every seventh acknowledges all but the last three records */
+static void run_op(uint32_t op) {
+	if (op % 7 == 6) {
+		uint32_t seq = flog.next_seq > 4 ? flog.next_seq - 4 : 0;
+		model.ack_inflight = seq;
+		if (flashlog_ack(&flog, seq) == FLASHLOG_OK && seq > model.acked) {
+			model.acked = seq;
+		}
+		model.ack_inflight = 0;
+		return;
+	}
+	uint8_t len = 1 + op * 13 % 40;
+	uint32_t seq = flog.next_seq;
+	model.append_inflight = seq;
+	model.inflight_len = len;
+	for (uint8_t i = 0; i < len; i++) {
+		model.inflight_data[i] = op + i * 31;
+	}
+	if (flashlog_append(&flog, model.inflight_data, len, &seq) ==
+		FLASHLOG_OK) {
+		model.len[seq] = len;
+		memcpy(model.data[seq], model.inflight_data, len);
+	}
+	model.append_inflight = 0;
+}
+
+/* Mounts and replays after a cut, returns non zero on a mismatch */
+static int recover(void) {
+	uint8_t out[FLASHLOG_MAX_DATA];
+	flashlog_cursor_t c;
+	uint32_t seq, expect;
+	uint16_t len = sizeof(out);
+
+	flashlog_mount(&flog);
+	uint32_t acked_max =
+		model.ack_inflight > model.acked ? model.ack_inflight : model.acked;
+	if (flog.acked > acked_max) {
+		fprintf(stderr, "acked %u, only %u was\n", flog.acked, acked_max);
+		return 1;
+	}
+	expect = flog.acked + 1;
+	flashlog_replay(&flog, &c);
+	while (flashlog_next(&flog, &c, out, &len, &seq) == FLASHLOG_OK) {
+		if (seq == model.append_inflight && !model.len[seq] &&
+			len == model.inflight_len &&
+			!memcmp(out, model.inflight_data, len)) {
+			/* Made it to flash before the power went */
+			model.len[seq] = len;
+			memcpy(model.data[seq], out, len);
+		}
+		if (seq != expect || seq >= MAX_SEQ || len != model.len[seq] ||
+			memcmp(out, model.data[seq], len)) {
+			fprintf(stderr, "replayed %u, expected %u\n", seq, expect);
+			return 1;
+		}
+		expect++;
+		len = sizeof(out);
+	}
+	if (expect < MAX_SEQ && model.len[expect]) {
+		fprintf(stderr, "record %u lost\n", expect);
+		return 1;
+	}
+	/* What the next append may reuse */
+	for (seq = expect; seq < MAX_SEQ; seq++) {
+		model.len[seq] = 0;
+	}
+	model.acked = flog.acked;
+	model.ack_inflight = 0;
+	model.append_inflight = 0;
+	return 0;
+}
+
+/* Runs the workload with the power failing after `budget` operations, and
+ * twice more at random points after recovering. Returns non zero on a
+ * failure, `cut` tells whether the first cut happened at all. */
+static int cut_case(uint32_t budget, int *cut) {
+	volatile uint32_t op = 0;
+	volatile uint8_t phase = 0;
+
+	flash_sim_reset();
+	memset(&model, 0, sizeof(model));
+	flashlog_mount(&flog);
+	*cut = 0;
+	flash_sim_budget = budget;
+	if (setjmp(flash_sim_cut)) {
+		flash_sim_budget = 0;
+		if (!phase) {
+			*cut = 1;
+		}
+		if (recover()) {
+			fprintf(stderr, "cut at %u, phase %u\n", budget, phase);
+			return 1;
+		}
+		op++;
+		if (++phase < CUT_PHASES) {
+			flash_sim_budget = 1 + next_random() % 400;
+		}
+	}
+	for (; op < CUT_OPS * CUT_PHASES; op++) {
+		run_op(op);
+	}
+	flash_sim_budget = 0;
+	return recover();
+}
+
+int main(void) {
+	uint32_t cases = 0;
+
+	printf("bench-begin board=sim hz=1000000000 flash=stm32f1\n");
+	steady();
+	printf("bench-end\n");
+	offline();
+
+	for (uint32_t budget = 1;; budget++) {
+		int cut;
+		if (cut_case(budget, &cut)) {
+			failures++;
+		}
+		if (!cut) {
+			break;
+		}
+		cases++;
+	}
+	printf("flashlog power cuts=%u failures=%d\n", cases, failures);
+	return failures != 0;
+}
@@ -0,0 +1,240 @@
+/* fmt.c against snprintf(): every field type over random and edge values
+ * gives the same text, a full buffer truncates and terminates as
+ * snprintf() does, then bench lines for the log lines of the firmware
+ * through both, in nanoseconds. These are host times against glibc; `make
+ * bench` has the Cortex-M3 cycles against newlib, and `make stack-report`
+ * the stack of both paths. Exits non zero on a mismatch. */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "fmt.h"
+
+#define SAMPLES 200000
+#define RUNS 64
+#define CALLS 1024
+
+static uint32_t random_state = 0x9e3779b9;
+static int failures;
+static volatile uint32_t sink;
+static char out[128];
+static char ref[128];
+static uint8_t data[64];
+static const uint8_t uid7[7] = {0x04, 0x9a, 0x3c, 0x52, 0xe1, 0x6f, 0x80};
+
+static uint32_t next_random(void) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+static uint32_t nanos(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* Compares `out` with `ref`, the first few mismatches are shown */
+static void same(const char *what) {
+	if (strcmp(out, ref)) {
+		if (failures++ < 10) {
+			fprintf(stderr, "%s: \"%s\", expected \"%s\"\n", what, out, ref);
+		}
+	}
+}
+
+/* A random value, a third of them small */
+static uint32_t value(void) {
+	uint32_t v = next_random();
+	return v % 3 ? v >> (v % 32) : v;
+}
+
+static void test_fields(void) {
+	static const uint32_t edges[] = {0, 1, 9, 10, 99, 100, 0x7fffffff,
+									 0x80000000, 0xfffffffe, 0xffffffff};
+	fmt_buf_t b;
+	fmt_sink_t s;
+
+	for (uint32_t i = 0; i < SAMPLES; i++) {
+		uint32_t v = i < sizeof(edges) / sizeof(edges[0]) ? edges[i] : value();
+		uint8_t digits = next_random() % 10;
+
+		s = fmt_buf(&b, out, sizeof(out));
+		fmt_u32(&s, v);
+		snprintf(ref, sizeof(ref), "%u", v);
+		same("fmt_u32");
+
+		s = fmt_buf(&b, out, sizeof(out));
+		fmt_i32(&s, (int32_t)v);
+		snprintf(ref, sizeof(ref), "%d", (int32_t)v);
+		same("fmt_i32");
+
+		s = fmt_buf(&b, out, sizeof(out));
+		fmt_hex(&s, v, digits);
+		snprintf(ref, sizeof(ref), "%0*x", digits > 8 ? 8 : digits, v);
+		same("fmt_hex");
+
+		/* Integer and fraction part from the digits of the integer */
+		uint8_t decimals = next_random() % 10;
+		int32_t x = (int32_t)v;
+		uint32_t mag = x < 0 ? -(uint32_t)x : (uint32_t)x;
+		uint32_t p = 1;
+		for (uint8_t d = 0; d < decimals; d++) {
+			p *= 10;
+		}
+		s = fmt_buf(&b, out, sizeof(out));
+		fmt_fixed(&s, x, decimals);
+		if (decimals) {
+			snprintf(ref, sizeof(ref), "%s%u.%0*u", x < 0 ? "-" : "",
+					 mag / p, decimals, mag % p);
+		} else {
+			snprintf(ref, sizeof(ref), "%d", x);
+		}
+		same("fmt_fixed");
+
+		/* Ties apart, the same as rounding the exact value */
+		decimals = next_random() % 5;
+		double exact = x / 65536.0 * pow(10, decimals);
+		if (fabs(exact - trunc(exact)) != 0.5) {
+			s = fmt_buf(&b, out, sizeof(out));
+			fmt_q16(&s, x, decimals);
+			snprintf(ref, sizeof(ref), "%.*f", decimals, x / 65536.0);
+			/* printf keeps the sign of a value that rounds to 0 */
+			if (!strncmp(ref, "-0", 2) && strspn(ref + 1, "0.") ==
+											  strlen(ref + 1)) {
+				memmove(ref, ref + 1, strlen(ref));
+			}
+			same("fmt_q16");
+		}
+	}
+}
+
+static void test_bytes(void) {
+	fmt_buf_t b;
+	fmt_sink_t s;
+	int len = 0;
+
+	s = fmt_buf(&b, out, sizeof(out));
+	fmt_hex_bytes(&s, uid7, sizeof(uid7), ' ');
+	for (uint8_t i = 0; i < sizeof(uid7); i++) {
+		len += snprintf(ref + len, sizeof(ref) - len, " %02x", uid7[i]);
+	}
+	same("fmt_hex_bytes");
+
+	s = fmt_buf(&b, out, sizeof(out));
+	fmt_hex_bytes(&s, uid7, 4, 0);
+	strcpy(ref, "049a3c52");
+	same("fmt_hex_bytes no separator");
+
+	s = fmt_buf(&b, out, sizeof(out));
+	fmt_hexdump(&s, data, 20);
+	strcpy(ref, "0000: 01 26 4b 70 95 ba df 04 29 4e 73 98 bd e2 07 2c\n"
+				"0010: 51 76 9b c0\n");
+	same("fmt_hexdump");
+}
+
+/* Cut short as snprintf() does it */
+static void test_truncation(void) {
+	char small[8];
+	fmt_buf_t b;
+
+	for (uint8_t size = 0; size <= sizeof(small); size++) {
+		memset(small, 'x', sizeof(small));
+		fmt_sink_t s = fmt_buf(&b, small, size);
+		fmt_str(&s, "Distance: ");
+		fmt_u32(&s, 1234);
+		const char *full = "Distance: 1234";
+		if (b.len != strlen(full) ||
+			(size && (memcmp(small, full, size - 1) || small[size - 1])) ||
+			(size < sizeof(small) && small[size] != 'x')) {
+			fprintf(stderr, "truncation to %u\n", size);
+			failures++;
+		}
+	}
+}
+
+static void fmt_distance(void) {
+	fmt_buf_t b;
+	fmt_sink_t s = fmt_buf(&b, out, sizeof(out));
+	fmt_str(&s, "Distance: ");
+	fmt_u32(&s, sink & 0xfff);
+	fmt_str(&s, " mm.\n");
+	sink += b.len;
+}
+
+static void format_distance(void) {
+	sink += snprintf(out, sizeof(out), "Distance: %lu mm.\n",
+					 (unsigned long)(sink & 0xfff));
+}
+
+static void fmt_uid(void) {
+	fmt_buf_t b;
+	fmt_sink_t s = fmt_buf(&b, out, sizeof(out));
+	fmt_hex_bytes(&s, uid7, sizeof(uid7), ' ');
+	sink += b.len;
+}
+
+static void format_uid(void) {
+	int len = 0;
+	for (uint8_t i = 0; i < sizeof(uid7); i++) {
+		len += snprintf(out + len, sizeof(out) - len, " %02x", uid7[i]);
+	}
+	sink += len;
+}
+
+static void drop(void *ctx, const char *chars, uint16_t len) {
+	(void)ctx;
+	(void)chars;
+	sink += len;
+}
+
+static void fmt_dump(void) {
+	const fmt_sink_t s = {drop, 0};
+	fmt_hexdump(&s, data, sizeof(data));
+}
+
+static void format_dump(void) {
+	for (uint8_t i = 0; i < sizeof(data); i++) {
+		sink += snprintf(out, sizeof(out), "0x%02X ", data[i]);
+	}
+}
+
+static void time_case(const char *name, void (*fn)(void)) {
+	bench_result_t r = {.name = name};
+	char line[BENCH_LINE_MAX];
+
+	for (uint32_t run = 0; run < RUNS; run++) {
+		uint32_t start = nanos();
+		for (uint32_t i = 0; i < CALLS; i++) {
+			fn();
+		}
+		bench_add_sample(&r, (nanos() - start) / CALLS);
+	}
+	bench_format(line, sizeof(line), &r, "ns");
+	printf("%s", line);
+}
+
+int main(void) {
+	for (uint8_t i = 0; i < sizeof(data); i++) {
+		data[i] = i * 37 + 1;
+	}
+	test_fields();
+	test_bytes();
+	test_truncation();
+
+	printf("bench-begin board=host hz=1000000000\n");
+	time_case("format_distance", format_distance);
+	time_case("fmt_distance", fmt_distance);
+	time_case("format_uid7", format_uid);
+	time_case("fmt_uid7", fmt_uid);
+	time_case("format_dump64", format_dump);
+	time_case("fmt_dump64", fmt_dump);
+	printf("bench-end\n");
+	printf("fmt failures=%d\n", failures);
+	return failures != 0;
+}
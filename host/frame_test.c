@@ -0,0 +1,330 @@
+/* frame.c round trips: random frames of every length through frame_pack()
+ * and frame_unpack(), and raw COBS through its encoder and decoder, with
+ * zero free, all zero and long zero free runs mixed in:
+ *
+ *   pack        no 0x00 before the delimiter, at most FRAME_MAX_ENCODED
+ *               bytes, decoded back unchanged
+ *   corrupt     a bit flipped in a data byte is always rejected; any byte
+ *               changed, code bytes included, is rejected but for CRC-16
+ *               collisions, which are counted against 2^-16
+ *   stream      a byte stream of intact, corrupted, cut short and noise
+ *               frames, split into random chunks and received the way
+ *               proto.c and reader_client.c do: every intact frame comes
+ *               out once and in order, nothing else does
+ *
+ * then bench lines for pack and unpack of a 64 byte frame, host time in
+ * nanoseconds. Exits non zero on a failure. */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "frame.h"
+
+#define SAMPLES 100000
+#define COBS_MAX 1024
+#define STREAM_FRAMES 50000
+#define STREAM_CHUNK 80
+#define RUNS 64
+#define CALLS 1024
+
+static uint32_t random_state = 0x1b873593;
+static int failures;
+static volatile uint32_t sink;
+
+static uint32_t next_random(void) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+static uint32_t nanos(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void check(bool ok, const char *what) {
+	if (!ok) {
+		if (failures++ < 10) {
+			fprintf(stderr, "%s\n", what);
+		}
+	}
+}
+
+/* Random bytes of one of the shapes COBS treats differently */
+static void fill(uint8_t *buf, size_t len) {
+	uint32_t shape = next_random() % 4;
+
+	for (size_t i = 0; i < len; i++) {
+		uint8_t b = next_random();
+		switch (shape) {
+		case 0:
+			buf[i] = b;
+			break;
+		case 1:
+			/* Zero free, runs past 254 bytes */
+			buf[i] = b | 1;
+			break;
+		case 2:
+			buf[i] = 0;
+			break;
+		default:
+			/* Mostly zeros */
+			buf[i] = b % 5 ? 0 : b;
+			break;
+		}
+	}
+}
+
+static bool zero_free(const uint8_t *buf, size_t len) {
+	return !memchr(buf, 0, len);
+}
+
+static void test_cobs(void) {
+	static uint8_t raw[COBS_MAX], enc[COBS_MAX + COBS_MAX / 254 + 1],
+		dec[sizeof(enc)];
+
+	for (uint32_t i = 0; i < SAMPLES; i++) {
+		size_t len = i < COBS_MAX ? i : next_random() % COBS_MAX;
+		fill(raw, len);
+		size_t n = frame_cobs_encode(raw, len, enc);
+		check(n <= len + len / 254 + 1 && zero_free(enc, n),
+			  "cobs: encoded size or a zero");
+		/* A code byte of 1 alone is the empty input */
+		size_t d = frame_cobs_decode(enc, n, dec);
+		check(d == len && !memcmp(raw, dec, len), "cobs: round trip");
+	}
+}
+
+static void test_pack(void) {
+	uint8_t raw[FRAME_MAX_RAW + 2], enc[FRAME_MAX_ENCODED];
+	uint8_t back[FRAME_MAX_ENCODED], copy[FRAME_MAX_RAW];
+
+	check(FRAME_MAX_ENCODED >= FRAME_MAX_RAW + 2 + (FRAME_MAX_RAW + 2 + 253) /
+														   254 + 1,
+		  "pack: FRAME_MAX_ENCODED too small");
+	for (uint32_t i = 0; i < SAMPLES; i++) {
+		size_t len = i <= FRAME_MAX_RAW ? i : next_random() % FRAME_MAX_RAW;
+		fill(raw, len);
+		memcpy(copy, raw, len);
+		size_t n = frame_pack(raw, len, enc);
+		check(n <= FRAME_MAX_ENCODED, "pack: too long");
+		check(enc[n - 1] == FRAME_DELIMITER && zero_free(enc, n - 1),
+			  "pack: delimiter");
+		size_t u = frame_unpack(enc, n - 1, back);
+		/* An empty frame unpacks as 0, the same as a damaged one */
+		check(u == len && !memcmp(copy, back, len), "pack: round trip");
+	}
+}
+
+static void test_corrupt(void) {
+	uint8_t raw[FRAME_MAX_RAW + 2], enc[FRAME_MAX_ENCODED];
+	uint8_t back[FRAME_MAX_ENCODED];
+	uint32_t flips = 0, changes = 0, collisions = 0;
+
+	for (uint32_t i = 0; i < SAMPLES; i++) {
+		size_t len = next_random() % FRAME_MAX_RAW + 1;
+		fill(raw, len);
+		size_t n = frame_pack(raw, len, enc) - 1;
+
+		/* Code bytes are the ones COBS put in, walk them */
+		bool code[FRAME_MAX_ENCODED] = {false};
+		for (size_t at = 0; at < n; at += enc[at]) {
+			code[at] = true;
+		}
+		size_t at = next_random() % n;
+		uint8_t was = enc[at];
+		if (!code[at]) {
+			enc[at] ^= 1 << (next_random() % 8);
+			if (enc[at]) {
+				flips++;
+				check(frame_unpack(enc, n, back) == 0,
+					  "corrupt: bit flip accepted");
+			}
+			enc[at] = was;
+		}
+		do {
+			enc[at] = next_random();
+		} while (enc[at] == was || enc[at] == 0);
+		changes++;
+		collisions += frame_unpack(enc, n, back) != 0;
+	}
+	printf("bench-info frame corrupt flips=%u changes=%u collisions=%u\n",
+		   flips, changes, collisions);
+	/* Expected changes / 65536, a wide margin */
+	check(collisions <= changes / 65536 * 4 + 4, "corrupt: CRC collisions");
+}
+
+/* The receive loop of proto.c and reader_client.c, `got` is called for
+ * every frame that unpacks */
+typedef struct {
+	uint8_t enc[FRAME_MAX_ENCODED];
+	size_t len;
+	bool discard;
+	uint32_t bad;
+} receiver_t;
+
+static void receive(receiver_t *r, const uint8_t *data, size_t n,
+					void (*got)(const uint8_t *raw, size_t len)) {
+	uint8_t raw[FRAME_MAX_ENCODED];
+
+	for (size_t i = 0; i < n; i++) {
+		if (data[i] != FRAME_DELIMITER) {
+			if (r->len < sizeof(r->enc)) {
+				r->enc[r->len++] = data[i];
+			} else {
+				r->discard = true;
+			}
+			continue;
+		}
+		size_t len = 0;
+		if (!r->discard && r->len) {
+			len = frame_unpack(r->enc, r->len, raw);
+		}
+		if (len) {
+			got(raw, len);
+		} else if (r->len || r->discard) {
+			r->bad++;
+		}
+		r->len = 0;
+		r->discard = false;
+	}
+}
+
+/* The intact frames in the order they were sent: a sequence number and a
+ * length that the payload is derived from */
+static struct {
+	uint16_t seq[STREAM_FRAMES];
+	uint32_t sent;
+	uint32_t received;
+	uint32_t foreign;
+} stream;
+
+static void payload(uint16_t seq, uint8_t *raw, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		raw[i] = i < 2 ? seq >> (8 * i) : (uint8_t)(seq * 31 + i);
+	}
+}
+
+static void got_frame(const uint8_t *raw, size_t len) {
+	uint8_t want[FRAME_MAX_RAW];
+	uint16_t seq = raw[0] | raw[1] << 8;
+
+	if (len < 2 || stream.received >= stream.sent ||
+		seq != stream.seq[stream.received]) {
+		stream.foreign++;
+		return;
+	}
+	payload(seq, want, len);
+	if (memcmp(want, raw, len)) {
+		stream.foreign++;
+		return;
+	}
+	stream.received++;
+}
+
+/* In chunks of random size, as reads from the link return them */
+static void feed(receiver_t *r, const uint8_t *bytes, size_t total) {
+	for (size_t at = 0; at < total;) {
+		size_t n = next_random() % STREAM_CHUNK + 1;
+		n = n < total - at ? n : total - at;
+		receive(r, &bytes[at], n, got_frame);
+		at += n;
+	}
+}
+
+static void test_stream(void) {
+	static uint8_t bytes[STREAM_FRAMES * 80];
+	uint8_t raw[FRAME_MAX_RAW + 2], enc[FRAME_MAX_ENCODED];
+	receiver_t r = {.len = 0};
+	size_t total = 0;
+	bool after_cut = false;
+
+	for (uint32_t f = 0; f < STREAM_FRAMES; f++) {
+		size_t len = next_random() % 60 + 2;
+		uint32_t kind = next_random() % 8;
+		payload(f, raw, len);
+		size_t n = frame_pack(raw, len, enc);
+		switch (kind) {
+		case 0:
+			/* A byte changed, a zero splits the frame in two */
+			enc[next_random() % (n - 1)] ^= next_random() % 255 + 1;
+			break;
+		case 1:
+			/* Cut short: no delimiter, runs into the next frame */
+			n = next_random() % (n - 1) + 1;
+			break;
+		case 2:
+			/* Line noise right in front of the frame */
+			for (uint32_t k = next_random() % 8 + 1; k; k--) {
+				bytes[total++] = next_random() | 1;
+			}
+			break;
+		default:
+			/* Intact, unless the frame before was cut short */
+			if (!after_cut) {
+				stream.seq[stream.sent++] = f;
+			}
+			break;
+		}
+		after_cut = kind == 1;
+		memcpy(&bytes[total], enc, n);
+		total += n;
+	}
+	feed(&r, bytes, total);
+
+	/* A frame longer than the receive buffer, then a delimiter */
+	uint32_t bad = r.bad;
+	total = 0;
+	bytes[total++] = FRAME_DELIMITER;
+	memset(&bytes[total], 0x55, FRAME_MAX_ENCODED + 10);
+	total += FRAME_MAX_ENCODED + 10;
+	bytes[total++] = FRAME_DELIMITER;
+	feed(&r, bytes, total);
+	bad = r.bad - bad;
+
+	printf("bench-info frame stream intact=%u received=%u bad=%u "
+		   "foreign=%u\n",
+		   stream.sent, stream.received, r.bad, stream.foreign);
+	check(stream.foreign == 0, "stream: a damaged frame was accepted");
+	check(stream.received == stream.sent, "stream: an intact frame was lost");
+	check(bad == 1, "stream: the overlong frame was not dropped");
+}
+
+static void time_case(const char *name, bool unpack) {
+	uint8_t raw[FRAME_MAX_RAW + 2], enc[FRAME_MAX_ENCODED];
+	uint8_t back[FRAME_MAX_ENCODED];
+	bench_result_t r = {.name = name};
+	char line[BENCH_LINE_MAX];
+
+	fill(raw, 64);
+	size_t n = frame_pack(raw, 64, enc) - 1;
+	for (uint32_t run = 0; run < RUNS; run++) {
+		uint32_t start = nanos();
+		for (uint32_t i = 0; i < CALLS; i++) {
+			sink += unpack ? frame_unpack(enc, n, back)
+						   : frame_pack(raw, 64, enc);
+		}
+		bench_add_sample(&r, (nanos() - start) / CALLS);
+	}
+	bench_format(line, sizeof(line), &r, "ns");
+	printf("%s", line);
+}
+
+int main(void) {
+	test_cobs();
+	test_pack();
+	test_corrupt();
+	test_stream();
+
+	printf("bench-begin board=host hz=1000000000\n");
+	time_case("frame_pack_64", false);
+	time_case("frame_unpack_64", true);
+	printf("bench-end\n");
+	printf("frame failures=%d\n", failures);
+	return failures != 0;
+}
@@ -0,0 +1,180 @@
+/* APDU latency and throughput of isodep.c against the ISO 14443-4 card
+ * model in isodep_sim.c, which also replays the FIFO watermark loop of
+ * PCD_TransceiveStream(). Same result lines as the benchmarks; the clock is
+ * the simulated time, so the numbers are modelled air and bus time on SPI:
+ *
+ *   isodep_read_N_fsF    READ of N bytes, the card and we using F byte
+ *                        frames; F 64 is the most the FIFO took before
+ *   isodep_update_N_fsF  UPDATE with N data bytes
+ *
+ * Then the FIFO levels of 1 KB both ways on every bus, and the protocol
+ * cases: a waiting time extension, and every frame of a chained exchange
+ * lost once in each direction. Exits non zero if anything fails. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "isodep_sim.h"
+
+#define APDU_MAX 1100
+
+static isodep_t dep;
+static uint8_t apdu[4 + APDU_MAX];
+static uint8_t resp[APDU_MAX + 2];
+static uint16_t apdu_n;
+static uint8_t apdu_ins;
+static int failures;
+
+static uint32_t sim_clock(void) { return isocard_ns; }
+
+static int activate(uint8_t fsci) {
+	isocard_reset();
+	isocard_fsci = fsci;
+	return isodep_rats(&dep) != ISODEP_OK;
+}
+
+/* One APDU, checked. Returns non zero on failure. */
+static int run_apdu(uint8_t ins, uint16_t n) {
+	uint16_t len = 4;
+	uint16_t respLen = sizeof(resp);
+
+	apdu[0] = 0x00;
+	apdu[1] = ins;
+	apdu[2] = n >> 8;
+	apdu[3] = n;
+	uint16_t sum = 0;
+	if (ins == ISOCARD_INS_UPDATE) {
+		for (uint16_t i = 0; i < n; i++) {
+			apdu[len] = i * 7 + 3;
+			sum += apdu[len++];
+		}
+	}
+	isodep_status_t status = isodep_exchange(&dep, apdu, len, resp, &respLen);
+	if (status != ISODEP_OK) {
+		return 1;
+	}
+	if (ins == ISOCARD_INS_UPDATE) {
+		return respLen != 4 || resp[0] != (sum >> 8) ||
+			   resp[1] != (uint8_t)sum || resp[2] != 0x90;
+	}
+	if (respLen != n + 2 || resp[n] != 0x90 || resp[n + 1] != 0x00) {
+		return 1;
+	}
+	for (uint16_t i = 0; i < n; i++) {
+		if (resp[i] != (uint8_t)i) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void bench_apdu(void) { failures += run_apdu(apdu_ins, apdu_n); }
+
+static void report(const bench_result_t *r) {
+	char line[BENCH_LINE_MAX];
+	bench_format(line, sizeof(line), r, "ns");
+	fputs(line, stdout);
+}
+
+static void run_benches(void) {
+	static const uint16_t sizes[] = {64, 250, 1024};
+	static const struct {
+		uint8_t fsci;
+		uint16_t fs;
+	} frames[] = {{5, 64}, {8, 256}};
+	bench_result_t r;
+	char name[40];
+
+	isocard_bus = ISOCARD_BUS_SPI;
+	for (size_t f = 0; f < sizeof(frames) / sizeof(frames[0]); f++) {
+		for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+			uint32_t mean[2];
+			apdu_n = sizes[i];
+			for (int u = 0; u <= 1; u++) {
+				apdu_ins = u ? ISOCARD_INS_UPDATE : ISOCARD_INS_READ;
+				if (activate(frames[f].fsci)) {
+					failures++;
+					return;
+				}
+				snprintf(name, sizeof(name), "isodep_%s_%u_fs%u",
+						 u ? "update" : "read", apdu_n, frames[f].fs);
+				bench_measure(&r, name, bench_apdu, BENCH_RUNS, sim_clock, 0);
+				report(&r);
+				mean[u] = r.total / r.runs;
+			}
+			printf("bench-info isodep n=%u fs=%u read_Bps=%lu update_Bps=%lu\n",
+				   apdu_n, frames[f].fs,
+				   (unsigned long)((uint64_t)apdu_n * 1000000000u / mean[0]),
+				   (unsigned long)((uint64_t)apdu_n * 1000000000u / mean[1]));
+		}
+	}
+}
+
+/* FIFO levels for 1 KB each way on every bus */
+static void fifo_check(void) {
+	static const char *const buses[] = {"spi", "uart", "i2c"};
+
+	for (int bus = ISOCARD_BUS_SPI; bus <= ISOCARD_BUS_I2C; bus++) {
+		isocard_bus = bus;
+		int fail = activate(8) || run_apdu(ISOCARD_INS_READ, 1024) ||
+				   run_apdu(ISOCARD_INS_UPDATE, 1024);
+		fail |= isocard_underruns || isocard_overruns;
+		printf("fifo bus=%s water=16 tx_low=%u rx_high=%u underruns=%lu "
+			   "overruns=%lu %s\n",
+			   buses[bus], isocard_tx_low, isocard_rx_high,
+			   (unsigned long)isocard_underruns,
+			   (unsigned long)isocard_overruns, fail ? "FAIL" : "ok");
+		failures += fail;
+	}
+	isocard_bus = ISOCARD_BUS_SPI;
+}
+
+/* Loses frame `frame` of a 600 byte UPDATE or READ at FS 256: one of the
+ * three command I-blocks of the UPDATE, or the command or one of the two
+ * R(ACK)s for the three response I-blocks of the READ */
+static int lose_case(uint32_t frame, isocard_lose_t how, uint8_t ins) {
+	if (activate(8)) {
+		return 1;
+	}
+	isocard_lose(isocard_frames + frame, how);
+	int fail = run_apdu(ins, 600);
+	// And the next one goes through on the same block numbers
+	isocard_lose(-1, ISOCARD_LOSE_NONE);
+	fail |= run_apdu(ins, 600);
+	if (!fail && !dep.retries) {
+		fail = 1;
+	}
+	if (fail) {
+		fprintf(stderr, "lose frame %u how %d ins %02x failed\n", frame, how,
+				ins);
+	}
+	return fail;
+}
+
+int main(void) {
+	uint32_t cases = 0, fails = 0;
+
+	printf("bench-begin board=sim hz=1000000000 card=iso14443-4 bus=spi\n");
+	run_benches();
+	printf("bench-end\n");
+	fifo_check();
+
+	// The card wants three frame waiting times for every answer
+	isocard_wtxm = 3;
+	cases++;
+	fails += activate(8) || run_apdu(ISOCARD_INS_READ, 600) || !dep.wtx;
+	isocard_wtxm = 0;
+
+	for (uint32_t frame = 0; frame < 3; frame++) {
+		for (isocard_lose_t how = ISOCARD_LOSE_COMMAND;
+			 how <= ISOCARD_LOSE_ANSWER; how++) {
+			fails += lose_case(frame, how, ISOCARD_INS_UPDATE);
+			fails += lose_case(frame, how, ISOCARD_INS_READ);
+			cases += 2;
+		}
+	}
+	printf("protocol cases=%u failures=%u\n", cases, fails);
+	failures += fails;
+	return failures != 0;
+}
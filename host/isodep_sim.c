@@ -0,0 +1,397 @@
+#include <string.h>
+
+#include "isodep_sim.h"
+#include "mfclassic_sim.h"
+#include "proto.h"
+
+/* PCD_FIFO_SIZE and PCD_WATER_LEVEL */
+#define FIFO_SIZE 64
+#define WATER_LEVEL 16
+/* PCD_SetTimeoutUs() goes up to PCD_TIMEOUT_MAX_US, the 32 bit clock here
+ * only to half its period. driver-bench has the long timeouts. */
+#define TIMEOUT_MAX_NS 0x7fffffffu
+/* Assumed: PICC_CRC_A() per byte at 72 MHz */
+#define CRC_BYTE_NS 140
+/* Bus rates as in mfrc522_sim.h */
+#define SPI_HZ 2250000
+#define UART_BAUD 1228800
+#define I2C_HZ 400000
+
+uint32_t isocard_ns;
+isocard_bus_t isocard_bus;
+uint8_t isocard_fsci = 8;
+uint8_t isocard_fwi = 4;
+uint8_t isocard_wtxm;
+uint32_t isocard_frames;
+uint8_t isocard_tx_low;
+uint8_t isocard_rx_high;
+uint32_t isocard_underruns;
+uint32_t isocard_overruns;
+
+static const uint16_t fs_table[] = {16, 24, 32, 40, 48, 64, 96, 128, 256};
+
+static int32_t lose_frame = -1;
+static isocard_lose_t lose_how;
+
+/* Card state */
+static uint16_t fsd;
+static uint8_t card_bn;
+static uint8_t cmd[4096];
+static uint16_t cmd_len;
+static uint8_t resp[4096];
+static uint16_t resp_len;
+static uint16_t resp_off;
+static bool wtx_pending;
+static uint8_t last[ISODEP_FSD];
+static uint16_t last_len;
+
+void isocard_reset(void) {
+	isocard_ns = 0;
+	isocard_frames = 0;
+	isocard_tx_low = FIFO_SIZE;
+	isocard_rx_high = 0;
+	isocard_underruns = 0;
+	isocard_overruns = 0;
+	lose_frame = -1;
+	fsd = 0;
+	cmd_len = 0;
+	resp_len = resp_off = 0;
+	wtx_pending = false;
+	last_len = 0;
+}
+
+void isocard_lose(uint32_t frame, isocard_lose_t how) {
+	lose_frame = frame;
+	lose_how = how;
+}
+
+/* Bus time of the loop's register accesses */
+static uint32_t bits_ns(uint32_t bits, uint32_t hz) {
+	return (uint64_t)bits * 1000000000u / hz;
+}
+
+static void reg_read(void) {
+	switch (isocard_bus) {
+	case ISOCARD_BUS_SPI:
+		isocard_ns += bits_ns(16, SPI_HZ);
+		break;
+	case ISOCARD_BUS_UART:
+		isocard_ns += bits_ns(20, UART_BAUD);
+		break;
+	case ISOCARD_BUS_I2C:
+		isocard_ns += bits_ns(1 + 9 * 2 + 1 + 9 * 2 + 1, I2C_HZ);
+		break;
+	}
+}
+
+static void burst_write(uint16_t n) {
+	switch (isocard_bus) {
+	case ISOCARD_BUS_SPI:
+		isocard_ns += bits_ns(8 * (n + 1), SPI_HZ);
+		break;
+	case ISOCARD_BUS_UART:
+		isocard_ns += bits_ns(30 * n, UART_BAUD);
+		break;
+	case ISOCARD_BUS_I2C:
+		isocard_ns += bits_ns(1 + 9 * (2 + n) + 1, I2C_HZ);
+		break;
+	}
+}
+
+static void reg_write(void) { burst_write(1); }
+
+static void burst_read(uint16_t n) {
+	switch (isocard_bus) {
+	case ISOCARD_BUS_SPI:
+		isocard_ns += bits_ns(8 * (n + 1), SPI_HZ);
+		break;
+	case ISOCARD_BUS_UART:
+		isocard_ns += bits_ns(20 * n, UART_BAUD);
+		break;
+	case ISOCARD_BUS_I2C:
+		isocard_ns += bits_ns(1 + 9 * 2 + 1 + 9 * (1 + n) + 1, I2C_HZ);
+		break;
+	}
+}
+
+/* Frame waiting times without ΔFWT, 4096/fc * 2^FWI each */
+static uint32_t fwt_ns(uint8_t wtxm) {
+	return ((uint64_t)4096 << isocard_fwi) * 100000 / 1356 * wtxm;
+}
+
+static void answer(const uint8_t *data, uint16_t len) {
+	memcpy(last, data, len);
+	last_len = len;
+}
+
+/* Next I-block of the response, within both frame sizes */
+static void next_block(void) {
+	uint16_t fs = fs_table[isocard_fsci < 8 ? isocard_fsci : 8];
+	uint16_t n = resp_len - resp_off;
+	uint8_t frame[ISODEP_FSD];
+
+	if (fs > fsd) {
+		fs = fsd;
+	}
+	if (n > fs - 3) {
+		n = fs - 3;
+	}
+	frame[0] = ISODEP_PCB_I | card_bn;
+	if (resp_off + n < resp_len) {
+		frame[0] |= ISODEP_PCB_CHAIN;
+	}
+	memcpy(&frame[1], &resp[resp_off], n);
+	resp_off += n;
+	answer(frame, 1 + n);
+}
+
+static void run_apdu(void) {
+	uint16_t n = cmd_len >= 4 ? (cmd[2] << 8) | cmd[3] : 0;
+
+	resp_len = resp_off = 0;
+	if (cmd_len >= 4 && cmd[1] == ISOCARD_INS_READ && n <= sizeof(resp) - 2) {
+		for (uint16_t i = 0; i < n; i++) {
+			resp[resp_len++] = i;
+		}
+	} else if (cmd_len == 4 + n && cmd[1] == ISOCARD_INS_UPDATE) {
+		uint16_t sum = 0;
+		for (uint16_t i = 0; i < n; i++) {
+			sum += cmd[4 + i];
+		}
+		resp[resp_len++] = sum >> 8;
+		resp[resp_len++] = sum;
+	} else {
+		resp[resp_len++] = 0x6A;
+		resp[resp_len++] = 0x86;
+		cmd_len = 0;
+		return;
+	}
+	resp[resp_len++] = 0x90;
+	resp[resp_len++] = 0x00;
+	cmd_len = 0;
+}
+
+/* The card's side of one frame, false if it stays silent. `delay` is its
+ * processing time on top of the frame delay time. */
+static bool card_frame(const uint8_t *in, uint16_t len, uint32_t *delay) {
+	uint8_t pcb = in[0];
+	uint8_t ctrl[2];
+
+	*delay = 0;
+	if (pcb == ISODEP_RATS && len == 2) {
+		uint8_t ats[5] = {5, 0x70 | isocard_fsci, 0x00, isocard_fwi << 4,
+						  0x02};
+		fsd = fs_table[(in[1] >> 4) < 8 ? in[1] >> 4 : 8];
+		card_bn = 1;
+		answer(ats, sizeof(ats));
+		return true;
+	}
+	if (!fsd) {
+		return false;
+	}
+	if ((pcb & 0xE2) == ISODEP_PCB_I) {
+		card_bn = pcb & ISODEP_PCB_BLOCK_NUM;
+		if ((size_t)cmd_len + len - 1 > sizeof(cmd)) {
+			return false;
+		}
+		memcpy(&cmd[cmd_len], &in[1], len - 1);
+		cmd_len += len - 1;
+		if (pcb & ISODEP_PCB_CHAIN) {
+			ctrl[0] = ISODEP_PCB_R_ACK | card_bn;
+			answer(ctrl, 1);
+			return true;
+		}
+		run_apdu();
+		if (isocard_wtxm) {
+			ctrl[0] = ISODEP_PCB_S_WTX;
+			ctrl[1] = isocard_wtxm;
+			answer(ctrl, 2);
+			wtx_pending = true;
+			return true;
+		}
+		next_block();
+		return true;
+	}
+	if (pcb == ISODEP_PCB_S_WTX && len == 2 && wtx_pending) {
+		// Longer than one frame waiting time, within the extension
+		wtx_pending = false;
+		*delay = fwt_ns(isocard_wtxm) - fwt_ns(1) / 2;
+		next_block();
+		return true;
+	}
+	if ((pcb & 0xFE) == ISODEP_PCB_R_ACK) {
+		if ((pcb & ISODEP_PCB_BLOCK_NUM) != card_bn &&
+			resp_off < resp_len) {
+			card_bn = pcb & ISODEP_PCB_BLOCK_NUM;
+			next_block();
+		}
+		return true;
+	}
+	if ((pcb & 0xFE) == ISODEP_PCB_R_NAK) {
+		if ((pcb & ISODEP_PCB_BLOCK_NUM) != card_bn) {
+			ctrl[0] = ISODEP_PCB_R_ACK | card_bn;
+			answer(ctrl, 1);
+		}
+		return true;
+	}
+	if (pcb == ISODEP_PCB_S_DESELECT && len == 1) {
+		fsd = 0;
+		answer(in, 1);
+		return true;
+	}
+	return false;
+}
+
+/* Sends `total` bytes through the FIFO as PCD_TransceiveStream() does.
+ * Returns false if it ran dry, and leaves isocard_ns at the end of the
+ * frame. */
+static bool stream_out(uint16_t total) {
+	uint16_t written = total < FIFO_SIZE ? total : FIFO_SIZE;
+	bool lo = true;
+
+	// Clear the IRQs, flush, the first part, StartSend
+	reg_write();
+	reg_write();
+	burst_write(written);
+	reg_write();
+	uint32_t start = isocard_ns;
+	uint32_t end = start + total * CARD_BYTE_NS;
+
+	for (;;) {
+		reg_read();
+		uint32_t t = isocard_ns - start;
+		// Bytes that left the FIFO, one per byte time
+		uint16_t gone = t / CARD_BYTE_NS + 1;
+		if (written < total && gone > written) {
+			isocard_underruns++;
+			return false;
+		}
+		if (isocard_ns - start >= end - start) {
+			return true;
+		}
+		uint16_t level = written - gone;
+		lo = lo || level <= WATER_LEVEL;
+		if (written < total && lo) {
+			reg_write();
+			lo = false;
+			reg_read();
+			gone = (isocard_ns - start) / CARD_BYTE_NS + 1;
+			if (gone > written) {
+				isocard_underruns++;
+				return false;
+			}
+			level = written - gone;
+			if (level < isocard_tx_low) {
+				isocard_tx_low = level;
+			}
+			uint16_t n = FIFO_SIZE - level;
+			if (n > total - written) {
+				n = total - written;
+			}
+			burst_write(n);
+			written += n;
+		}
+	}
+}
+
+/* Receives `total` bytes arriving from `start` on, drained on HiAlert and
+ * RxIRq */
+static bool stream_in(uint32_t start, uint16_t total) {
+	uint32_t end = start + total * CARD_BYTE_NS;
+	uint16_t drained = 0;
+	bool hi = false;
+
+	for (;;) {
+		reg_read();
+		int32_t t = isocard_ns - start;
+		uint16_t arrived = t <= 0 ? 0 : t / CARD_BYTE_NS;
+		if (arrived > total) {
+			arrived = total;
+		}
+		if (arrived - drained > FIFO_SIZE) {
+			isocard_overruns++;
+			return false;
+		}
+		hi = hi || FIFO_SIZE - (arrived - drained) <= WATER_LEVEL;
+		bool done = (int32_t)(isocard_ns - end) >= 0;
+		if (hi || done) {
+			if (hi) {
+				reg_write();
+				hi = false;
+			}
+			reg_read();
+			t = isocard_ns - start;
+			arrived = t <= 0 ? 0 : t / CARD_BYTE_NS;
+			if (arrived > total) {
+				arrived = total;
+			}
+			uint16_t level = arrived - drained;
+			if (level > FIFO_SIZE) {
+				isocard_overruns++;
+				return false;
+			}
+			if (level > isocard_rx_high) {
+				isocard_rx_high = level;
+			}
+			burst_read(level);
+			drained += level;
+		}
+		if (done) {
+			return true;
+		}
+	}
+}
+
+uint8_t isodep_pcd_transceive(uint8_t *frame, uint16_t len, uint8_t *back,
+							  uint16_t *backLen, uint32_t timeoutUs) {
+	uint32_t timeout = timeoutUs * 1000u;
+	uint32_t delay = 0;
+	bool heard = false;
+
+	if (timeoutUs > TIMEOUT_MAX_NS / 1000) {
+		timeout = TIMEOUT_MAX_NS;
+	}
+	isocard_ns += len * CRC_BYTE_NS;
+	// PCD_SetTimeoutUs(), PCD_StartTransceive()
+	for (uint8_t i = 0; i < 4; i++) {
+		reg_write();
+	}
+
+	bool lost = (int32_t)isocard_frames == lose_frame;
+	isocard_frames++;
+	if (!(lost && lose_how == ISOCARD_LOSE_COMMAND)) {
+		heard = card_frame(frame, len, &delay);
+	}
+	if (!stream_out(len + 2)) {
+		return PROTO_STATUS_ERROR;
+	}
+	uint32_t txEnd = isocard_ns;
+	if (!heard || lost || CARD_FDT_NS + delay > timeout) {
+		// Polls until the timer runs out
+		while (isocard_ns - txEnd < timeout) {
+			reg_read();
+		}
+		for (uint8_t i = 0; i < 2; i++) {
+			reg_write();
+		}
+		return PROTO_STATUS_TIMEOUT;
+	}
+
+	if (!stream_in(txEnd + CARD_FDT_NS + delay, last_len + 2)) {
+		return PROTO_STATUS_ERROR;
+	}
+	// ErrorReg, ControlReg, PCD_SetTimeoutUs()
+	reg_read();
+	reg_read();
+	reg_write();
+	reg_write();
+	isocard_ns += (last_len + 2) * CRC_BYTE_NS;
+	if (last_len + 2 > *backLen) {
+		return PROTO_STATUS_NO_ROOM;
+	}
+	memcpy(back, last, last_len);
+	*backLen = last_len;
+	return PROTO_STATUS_OK;
+}
+
+void isodep_pcd_wait_us(uint32_t us) { isocard_ns += us * 1000u; }
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "isodep.h"
+
+/* Host model of an ISO 14443-4 card behind the frame hooks of isodep.h,
+ * with the PCD side of every frame replayed through the watermark loop of
+ * PCD_TransceiveStream(): a 64 byte FIFO that the air empties while
+ * sending and fills while receiving at 106 kbit/s, and the register
+ * traffic of the loop on one of the host buses. It adds up the time and
+ * records how close the FIFO came to running dry or over.
+ *
+ * The card answers two commands, CLA 0x00 and the length in P1 P2:
+ *   INS 0xB0  that many response bytes (i & 0xff), then 90 00
+ *   INS 0xD6  that many data bytes, answered with their sum (2 bytes) and
+ *             90 00 */
+
+#define ISOCARD_INS_READ 0xB0
+#define ISOCARD_INS_UPDATE 0xD6
+
+typedef enum {
+	ISOCARD_BUS_SPI,
+	ISOCARD_BUS_UART,
+	ISOCARD_BUS_I2C,
+} isocard_bus_t;
+
+typedef enum {
+	ISOCARD_LOSE_NONE,
+	/* The frame from the PCD never arrives */
+	ISOCARD_LOSE_COMMAND,
+	/* The card's answer to it never arrives */
+	ISOCARD_LOSE_ANSWER,
+} isocard_lose_t;
+
+/* Simulated time in nanoseconds since isocard_reset(), wraps at 2^32 */
+extern uint32_t isocard_ns;
+extern isocard_bus_t isocard_bus;
+/* FSCI and FWI the card puts in its ATS */
+extern uint8_t isocard_fsci;
+extern uint8_t isocard_fwi;
+/* Answer every final command I-block with S(WTX) first and then take this
+ * many frame waiting times to answer, 0 for none */
+extern uint8_t isocard_wtxm;
+/* Frames from the PCD since isocard_reset() */
+extern uint32_t isocard_frames;
+/* Worst FIFO level seen: the fewest bytes still queued while sending with
+ * more to come, and the most waiting while receiving */
+extern uint8_t isocard_tx_low;
+extern uint8_t isocard_rx_high;
+/* Frames cut short or overrun, the driver reports them as errors */
+extern uint32_t isocard_underruns;
+extern uint32_t isocard_overruns;
+
+void isocard_reset(void);
+/* Loses frame number `frame` (isocard_frames) the given way */
+void isocard_lose(uint32_t frame, isocard_lose_t how);
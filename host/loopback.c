@@ -0,0 +1,117 @@
+/* Round trip times over a serial link that is looped back, with a wire from
+ * TX to RX of a USB-serial adapter or through `pty_reader -e`:
+ *
+ *   build/loopback <tty> [baud]
+ *
+ * Prints the same result lines as the benchmarks, in nanoseconds. The
+ * throughput of a block case in bytes/s is len * 1e9 / mean. Runs that time
+ * out or echo wrong data are left out. */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "reader_client.h"
+
+#define TIMEOUT_MS 1000
+/* Writes no more than this ahead of the echo, so neither side blocks on a
+ * full buffer */
+#define WINDOW 256
+
+static const struct {
+	const char *name;
+	size_t len;
+} cases[] = {
+	{"loopback_rtt1", 1},
+	{"loopback_block64", 64},
+	{"loopback_block256", 256},
+	{"loopback_block4096", 4096},
+};
+
+static uint8_t block[4096];
+static uint8_t echo[4096];
+
+static uint32_t nanos(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* Nanoseconds until `len` bytes are back, 0 on a timeout or mismatch */
+static uint32_t round_trip(int fd, size_t len) {
+	struct pollfd pfd = {.fd = fd, .events = POLLIN};
+	size_t sent = 0, got = 0;
+	uint32_t start = nanos();
+
+	while (got < len) {
+		size_t chunk = WINDOW - (sent - got);
+		if (chunk > len - sent) {
+			chunk = len - sent;
+		}
+		if (chunk) {
+			ssize_t n = write(fd, &block[sent], chunk);
+			if (n > 0) {
+				sent += n;
+			}
+		}
+		ssize_t n = read(fd, &echo[got], len - got);
+		if (n > 0) {
+			got += n;
+			continue;
+		}
+		if (n < 0 && errno != EAGAIN && errno != EINTR) {
+			return 0;
+		}
+		if (sent == len && poll(&pfd, 1, TIMEOUT_MS) <= 0) {
+			return 0;
+		}
+	}
+	uint32_t ticks = nanos() - start;
+	return memcmp(block, echo, len) ? 0 : ticks;
+}
+
+int main(int argc, char **argv) {
+	reader_t r;
+	bench_result_t res;
+	char line[BENCH_LINE_MAX];
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <tty> [baud]\n", argv[0]);
+		return 2;
+	}
+	if (reader_open(&r, argv[1]) < 0) {
+		perror(argv[1]);
+		return 1;
+	}
+	if (argc > 2 && reader_set_baud(&r, strtoul(argv[2], NULL, 0)) < 0) {
+		fprintf(stderr, "%s: unsupported baud rate %s\n", argv[1], argv[2]);
+		return 1;
+	}
+	for (size_t i = 0; i < sizeof(block); i++) {
+		block[i] = i * 13 + 7;
+	}
+	uint32_t overhead = bench_overhead(nanos);
+
+	printf("bench-begin board=host hz=1000000000\n");
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		res.name = cases[i].name;
+		res.runs = 0;
+		res.total = 0;
+		for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+			uint32_t ticks = round_trip(r.fd, cases[i].len);
+			if (ticks) {
+				bench_add_sample(&res, ticks - overhead);
+			}
+		}
+		bench_format(line, sizeof(line), &res, "ns");
+		printf("%s", line);
+	}
+	printf("bench-end\n");
+	reader_close(&r);
+	return 0;
+}
@@ -0,0 +1,179 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "mfclassic_sim.h"
+#include "proto.h"
+
+uint32_t card_ns;
+uint32_t card_silent_ns = 1000000;
+uint32_t card_ops;
+uint8_t card_watch_block = 0xff;
+uint32_t card_watch_ns;
+
+static uint8_t blocks[CARD_BLOCKS][MF_BLOCK_SIZE];
+static uint8_t card_key[MF_KEY_SIZE];
+static uint8_t card_uid[MF_UID_SIZE];
+static int auth_sector = -1;
+static bool buffer_full;
+static int32_t buffer;
+
+static bool powered = true;
+static int32_t tear_op = -1;
+static card_tear_t tear_how;
+
+static void air(uint32_t ns) { card_ns += ns; }
+
+/* PCD frame of `tx` bytes and a response of `rx` bytes, 0 for an ACK */
+static void frame(uint8_t tx, uint8_t rx) {
+	air(CARD_PCD_NS + tx * CARD_BYTE_NS + CARD_FDT_NS);
+	air(rx ? rx * CARD_BYTE_NS : CARD_ACK_NS);
+}
+
+void card_reset(const uint8_t *key, const uint8_t *uid) {
+	memset(blocks, 0, sizeof(blocks));
+	memcpy(card_key, key, MF_KEY_SIZE);
+	memcpy(card_uid, uid, MF_UID_SIZE);
+	card_ns = 0;
+	card_ops = 0;
+	tear_op = -1;
+	card_power_up();
+}
+
+void card_tear(int32_t op, card_tear_t how) {
+	tear_op = op;
+	tear_how = how;
+}
+
+void card_power_up(void) {
+	powered = true;
+	auth_sector = -1;
+	buffer_full = false;
+}
+
+const uint8_t *card_block(uint8_t block) { return blocks[block]; }
+
+/* Counts the exchange and decides whether it gets torn. Returns true if
+ * the card is to handle the command at all. */
+static bool begin(void) {
+	if (powered && (int32_t)card_ops == tear_op) {
+		powered = false;
+		card_ops++;
+		return tear_how != CARD_TEAR_BEFORE;
+	}
+	card_ops++;
+	return powered;
+}
+
+/* The answer, or the driver's timeout once the power is gone */
+static uint8_t end(uint8_t status) {
+	if (!powered) {
+		air(25000000);
+		return PROTO_STATUS_TIMEOUT;
+	}
+	return status;
+}
+
+static bool in_sector(uint8_t block) {
+	return block < CARD_BLOCKS && block / 4 == auth_sector && block % 4 != 3;
+}
+
+static void program(uint8_t block, const uint8_t *data) {
+	if (!powered && tear_how == CARD_TEAR_DURING) {
+		memcpy(blocks[block], data, MF_BLOCK_SIZE / 2);
+		return;
+	}
+	memcpy(blocks[block], data, MF_BLOCK_SIZE);
+	air(CARD_PROG_NS);
+}
+
+uint8_t mf_card_auth(uint8_t keyType, uint8_t block, const uint8_t *key,
+					 const uint8_t *uid) {
+	/* Three passes: nonce, reader answer, card answer */
+	air(CARD_PCD_NS + 4 * CARD_BYTE_NS + CARD_FDT_NS + 4 * CARD_BYTE_NS);
+	air(8 * CARD_BYTE_NS + CARD_FDT_NS + 4 * CARD_BYTE_NS);
+	if (!begin()) {
+		return end(PROTO_STATUS_TIMEOUT);
+	}
+	if (keyType != MF_AUTH_KEY_A || memcmp(key, card_key, MF_KEY_SIZE) ||
+		memcmp(uid, card_uid, MF_UID_SIZE)) {
+		auth_sector = -1;
+		return end(PROTO_STATUS_ERROR);
+	}
+	auth_sector = block / 4;
+	return end(PROTO_STATUS_OK);
+}
+
+uint8_t mf_card_read(uint8_t block, uint8_t *data) {
+	frame(4, MF_BLOCK_SIZE + 2);
+	air(2 * CARD_CRC_NS);
+	if (!begin()) {
+		return end(PROTO_STATUS_TIMEOUT);
+	}
+	if (!in_sector(block)) {
+		return end(PROTO_STATUS_MIFARE_NACK);
+	}
+	memcpy(data, blocks[block], MF_BLOCK_SIZE);
+	return end(PROTO_STATUS_OK);
+}
+
+uint8_t mf_card_write(uint8_t block, const uint8_t *data) {
+	frame(4, 0);
+	frame(MF_BLOCK_SIZE + 2, 0);
+	if (!begin()) {
+		return end(PROTO_STATUS_TIMEOUT);
+	}
+	if (!in_sector(block)) {
+		return end(PROTO_STATUS_MIFARE_NACK);
+	}
+	program(block, data);
+	return end(PROTO_STATUS_OK);
+}
+
+uint8_t mf_card_operate(uint8_t op, uint8_t block, int32_t operand) {
+	int32_t value;
+
+	frame(4, 0);
+	/* The second part has no answer, the driver waits for a NAK */
+	air(CARD_PCD_NS + 6 * CARD_BYTE_NS + card_silent_ns);
+	if (!begin()) {
+		return end(PROTO_STATUS_TIMEOUT);
+	}
+	if (!in_sector(block) || !mf_value_decode(blocks[block], &value, NULL)) {
+		return end(PROTO_STATUS_MIFARE_NACK);
+	}
+	switch (op) {
+	case MF_OP_INCREMENT:
+		buffer = (int32_t)((uint32_t)value + (uint32_t)operand);
+		break;
+	case MF_OP_DECREMENT:
+		buffer = (int32_t)((uint32_t)value - (uint32_t)operand);
+		break;
+	case MF_OP_RESTORE:
+		buffer = value;
+		break;
+	default:
+		return end(PROTO_STATUS_MIFARE_NACK);
+	}
+	buffer_full = powered;
+	return end(PROTO_STATUS_OK);
+}
+
+uint8_t mf_card_transfer(uint8_t block) {
+	uint8_t data[MF_BLOCK_SIZE];
+
+	frame(4, 0);
+	if (!begin()) {
+		return end(PROTO_STATUS_TIMEOUT);
+	}
+	if (!in_sector(block) || !buffer_full) {
+		return end(PROTO_STATUS_MIFARE_NACK);
+	}
+	/* The address bytes stay those of the block */
+	mf_value_encode(data, buffer, blocks[block][12]);
+	program(block, data);
+	uint8_t status = end(PROTO_STATUS_OK);
+	if (status == PROTO_STATUS_OK && block == card_watch_block) {
+		card_watch_ns = card_ns;
+	}
+	return status;
+}
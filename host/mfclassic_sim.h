@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "mf_value.h"
+
+/* Host model of a MIFARE Classic 1K behind the card hooks of mf_value.h.
+ * It keeps the blocks, the authenticated sector and the transfer buffer,
+ * and adds up the time each exchange takes: ISO 14443-3 air time at
+ * 106 kbit/s, the register traffic of the driver on SPI, and the card's
+ * EEPROM programming. Power can be cut at any exchange to test tearing. */
+
+/* 8 data bits and parity per byte at 106 kbit/s */
+#define CARD_BYTE_NS 84956
+/* A 4 bit ACK or NAK with start and end of frame */
+#define CARD_ACK_NS 56640
+/* Frame delay time from the end of a PCD frame to the PICC response */
+#define CARD_FDT_NS 91150
+/* Driver register traffic around one frame, about 12 SPI transactions at
+ * SIM_SPI_HZ (see bus_bench) */
+#define CARD_PCD_NS 85000
+/* One CRC_A on the MFRC522 coprocessor, as MIFARE_ReadBlock() does twice */
+#define CARD_CRC_NS 90000
+/* Assumed EEPROM programming time of WRITE and TRANSFER */
+#define CARD_PROG_NS 2500000
+
+#define CARD_BLOCKS 64
+
+typedef enum {
+	/* The command never reached the card */
+	CARD_TEAR_BEFORE,
+	/* Power lost while programming: half of the block is new */
+	CARD_TEAR_DURING,
+	/* Done on the card, the response is lost */
+	CARD_TEAR_AFTER,
+} card_tear_t;
+
+/* Simulated time in nanoseconds since card_reset(), wraps at 2^32 */
+extern uint32_t card_ns;
+/* How long the driver waits out the silent second part of INCREMENT,
+ * DECREMENT and RESTORE; MIFARE_SILENT_TIMEOUT_US by default */
+extern uint32_t card_silent_ns;
+/* Exchanges since card_reset() */
+extern uint32_t card_ops;
+/* Time at which the last TRANSFER into `card_watch_block` was acknowledged */
+extern uint8_t card_watch_block;
+extern uint32_t card_watch_ns;
+
+/* Blank card with `key` as key A of every sector */
+void card_reset(const uint8_t *key, const uint8_t *uid);
+/* Cuts the power at exchange number `op` (card_ops) in the given way, until
+ * card_power_up(). -1 to never tear. */
+void card_tear(int32_t op, card_tear_t how);
+void card_power_up(void);
+const uint8_t *card_block(uint8_t block);
@@ -0,0 +1,546 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "mfclassic_sim.h"
+#include "mfrc522_sim.h"
+
+/* Register addresses, mfrc522.h needs the target headers */
+#define COMMAND_REG 0x01
+#define COM_IRQ_REG 0x04
+#define DIV_IRQ_REG 0x05
+#define ERROR_REG 0x06
+#define FIFO_DATA_REG 0x09
+#define FIFO_LEVEL_REG 0x0a
+#define WATER_LEVEL_REG 0x0b
+#define CONTROL_REG 0x0c
+#define BIT_FRAMING_REG 0x0d
+#define MODE_REG 0x11
+#define CRC_RESULT_MSB_REG 0x21
+#define CRC_RESULT_LSB_REG 0x22
+#define T_MODE_REG 0x2a
+#define T_PRESCALER_REG 0x2b
+#define T_RELOAD_HI_REG 0x2c
+#define T_RELOAD_LO_REG 0x2d
+#define VERSION_REG 0x37
+#define CMD_CALC_CRC 0x03
+#define CMD_TRANSCEIVE 0x0c
+#define CMD_SOFT_RESET 0x0f
+#define FIFO_SIZE 64
+/* ComIrqReg, DivIrqReg and ErrorReg bits */
+#define TX_IRQ 0x40
+#define RX_IRQ 0x20
+#define HI_ALERT_IRQ 0x08
+#define LO_ALERT_IRQ 0x04
+#define TIMER_IRQ 0x01
+#define CRC_IRQ 0x04
+#define BUFFER_OVFL 0x10
+/* ISO 14443-3 commands */
+#define PICC_REQA 0x26
+#define PICC_WUPA 0x52
+#define PICC_HLTA 0x50
+#define PICC_SEL_CL1 0x93
+#define PICC_CT 0x88
+/* NFC Forum type 2 commands, and the 4 bit answers to WRITE */
+#define PICC_READ 0x30
+#define PICC_WRITE 0xa2
+#define PICC_GET_VERSION 0x60
+#define PICC_FAST_READ 0x3a
+#define PICC_ACK 0x0a
+#define PICC_NAK 0x00
+/* UART rates further apart than this garble every byte */
+#define BAUD_TOLERANCE_PCT 3
+
+uint64_t sim_ns;
+uint32_t sim_errors;
+
+static uint8_t regs[64];
+static uint8_t fifo[FIFO_SIZE];
+static uint8_t fifo_len;
+static uint32_t chip_baud;
+static uint32_t host_baud;
+
+static bool spi_first;
+static bool spi_read;
+static uint8_t spi_addr;
+
+static bool uart_have_addr;
+static uint8_t uart_addr;
+/* Byte the chip sends next and the rate it goes out at */
+static bool uart_out_full;
+static uint8_t uart_out;
+static uint32_t uart_out_baud;
+
+/* A transceive on the air: the frame leaves the FIFO byte by byte and ends
+ * when the FIFO runs empty, the answer comes in byte by byte after the
+ * frame delay. `air_at` is the time of the next step. */
+typedef enum {
+	AIR_IDLE,
+	AIR_TX,
+	/* Until the answer starts, or the timer runs out without one */
+	AIR_WAIT,
+	AIR_RX,
+} air_t;
+
+static air_t air;
+static uint64_t air_at;
+static uint8_t tx_frame[SIM_FRAME_MAX];
+static uint16_t tx_len;
+static uint8_t tx_bits;
+static uint8_t rx_frame[SIM_FRAME_MAX];
+static uint16_t rx_len;
+static uint16_t rx_at;
+/* Valid bits in the last byte of the answer, 0 for 8 */
+static uint8_t rx_bits;
+
+typedef enum {
+	CARD_OFF,
+	CARD_IDLE,
+	CARD_READY,
+	CARD_ACTIVE,
+	CARD_HALT,
+} card_state_t;
+
+static struct {
+	card_state_t state;
+	uint8_t uid[10];
+	uint8_t size;
+	/* Cascade level being selected in CARD_READY */
+	uint8_t level;
+	/* Type 2 memory, NULL for the echo */
+	const uint8_t *version;
+	uint8_t *mem;
+	uint16_t pages;
+} card;
+
+static void wire(uint32_t bits, uint32_t hz) {
+	sim_ns += (uint64_t)bits * 1000000000u / hz;
+}
+
+/* Datasheet 8.1.3.2: 27.12 MHz divided by BR_T1 and scaled by BR_T0 */
+static uint32_t serial_baud(uint8_t reg) {
+	uint8_t t0 = reg >> 5, t1 = reg & 0x1f;
+	if (t0 == 0) {
+		return 27120000 / (t1 + 1);
+	}
+	return 27120000 / ((t1 + 33) << (t0 - 1));
+}
+
+static bool baud_match(uint32_t a, uint32_t b) {
+	uint32_t diff = a > b ? a - b : b - a;
+	return diff * 100 <= b * BAUD_TOLERANCE_PCT;
+}
+
+static void reset_chip(void) {
+	memset(regs, 0, sizeof(regs));
+	regs[COMMAND_REG] = 0x20;
+	regs[MFRC522_BUS_SERIAL_SPEED_REG] = 0xeb;
+	regs[VERSION_REG] = SIM_VERSION;
+	regs[WATER_LEVEL_REG] = 0x08;
+	regs[MODE_REG] = 0x3f;
+	fifo_len = 0;
+	air = AIR_IDLE;
+	chip_baud = serial_baud(regs[MFRC522_BUS_SERIAL_SPEED_REG]);
+	uart_have_addr = false;
+}
+
+void sim_reset(void) {
+	reset_chip();
+	card.state = CARD_OFF;
+	host_baud = MFRC522_BUS_UART_RESET_BAUD;
+	uart_out_full = false;
+	sim_ns = 0;
+	sim_errors = 0;
+}
+
+/* ISO 14443-3 CRC_A, the bit reversed CCITT polynomial */
+static uint16_t crc_a(uint16_t crc, const uint8_t *data, uint16_t len) {
+	while (len--) {
+		uint8_t b = *data++ ^ (uint8_t)crc;
+		b ^= b << 4;
+		crc = (crc >> 8) ^ ((uint16_t)b << 8) ^ ((uint16_t)b << 3) ^ (b >> 4);
+	}
+	return crc;
+}
+
+static uint16_t put_crc(uint8_t *frame, uint16_t len) {
+	uint16_t crc = crc_a(0x6363, frame, len);
+	frame[len] = crc;
+	frame[len + 1] = crc >> 8;
+	return len + 2;
+}
+
+/* UID bytes of the cascade level being selected, then their BCC */
+static void level_bytes(uint8_t *out) {
+	uint8_t i = 3 * card.level;
+	if (card.size > i + 4) {
+		out[0] = PICC_CT;
+		memcpy(&out[1], &card.uid[i], 3);
+	} else {
+		memcpy(out, &card.uid[i], 4);
+	}
+	out[4] = out[0] ^ out[1] ^ out[2] ^ out[3];
+}
+
+/* Answer of the active card with memory to a type 2 command */
+static uint16_t tag_command(const uint8_t *f, uint16_t len, uint8_t *out) {
+	if (f[0] == PICC_GET_VERSION && len == 1) {
+		memcpy(out, card.version, 8);
+		return put_crc(out, 8);
+	}
+	if (f[0] == PICC_READ && len == 2 && f[1] < card.pages) {
+		/* Four pages, rolling over to page 0 */
+		for (uint8_t i = 0; i < 4; i++) {
+			memcpy(&out[4 * i], &card.mem[4 * ((f[1] + i) % card.pages)], 4);
+		}
+		return put_crc(out, 16);
+	}
+	if (f[0] == PICC_FAST_READ && len == 3 && f[1] <= f[2] &&
+		f[2] < card.pages && 4 * (f[2] - f[1] + 1) + 2 <= SIM_FRAME_MAX) {
+		uint16_t n = 4 * (f[2] - f[1] + 1);
+		memcpy(out, &card.mem[4 * f[1]], n);
+		return put_crc(out, n);
+	}
+	if (f[0] == PICC_WRITE && len == 6 && f[1] < card.pages) {
+		memcpy(&card.mem[4 * f[1]], &f[2], 4);
+		out[0] = PICC_ACK;
+		rx_bits = 4;
+		return 1;
+	}
+	/* Anything else is NAKed and sends the card back to IDLE */
+	card.state = CARD_IDLE;
+	out[0] = PICC_NAK;
+	rx_bits = 4;
+	return 1;
+}
+
+/* What the card does with a frame of `len` bytes, `bits` valid in the last
+ * one (0 for all 8), returns the length of its answer in `out`, with
+ * rx_bits valid in its last byte */
+static uint16_t card_frame(const uint8_t *f, uint16_t len, uint8_t bits,
+						   uint8_t *out) {
+	card_state_t was = card.state;
+	uint8_t lb[5];
+
+	rx_bits = 0;
+	if (card.state == CARD_OFF) {
+		return 0;
+	}
+	/* Anything unexpected sends the card back to IDLE, or HALT */
+	card.state = was == CARD_HALT ? CARD_HALT : CARD_IDLE;
+	if (len == 1 && bits == 7) {
+		if ((f[0] == PICC_REQA && was == CARD_IDLE) ||
+			(f[0] == PICC_WUPA && (was == CARD_IDLE || was == CARD_HALT))) {
+			card.state = CARD_READY;
+			card.level = 0;
+			/* ATQA: the UID size in bits 7-6 */
+			out[0] = (card.size / 3 - 1) << 6 | 0x04;
+			out[1] = 0x00;
+			return 2;
+		}
+		return 0;
+	}
+	if (bits) {
+		return 0;
+	}
+	if (was == CARD_READY && len >= 2 &&
+		f[0] == PICC_SEL_CL1 + 2 * card.level) {
+		level_bytes(lb);
+		if (f[1] == 0x70) {
+			if (len != 9 || crc_a(0x6363, f, len) || memcmp(&f[2], lb, 5)) {
+				return 0;
+			}
+			/* SAK: cascade bit while more levels follow */
+			if (card.size > 3 * card.level + 4) {
+				card.level++;
+				card.state = CARD_READY;
+				out[0] = 0x04;
+			} else {
+				card.state = CARD_ACTIVE;
+				out[0] = 0x08;
+			}
+			return put_crc(out, 1);
+		}
+		/* ANTICOLLISION with whole bytes known, the rest of them back */
+		uint8_t known = (f[1] >> 4) - 2;
+		if ((f[1] & 0x07) || known > 4 || len != 2 + known ||
+			memcmp(&f[2], lb, known)) {
+			return 0;
+		}
+		card.state = CARD_READY;
+		memcpy(out, &lb[known], 5 - known);
+		return 5 - known;
+	}
+	if (was == CARD_ACTIVE) {
+		if (len == 4 && f[0] == PICC_HLTA && f[1] == 0 &&
+			!crc_a(0x6363, f, len)) {
+			card.state = CARD_HALT;
+			return 0;
+		}
+		card.state = CARD_ACTIVE;
+		if (card.mem) {
+			/* A damaged frame goes unanswered */
+			if (len < 3 || crc_a(0x6363, f, len)) {
+				return 0;
+			}
+			return tag_command(f, len - 2, out);
+		}
+		/* Echoed back, for the frame streaming */
+		memcpy(out, f, len);
+		return len;
+	}
+	return 0;
+}
+
+/* TAuto timer from the end of the frame, 13.56 MHz / (2 * TPrescaler + 1)
+ * ticks until TReload runs out */
+static uint64_t timeout_ns(void) {
+	uint32_t prescaler = (regs[T_MODE_REG] & 0x0f) << 8 | regs[T_PRESCALER_REG];
+	uint32_t reload = regs[T_RELOAD_HI_REG] << 8 | regs[T_RELOAD_LO_REG];
+	return (uint64_t)(reload + 1) * (2 * prescaler + 1) * 1000000000u /
+		   13560000;
+}
+
+static uint8_t fifo_pop(void) {
+	uint8_t value = fifo[0];
+	memmove(fifo, &fifo[1], --fifo_len);
+	return value;
+}
+
+/* Brings the air up to sim_ns: the bus traffic is the clock */
+static void advance(void) {
+	while (air != AIR_IDLE && sim_ns >= air_at) {
+		switch (air) {
+		case AIR_TX:
+			if (fifo_len && tx_len < SIM_FRAME_MAX) {
+				tx_frame[tx_len++] = fifo_pop();
+				air_at += CARD_BYTE_NS;
+				break;
+			}
+			regs[COM_IRQ_REG] |= TX_IRQ;
+			rx_len = card_frame(tx_frame, tx_len, tx_bits, rx_frame);
+			rx_at = 0;
+			air = AIR_WAIT;
+			air_at += rx_len ? CARD_FDT_NS : timeout_ns();
+			break;
+		case AIR_WAIT:
+			if (!rx_len) {
+				/* TimerIRq, only with TAuto */
+				regs[COM_IRQ_REG] |= regs[T_MODE_REG] & 0x80 ? TIMER_IRQ : 0;
+				air = AIR_IDLE;
+				break;
+			}
+			air = AIR_RX;
+			air_at += CARD_BYTE_NS;
+			break;
+		default:
+			if (fifo_len < FIFO_SIZE) {
+				fifo[fifo_len++] = rx_frame[rx_at];
+			} else {
+				regs[ERROR_REG] |= BUFFER_OVFL;
+			}
+			air_at += CARD_BYTE_NS;
+			if (++rx_at == rx_len) {
+				regs[CONTROL_REG] = (regs[CONTROL_REG] & ~0x07) | rx_bits;
+				regs[COM_IRQ_REG] |= RX_IRQ;
+				air = AIR_IDLE;
+			}
+			break;
+		}
+	}
+	if (fifo_len <= regs[WATER_LEVEL_REG]) {
+		regs[COM_IRQ_REG] |= LO_ALERT_IRQ;
+	}
+	if (FIFO_SIZE - fifo_len <= regs[WATER_LEVEL_REG]) {
+		regs[COM_IRQ_REG] |= HI_ALERT_IRQ;
+	}
+}
+
+/* The coprocessor takes what is in the FIFO, with the preset of ModeReg */
+static void calc_crc(void) {
+	static const uint16_t presets[] = {0x0000, 0x6363, 0xa671, 0xffff};
+	uint16_t crc = crc_a(presets[regs[MODE_REG] & 0x03], fifo, fifo_len);
+
+	fifo_len = 0;
+	regs[CRC_RESULT_MSB_REG] = crc >> 8;
+	regs[CRC_RESULT_LSB_REG] = crc;
+	regs[DIV_IRQ_REG] |= CRC_IRQ;
+}
+
+/* Set1 and Set2: the bits written as 1 are set or cleared */
+static void irq_write(uint8_t reg, uint8_t value) {
+	if (value & 0x80) {
+		regs[reg] |= value & 0x7f;
+	} else {
+		regs[reg] &= ~value;
+	}
+}
+
+static uint8_t reg_read(uint8_t reg) {
+	advance();
+	switch (reg) {
+	case FIFO_DATA_REG:
+		return fifo_len ? fifo_pop() : 0;
+	case FIFO_LEVEL_REG:
+		return fifo_len;
+	default:
+		return regs[reg];
+	}
+}
+
+static void reg_write(uint8_t reg, uint8_t value) {
+	advance();
+	switch (reg) {
+	case FIFO_DATA_REG:
+		if (fifo_len < FIFO_SIZE) {
+			fifo[fifo_len++] = value;
+		} else {
+			regs[ERROR_REG] |= BUFFER_OVFL;
+		}
+		break;
+	case FIFO_LEVEL_REG:
+		if (value & 0x80) {
+			fifo_len = 0;
+			regs[ERROR_REG] &= ~BUFFER_OVFL;
+		}
+		break;
+	case COMMAND_REG:
+		if ((value & 0x0f) == CMD_SOFT_RESET) {
+			reset_chip();
+			break;
+		}
+		regs[reg] = value;
+		/* A new command ends whatever was on the air */
+		air = AIR_IDLE;
+		if ((value & 0x0f) == CMD_CALC_CRC) {
+			calc_crc();
+		}
+		break;
+	case COM_IRQ_REG:
+	case DIV_IRQ_REG:
+		irq_write(reg, value);
+		break;
+	case BIT_FRAMING_REG:
+		/* StartSend reads back as 0 */
+		regs[reg] = value & 0x7f;
+		if ((value & 0x80) && (regs[COMMAND_REG] & 0x0f) == CMD_TRANSCEIVE) {
+			air = AIR_TX;
+			air_at = sim_ns;
+			tx_len = 0;
+			tx_bits = value & 0x07;
+			regs[ERROR_REG] = 0;
+		}
+		break;
+	case ERROR_REG:
+	case VERSION_REG:
+		break;
+	case MFRC522_BUS_SERIAL_SPEED_REG:
+		regs[reg] = value;
+		chip_baud = serial_baud(value);
+		break;
+	default:
+		regs[reg] = value;
+		break;
+	}
+}
+
+void sim_card_enter(const uint8_t *uid, uint8_t size) {
+	memcpy(card.uid, uid, size);
+	card.size = size;
+	card.state = CARD_IDLE;
+}
+
+void sim_card_leave(void) { card.state = CARD_OFF; }
+
+void sim_card_memory(const uint8_t *version, uint8_t *mem, uint16_t pages) {
+	card.version = version;
+	card.mem = mem;
+	card.pages = pages;
+}
+
+uint8_t sim_peek(uint8_t reg) {
+	return reg == FIFO_LEVEL_REG ? fifo_len : regs[reg & MFRC522_BUS_ADDR_MASK];
+}
+
+void mfrc522_spi_select(void) { spi_first = true; }
+
+void mfrc522_spi_deselect(void) {}
+
+uint8_t mfrc522_spi_xfer(uint8_t byte) {
+	wire(8, SIM_SPI_HZ);
+	if (spi_first) {
+		spi_first = false;
+		spi_read = byte & 0x80;
+		spi_addr = (byte >> 1) & MFRC522_BUS_ADDR_MASK;
+		return 0;
+	}
+	if (spi_read) {
+		uint8_t value = reg_read(spi_addr);
+		spi_addr = (byte >> 1) & MFRC522_BUS_ADDR_MASK;
+		return value;
+	}
+	reg_write(spi_addr, byte);
+	return 0;
+}
+
+static void uart_respond(uint8_t byte) {
+	uart_out = byte;
+	uart_out_baud = chip_baud;
+	uart_out_full = true;
+}
+
+/* Start, 8 data bits and stop */
+void mfrc522_uart_put(uint8_t byte) {
+	wire(10, host_baud);
+	if (!baud_match(host_baud, chip_baud)) {
+		sim_errors++;
+		uart_have_addr = false;
+		return;
+	}
+	if (!uart_have_addr) {
+		if (byte & 0x80) {
+			uart_respond(reg_read(byte & MFRC522_BUS_ADDR_MASK));
+		} else {
+			uart_addr = byte & MFRC522_BUS_ADDR_MASK;
+			uart_have_addr = true;
+		}
+		return;
+	}
+	/* The echo still goes out at the rate the write came in at */
+	uart_have_addr = false;
+	uart_respond(uart_addr);
+	reg_write(uart_addr, byte);
+}
+
+uint8_t mfrc522_uart_get(void) {
+	if (!uart_out_full) {
+		/* The firmware would wait forever */
+		sim_errors++;
+		return 0;
+	}
+	uart_out_full = false;
+	wire(10, uart_out_baud);
+	if (!baud_match(host_baud, uart_out_baud)) {
+		sim_errors++;
+		return 0xff;
+	}
+	return uart_out;
+}
+
+void mfrc522_uart_set_baud(uint32_t baud) { host_baud = baud; }
+
+/* START, address and register byte with their ACKs, data, STOP */
+void mfrc522_i2c_write(uint8_t reg, const uint8_t *data, uint8_t len) {
+	wire(1 + 9 * (2 + len) + 1, SIM_I2C_HZ);
+	for (uint8_t i = 0; i < len; i++) {
+		reg_write(reg & MFRC522_BUS_ADDR_MASK, data[i]);
+	}
+}
+
+/* As a write of the register byte, then a repeated START, the address and
+ * the data */
+void mfrc522_i2c_read(uint8_t reg, uint8_t *out, uint8_t len) {
+	wire(1 + 9 * 2 + 1 + 9 * (1 + len) + 1, SIM_I2C_HZ);
+	for (uint8_t i = 0; i < len; i++) {
+		out[i] = reg_read(reg & MFRC522_BUS_ADDR_MASK);
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Host model of the MFRC522 behind the byte level hooks of mfrc522_bus.h,
+ * for every bus at once. It keeps a register file with the FIFO, the soft
+ * reset and the UART speed switch, and adds up the time the bus traffic
+ * would take on the wire at the rates below.
+ *
+ * Behind it is enough of the chip for src/mfrc522.c to run on: Transceive
+ * with StartSend, the FIFO watermark alerts, the TAuto timer, the CRC
+ * coprocessor and ComIrqReg, DivIrqReg and ErrorReg as the driver polls
+ * them. The wire time is the clock of the air: a frame leaves the FIFO and
+ * the answer comes back at 106 kbit/s with the frame delay of
+ * mfclassic_sim.h, while the driver polls. In the field is at most one ISO
+ * 14443-3 card, which answers REQA, WUPA, ANTICOLLISION, SELECT and HLTA and
+ * echoes any other frame once selected, or with memory given, answers as
+ * an NFC Forum type 2 tag. */
+
+#define SIM_SPI_HZ 2250000
+#define SIM_I2C_HZ 400000
+/* Register values after reset that the driver looks at */
+#define SIM_VERSION 0x92
+/* Longest frame on the air either way */
+#define SIM_FRAME_MAX 256
+
+/* Wire time in nanoseconds since the start, 64 bits for the long timeouts
+ * of PCD_SetTimeoutUs() */
+extern uint64_t sim_ns;
+/* Bytes the chip could not make sense of, e.g. from a baud rate mismatch */
+extern uint32_t sim_errors;
+
+/* Power up state */
+void sim_reset(void);
+uint8_t sim_peek(uint8_t reg);
+/* A card with a 4, 7 or 10 byte UID is put into the field, powered up and
+ * IDLE; and taken out again */
+void sim_card_enter(const uint8_t *uid, uint8_t size);
+void sim_card_leave(void);
+/* Once selected, the card answers as an NTAG21x instead of the echo:
+ * GET_VERSION with `version`, READ, FAST_READ and WRITE on the `pages`
+ * pages of `mem`, a NAK to anything else. NULL to echo again. */
+void sim_card_memory(const uint8_t *version, uint8_t *mem, uint16_t pages);
+
+void mfrc522_spi_select(void);
+void mfrc522_spi_deselect(void);
+uint8_t mfrc522_spi_xfer(uint8_t byte);
+
+void mfrc522_uart_put(uint8_t byte);
+uint8_t mfrc522_uart_get(void);
+void mfrc522_uart_set_baud(uint32_t baud);
+
+void mfrc522_i2c_write(uint8_t reg, const uint8_t *data, uint8_t len);
+void mfrc522_i2c_read(uint8_t reg, uint8_t *out, uint8_t len);
+
+#include "mfrc522_bus.h"
@@ -0,0 +1,174 @@
+/* Stand-in for the reader on a Linux pty, to run host code such as
+ * reader_client.c without hardware:
+ *
+ *   build/pty_reader [-e]
+ *
+ * prints the path of the pty to open instead of the reader's tty. By default
+ * it runs the firmware's src/proto.c: src/mfrc522.c on mfrc522_sim.c with an
+ * NTAG215 in the field, flashlog.c and acl.c on flash_sim.c, and link.h of
+ * target/ on the pty. The card arrives before the host connects, so it is
+ * in the flash log and halted. With -e it echoes every byte back like a
+ * wire from TX to RX, for `loopback`. A pty ignores the baud rate, so
+ * loopback times over it are the host overhead only. */
+
+#define _XOPEN_SOURCE 600
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "flash_sim.h"
+#include "fmt.h"
+#include "frame.h"
+#include "idle.h"
+#include "link.h"
+#include "mfrc522.h"
+#include "mfrc522_sim.h"
+#include "proto.h"
+
+static const uint8_t card_uid[] = {0x04, 0xa2, 0x3c, 0x12, 0x5b, 0x61, 0x80};
+static const uint8_t tag_version[8] = {0x00, 0x04, 0x04, 0x02,
+									   0x01, 0x00, 0x11, 0x03};
+#define TAG_PAGES 135
+#define TAG_USER_FIRST 4
+#define TAG_USER_LAST 129
+static uint8_t tag_mem[TAG_PAGES * 4];
+
+static int pty = -1;
+static bool host_seen;
+static uint8_t rx_buf[FRAME_MAX_ENCODED];
+static uint16_t rx_len;
+static uint16_t rx_pos;
+
+static int write_all(int fd, const uint8_t *data, size_t len) {
+	while (len) {
+		ssize_t n = write(fd, data, len);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void log_write(void *ctx, const char *data, uint16_t len) {
+	(void)ctx;
+	fwrite(data, 1, len, stderr);
+}
+
+const fmt_sink_t fmt_log = {log_write, 0};
+
+uint32_t idle_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * IDLE_HZ + (uint64_t)ts.tv_nsec * IDLE_HZ / 1000000000;
+}
+
+/* No sleeping and no clock switches on the host */
+void idle_get_stats(idle_stats_t *out) { memset(out, 0, sizeof(*out)); }
+
+void clock_get_stats(clock_stats_t *out) { memset(out, 0, sizeof(*out)); }
+
+void link_init(void) {}
+
+void link_seen(void) { host_seen = true; }
+
+bool link_ready(void) { return host_seen; }
+
+uint16_t link_write(const void *data, uint16_t len) {
+	return write_all(pty, data, len) ? 0 : len;
+}
+
+uint16_t link_read(void *data, uint16_t len) {
+	if (len > rx_len - rx_pos) {
+		len = rx_len - rx_pos;
+	}
+	memcpy(data, &rx_buf[rx_pos], len);
+	rx_pos += len;
+	return len;
+}
+
+/* write() blocks rather than drops */
+uint16_t link_tx_free(void) { return FRAME_MAX_ENCODED; }
+
+uint16_t link_rx_available(void) { return rx_len - rx_pos; }
+
+bool link_notify(const void *data, uint16_t len) {
+	(void)data;
+	(void)len;
+	return false;
+}
+
+static void reader_init(void) {
+	sim_reset();
+	mfrc522_bus_init();
+	MFRC522_Reset();
+	MFRC522_Init();
+	flash_sim_reset();
+
+	/* Every user byte holds its own offset in the tag memory */
+	for (uint16_t i = 4 * TAG_USER_FIRST; i < 4 * (TAG_USER_LAST + 1); i++) {
+		tag_mem[i] = i;
+	}
+	sim_card_enter(card_uid, sizeof(card_uid));
+	sim_card_memory(tag_version, tag_mem, TAG_PAGES);
+
+	proto_init();
+	proto_poll();
+}
+
+int main(int argc, char **argv) {
+	int echo = argc > 1 && !strcmp(argv[1], "-e");
+	struct termios t;
+
+	if (!echo) {
+		reader_init();
+	}
+	pty = posix_openpt(O_RDWR | O_NOCTTY);
+	if (pty < 0 || grantpt(pty) < 0 || unlockpt(pty) < 0) {
+		perror("pty");
+		return 1;
+	}
+	/* Keeping the slave open stops reads on the master from failing with
+	 * EIO while no client is connected. Raw, like reader_open() sets it. */
+	int slave = open(ptsname(pty), O_RDWR | O_NOCTTY);
+	if (slave < 0 || tcgetattr(slave, &t) < 0) {
+		perror(ptsname(pty));
+		return 1;
+	}
+	cfmakeraw(&t);
+	tcsetattr(slave, TCSANOW, &t);
+	printf("%s\n", ptsname(pty));
+	fflush(stdout);
+
+	for (;;) {
+		ssize_t n = read(pty, rx_buf, sizeof(rx_buf));
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("read");
+			return 1;
+		}
+		if (echo) {
+			write_all(pty, rx_buf, n);
+			continue;
+		}
+		rx_len = n;
+		rx_pos = 0;
+		while (rx_pos < rx_len) {
+			proto_poll();
+		}
+	}
+}
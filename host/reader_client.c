@@ -0,0 +1,508 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "reader_client.h"
+
+int reader_open(reader_t *r, const char *tty) {
+	struct termios t;
+
+	memset(r, 0, sizeof(*r));
+	r->fd = open(tty, O_RDWR | O_NOCTTY);
+	if (r->fd < 0) {
+		return -1;
+	}
+	if (tcgetattr(r->fd, &t) < 0) {
+		close(r->fd);
+		return -1;
+	}
+	cfmakeraw(&t);
+	t.c_cc[VMIN] = 0;
+	t.c_cc[VTIME] = 0;
+	if (tcsetattr(r->fd, TCSANOW, &t) < 0) {
+		close(r->fd);
+		return -1;
+	}
+	tcflush(r->fd, TCIOFLUSH);
+	return 0;
+}
+
+void reader_close(reader_t *r) {
+	if (r->fd >= 0) {
+		close(r->fd);
+	}
+	r->fd = -1;
+}
+
+int reader_set_baud(reader_t *r, uint32_t baud) {
+	static const struct {
+		uint32_t baud;
+		speed_t speed;
+	} speeds[] = {
+		{9600, B9600},		 {115200, B115200},	  {230400, B230400},
+		{460800, B460800},	 {921600, B921600},	  {1000000, B1000000},
+		{1500000, B1500000}, {2000000, B2000000}, {3000000, B3000000},
+		{4000000, B4000000},
+	};
+	struct termios t;
+
+	for (size_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+		if (speeds[i].baud != baud) {
+			continue;
+		}
+		if (tcgetattr(r->fd, &t) < 0 || cfsetspeed(&t, speeds[i].speed) < 0) {
+			return -1;
+		}
+		return tcsetattr(r->fd, TCSANOW, &t);
+	}
+	return -1;
+}
+
+static int write_all(int fd, const uint8_t *data, size_t len) {
+	while (len) {
+		ssize_t n = write(fd, data, len);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int reader_send(reader_t *r, uint8_t op, const uint8_t *args, size_t len) {
+	uint8_t raw[FRAME_MAX_RAW + 2];
+	uint8_t enc[FRAME_MAX_ENCODED];
+
+	if (len > FRAME_MAX_RAW - 2) {
+		return -1;
+	}
+	uint8_t seq = r->seq++;
+	raw[0] = seq;
+	raw[1] = op;
+	memcpy(&raw[2], args, len);
+	size_t n = frame_pack(raw, len + 2, enc);
+	if (write_all(r->fd, enc, n) < 0) {
+		return -1;
+	}
+	return seq;
+}
+
+int reader_recv(reader_t *r, reader_response_t *resp, int timeout_ms) {
+	uint8_t raw[FRAME_MAX_ENCODED];
+	struct pollfd pfd = {.fd = r->fd, .events = POLLIN};
+
+	for (;;) {
+		uint8_t c;
+		ssize_t n = read(r->fd, &c, 1);
+		if (n < 0 && errno != EAGAIN && errno != EINTR) {
+			return -1;
+		}
+		if (n <= 0) {
+			int ready = poll(&pfd, 1, timeout_ms);
+			if (ready <= 0) {
+				return -1;
+			}
+			continue;
+		}
+		if (c != FRAME_DELIMITER) {
+			if (r->rx_len < sizeof(r->rx_enc)) {
+				r->rx_enc[r->rx_len++] = c;
+			}
+			continue;
+		}
+
+		size_t len = frame_unpack(r->rx_enc, r->rx_len, raw);
+		r->rx_len = 0;
+		/* Skip damaged frames and wait for the next one */
+		if (len < 3 || len > FRAME_MAX_RAW) {
+			continue;
+		}
+		resp->seq = raw[0];
+		resp->op = raw[1] & ~PROTO_RESPONSE;
+		resp->status = raw[2];
+		resp->len = len - 3;
+		memcpy(resp->payload, &raw[3], resp->len);
+		return 0;
+	}
+}
+
+int reader_call(reader_t *r, uint8_t op, const uint8_t *args, size_t len,
+				reader_response_t *resp, int timeout_ms) {
+	int seq = reader_send(r, op, args, len);
+	if (seq < 0) {
+		return -1;
+	}
+	do {
+		if (reader_recv(r, resp, timeout_ms) < 0) {
+			return -1;
+		}
+	} while (resp->seq != seq);
+	return 0;
+}
+
+static size_t get_uid(const uint8_t *p, size_t len, reader_uid_t *uid) {
+	if (len < 2 || p[0] > sizeof(uid->uid) || len < (size_t)p[0] + 2) {
+		return 0;
+	}
+	uid->size = p[0];
+	memcpy(uid->uid, &p[1], uid->size);
+	uid->sak = p[1 + uid->size];
+	return uid->size + 2;
+}
+
+int reader_poll(reader_t *r, int *present) {
+	reader_response_t resp;
+	if (reader_call(r, PROTO_OP_POLL, NULL, 0, &resp, 1000) < 0) {
+		return -1;
+	}
+	*present = resp.len && resp.payload[0];
+	return resp.status;
+}
+
+int reader_select(reader_t *r, reader_uid_t *uid) {
+	reader_response_t resp;
+	if (reader_call(r, PROTO_OP_SELECT, NULL, 0, &resp, 1000) < 0) {
+		return -1;
+	}
+	if (resp.status == 0 && !get_uid(resp.payload, resp.len, uid)) {
+		return -1;
+	}
+	return resp.status;
+}
+
+int reader_read_range(reader_t *r, uint8_t block, uint8_t count,
+					  uint8_t *out) {
+	reader_response_t resp;
+	uint8_t args[2] = {block, count};
+	if (reader_call(r, PROTO_OP_READ_RANGE, args, 2, &resp, 2000) < 0) {
+		return -1;
+	}
+	if (resp.status == 0) {
+		if (resp.len != 16u * count) {
+			return -1;
+		}
+		memcpy(out, resp.payload, resp.len);
+	}
+	return resp.status;
+}
+
+int reader_inventory(reader_t *r, reader_uid_t *uids, uint8_t max,
+					 uint8_t *found) {
+	reader_response_t resp;
+	if (reader_call(r, PROTO_OP_INVENTORY, &max, 1, &resp, 2000) < 0) {
+		return -1;
+	}
+	*found = 0;
+	if (resp.status != 0) {
+		return resp.status;
+	}
+	size_t at = 1;
+	for (uint8_t i = 0; resp.len && i < resp.payload[0] && i < max; i++) {
+		size_t n = get_uid(&resp.payload[at], resp.len - at, &uids[i]);
+		if (!n) {
+			return -1;
+		}
+		at += n;
+		(*found)++;
+	}
+	return resp.status;
+}
+
+/* Fetches a struct of 32-bit counters sent as little endian words */
+static int get_words(reader_t *r, uint8_t op, void *out, size_t size) {
+	reader_response_t resp;
+	if (reader_call(r, op, NULL, 0, &resp, 1000) < 0) {
+		return -1;
+	}
+	uint32_t *words = out;
+	memset(out, 0, size);
+	for (size_t i = 0; i < size / 4 && 4 * i + 3 < resp.len; i++) {
+		const uint8_t *p = &resp.payload[4 * i];
+		words[i] = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+	return resp.status;
+}
+
+int reader_stats(reader_t *r, proto_stats_t *stats) {
+	return get_words(r, PROTO_OP_STATS, stats, sizeof(*stats));
+}
+
+int reader_idle_stats(reader_t *r, idle_stats_t *stats) {
+	return get_words(r, PROTO_OP_IDLE_STATS, stats, sizeof(*stats));
+}
+
+int reader_clock_stats(reader_t *r, clock_stats_t *stats) {
+	return get_words(r, PROTO_OP_CLOCK_STATS, stats, sizeof(*stats));
+}
+
+int reader_metrics(reader_t *r, uint32_t words[METRICS_WORDS]) {
+	reader_response_t resp;
+	uint16_t first = 0;
+
+	while (first < METRICS_WORDS) {
+		uint8_t args[2] = {first & 0xff, first >> 8};
+		if (reader_call(r, PROTO_OP_METRICS, args, sizeof(args), &resp, 1000) <
+			0) {
+			return -1;
+		}
+		if (resp.status != 0) {
+			return resp.status;
+		}
+		if (resp.len < 6 ||
+			(resp.payload[0] | resp.payload[1] << 8) != METRICS_WORDS) {
+			return -1;
+		}
+		for (size_t i = 2; i + 3 < resp.len && first < METRICS_WORDS; i += 4) {
+			const uint8_t *p = &resp.payload[i];
+			words[first++] =
+				p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+		}
+	}
+	return 0;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int reader_log_read(reader_t *r, reader_log_event_t *events, uint8_t max,
+					uint8_t *n, uint32_t *pending) {
+	reader_response_t resp;
+	if (reader_call(r, PROTO_OP_LOG_READ, NULL, 0, &resp, 1000) < 0) {
+		return -1;
+	}
+	if (resp.status != 0) {
+		return resp.status;
+	}
+	if (resp.len < 5) {
+		return -1;
+	}
+	*pending = get_u32(resp.payload);
+	*n = 0;
+	for (size_t i = 5, k = 0; k < resp.payload[4] && *n < max; k++) {
+		if (i + 5 > resp.len) {
+			return -1;
+		}
+		const uint8_t *rec = &resp.payload[i + 5];
+		uint8_t len = resp.payload[i + 4];
+		if (i + 5 + len > resp.len || len < 6 ||
+			rec[4] > sizeof(events->uid.uid) || 6u + rec[4] > len) {
+			return -1;
+		}
+		reader_log_event_t *ev = &events[(*n)++];
+		ev->seq = get_u32(&resp.payload[i]);
+		ev->ticks = get_u32(rec);
+		ev->uid.size = rec[4];
+		ev->uid.sak = rec[5];
+		memcpy(ev->uid.uid, &rec[6], rec[4]);
+		i += 5 + len;
+	}
+	return 0;
+}
+
+int reader_log_ack(reader_t *r, uint32_t seq) {
+	reader_response_t resp;
+	uint8_t args[4] = {seq, seq >> 8, seq >> 16, seq >> 24};
+	if (reader_call(r, PROTO_OP_LOG_ACK, args, sizeof(args), &resp, 1000) <
+		0) {
+		return -1;
+	}
+	return resp.status;
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+	for (uint8_t i = 0; i < 8; i++) {
+		p[i] = v >> (8 * i);
+	}
+}
+
+static int acl_load_call(reader_t *r, const uint8_t *args, size_t len) {
+	reader_response_t resp;
+	/* A begin erases a bank, a few pages at 20-40 ms */
+	if (reader_call(r, PROTO_OP_ACL_LOAD, args, len, &resp, 2000) < 0) {
+		return -1;
+	}
+	return resp.status;
+}
+
+int reader_acl_load(reader_t *r, const uint64_t *keys, uint32_t count) {
+	uint8_t args[1 + 8 * PROTO_MAX_ACL_KEYS];
+	int status;
+
+	args[0] = PROTO_ACL_BEGIN;
+	if ((status = acl_load_call(r, args, 1)) != 0) {
+		return status;
+	}
+	args[0] = PROTO_ACL_KEYS;
+	for (uint32_t i = 0; i < count; i += PROTO_MAX_ACL_KEYS) {
+		uint32_t n = count - i < PROTO_MAX_ACL_KEYS ? count - i
+													 : PROTO_MAX_ACL_KEYS;
+		for (uint32_t k = 0; k < n; k++) {
+			put_u64(&args[1 + 8 * k], keys[i + k]);
+		}
+		if ((status = acl_load_call(r, args, 1 + 8 * n)) != 0) {
+			return status;
+		}
+	}
+	args[0] = PROTO_ACL_COMMIT;
+	return acl_load_call(r, args, 1);
+}
+
+int reader_acl_update(reader_t *r, const acl_delta_t *changes, uint8_t n,
+					  uint8_t *applied) {
+	uint8_t args[9 * PROTO_MAX_ACL_UPDATES];
+	reader_response_t resp;
+
+	if (n > PROTO_MAX_ACL_UPDATES) {
+		return -1;
+	}
+	for (uint8_t i = 0; i < n; i++) {
+		args[9 * i] = changes[i].op;
+		put_u64(&args[9 * i + 1], changes[i].key);
+	}
+	/* A merge into the other bank may come first */
+	if (reader_call(r, PROTO_OP_ACL_UPDATE, args, 9 * n, &resp, 2000) < 0) {
+		return -1;
+	}
+	*applied = resp.len == 1 ? resp.payload[0] : 0;
+	return resp.status;
+}
+
+int reader_acl_info(reader_t *r, acl_info_t *info) {
+	return get_words(r, PROTO_OP_ACL_INFO, info, sizeof(*info));
+}
+
+int reader_acl_check(reader_t *r, const uint8_t *uid, uint8_t size,
+					 int *allowed) {
+	uint8_t args[1 + 10];
+	reader_response_t resp;
+
+	if (size > sizeof(args) - 1) {
+		return -1;
+	}
+	args[0] = size;
+	memcpy(&args[1], uid, size);
+	if (reader_call(r, PROTO_OP_ACL_CHECK, args, 1 + size, &resp, 1000) < 0) {
+		return -1;
+	}
+	if (resp.status == 0) {
+		if (resp.len != 1) {
+			return -1;
+		}
+		*allowed = resp.payload[0];
+	}
+	return resp.status;
+}
+
+int reader_events(reader_t *r, int enable) {
+	reader_response_t resp;
+	uint8_t arg = enable != 0;
+	if (reader_call(r, PROTO_OP_EVENTS, &arg, 1, &resp, 1000) < 0) {
+		return -1;
+	}
+	return resp.status;
+}
+
+int reader_ul_info(reader_t *r, reader_ul_info_t *info) {
+	reader_response_t resp;
+	if (reader_call(r, PROTO_OP_UL_INFO, NULL, 0, &resp, 1000) < 0) {
+		return -1;
+	}
+	if (resp.status == 0) {
+		if (resp.len != PROTO_UL_INFO_SIZE) {
+			return -1;
+		}
+		info->type = resp.payload[0];
+		info->pages = resp.payload[1];
+		info->user_first = resp.payload[2];
+		info->user_last = resp.payload[3];
+		memcpy(info->version, &resp.payload[4], sizeof(info->version));
+	}
+	return resp.status;
+}
+
+static uint8_t ul_chunk(uint16_t left) {
+	return left < PROTO_MAX_UL_PAGES ? left : PROTO_MAX_UL_PAGES;
+}
+
+int reader_ul_read(reader_t *r, uint8_t first, uint16_t count, uint8_t *out) {
+	reader_response_t resp;
+	uint16_t done;
+	uint8_t n;
+	int seq = -1;
+
+	for (done = 0; done < count; done += n) {
+		n = ul_chunk(count - done);
+		uint8_t args[2] = {first + done, n};
+		int s = reader_send(r, PROTO_OP_UL_READ, args, sizeof(args));
+		if (s < 0) {
+			return -1;
+		}
+		if (seq < 0) {
+			seq = s;
+		}
+	}
+	/* A failed chunk leaves the rest in flight, reader_call() skips them */
+	for (done = 0; done < count; done += n, seq = (seq + 1) & 0xff) {
+		n = ul_chunk(count - done);
+		do {
+			if (reader_recv(r, &resp, 2000) < 0) {
+				return -1;
+			}
+		} while (resp.seq != seq);
+		if (resp.status != 0) {
+			return resp.status;
+		}
+		if (resp.len != 4u * n) {
+			return -1;
+		}
+		memcpy(&out[4 * done], resp.payload, resp.len);
+	}
+	return 0;
+}
+
+int reader_ul_write(reader_t *r, uint8_t first, uint16_t count,
+					const uint8_t *data, int verify) {
+	reader_response_t resp;
+	uint8_t args[2 + 4 * PROTO_MAX_UL_PAGES];
+	uint8_t n;
+
+	for (uint16_t done = 0; done < count; done += n) {
+		n = ul_chunk(count - done);
+		args[0] = first + done;
+		args[1] = verify != 0;
+		memcpy(&args[2], &data[4 * done], 4 * n);
+		/* Programming takes a few ms per page */
+		if (reader_call(r, PROTO_OP_UL_WRITE, args, 2 + 4 * n, &resp, 5000) <
+			0) {
+			return -1;
+		}
+		if (resp.status != 0) {
+			return resp.status;
+		}
+	}
+	return 0;
+}
+
+int reader_parse_event(const uint8_t *data, size_t len, reader_event_t *ev) {
+	if (len < PROTO_EVENT_SIZE || data[0] != 0xa1 ||
+		data[1] != PROTO_EVENT_CARD) {
+		return -1;
+	}
+	ev->seq = data[2] | (data[3] << 8);
+	ev->allowed = data[4];
+	ev->uid.size = data[8];
+	ev->uid.sak = data[9];
+	if (ev->uid.size > sizeof(ev->uid.uid)) {
+		return -1;
+	}
+	memcpy(ev->uid.uid, &data[10], ev->uid.size);
+	return 0;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "acl.h"
+#include "clock.h"
+#include "frame.h"
+#include "idle.h"
+#include "metrics.h"
+#include "proto.h"
+
+/* Linux client for the binary reader protocol (include/proto.h) over the
+ * CDC-ACM tty of the reader, or a serial tty for a LINK=uart build. */
+
+typedef struct {
+	int fd;
+	uint8_t seq;
+	uint8_t rx_enc[FRAME_MAX_ENCODED];
+	size_t rx_len;
+} reader_t;
+
+typedef struct {
+	uint8_t seq;
+	uint8_t op;
+	uint8_t status;
+	uint8_t payload[FRAME_MAX_RAW];
+	size_t len;
+} reader_response_t;
+
+typedef struct {
+	uint8_t size;
+	uint8_t uid[10];
+	uint8_t sak;
+} reader_uid_t;
+
+/* PROTO_OP_UL_INFO, type is a UL_Type from ultralight.h */
+typedef struct {
+	uint8_t type;
+	uint8_t pages;
+	uint8_t user_first;
+	uint8_t user_last;
+	uint8_t version[8];
+} reader_ul_info_t;
+
+typedef struct {
+	uint16_t seq;
+	/* The reader's access list allows the card */
+	uint8_t allowed;
+	reader_uid_t uid;
+} reader_event_t;
+
+/* PROTO_OP_LOG_READ */
+typedef struct {
+	uint32_t seq;
+	/* RTC ticks of the arrival, see idle.h */
+	uint32_t ticks;
+	reader_uid_t uid;
+} reader_log_event_t;
+
+int reader_open(reader_t *r, const char *tty);
+void reader_close(reader_t *r);
+/* Only needed for a USB-serial adapter on a LINK=uart reader, the CDC-ACM
+ * tty ignores the baud rate. Returns -1 for a rate termios does not know. */
+int reader_set_baud(reader_t *r, uint32_t baud);
+
+/* Queues a request without waiting for the response, so several requests
+ * can be pipelined in one transfer. Returns the sequence number or -1. */
+int reader_send(reader_t *r, uint8_t op, const uint8_t *args, size_t len);
+/* Waits for the next response. Returns 0, or -1 on error or timeout. */
+int reader_recv(reader_t *r, reader_response_t *resp, int timeout_ms);
+/* reader_send() followed by reader_recv() */
+int reader_call(reader_t *r, uint8_t op, const uint8_t *args, size_t len,
+				reader_response_t *resp, int timeout_ms);
+
+/* The helpers below return the response status, or -1 on a link error */
+int reader_poll(reader_t *r, int *present);
+int reader_select(reader_t *r, reader_uid_t *uid);
+int reader_read_range(reader_t *r, uint8_t block, uint8_t count,
+					  uint8_t *out);
+int reader_inventory(reader_t *r, reader_uid_t *uids, uint8_t max,
+					 uint8_t *found);
+int reader_stats(reader_t *r, proto_stats_t *stats);
+int reader_idle_stats(reader_t *r, idle_stats_t *stats);
+int reader_clock_stats(reader_t *r, clock_stats_t *stats);
+int reader_events(reader_t *r, int enable);
+/* The whole metrics_words array, in as many requests as it takes. Fails
+ * with -1 when the reader has a different METRICS list. Print it with
+ * metrics_format(). */
+int reader_metrics(reader_t *r, uint32_t words[METRICS_WORDS]);
+/* The oldest card arrivals in the reader's flash log, up to `max` of what
+ * one response holds. `pending` gets the number logged in all. The same
+ * ones come back until reader_log_ack() drops them. */
+int reader_log_read(reader_t *r, reader_log_event_t *events, uint8_t max,
+					uint8_t *n, uint32_t *pending);
+int reader_log_ack(reader_t *r, uint32_t seq);
+/* Replaces the reader's access list with `count` acl_key() values in
+ * ascending order, one request per PROTO_MAX_ACL_KEYS. A failure leaves the
+ * old list in force. */
+int reader_acl_load(reader_t *r, const uint64_t *keys, uint32_t count);
+/* Up to PROTO_MAX_ACL_UPDATES changes, applied in order until one fails.
+ * `applied` gets how many made it. */
+int reader_acl_update(reader_t *r, const acl_delta_t *changes, uint8_t n,
+					  uint8_t *applied);
+int reader_acl_info(reader_t *r, acl_info_t *info);
+/* The reader's decision for a card, without the card */
+int reader_acl_check(reader_t *r, const uint8_t *uid, uint8_t size,
+					 int *allowed);
+/* Ultralight/NTAG21x pages of the selected tag, reader_ul_info() first.
+ * Ranges longer than PROTO_MAX_UL_PAGES take several requests: pipelined for
+ * reads, one at a time for writes so that nothing is written after a chunk
+ * failed. */
+int reader_ul_info(reader_t *r, reader_ul_info_t *info);
+int reader_ul_read(reader_t *r, uint8_t first, uint16_t count, uint8_t *out);
+int reader_ul_write(reader_t *r, uint8_t first, uint16_t count,
+					const uint8_t *data, int verify);
+
+/* Decodes a card arrival notification read from the interrupt endpoint
+ * 0x83, e.g. with libusb after detaching the ACM driver. The tty does not
+ * expose that endpoint. Returns 0 on success. */
+int reader_parse_event(const uint8_t *data, size_t len, reader_event_t *ev);
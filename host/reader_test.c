@@ -0,0 +1,244 @@
+/* Every op of proto.h through reader_client.c against the firmware's
+ * src/proto.c in pty_reader, which is started as build/pty_reader or the
+ * path given:
+ *
+ *   build/reader_test [pty_reader]
+ *
+ * The tag of pty_reader is an NTAG215 with a 7 byte UID whose user pages
+ * hold their own byte offsets. It came into the field before the host was
+ * there, so it starts out in the flash log and halted. Exits non zero on a
+ * failure. */
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "reader_client.h"
+
+#define TIMEOUT_MS 2000
+#define ACL_KEYS 300
+#define TAG_PAGES 135
+#define TAG_USER_FIRST 4
+#define TAG_USER_LAST 129
+/* UL_TYPE_NTAG215 of ultralight.h */
+#define TAG_TYPE 4
+
+static const uint8_t card_uid[] = {0x04, 0xa2, 0x3c, 0x12, 0x5b, 0x61, 0x80};
+
+static int failures;
+static uint32_t random_state = 0x2545f491;
+
+static void check(bool ok, const char *what) {
+	if (!ok && failures++ < 20) {
+		fprintf(stderr, "%s\n", what);
+	}
+}
+
+static uint32_t next_random(void) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+static int compare_keys(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static bool is_card(const reader_uid_t *uid) {
+	return uid->size == sizeof(card_uid) &&
+		   !memcmp(uid->uid, card_uid, sizeof(card_uid));
+}
+
+/* What the tag memory holds before any write */
+static uint8_t tag_byte(uint16_t offset) {
+	return offset >= 4 * TAG_USER_FIRST && offset < 4 * (TAG_USER_LAST + 1)
+			   ? (uint8_t)offset
+			   : 0;
+}
+
+static void test_log(reader_t *r) {
+	reader_log_event_t ev[4];
+	uint8_t n = 0;
+	uint32_t pending = 0;
+
+	check(reader_log_read(r, ev, 4, &n, &pending) == PROTO_STATUS_OK &&
+			  n == 1 && pending == 1 && is_card(&ev[0].uid),
+		  "log_read: not the arrival");
+	check(reader_log_ack(r, ev[0].seq) == PROTO_STATUS_OK, "log_ack");
+	check(reader_log_read(r, ev, 4, &n, &pending) == PROTO_STATUS_OK &&
+			  n == 0 && pending == 0,
+		  "log_read: not dropped by the ack");
+}
+
+static void test_card(reader_t *r) {
+	static uint8_t mem[4 * TAG_PAGES];
+	static uint8_t data[4 * TAG_PAGES];
+	reader_uid_t uid;
+	reader_ul_info_t info;
+	int present = -1;
+
+	check(reader_poll(r, &present) == PROTO_STATUS_OK && !present,
+		  "poll: the halted card answered REQA");
+	check(reader_select(r, &uid) == PROTO_STATUS_OK && is_card(&uid),
+		  "select: not the card");
+
+	check(reader_read_range(r, 4, 2, data) == PROTO_STATUS_OK,
+		  "read_range: failed");
+	for (uint16_t i = 0; i < 32; i++) {
+		check(data[i] == tag_byte(16 + (i / 16) * 4 + i % 16),
+			  "read_range: wrong data");
+	}
+
+	check(reader_ul_info(r, &info) == PROTO_STATUS_OK &&
+			  info.type == TAG_TYPE && info.pages == TAG_PAGES &&
+			  info.user_first == TAG_USER_FIRST &&
+			  info.user_last == TAG_USER_LAST,
+		  "ul_info: not an NTAG215");
+	check(reader_ul_read(r, 0, TAG_PAGES, mem) == PROTO_STATUS_OK,
+		  "ul_read: failed");
+	for (uint16_t i = 4 * TAG_USER_FIRST; i < sizeof(mem); i++) {
+		check(mem[i] == tag_byte(i), "ul_read: wrong data");
+	}
+
+	uint16_t pages = TAG_USER_LAST + 1 - TAG_USER_FIRST;
+	for (uint16_t i = 0; i < 4 * pages; i++) {
+		data[i] = next_random();
+	}
+	check(reader_ul_write(r, TAG_USER_FIRST, pages, data, 1) ==
+			  PROTO_STATUS_OK,
+		  "ul_write: failed");
+	check(reader_ul_read(r, TAG_USER_FIRST, pages, mem) == PROTO_STATUS_OK &&
+			  !memcmp(mem, data, 4 * pages),
+		  "ul_write: not read back");
+	check(reader_ul_write(r, 2, 1, data, 0) == PROTO_STATUS_INVALID,
+		  "ul_write: lock bytes written");
+	check(reader_ul_write(r, TAG_USER_LAST, 2, data, 0) ==
+			  PROTO_STATUS_INVALID,
+		  "ul_write: past the user memory");
+
+	/* A READ past the end is NAKed and the tag goes back to IDLE, so the
+	 * inventory finds it */
+	check(reader_read_range(r, TAG_PAGES + 10, 1, data) ==
+			  PROTO_STATUS_MIFARE_NACK,
+		  "read_range: no NAK past the end");
+	uint8_t found = 0;
+	reader_uid_t uids[4];
+	check(reader_inventory(r, uids, 4, &found) == PROTO_STATUS_OK &&
+			  found == 1 && is_card(&uids[0]),
+		  "inventory: not the card");
+}
+
+static void test_acl(reader_t *r) {
+	static uint64_t keys[ACL_KEYS];
+	uint64_t card_key = acl_key(card_uid, sizeof(card_uid));
+	acl_info_t info;
+	int allowed = -1;
+
+	check(reader_acl_check(r, card_uid, sizeof(card_uid), &allowed) ==
+				  PROTO_STATUS_OK &&
+			  !allowed,
+		  "acl_check: allowed by an empty list");
+
+	keys[0] = card_key;
+	for (uint32_t i = 1; i < ACL_KEYS; i++) {
+		uint32_t uid = next_random();
+		keys[i] = acl_key((const uint8_t *)&uid, sizeof(uid));
+	}
+	qsort(keys, ACL_KEYS, sizeof(keys[0]), compare_keys);
+	check(reader_acl_load(r, keys, ACL_KEYS) == PROTO_STATUS_OK,
+		  "acl_load: failed");
+	check(reader_acl_check(r, card_uid, sizeof(card_uid), &allowed) ==
+				  PROTO_STATUS_OK &&
+			  allowed,
+		  "acl_check: loaded but denied");
+
+	acl_delta_t change = {card_key, ACL_REMOVE};
+	uint8_t applied = 0;
+	check(reader_acl_update(r, &change, 1, &applied) == PROTO_STATUS_OK &&
+			  applied == 1,
+		  "acl_update: failed");
+	check(reader_acl_check(r, card_uid, sizeof(card_uid), &allowed) ==
+				  PROTO_STATUS_OK &&
+			  !allowed,
+		  "acl_check: removed but allowed");
+
+	/* The arrival before the host was the first lookup */
+	check(reader_acl_info(r, &info) == PROTO_STATUS_OK &&
+			  info.count == ACL_KEYS && info.deltas == 1 &&
+			  info.lookups == 4 && info.allowed == 1,
+		  "acl_info: wrong counts");
+}
+
+static void test_stats(reader_t *r) {
+	static uint32_t words[METRICS_WORDS];
+	reader_response_t resp;
+	proto_stats_t stats;
+	idle_stats_t idle;
+	clock_stats_t clock;
+
+	check(reader_events(r, 0) == PROTO_STATUS_OK, "events: failed");
+	check(reader_call(r, 0x7f, NULL, 0, &resp, TIMEOUT_MS) == 0 &&
+			  resp.status == PROTO_ERR_OP,
+		  "unknown op: not PROTO_ERR_OP");
+	check(reader_idle_stats(r, &idle) == PROTO_STATUS_OK, "idle_stats");
+	check(reader_clock_stats(r, &clock) == PROTO_STATUS_OK, "clock_stats");
+	check(reader_metrics(r, words) == PROTO_STATUS_OK &&
+			  words[METRIC_card_reads] >= 2 &&
+			  words[METRIC_pcd_exchanges] > words[METRIC_card_reads],
+		  "metrics: no card reads");
+	check(reader_stats(r, &stats) == PROTO_STATUS_OK &&
+			  stats.rx_bad_frames == 0 && stats.rx_bad_ops == 1 &&
+			  stats.tx_frames + 1 == stats.rx_frames &&
+			  stats.events_logged == 1,
+		  "stats: wrong counts");
+}
+
+int main(int argc, char **argv) {
+	const char *path = argc > 1 ? argv[1] : "build/pty_reader";
+	char tty[256];
+	int out[2];
+	reader_t r;
+
+	if (pipe(out) < 0) {
+		perror("pipe");
+		return 1;
+	}
+	pid_t pid = fork();
+	if (pid == 0) {
+		dup2(out[1], STDOUT_FILENO);
+		close(out[0]);
+		execl(path, path, (char *)NULL);
+		perror(path);
+		_exit(1);
+	}
+	close(out[1]);
+	FILE *f = fdopen(out[0], "r");
+	if (pid < 0 || !f || !fgets(tty, sizeof(tty), f)) {
+		fprintf(stderr, "%s: no pty\n", path);
+		return 1;
+	}
+	tty[strcspn(tty, "\n")] = 0;
+	if (reader_open(&r, tty) < 0) {
+		perror(tty);
+		kill(pid, SIGTERM);
+		return 1;
+	}
+
+	test_log(&r);
+	test_card(&r);
+	test_acl(&r);
+	test_stats(&r);
+
+	reader_close(&r);
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	printf("reader failures=%d\n", failures);
+	return failures != 0;
+}
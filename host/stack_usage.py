@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""Worst-case stack depth per function from the GCC -fstack-usage (.su) and
+-fcallgraph-info=su (.ci) files of a firmware build.
+
+    host/stack_usage.py build/bluepill
+
+Prints one line per function, deepest first:
+
+    <worst> <self> <flags> <function> <file>
+
+worst is the deepest path through the call graph starting at the function.
+Flags: D dynamic frame, R part of a recursion, U calls something without
+stack information (library code, indirect calls), so worst is a lower bound.
+Interrupt handlers additionally need 32 bytes of exception frame each, on
+the main stack; the summary at the end adds them up assuming no nesting.
+"""
+
+import os
+import re
+import sys
+
+NODE = re.compile(r'node: \{ title: "([^"]+)" label: "([^"]*)"')
+EDGE = re.compile(r'edge: \{ sourcename: "([^"]+)" targetname: "([^"]+)"')
+BYTES = re.compile(r"(\d+) bytes \(([a-z,]+)\)")
+EXCEPTION_FRAME = 32
+
+
+class Function:
+    def __init__(self, name, unit):
+        # Static functions are titled "<file>:<name>"
+        self.title = name
+        self.name = name.rsplit(":", 1)[-1]
+        self.unit = unit
+        self.size = None
+        self.dynamic = False
+        self.calls = []
+
+
+def load(build_dir):
+    functions = {}
+    edges = []
+    for entry in sorted(os.listdir(build_dir)):
+        if not entry.endswith(".ci"):
+            continue
+        unit = entry[:-3]
+        with open(os.path.join(build_dir, entry)) as f:
+            text = f.read()
+        for title, label in NODE.findall(text):
+            m = BYTES.search(label)
+            if not m:
+                continue
+            fn = Function(title, unit)
+            fn.size = int(m.group(1))
+            fn.dynamic = m.group(2) != "static"
+            functions[(unit, title)] = fn
+        for src, dst in EDGE.findall(text):
+            edges.append((unit, src, dst))
+
+    by_name = {}
+    for fn in functions.values():
+        by_name.setdefault(fn.title, []).append(fn)
+    for unit, src, dst in edges:
+        caller = functions.get((unit, src))
+        if caller is None:
+            continue
+        # Static functions first, then a unique global definition
+        callee = functions.get((unit, dst))
+        if callee is None and len(by_name.get(dst, [])) == 1:
+            callee = by_name[dst][0]
+        caller.calls.append(callee)
+    return functions
+
+
+def worst(fn, memo, active):
+    """Returns (depth, flags) of the deepest path starting at fn"""
+    key = (fn.unit, fn.title)
+    if key in memo:
+        return memo[key]
+    if key in active:
+        return 0, {"R"}
+    active.add(key)
+    depth = 0
+    flags = {"D"} if fn.dynamic else set()
+    for callee in fn.calls:
+        if callee is None:
+            flags.add("U")
+            continue
+        d, f = worst(callee, memo, active)
+        depth = max(depth, d)
+        flags |= f
+    active.discard(key)
+    memo[key] = (fn.size + depth, flags)
+    return memo[key]
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(__doc__)
+    functions = load(sys.argv[1])
+    if not functions:
+        sys.exit("no .ci files in %s, build with -fcallgraph-info=su"
+                 % sys.argv[1])
+
+    memo = {}
+    rows = []
+    for fn in functions.values():
+        depth, flags = worst(fn, memo, set())
+        rows.append((depth, fn.size, "".join(sorted(flags)) or "-", fn))
+    rows.sort(key=lambda r: (-r[0], r[3].name))
+    for depth, size, flags, fn in rows:
+        print("%6d %6d %-3s %s %s" % (depth, size, flags, fn.name, fn.unit))
+
+    isrs = [r for r in rows if r[3].name.endswith(("_isr", "_handler"))]
+    thread = [r for r in rows if r[3].name in ("app_main", "main")]
+    print()
+    for depth, _, flags, fn in thread:
+        print("thread %s %d bytes %s" % (fn.name, depth, flags))
+    total = sum(r[0] + EXCEPTION_FRAME for r in isrs)
+    print("isr %d handlers, %d bytes if all nest" % (len(isrs), total))
+
+
+if __name__ == "__main__":
+    main()
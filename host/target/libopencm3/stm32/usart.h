@@ -0,0 +1,4 @@
+#pragma once
+
+/* Nothing of it is used by the sources built on the host */
+#include "opencm3.h"
@@ -0,0 +1,21 @@
+#pragma once
+
+/* Stand-in for include/link.h: the command protocol over the pty of
+ * pty_reader.c instead of USB or the UART */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LINK_CHUNK 64
+/* No event channel, arrivals go to the flash log as with LINK=uart */
+#define LINK_EVENTS false
+
+void link_init(void);
+/* A well formed request came in, the host counts as there from then on */
+void link_seen(void);
+bool link_ready(void);
+uint16_t link_write(const void *data, uint16_t len);
+uint16_t link_read(void *data, uint16_t len);
+uint16_t link_tx_free(void);
+uint16_t link_rx_available(void);
+bool link_notify(const void *data, uint16_t len);
@@ -0,0 +1,11 @@
+#pragma once
+
+/* Stand-in for include/mfrc522_port.h: the byte hooks under mfrc522_bus.h
+ * are the register model of mfrc522_sim.c instead of the board's bus */
+
+#include "board.h"
+#include "utils.h"
+
+void mfrc522_port_init(void);
+
+#include "../mfrc522_sim.h"
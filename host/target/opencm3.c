@@ -0,0 +1,129 @@
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/st_usbfs.h>
+
+/* The registers and calls behind opencm3.h */
+
+volatile uint32_t target_gpio_bsrr[TARGET_GPIO_PORTS];
+volatile uint32_t target_gpio_idr[TARGET_GPIO_PORTS];
+volatile uint32_t target_spi_dr;
+volatile uint32_t target_spi_sr = SPI_SR_RXNE;
+volatile uint32_t target_dbgmcu_cr;
+volatile uint8_t target_itm_stim[32];
+volatile uint16_t target_usb_cntr;
+uint8_t target_irq_enabled[TARGET_IRQS];
+
+uint32_t target_primask;
+volatile uint32_t target_scb_icsr;
+
+const struct rcc_clock_scale rcc_hse_configs[RCC_CLOCK_HSE8_END] = {
+	[RCC_CLOCK_HSE8_24MHZ] = {0, 24000000, 24000000, 24000000},
+	[RCC_CLOCK_HSE8_72MHZ] = {2, 72000000, 36000000, 72000000},
+};
+uint32_t rcc_ahb_frequency = 72000000;
+uint32_t rcc_apb1_frequency = 36000000;
+uint32_t rcc_apb2_frequency = 72000000;
+
+/* Out of reset into the 72 MHz profile, as after board_setup_clocks() */
+volatile uint32_t target_rcc_cr =
+	RCC_CR_HSION | RCC_CR_HSIRDY | RCC_CR_PLLON | RCC_CR_PLLRDY;
+volatile uint32_t target_rcc_cfgr =
+	RCC_CFGR_SW_SYSCLKSEL_PLLCLK | RCC_CFGR_SWS_SYSCLKSEL_PLLCLK << 2;
+uint32_t target_sysclk_hz = 72000000;
+uint8_t target_flash_ws = 2;
+uint32_t target_rcc_pll_ignored;
+uint32_t target_flash_violations;
+/* The PLL output for the multiplier it was started with */
+static uint32_t pll_hz = 72000000;
+
+static uint32_t cycles;
+
+/* Zero wait states up to 24 MHz, one up to 48 MHz, two up to 72 MHz */
+static void check_flash(void) {
+	if (target_sysclk_hz > 24000000u * (target_flash_ws + 1)) {
+		target_flash_violations++;
+	}
+}
+
+static uint32_t osc_bits(enum rcc_osc osc) {
+	switch (osc) {
+	case RCC_PLL:
+		return RCC_CR_PLLON | RCC_CR_PLLRDY;
+	case RCC_HSE:
+		return RCC_CR_HSEON | RCC_CR_HSERDY;
+	case RCC_HSI:
+		return RCC_CR_HSION | RCC_CR_HSIRDY;
+	default:
+		return 0;
+	}
+}
+
+void target_rcc_reset(void) {
+	target_rcc_cr = RCC_CR_HSION | RCC_CR_HSIRDY;
+	target_rcc_cfgr = 0;
+	target_sysclk_hz = 8000000;
+	target_flash_ws = 0;
+	rcc_ahb_frequency = 8000000;
+	rcc_apb1_frequency = 8000000;
+	rcc_apb2_frequency = 8000000;
+}
+
+void rcc_osc_on(enum rcc_osc osc) { target_rcc_cr |= osc_bits(osc); }
+
+/* The oscillator of SYSCLK keeps running */
+void rcc_osc_off(enum rcc_osc osc) {
+	static const uint32_t source[] = {
+		[RCC_PLL] = RCC_CFGR_SWS_SYSCLKSEL_PLLCLK,
+		[RCC_HSE] = RCC_CFGR_SWS_SYSCLKSEL_HSECLK,
+		[RCC_HSI] = RCC_CFGR_SWS_SYSCLKSEL_HSICLK,
+	};
+	if (osc > RCC_HSI || rcc_system_clock_source() != source[osc]) {
+		target_rcc_cr &= ~osc_bits(osc);
+	}
+}
+
+void rcc_wait_for_osc_ready(enum rcc_osc osc) { (void)osc; }
+
+void rcc_set_sysclk_source(uint32_t clk) {
+	target_rcc_cfgr = (target_rcc_cfgr & ~0xf) | clk | clk << 2;
+	target_sysclk_hz = clk == RCC_CFGR_SW_SYSCLKSEL_PLLCLK ? pll_hz : 8000000;
+	check_flash();
+}
+
+uint32_t rcc_system_clock_source(void) { return (target_rcc_cfgr >> 2) & 3; }
+
+/* The steps of libopencm3's F1 version: HSI, HSE, the prescalers and the
+ * flash latency, then the PLL. It never stops the PLL. */
+void rcc_clock_setup_pll(const struct rcc_clock_scale *clock) {
+	rcc_osc_on(RCC_HSI);
+	rcc_set_sysclk_source(RCC_CFGR_SW_SYSCLKSEL_HSICLK);
+	rcc_osc_on(RCC_HSE);
+	rcc_set_sysclk_source(RCC_CFGR_SW_SYSCLKSEL_HSECLK);
+	target_flash_ws = clock->flash_waitstates;
+	check_flash();
+	if (target_rcc_cr & RCC_CR_PLLON) {
+		target_rcc_pll_ignored++;
+	} else {
+		pll_hz = clock->ahb_frequency;
+	}
+	rcc_osc_on(RCC_PLL);
+	rcc_set_sysclk_source(RCC_CFGR_SW_SYSCLKSEL_PLLCLK);
+	rcc_ahb_frequency = clock->ahb_frequency;
+	rcc_apb1_frequency = clock->apb1_frequency;
+	rcc_apb2_frequency = clock->apb2_frequency;
+}
+
+void gpio_set_mode(uint32_t port, uint8_t mode, uint8_t cnf, uint16_t pins) {
+	(void)port;
+	(void)mode;
+	(void)cnf;
+	(void)pins;
+}
+
+uint32_t target_cycles(void) { return cycles++; }
+
+void nvic_enable_irq(uint8_t irqn) { target_irq_enabled[irqn] = 1; }
+
+void nvic_disable_irq(uint8_t irqn) { target_irq_enabled[irqn] = 0; }
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Host stand-ins for the parts of libopencm3 that the firmware sources
+ * built on the host use: src/cdc_stream.c under usb_sim.c and
+ * src/mfrc522.c under mfrc522_sim.c. Registers are plain variables in
+ * opencm3.c, the headers under libopencm3/ pull in what they need of this
+ * file. Only what those sources touch is here, with the libopencm3 names. */
+
+#define MMIO32(addr) (*(volatile uint32_t *)(addr))
+#define BIT0 (1 << 0)
+
+/* stm32/gpio.h */
+#define GPIOA 0
+#define GPIOB 1
+#define GPIOC 2
+#define TARGET_GPIO_PORTS 3
+#define GPIO0 (1 << 0)
+#define GPIO1 (1 << 1)
+#define GPIO2 (1 << 2)
+#define GPIO3 (1 << 3)
+#define GPIO4 (1 << 4)
+#define GPIO5 (1 << 5)
+#define GPIO6 (1 << 6)
+#define GPIO7 (1 << 7)
+#define GPIO8 (1 << 8)
+#define GPIO9 (1 << 9)
+#define GPIO10 (1 << 10)
+#define GPIO11 (1 << 11)
+#define GPIO12 (1 << 12)
+#define GPIO13 (1 << 13)
+#define GPIO_MODE_INPUT 0
+#define GPIO_MODE_OUTPUT_2_MHZ 2
+#define GPIO_CNF_INPUT_FLOAT 1
+#define GPIO_CNF_OUTPUT_PUSHPULL 0
+extern volatile uint32_t target_gpio_bsrr[TARGET_GPIO_PORTS];
+extern volatile uint32_t target_gpio_idr[TARGET_GPIO_PORTS];
+#define GPIO_BSRR(port) (target_gpio_bsrr[port])
+#define GPIO_IDR(port) (target_gpio_idr[port])
+void gpio_set_mode(uint32_t port, uint8_t mode, uint8_t cnf, uint16_t pins);
+
+/* stm32/rcc.h, with the PLL of the real RCC: it takes a new multiplier
+ * only while PLLON is clear and cannot be stopped while it clocks the
+ * core. SYSCLK and the flash wait states are kept as they are on the chip,
+ * so a test can hold them against rcc_ahb_frequency. Oscillators are ready
+ * as soon as they are on. */
+struct rcc_clock_scale {
+	uint8_t flash_waitstates;
+	uint32_t ahb_frequency;
+	uint32_t apb1_frequency;
+	uint32_t apb2_frequency;
+};
+enum rcc_osc {
+	RCC_PLL,
+	RCC_HSE,
+	RCC_HSI,
+	RCC_LSE,
+	RCC_LSI,
+};
+extern volatile uint32_t target_rcc_cr;
+extern volatile uint32_t target_rcc_cfgr;
+#define RCC_CR target_rcc_cr
+#define RCC_CFGR target_rcc_cfgr
+#define RCC_CR_HSION (1 << 0)
+#define RCC_CR_HSIRDY (1 << 1)
+#define RCC_CR_HSEON (1 << 16)
+#define RCC_CR_HSERDY (1 << 17)
+#define RCC_CR_PLLON (1 << 24)
+#define RCC_CR_PLLRDY (1 << 25)
+#define RCC_CFGR_SW_SYSCLKSEL_HSICLK 0
+#define RCC_CFGR_SW_SYSCLKSEL_HSECLK 1
+#define RCC_CFGR_SW_SYSCLKSEL_PLLCLK 2
+#define RCC_CFGR_SWS_SYSCLKSEL_HSICLK 0
+#define RCC_CFGR_SWS_SYSCLKSEL_HSECLK 1
+#define RCC_CFGR_SWS_SYSCLKSEL_PLLCLK 2
+/* What the core and the flash actually run at */
+extern uint32_t target_sysclk_hz;
+extern uint8_t target_flash_ws;
+/* rcc_clock_setup_pll() calls whose multiplier the PLL ignored, and times
+ * SYSCLK ran faster than the flash wait states allow */
+extern uint32_t target_rcc_pll_ignored;
+extern uint32_t target_flash_violations;
+/* The RCC as it comes out of reset: HSI at 8 MHz, the PLL off */
+void target_rcc_reset(void);
+void rcc_osc_on(enum rcc_osc osc);
+void rcc_osc_off(enum rcc_osc osc);
+void rcc_wait_for_osc_ready(enum rcc_osc osc);
+void rcc_set_sysclk_source(uint32_t clk);
+uint32_t rcc_system_clock_source(void);
+enum rcc_clock_hse8 {
+	RCC_CLOCK_HSE8_24MHZ,
+	RCC_CLOCK_HSE8_72MHZ,
+	RCC_CLOCK_HSE8_END,
+};
+extern const struct rcc_clock_scale rcc_hse_configs[RCC_CLOCK_HSE8_END];
+extern uint32_t rcc_ahb_frequency;
+extern uint32_t rcc_apb1_frequency;
+extern uint32_t rcc_apb2_frequency;
+void rcc_clock_setup_pll(const struct rcc_clock_scale *clock);
+
+/* stm32/spi.h, stm32/dbgmcu.h and cm3/itm.h, for the inline helpers of
+ * utils.h */
+extern volatile uint32_t target_spi_dr;
+extern volatile uint32_t target_spi_sr;
+#define SPI_DR(spi) (*((void)(spi), &target_spi_dr))
+#define SPI_SR(spi) (*((void)(spi), &target_spi_sr))
+#define SPI_SR_RXNE (1 << 0)
+#define SPI1 0
+extern volatile uint32_t target_dbgmcu_cr;
+#define DBGMCU_CR target_dbgmcu_cr
+extern volatile uint8_t target_itm_stim[32];
+#define ITM_STIM8(port) (target_itm_stim[port])
+#define ITM_STIM_FIFOREADY (1 << 0)
+
+/* cm3/dwt.h: moves on by one cycle at every read, so that the busy waits
+ * of utils.h end */
+uint32_t target_cycles(void);
+#define DWT_CYCCNT target_cycles()
+static inline uint32_t dwt_read_cycle_counter(void) { return target_cycles(); }
+
+/* cm3/cortex.h: nothing interrupts the host, the mask is only tracked */
+extern uint32_t target_primask;
+static inline uint32_t cm_mask_interrupts(uint32_t mask) {
+	uint32_t old = target_primask;
+	target_primask = mask;
+	return old;
+}
+
+/* cm3/scb.h: VECTACTIVE is the exception being handled, a test sets it to
+ * run firmware code as an interrupt would */
+extern volatile uint32_t target_scb_icsr;
+#define SCB_ICSR target_scb_icsr
+#define SCB_ICSR_VECTACTIVE 0x1ff
+
+/* cm3/nvic.h */
+#define NVIC_USB_LP_CAN_RX0_IRQ 20
+#define TARGET_IRQS 64
+/* Set while enabled */
+extern uint8_t target_irq_enabled[TARGET_IRQS];
+void nvic_enable_irq(uint8_t irqn);
+void nvic_disable_irq(uint8_t irqn);
+
+/* cm3/sync.h */
+static inline void __dmb(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+
+/* stm32/st_usbfs.h */
+extern volatile uint16_t target_usb_cntr;
+#define USB_CNTR_REG (&target_usb_cntr)
+#define USB_CNTR_FSUSP 0x0008
+#define GET_REG(reg) ((uint16_t)*(reg))
+#define SET_REG(reg, val) (*(reg) = (uint16_t)(val))
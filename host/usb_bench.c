@@ -0,0 +1,352 @@
+/* src/cdc_stream.c on the USB device model in usb_sim.c, built from the
+ * firmware source against the stand-in headers in target/:
+ *
+ *   holds       the clock and stop holds from cdc_stream_init() on, through
+ *               bus resets, given up in suspend only
+ *   zlp         every transfer that ends on a packet boundary ends with a
+ *               zero-length packet, no other does
+ *   tx_wrap     random writes against random IN polling, across many
+ *               wraps of the TX ring, including packets split by the wrap
+ *   rx_wrap     random OUT packets against random reads, with the endpoint
+ *               NAKing while the RX ring is full, nothing lost or reordered
+ *
+ * then what the model counts for streams of fixed size writes and reads:
+ * packets, zero-length packets and NAKs per chunk. The model has no bus
+ * timing, so there are no bus throughput figures. The only time measured
+ * is host CPU time per packet through cdc_stream.c and the model, not
+ * target time. Exits non zero if anything fails. */
+
+#include <libopencm3/stm32/st_usbfs.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "cdc_stream.h"
+#include "idle.h"
+#include "usb_sim.h"
+
+#define WRAP_STEPS 200000
+#define CHUNKS 1000
+#define HOST_BYTES (4 * 1024 * 1024)
+
+static uint32_t random_state = 0x6b43a9b5;
+static int failures;
+static uint8_t clock_holds;
+static uint8_t stop_holds;
+
+/* The holds cdc_stream.c takes, see clock.h and idle.h */
+void clock_hold(void) { clock_holds++; }
+void clock_release(void) { clock_holds--; }
+void idle_hold(idle_mode_t mode) { stop_holds += mode == IDLE_STOP; }
+void idle_release(idle_mode_t mode) { stop_holds -= mode == IDLE_STOP; }
+
+static uint32_t next_random(void) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+static uint32_t nanos(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void check(bool ok, const char *what) {
+	if (!ok) {
+		fprintf(stderr, "%s\n", what);
+		failures++;
+	}
+}
+
+static bool held(uint8_t n) { return clock_holds == n && stop_holds == n; }
+
+static bool suspended(void) { return target_usb_cntr & USB_CNTR_FSUSP; }
+
+/* A fresh link, enumerated */
+static void start(void) {
+	clock_holds = 0;
+	stop_holds = 0;
+	cdc_stream_init();
+	usb_sim_reset();
+	usb_sim_configure();
+}
+
+static void test_holds(void) {
+	clock_holds = 0;
+	stop_holds = 0;
+	cdc_stream_init();
+	check(held(1) && !cdc_stream_configured(), "holds: init");
+	usb_sim_reset();
+	check(held(1), "holds: reset before configuration");
+	usb_sim_configure();
+	check(held(1) && cdc_stream_configured(), "holds: configured");
+	usb_sim_reset();
+	check(held(1) && !cdc_stream_configured(), "holds: reset");
+	usb_sim_configure();
+	usb_sim_suspend();
+	usb_sim_suspend();
+	check(held(0) && suspended() && !cdc_stream_configured(),
+		  "holds: suspend");
+	usb_sim_resume();
+	check(held(1) && !suspended() && cdc_stream_configured(),
+		  "holds: resume");
+	usb_sim_resume();
+	check(held(1), "holds: second resume");
+	/* Unplugged and plugged in again, the reset comes first */
+	usb_sim_suspend();
+	usb_sim_reset();
+	check(held(1) && !suspended() && !cdc_stream_configured(),
+		  "holds: reset in suspend");
+}
+
+/* Collects IN packets until a NAK, returns the bytes; `zlps` and `shorts`
+ * count the zero-length and the other short packets */
+static uint32_t drain(uint8_t *out, uint32_t *zlps, uint32_t *shorts) {
+	uint8_t packet[USB_SIM_PACKET];
+	uint16_t len;
+	uint32_t n = 0;
+
+	while (usb_sim_in(0x82, packet, &len)) {
+		memcpy(&out[n], packet, len);
+		n += len;
+		*zlps += len == 0;
+		*shorts += len > 0 && len < USB_SIM_PACKET;
+	}
+	return n;
+}
+
+static void test_zlp(void) {
+	static const uint16_t lengths[] = {1,	63,	 64,  65,	127,
+									   128, 129, 640, 2047, 2048};
+	static uint8_t in[CDC_STREAM_TX_SIZE], out[CDC_STREAM_TX_SIZE];
+
+	start();
+	for (uint8_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+		uint16_t len = lengths[i];
+		uint32_t zlps = 0, shorts = 0;
+		for (uint16_t j = 0; j < len; j++) {
+			in[j] = next_random();
+		}
+		check(cdc_stream_write(in, len) == len, "zlp: write");
+		uint32_t n = drain(out, &zlps, &shorts);
+		bool boundary = len % USB_SIM_PACKET == 0;
+		if (n != len || memcmp(in, out, len) || zlps != boundary ||
+			shorts != !boundary) {
+			fprintf(stderr, "zlp: %u bytes came as %u, %u zlps\n", len, n,
+					zlps);
+			failures++;
+		}
+	}
+
+	/* A second transfer queued behind the ZLP of the first */
+	uint8_t packet[USB_SIM_PACKET];
+	uint16_t len;
+	uint32_t zlps = 0, shorts = 0;
+	cdc_stream_write(in, USB_SIM_PACKET);
+	check(usb_sim_in(0x82, packet, &len) && len == USB_SIM_PACKET,
+		  "zlp: first packet");
+	cdc_stream_write(in, 10);
+	check(usb_sim_in(0x82, packet, &len) && len == 0, "zlp: queued behind");
+	check(drain(out, &zlps, &shorts) == 10 && shorts == 1 && zlps == 0,
+		  "zlp: second transfer");
+}
+
+static void test_tx_wrap(void) {
+	static uint8_t chunk[300], out[CDC_STREAM_TX_SIZE];
+	uint8_t packet[USB_SIM_PACKET];
+	uint8_t next_in = 0, next_out = 0;
+	uint32_t written = 0, read = 0;
+	cdc_stream_stats_t before, st;
+
+	start();
+	cdc_stream_get_stats(&before);
+	for (uint32_t step = 0; step < WRAP_STEPS; step++) {
+		uint16_t len = next_random() % sizeof(chunk) + 1;
+		for (uint16_t i = 0; i < len; i++) {
+			chunk[i] = next_in + i;
+		}
+		uint16_t n = cdc_stream_write(chunk, len);
+		next_in += n;
+		written += n;
+
+		/* The host polls a random number of times */
+		for (uint32_t polls = next_random() % 8; polls; polls--) {
+			uint16_t got;
+			if (!usb_sim_in(0x82, packet, &got)) {
+				break;
+			}
+			for (uint16_t i = 0; i < got; i++) {
+				if (packet[i] != next_out++) {
+					fprintf(stderr, "tx_wrap: byte %u wrong\n", read + i);
+					failures++;
+					return;
+				}
+			}
+			read += got;
+		}
+	}
+	uint32_t zlps = 0, shorts = 0;
+	uint32_t n = drain(out, &zlps, &shorts);
+	for (uint32_t i = 0; i < n; i++) {
+		if (out[i] != next_out++) {
+			fprintf(stderr, "tx_wrap: byte %u wrong\n", read + i);
+			failures++;
+			return;
+		}
+	}
+	read += n;
+	cdc_stream_get_stats(&st);
+	check(read == written && st.tx_bytes - before.tx_bytes == written,
+		  "tx_wrap: lost bytes");
+	check(written > 100 * CDC_STREAM_TX_SIZE, "tx_wrap: too few wraps");
+	printf("bench-info usb tx_wrap bytes=%u wraps=%u packets=%u zlps=%u "
+		   "overruns=%u\n",
+		   written, written / CDC_STREAM_TX_SIZE,
+		   st.tx_packets - before.tx_packets, st.tx_zlps - before.tx_zlps,
+		   st.tx_overruns - before.tx_overruns);
+}
+
+static void test_rx_wrap(void) {
+	uint8_t packet[USB_SIM_PACKET], buf[200];
+	uint8_t next_in = 0, next_out = 0;
+	uint32_t sent = 0, read = 0, refused = 0;
+	uint16_t pending = 0;
+	cdc_stream_stats_t before, st;
+
+	start();
+	cdc_stream_get_stats(&before);
+	for (uint32_t step = 0; step < WRAP_STEPS; step++) {
+		/* The host sends a burst, a NAKed packet is sent again later */
+		for (uint32_t burst = next_random() % 12; burst; burst--) {
+			if (!pending) {
+				pending = next_random() % USB_SIM_PACKET + 1;
+				for (uint16_t i = 0; i < pending; i++) {
+					packet[i] = next_in + i;
+				}
+			}
+			if (!usb_sim_out(0x01, packet, pending)) {
+				refused++;
+				break;
+			}
+			next_in += pending;
+			sent += pending;
+			pending = 0;
+		}
+		uint16_t n = cdc_stream_read(buf, next_random() % sizeof(buf));
+		for (uint16_t i = 0; i < n; i++) {
+			if (buf[i] != next_out++) {
+				fprintf(stderr, "rx_wrap: byte %u wrong\n", read + i);
+				failures++;
+				return;
+			}
+		}
+		read += n;
+	}
+	while (cdc_stream_rx_available()) {
+		read += cdc_stream_read(buf, sizeof(buf));
+	}
+	cdc_stream_get_stats(&st);
+	check(read == sent && st.rx_bytes - before.rx_bytes == sent,
+		  "rx_wrap: lost bytes");
+	check(refused > 0 && st.rx_naks > before.rx_naks, "rx_wrap: never full");
+	check(sent > 100 * CDC_STREAM_RX_SIZE, "rx_wrap: too few wraps");
+	printf("bench-info usb rx_wrap bytes=%u wraps=%u naks=%u refused=%u\n",
+		   sent, sent / CDC_STREAM_RX_SIZE, st.rx_naks - before.rx_naks,
+		   refused);
+}
+
+/* Hundredths of `n` per chunk */
+static void per_chunk(const char *name, uint32_t n) {
+	uint32_t x100 = (uint64_t)n * 100 / CHUNKS;
+	printf(" %s=%u.%02u", name, x100 / 100, x100 % 100);
+}
+
+/* The firmware writes `chunk` bytes, as far as they fit, and the host polls
+ * the bulk IN endpoint until it NAKs. The packets include the ZLPs. */
+static void chunks_in(uint16_t chunk) {
+	static uint8_t data[CDC_STREAM_TX_SIZE];
+	uint8_t packet[USB_SIM_PACKET];
+	uint16_t len;
+
+	start();
+	usb_sim_stats_t before = usb_sim_stats;
+	for (uint32_t i = 0; i < CHUNKS; i++) {
+		uint16_t n = chunk < cdc_stream_tx_free() ? chunk
+												  : cdc_stream_tx_free();
+		cdc_stream_write(data, n);
+		while (usb_sim_in(0x82, packet, &len)) {
+		}
+	}
+	printf("bench-info usb in chunk=%u", chunk);
+	per_chunk("packets", usb_sim_stats.in_packets - before.in_packets);
+	per_chunk("zlps", usb_sim_stats.in_zlps - before.in_zlps);
+	per_chunk("naks", usb_sim_stats.in_naks - before.in_naks);
+	printf("\n");
+}
+
+/* The host sends full packets until the endpoint NAKs, then the firmware
+ * reads `chunk` bytes */
+static void chunks_out(uint16_t chunk) {
+	static uint8_t data[CDC_STREAM_RX_SIZE];
+
+	start();
+	usb_sim_stats_t before = usb_sim_stats;
+	for (uint32_t i = 0; i < CHUNKS; i++) {
+		while (usb_sim_out(0x01, data, USB_SIM_PACKET)) {
+		}
+		cdc_stream_read(data, chunk);
+	}
+	printf("bench-info usb out chunk=%u", chunk);
+	per_chunk("packets", usb_sim_stats.out_packets - before.out_packets);
+	per_chunk("naks", usb_sim_stats.out_naks - before.out_naks);
+	printf("\n");
+}
+
+/* Host CPU time of the stream code and the model per 64 byte packet, not
+ * target time */
+static void host_in(void) {
+	static uint8_t data[1024];
+	bench_result_t r = {.name = "usb_host_in_packet"};
+	uint8_t packet[USB_SIM_PACKET];
+	uint16_t len;
+
+	start();
+	for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+		uint32_t t = nanos();
+		for (uint32_t n = 0; n < HOST_BYTES / BENCH_RUNS; n += sizeof(data)) {
+			cdc_stream_write(data, sizeof(data));
+			while (usb_sim_in(0x82, packet, &len)) {
+			}
+		}
+		bench_add_sample(&r, (uint64_t)(nanos() - t) * USB_SIM_PACKET /
+								 (HOST_BYTES / BENCH_RUNS));
+	}
+	char line[BENCH_LINE_MAX];
+	bench_format(line, sizeof(line), &r, "ns");
+	printf("%s", line);
+}
+
+int main(void) {
+	test_holds();
+	test_zlp();
+	test_tx_wrap();
+	test_rx_wrap();
+	check(usb_sim_stats.masked == 0, "events while the USB IRQ was masked");
+
+	chunks_in(64);
+	chunks_in(100);
+	chunks_in(1216);
+	chunks_in(2048);
+	chunks_out(64);
+	chunks_out(512);
+
+	/* Host CPU time, so board=host */
+	printf("bench-begin board=host hz=1000000000\n");
+	host_in();
+	printf("bench-end\n");
+	printf("usb failures=%d\n", failures);
+	return failures != 0;
+}
@@ -0,0 +1,188 @@
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/usb/usbd.h>
+#include <string.h>
+
+#include "usb_sim.h"
+
+struct _usbd_driver {
+	uint8_t unused;
+};
+
+typedef struct {
+	uint8_t buf[USB_SIM_PACKET];
+	uint16_t len;
+	/* IN: a packet is armed. OUT: the endpoint NAKs. */
+	bool full;
+	bool nak;
+	usbd_endpoint_callback callback;
+} endpoint_t;
+
+struct _usbd_device {
+	void (*on_reset)(void);
+	void (*on_suspend)(void);
+	void (*on_resume)(void);
+	usbd_set_config_callback on_config;
+	endpoint_t in[USB_SIM_ENDPOINTS];
+	endpoint_t out[USB_SIM_ENDPOINTS];
+};
+
+const usbd_driver st_usbfs_v1_usb_driver;
+usb_sim_stats_t usb_sim_stats;
+
+static usbd_device device;
+
+/* The interrupt only runs while the firmware has it enabled */
+static bool irq(void) {
+	if (!target_irq_enabled[NVIC_USB_LP_CAN_RX0_IRQ]) {
+		usb_sim_stats.masked++;
+		return false;
+	}
+	return true;
+}
+
+usbd_device *usbd_init(const usbd_driver *driver,
+					   const struct usb_device_descriptor *dev,
+					   const struct usb_config_descriptor *conf,
+					   const char *const *strings, int num_strings,
+					   uint8_t *control_buffer, uint16_t control_buffer_size) {
+	(void)driver;
+	(void)dev;
+	(void)conf;
+	(void)strings;
+	(void)num_strings;
+	(void)control_buffer;
+	(void)control_buffer_size;
+	uint32_t masked = usb_sim_stats.masked;
+	memset(&device, 0, sizeof(device));
+	memset(&usb_sim_stats, 0, sizeof(usb_sim_stats));
+	usb_sim_stats.masked = masked;
+	return &device;
+}
+
+void usbd_register_reset_callback(usbd_device *usbd_dev,
+								  void (*callback)(void)) {
+	usbd_dev->on_reset = callback;
+}
+
+void usbd_register_suspend_callback(usbd_device *usbd_dev,
+									void (*callback)(void)) {
+	usbd_dev->on_suspend = callback;
+}
+
+void usbd_register_resume_callback(usbd_device *usbd_dev,
+								   void (*callback)(void)) {
+	usbd_dev->on_resume = callback;
+}
+
+int usbd_register_set_config_callback(usbd_device *usbd_dev,
+									  usbd_set_config_callback callback) {
+	usbd_dev->on_config = callback;
+	return 0;
+}
+
+int usbd_register_control_callback(usbd_device *usbd_dev, uint8_t type,
+								   uint8_t type_mask,
+								   usbd_control_callback callback) {
+	(void)usbd_dev;
+	(void)type;
+	(void)type_mask;
+	(void)callback;
+	return 0;
+}
+
+void usbd_poll(usbd_device *usbd_dev) { (void)usbd_dev; }
+
+void usbd_ep_setup(usbd_device *usbd_dev, uint8_t addr, uint8_t type,
+				   uint16_t max_size, usbd_endpoint_callback callback) {
+	(void)type;
+	(void)max_size;
+	endpoint_t *ep = addr & 0x80 ? &usbd_dev->in[addr & 0x7f]
+								 : &usbd_dev->out[addr & 0x7f];
+	memset(ep, 0, sizeof(*ep));
+	ep->callback = callback;
+}
+
+uint16_t usbd_ep_write_packet(usbd_device *usbd_dev, uint8_t addr,
+							  const void *buf, uint16_t len) {
+	endpoint_t *ep = &usbd_dev->in[addr & 0x7f];
+	if (ep->full) {
+		return 0;
+	}
+	memcpy(ep->buf, buf, len);
+	ep->len = len;
+	ep->full = true;
+	return len;
+}
+
+uint16_t usbd_ep_read_packet(usbd_device *usbd_dev, uint8_t addr, void *buf,
+							 uint16_t len) {
+	endpoint_t *ep = &usbd_dev->out[addr & 0x7f];
+	if (len > ep->len) {
+		len = ep->len;
+	}
+	memcpy(buf, ep->buf, len);
+	return len;
+}
+
+void usbd_ep_nak_set(usbd_device *usbd_dev, uint8_t addr, uint8_t nak) {
+	usbd_dev->out[addr & 0x7f].nak = nak;
+}
+
+void usb_sim_reset(void) {
+	memset(device.in, 0, sizeof(device.in));
+	memset(device.out, 0, sizeof(device.out));
+	if (irq() && device.on_reset) {
+		device.on_reset();
+	}
+}
+
+void usb_sim_configure(void) {
+	if (irq() && device.on_config) {
+		device.on_config(&device, 1);
+	}
+}
+
+void usb_sim_suspend(void) {
+	if (irq() && device.on_suspend) {
+		device.on_suspend();
+	}
+}
+
+void usb_sim_resume(void) {
+	if (irq() && device.on_resume) {
+		device.on_resume();
+	}
+}
+
+bool usb_sim_in(uint8_t addr, uint8_t *buf, uint16_t *len) {
+	endpoint_t *ep = &device.in[addr & 0x7f];
+	if (!ep->full) {
+		usb_sim_stats.in_naks++;
+		return false;
+	}
+	memcpy(buf, ep->buf, ep->len);
+	*len = ep->len;
+	ep->full = false;
+	usb_sim_stats.in_packets++;
+	usb_sim_stats.in_bytes += ep->len;
+	usb_sim_stats.in_zlps += ep->len == 0;
+	if (irq() && ep->callback) {
+		ep->callback(&device, addr);
+	}
+	return true;
+}
+
+bool usb_sim_out(uint8_t addr, const uint8_t *data, uint16_t len) {
+	endpoint_t *ep = &device.out[addr & 0x7f];
+	if (ep->nak || !ep->callback) {
+		usb_sim_stats.out_naks++;
+		return false;
+	}
+	memcpy(ep->buf, data, len);
+	ep->len = len;
+	usb_sim_stats.out_packets++;
+	if (irq()) {
+		ep->callback(&device, addr);
+	}
+	return true;
+}
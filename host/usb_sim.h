@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Host model of the USB device peripheral under the libopencm3 usbd API,
+ * enough to run src/cdc_stream.c with the descriptors of usb.h. The
+ * firmware callbacks run as the USB interrupt would run them; the calls
+ * below are the host's side of the bus, one token or bus event each.
+ *
+ * An endpoint buffer holds one packet, as the packet memory does: a write
+ * to an IN endpoint that has not been collected yet returns 0, an OUT
+ * endpoint set to NAK refuses the packet. There is no bus timing: the
+ * model counts packets, zero-length packets and NAKs only. */
+
+#define USB_SIM_ENDPOINTS 4
+#define USB_SIM_PACKET 64
+
+typedef struct {
+	uint32_t in_packets;
+	uint32_t in_zlps;
+	uint32_t in_bytes;
+	/* IN tokens with nothing armed */
+	uint32_t in_naks;
+	uint32_t out_packets;
+	uint32_t out_naks;
+	/* Bus events raised while the firmware had the USB interrupt masked,
+	 * which the host side of the model never does on purpose */
+	uint32_t masked;
+} usb_sim_stats_t;
+
+extern usb_sim_stats_t usb_sim_stats;
+
+/* Bus reset, SET_CONFIGURATION 1, suspend after 3 ms idle and wake-up */
+void usb_sim_reset(void);
+void usb_sim_configure(void);
+void usb_sim_suspend(void);
+void usb_sim_resume(void);
+
+/* An IN token to `ep` (0x81 to 0x83): the armed packet into `buf` and its
+ * length into `len`, then the transfer complete callback. False is a NAK. */
+bool usb_sim_in(uint8_t ep, uint8_t *buf, uint16_t *len);
+/* An OUT packet to `ep`, false if the endpoint NAKs it */
+bool usb_sim_out(uint8_t ep, const uint8_t *data, uint16_t len);
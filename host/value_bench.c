@@ -0,0 +1,168 @@
+/* Tap latency of the purse transactions in mf_value.c against the MIFARE
+ * Classic model in mfclassic_sim.c, then a tear at every exchange of a
+ * debit to check that the balance only ever ends up as before or after
+ * it. Same result lines as the benchmarks; the clock is the simulated time,
+ * so the numbers are the modelled air, bus and EEPROM time, not CPU time:
+ *
+ *   value_debit_commit  tap until the backup TRANSFER is acknowledged
+ *   value_debit         the whole tap, value block synced again
+ *   value_debit_recover a tap finishing a debit torn after its commit
+ *   *_wait25ms          the same, waiting the full 25 ms timer out on the
+ *                       silent half of DECREMENT and RESTORE */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "mfclassic_sim.h"
+
+#define START_BALANCE 100000
+#define FARE 150
+
+static const uint8_t key[MF_KEY_SIZE] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+static const uint8_t uid[MF_UID_SIZE] = {0x9c, 0x31, 0x5a, 0x07};
+static const mf_purse_t purse = {
+	.block = 4, .backup = 5, .keyType = MF_AUTH_KEY_A,
+	.key = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff}};
+
+static uint32_t sim_clock(void) { return card_ns; }
+
+static int fresh_card(void) {
+	mf_value_tx_t tx;
+	card_reset(key, uid);
+	return mf_purse_format(&purse, uid, START_BALANCE, &tx) != MF_VALUE_OK;
+}
+
+static int32_t balance(void) {
+	mf_value_tx_t tx;
+	if (mf_purse_balance(&purse, uid, &tx) != MF_VALUE_OK) {
+		return -1;
+	}
+	return tx.before;
+}
+
+static void debit(void) {
+	mf_value_tx_t tx;
+	mf_purse_debit(&purse, uid, FARE, &tx);
+}
+
+/* The debit is torn at the TRANSFER into the value block, after the
+ * commit, and the timed tap finishes it before its own debit */
+static uint32_t recover_once(void) {
+	mf_value_tx_t tx;
+	uint32_t ops = card_ops;
+
+	card_tear(ops + 6, CARD_TEAR_DURING);
+	mf_purse_debit(&purse, uid, FARE, &tx);
+	card_power_up();
+	card_tear(-1, CARD_TEAR_BEFORE);
+
+	uint32_t start = card_ns;
+	if (mf_purse_debit(&purse, uid, FARE, &tx) != MF_VALUE_OK ||
+		!tx.recovered) {
+		return 0;
+	}
+	return card_ns - start;
+}
+
+static void report(const bench_result_t *r) {
+	char line[BENCH_LINE_MAX];
+	bench_format(line, sizeof(line), r, "ns");
+	printf("%s", line);
+}
+
+static void run_benches(const char *suffix) {
+	bench_result_t r;
+	char name[40];
+
+	fresh_card();
+	card_watch_block = purse.backup;
+	snprintf(name, sizeof(name), "value_debit_commit%s", suffix);
+	r.name = name;
+	r.runs = 0;
+	r.total = 0;
+	for (uint32_t i = 0; i < BENCH_RUNS; i++) {
+		uint32_t start = card_ns;
+		debit();
+		bench_add_sample(&r, card_watch_ns - start);
+	}
+	report(&r);
+
+	fresh_card();
+	snprintf(name, sizeof(name), "value_debit%s", suffix);
+	bench_measure(&r, name, debit, BENCH_RUNS, sim_clock, 0);
+	report(&r);
+
+	fresh_card();
+	snprintf(name, sizeof(name), "value_debit_recover%s", suffix);
+	r.name = name;
+	r.runs = 0;
+	r.total = 0;
+	for (uint32_t i = 0; i < BENCH_RUNS; i++) {
+		uint32_t ns = recover_once();
+		if (ns) {
+			bench_add_sample(&r, ns);
+		}
+	}
+	report(&r);
+}
+
+/* Tears a debit at exchange `op` and checks what the card is left with */
+static int tear_case(uint32_t op, card_tear_t how, uint32_t *torn) {
+	mf_value_tx_t tx;
+
+	if (fresh_card()) {
+		return 1;
+	}
+	card_tear(card_ops + op, how);
+	mf_value_status_t status = mf_purse_debit(&purse, uid, FARE, &tx);
+	card_power_up();
+	card_tear(-1, CARD_TEAR_BEFORE);
+	*torn += status != MF_VALUE_OK;
+
+	int32_t after = balance();
+	if (after != START_BALANCE - FARE &&
+		(status == MF_VALUE_OK || after != START_BALANCE)) {
+		fprintf(stderr, "tear at %u/%d: balance %ld\n", op, how, (long)after);
+		return 1;
+	}
+	/* The next tap goes through and both blocks agree again */
+	int32_t v, b;
+	if (mf_purse_debit(&purse, uid, FARE, &tx) != MF_VALUE_OK ||
+		tx.after != after - FARE || balance() != tx.after ||
+		!mf_value_decode(card_block(purse.block), &v, NULL) ||
+		!mf_value_decode(card_block(purse.backup), &b, NULL) || v != b ||
+		v != tx.after) {
+		fprintf(stderr, "tear at %u/%d: not recovered\n", op, how);
+		return 1;
+	}
+	return 0;
+}
+
+int main(void) {
+	uint32_t cases = 0, torn = 0, failures = 0;
+
+	if (fresh_card() || balance() != START_BALANCE) {
+		fprintf(stderr, "purse does not format\n");
+		return 1;
+	}
+
+	printf("bench-begin board=sim hz=1000000000 card=mfclassic\n");
+	run_benches("");
+	card_silent_ns = 25000000;
+	run_benches("_wait25ms");
+	card_silent_ns = 1000000;
+	printf("bench-end\n");
+
+	/* A debit is auth, 2 reads and 2 operate/transfer pairs; tearing one
+	 * past the end checks the untorn path too */
+	for (uint32_t op = 0; op <= 8; op++) {
+		for (card_tear_t how = CARD_TEAR_BEFORE; how <= CARD_TEAR_AFTER;
+			 how++) {
+			failures += tear_case(op, how, &torn);
+			cases++;
+		}
+	}
+	printf("tear cases=%u torn=%u failures=%u\n", cases, torn, failures);
+	return failures != 0;
+}
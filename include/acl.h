@@ -0,0 +1,181 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Access list of card UIDs, so that the reader decides on a tap without a
+ * round trip to the host. No target specific code in here: the flash hooks
+ * at the end are implemented on the STM32F1 flash controller in
+ * src/acl_port.c, and in RAM by host/acl_bench.c.
+ *
+ * The list is a sorted array of keys in one of two flash banks. A lookup
+ * goes through
+ *   1. the delta table: the changes since the bank was written, sorted, in
+ *      RAM, binary search
+ *   2. the Bloom filter in RAM, built from the bank at mount, which turns
+ *      away most unknown cards after a few bit tests
+ *   3. interpolation search of the bank. UIDs are random, so the guesses
+ *      land close; after ACL_SEARCH_GUESSES it goes on by halving, which
+ *      bounds the worst case.
+ *
+ * Updates from the host are appended as delta records to the delta page.
+ * Once the page or the delta table is full, the bank and the deltas are
+ * merged into the other bank; a whole new list is loaded into the other
+ * bank the same way. The bank header is programmed last, with the next
+ * generation, so a power cut leaves the old list in force. Deltas carry
+ * the low bits of the generation of the bank they were made for, and only
+ * those of the active bank are replayed at mount: if the power went after
+ * the header but before the delta page was erased, the old deltas are
+ * merged already, or belong to a list a load replaced, and are skipped.
+ *
+ *   bank:  [magic: 4][generation: 4][count: 4][check: 4][key: 8] * count
+ *   delta: [key: 8][op: 1][generation: 3][check: 4]
+ *
+ * The check is acl_check_words() of the words before it, which are
+ * programmed first: a record cut short does not carry a matching check.
+ *
+ * Keys: the UID bytes from the most significant byte down, then the UID
+ * size in the lowest byte, so keys are as evenly spread as the UIDs for
+ * both single (4 byte) and double (7 byte) size UIDs. Triple size UIDs do
+ * not fit and are always denied.
+ *
+ * Flash is programmed and erased from thread mode only, see flashlog.h. */
+
+/* STM32F103x8 pages, reserved by stm32f103c8-stores.ld */
+#define ACL_PAGE_SIZE 1024
+#define ACL_BANK_PAGES 4
+#define ACL_BANK_SIZE (ACL_BANK_PAGES * ACL_PAGE_SIZE)
+/* Banks 0 and 1 hold a list each */
+#define ACL_DELTA_BANK 2
+#define ACL_NONE 0xff
+
+#define ACL_MAGIC 0x4c434124
+#define ACL_HEADER_SIZE 16
+#define ACL_DELTA_SIZE 16
+#define ACL_MAX_KEYS ((ACL_BANK_SIZE - ACL_HEADER_SIZE) / 8)
+/* Interpolation works on 16 bit indices */
+#define ACL_SEARCH_MAX 0xffff
+/* Interpolation steps before a search falls back to halving */
+#define ACL_SEARCH_GUESSES 8
+
+/* Firmware sizes: 8 bits a key at ACL_MAX_KEYS, 2-3% false positives */
+#define ACL_BLOOM_WORDS 128
+#define ACL_BLOOM_HASHES 4
+#define ACL_DELTA_MAX 32
+
+typedef enum {
+	ACL_REMOVE,
+	ACL_ADD,
+} acl_op_t;
+
+typedef enum {
+	ACL_OK,
+	/* More keys than a bank holds, or no room for another delta */
+	ACL_FULL,
+	/* Not a key, or a load not in ascending order */
+	ACL_INVALID,
+	/* A load is in progress, or none is for the keys and commit */
+	ACL_BUSY,
+	/* Programming or erasing failed */
+	ACL_FLASH,
+} acl_status_t;
+
+typedef struct {
+	uint64_t key;
+	uint8_t op;
+} acl_delta_t;
+
+typedef struct {
+	/* Keys of the active bank */
+	const uint64_t *keys;
+	uint32_t count;
+	/* ACL_NONE for no list */
+	uint8_t bank;
+	uint32_t generation;
+	/* Power of two words */
+	uint32_t *bloom;
+	uint32_t bloom_mask;
+	uint8_t bloom_hashes;
+	acl_delta_t *deltas;
+	uint16_t delta_count;
+	uint16_t delta_max;
+	/* Free space in the delta page */
+	uint16_t delta_offset;
+	/* Load into the bank that is not active */
+	bool loading;
+	uint32_t load_count;
+	uint64_t load_last;
+	/* Found at mount: delta records failing their check */
+	uint32_t torn;
+	uint32_t lookups;
+	uint32_t bloom_rejects;
+	/* Keys read from the bank by the searches */
+	uint32_t probes;
+	uint32_t allowed;
+} acl_t;
+
+/* What PROTO_OP_ACL_INFO returns */
+typedef struct {
+	uint32_t count;
+	uint32_t generation;
+	uint32_t deltas;
+	uint32_t lookups;
+	uint32_t bloom_rejects;
+	uint32_t probes;
+	uint32_t allowed;
+} acl_info_t;
+
+/* `bloom_words` is a power of two */
+void acl_init(acl_t *a, uint32_t *bloom, uint32_t bloom_words,
+			  uint8_t bloom_hashes, acl_delta_t *deltas, uint16_t delta_max);
+/* Finds the newest valid bank and replays the delta page */
+void acl_mount(acl_t *a);
+/* Uses `count` sorted keys in RAM instead of a bank, no flash involved */
+void acl_set_keys(acl_t *a, const uint64_t *keys, uint32_t count);
+
+/* 0 for a UID that does not fit a key */
+static inline uint64_t acl_key(const uint8_t *uid, uint8_t size) {
+	uint64_t key = 0;
+
+	if (size != 4 && size != 7) {
+		return 0;
+	}
+	for (uint8_t i = 0; i < size; i++) {
+		key |= (uint64_t)uid[i] << (56 - 8 * i);
+	}
+	return key | size;
+}
+
+bool acl_lookup(acl_t *a, uint64_t key);
+static inline bool acl_allows(acl_t *a, const uint8_t *uid, uint8_t size) {
+	uint64_t key = acl_key(uid, size);
+	return key && acl_lookup(a, key);
+}
+void acl_get_info(const acl_t *a, acl_info_t *info);
+
+/* Index of `key` in `count` sorted keys, -1 if absent. `probes` is added
+ * the keys compared. */
+int32_t acl_search(const uint64_t *keys, uint32_t count, uint64_t key,
+				   bool interpolate, uint32_t *probes);
+bool acl_bloom_test(const acl_t *a, uint64_t key);
+uint32_t acl_check_words(const uint32_t *words, uint8_t n);
+
+/* Persists one change. Merges the deltas into the other bank first when
+ * there is no room for it. */
+acl_status_t acl_update(acl_t *a, uint64_t key, acl_op_t op);
+/* Writes the bank and the deltas to the other bank */
+acl_status_t acl_compact(acl_t *a);
+/* A new list: begin, the keys in ascending order over any number of calls,
+ * commit. Lookups use the old list until the commit, which drops the
+ * deltas. A begin restarts a load in progress. */
+acl_status_t acl_load_begin(acl_t *a);
+acl_status_t acl_load_keys(acl_t *a, const uint64_t *keys, uint16_t n);
+acl_status_t acl_load_commit(acl_t *a);
+
+/* Flash hooks. `offset` and `len` are even, programming goes a half-word
+ * at a time and fails on anything but an erased half-word. Banks read back
+ * memory mapped and 8 byte aligned; ACL_DELTA_BANK is one page. */
+bool acl_flash_erase(uint8_t bank);
+bool acl_flash_program(uint8_t bank, uint16_t offset, const void *data,
+					   uint16_t len);
+const uint8_t *acl_flash_bank(uint8_t bank);
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Continuous ADC1 scan of the temperature sensor, Vrefint and up to
+ * ADC_SAMPLER_MAX_EXT external channels. Samples are moved by circular DMA
+ * and decimated in the half/full-transfer interrupt.
+ *
+ * Neither the ADC nor DMA run in stop, so continuous sampling holds it for
+ * good. For a firmware that sleeps in stop, ADC_SAMPLER_ONESHOT samples one
+ * round per adc_sampler_update() instead: the ADC is powered up for
+ * ADC_SAMPLER_OVERSAMPLE scans, decimated in the transfer complete
+ * interrupt and powered down again, and stop is only held for the round,
+ * under a millisecond with two channels. */
+
+/* Extra bits of resolution gained by oversampling. Every result is the sum of
+ * 4^ADC_SAMPLER_OVERSAMPLE_BITS conversions shifted right by
+ * ADC_SAMPLER_OVERSAMPLE_BITS, i.e. a 12 + ADC_SAMPLER_OVERSAMPLE_BITS bit
+ * value. */
+#define ADC_SAMPLER_OVERSAMPLE_BITS 2
+#define ADC_SAMPLER_OVERSAMPLE (1 << (2 * ADC_SAMPLER_OVERSAMPLE_BITS))
+#define ADC_SAMPLER_RESOLUTION (12 + ADC_SAMPLER_OVERSAMPLE_BITS)
+#define ADC_SAMPLER_FULL_SCALE ((1 << ADC_SAMPLER_RESOLUTION) - 1)
+
+/* Vrefint and temperature sensor characteristics from the STM32F103
+ * datasheet, in units of 10 uV */
+#define ADC_SAMPLER_VREFINT_10UV 120000
+#define ADC_SAMPLER_TEMP_V25_10UV 143000
+#define ADC_SAMPLER_TEMP_SLOPE_10UV 430
+
+#define ADC_SAMPLER_MAX_EXT 6
+#define ADC_SAMPLER_MAX_CHANNELS (2 + ADC_SAMPLER_MAX_EXT)
+
+/* Indexes in adc_snapshot_t.value; external channels follow in the order they
+ * were passed to adc_sampler_init() */
+#define ADC_SAMPLER_TEMP 0
+#define ADC_SAMPLER_VREF 1
+#define ADC_SAMPLER_EXT(n) (2 + (n))
+
+typedef struct {
+	/* Number of completed decimation rounds, 0 if nothing was sampled yet */
+	uint32_t seq;
+	uint8_t count;
+	uint16_t value[ADC_SAMPLER_MAX_CHANNELS];
+} adc_snapshot_t;
+
+typedef enum {
+	ADC_SAMPLER_CONTINUOUS,
+	ADC_SAMPLER_ONESHOT,
+} adc_sampler_mode_t;
+
+/* Called from the DMA interrupt after a buffer half has been decimated and
+ * published. `half` is true for the half-transfer event, a one-shot round
+ * ends with the full-transfer one. */
+typedef void (*adc_sampler_cb_t)(bool half);
+
+/* Sets up the ADC and DMA. Continuous sampling starts right away, one-shot
+ * sampling waits for adc_sampler_update(). */
+void adc_sampler_init(const uint8_t *ext_channels, uint8_t n_ext,
+					  adc_sampler_mode_t mode);
+void adc_sampler_set_callback(adc_sampler_cb_t cb);
+/* One-shot mode: starts a round unless one is running. From thread mode
+ * only, it waits a few microseconds for the ADC to power up and calibrate.
+ * Does nothing in continuous mode. */
+void adc_sampler_update(void);
+
+/* Copies the latest published values. Never waits on a conversion; retries
+ * only if the DMA interrupt published new data in the middle of the copy. */
+void adc_sampler_snapshot(adc_snapshot_t *out);
+
+/* The conversions of decimated values, `vref` the one of Vrefint. Ratios
+ * against Vrefint make them independent of VDDA. No target specific code,
+ * host/adc_test.c checks them against known readings. */
+static inline uint32_t adc_sampler_vdda_from(uint16_t vref) {
+	return ADC_SAMPLER_VREFINT_10UV / 100 * ADC_SAMPLER_FULL_SCALE / vref;
+}
+
+static inline uint32_t adc_sampler_mv_from(uint16_t value, uint16_t vref) {
+	return (uint32_t)value * (ADC_SAMPLER_VREFINT_10UV / 100) / vref;
+}
+
+static inline int32_t adc_sampler_cdeg_from(uint16_t temp, uint16_t vref) {
+	int32_t vsense = (uint32_t)temp * ADC_SAMPLER_VREFINT_10UV / vref;
+	return (ADC_SAMPLER_TEMP_V25_10UV - vsense) * 100 /
+			   ADC_SAMPLER_TEMP_SLOPE_10UV +
+		   2500;
+}
+
+/* Analog supply voltage derived from Vrefint, in mV. 0 if not sampled yet. */
+uint32_t adc_sampler_vdda_mv(void);
+/* Voltage of external channel `n`, in mV */
+uint32_t adc_sampler_ext_mv(uint8_t n);
+/* Die temperature in hundredths of a degree Celsius. Falls back to 20 C until
+ * the first snapshot is available. */
+int32_t adc_sampler_temperature_cdeg(void);
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fmt.h"
+
+/* Micro-benchmark harness shared by the firmware (DWT cycle counter) and the
+ * host build (monotonic clock). No target specific code in here.
+ *
+ * Every result is reported as one line:
+ *   bench <name> runs=<n> min=<t> mean=<t> max=<t> unit=<unit>
+ * with the clock read overhead already subtracted. Distributions add a
+ * histogram line with the counts of equally wide bins from lo on, and the
+ * samples below and above them:
+ *   hist <name> lo=<t> width=<t> below=<n> above=<n> bins=<n>,<n>,... unit=<unit>
+ */
+
+#define BENCH_RUNS 64
+#define BENCH_LINE_MAX 96
+#define BENCH_HIST_BINS 16
+#define BENCH_HIST_LINE_MAX 192
+
+/* Free running counter, wraps around at 2^32 */
+typedef uint32_t (*bench_clock_t)(void);
+
+typedef struct {
+	const char *name;
+	uint32_t runs;
+	uint32_t min;
+	uint32_t max;
+	uint64_t total;
+} bench_result_t;
+
+typedef struct {
+	const char *name;
+	uint32_t lo;
+	uint32_t width;
+	uint32_t below;
+	uint32_t above;
+	uint32_t bins[BENCH_HIST_BINS];
+} bench_hist_t;
+
+/* Ticks spent between two back to back clock reads, the lowest of a few
+ * tries */
+uint32_t bench_overhead(bench_clock_t clock);
+
+/* Times `runs` calls of `fn`, one at a time */
+void bench_measure(bench_result_t *r, const char *name, void (*fn)(void),
+				   uint32_t runs, bench_clock_t clock, uint32_t overhead);
+
+/* Adds a single externally timed sample, e.g. for interrupt latency */
+void bench_add_sample(bench_result_t *r, uint32_t ticks);
+
+/* Writes the result line including the trailing newline */
+void bench_write(const fmt_sink_t *s, const bench_result_t *r,
+				 const char *unit);
+/* The same into `buf`, returns the length as snprintf() does */
+int bench_format(char *buf, size_t size, const bench_result_t *r,
+				 const char *unit);
+
+void bench_hist_init(bench_hist_t *h, const char *name, uint32_t lo,
+					 uint32_t width);
+void bench_hist_add(bench_hist_t *h, uint32_t ticks);
+/* Same as bench_write() and bench_format() for the histogram line */
+void bench_hist_write(const fmt_sink_t *s, const bench_hist_t *h,
+					  const char *unit);
+int bench_hist_format(char *buf, size_t size, const bench_hist_t *h,
+					  const char *unit);
+
+/* Runs the firmware suite and prints the results, only built by `make bench`.
+ * Expects SPI and the MFRC522 to be initialised. */
+void bench_suite_run(void);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <libopencm3/stm32/gpio.h>
+#include <stdbool.h>
+
+#include "utils.h"
+
+/* Compile-time board support. The Makefile defines BOARD_<NAME> from
+ * BOARD=<name>; the board header provides pin maps and peripheral
+ * assignments as constants and board_setup_clocks(). */
+
+#if defined(BOARD_BLUEPILL)
+#include "board_bluepill.h"
+#elif defined(BOARD_STM32L152)
+#include "board_stm32l152.h"
+#else
+#error "No board selected, build with BOARD=<name>"
+#endif
+
+/* With a constant port_pin_t these fold into a single store of an
+ * immediate to BSRR, unlike the out-of-line gpio_set()/gpio_clear() */
+static inline void board_pin_set(const port_pin_t p) {
+	GPIO_BSRR(p.port) = p.pin;
+}
+
+static inline void board_pin_clear(const port_pin_t p) {
+	GPIO_BSRR(p.port) = (uint32_t)p.pin << 16;
+}
+
+static inline bool board_pin_get(const port_pin_t p) {
+	return GPIO_IDR(p.port) & p.pin;
+}
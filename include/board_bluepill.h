@@ -0,0 +1,92 @@
+#pragma once
+
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/i2c.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/spi.h>
+#include <libopencm3/stm32/timer.h>
+#include <libopencm3/stm32/usart.h>
+
+/* STM32F103C8T6 "blue pill" with an MFRC522 on SPI1 and an HC-SR04 */
+
+#define BOARD_NAME "bluepill"
+
+/* Clock governor profiles, see clock.h. USB only works from the 72 MHz PLL. */
+#define BOARD_CLOCK_LOW (&rcc_hse_configs[RCC_CLOCK_HSE8_24MHZ])
+#define BOARD_CLOCK_HIGH (&rcc_hse_configs[RCC_CLOCK_HSE8_72MHZ])
+
+static inline void board_setup_clocks(void) {
+	rcc_clock_setup_pll(BOARD_CLOCK_HIGH);
+}
+
+/* Green LED */
+#define BOARD_LED_GREEN ((port_pin_t){GPIOC, GPIO13})
+/* On-board LED, lit when low */
+#define BOARD_LED_ONBOARD ((port_pin_t){GPIOB, GPIO11})
+
+/* LED bar, overlaps with the echo input and SPI1 */
+static const port_pin_t board_leds[] = {
+	{GPIOC, GPIO13}, {GPIOA, GPIO0}, {GPIOA, GPIO1}, {GPIOA, GPIO2},
+	{GPIOA, GPIO3},	 {GPIOA, GPIO4}, {GPIOA, GPIO5}, {GPIOA, GPIO6},
+	{GPIOB, GPIO0},	 {GPIOB, GPIO1},
+};
+
+/* HC-SR04 */
+#define BOARD_ECHO ((port_pin_t){GPIOA, GPIO_TIM2_CH2})
+#define BOARD_ECHO_EXTI EXTI1
+#define BOARD_ECHO_IRQ NVIC_EXTI1_IRQ
+#define board_echo_isr exti1_isr
+#define BOARD_ECHO_TIMER TIM2
+#define BOARD_ECHO_TIMER_RCC RCC_TIM2
+#define BOARD_ECHO_TIMER_IRQ NVIC_TIM2_IRQ
+#define BOARD_TRIGGER ((port_pin_t){GPIOA, GPIO_TIM3_CH1})
+#define BOARD_TRIGGER_TIMER TIM3
+#define BOARD_TRIGGER_TIMER_RCC RCC_TIM3
+
+/* Interrupt latency stimulus (make bench), wired to the echo input PA1:
+ * TIM4 channel 3 on PB8, PB6 and PB7 are I2C1 */
+#define BOARD_IRQLAT_TIMER TIM4
+#define BOARD_IRQLAT_TIMER_RCC RCC_TIM4
+#define BOARD_IRQLAT_OC TIM_OC3
+#define BOARD_IRQLAT_STIMULUS ((port_pin_t){GPIOB, GPIO_TIM4_CH3})
+
+/* MFRC522 */
+#define BOARD_MFRC522_SPI SPI1
+#define BOARD_MFRC522_SPI_RCC RCC_SPI1
+#define BOARD_MFRC522_NSS ((port_pin_t){GPIOA, GPIO_SPI1_NSS})
+/* Highest SCK rate the wiring is known to work with */
+#define BOARD_MFRC522_SPI_HZ 2250000
+/* The same module on its UART (MFRC522_BUS=uart): PA2 to SDA, the chip's RX,
+ * and MISO, its TX, to PA3 */
+#define BOARD_MFRC522_USART USART2
+#define BOARD_MFRC522_USART_RCC RCC_USART2
+#define BOARD_MFRC522_USART_TX ((port_pin_t){GPIOA, GPIO_USART2_TX})
+#define BOARD_MFRC522_USART_RX ((port_pin_t){GPIOA, GPIO_USART2_RX})
+/* Or on I2C (MFRC522_BUS=i2c), with external pull-ups */
+#define BOARD_MFRC522_I2C I2C1
+#define BOARD_MFRC522_I2C_RCC RCC_I2C1
+#define BOARD_MFRC522_I2C_PINS ((port_pin_t){GPIOB, GPIO_I2C1_SCL | GPIO_I2C1_SDA})
+
+#define BOARD_USART USART1
+#define BOARD_USART_RCC RCC_USART1
+#define BOARD_USART_TX ((port_pin_t){GPIOA, GPIO_USART1_TX})
+#define BOARD_USART_RX ((port_pin_t){GPIOA, GPIO_USART1_RX})
+#define BOARD_USART_IRQ NVIC_USART1_IRQ
+#define board_usart_isr usart1_isr
+/* The fixed DMA1 request channels of USART1 */
+#define BOARD_USART_DMA_TX DMA_CHANNEL4
+#define BOARD_USART_DMA_TX_IRQ NVIC_DMA1_CHANNEL4_IRQ
+#define board_usart_dma_tx_isr dma1_channel4_isr
+#define BOARD_USART_DMA_RX DMA_CHANNEL5
+#define BOARD_USART_DMA_RX_IRQ NVIC_DMA1_CHANNEL5_IRQ
+#define board_usart_dma_rx_isr dma1_channel5_isr
+
+/* USB D+, pulled low at startup to force re-enumeration */
+#define BOARD_USB_DP ((port_pin_t){GPIOA, GPIO12})
+
+/* 32.768 kHz crystal, clocks the RTC that keeps time in stop and standby */
+#define BOARD_RTC_CLOCK RCC_LSE
+#define BOARD_RTC_HZ 32768
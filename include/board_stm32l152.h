@@ -0,0 +1,28 @@
+#pragma once
+
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/rcc.h>
+
+/* STM32L152RCT6 discovery board */
+
+#define BOARD_NAME "stm32l152"
+
+static inline void board_setup_clocks(void) {
+	rcc_clock_setup_pll(&rcc_clock_config[RCC_CLOCK_VRANGE1_HSI_PLL_32MHZ]);
+}
+
+#define BOARD_LED_BLUE ((port_pin_t){GPIOB, GPIO6})
+#define BOARD_LED_GREEN ((port_pin_t){GPIOB, GPIO7})
+
+static const port_pin_t board_leds[] = {
+	{GPIOB, GPIO6},
+	{GPIOB, GPIO7},
+};
+
+/* User button */
+#define BOARD_BUTTON ((port_pin_t){GPIOA, GPIO0})
+#define BOARD_BUTTON_EXTI EXTI0
+#define BOARD_BUTTON_IRQ NVIC_EXTI0_IRQ
+#define board_button_isr exti0_isr
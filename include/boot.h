@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Boot timeline from main() to the first card poll. boot_start() is the
+ * first statement of main(), every init stage ends with boot_mark() and
+ * boot_report() prints the timeline once, in the bench format (bench.h) so
+ * that two builds compare with host/bench_compare.py:
+ *   bench boot_<stage> runs=1 min=<t> mean=<t> max=<t> unit=us
+ *   bench boot_total ...
+ * between bench-begin and bench-end lines. `make BOOT_DELAYS=1` builds the
+ * old boot order with its fixed waits for the comparison.
+ *
+ * Stages are timed with the DWT cycle counter at the core clock of their
+ * start, so the stage that switches to the PLL is counted at HSI speed. The
+ * reset handler copying .data and .ramtext runs before main() and is not
+ * in it. */
+
+#define BOOT_MAX_STAGES 16
+
+/* Enables the DWT cycle counter and starts the timeline */
+void boot_start(void);
+/* Ends the current stage, `stage` has to be a string literal */
+void boot_mark(const char *stage);
+/* Prints the timeline, only the first call does anything */
+void boot_report(void);
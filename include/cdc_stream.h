@@ -0,0 +1,51 @@
+#pragma once
+
+#include <libopencm3/usb/usbd.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Streaming layer on top of the CDC-ACM data endpoints. Writes go into a TX
+ * ring that is drained in back-to-back 64-byte packets on endpoint 0x82,
+ * received packets from endpoint 0x01 land in an RX ring. */
+
+#define CDC_STREAM_PACKET 64
+#define CDC_STREAM_TX_SIZE 2048
+#define CDC_STREAM_RX_SIZE 512
+#define CDC_STREAM_NOTIFY_SIZE 32
+
+typedef struct {
+	uint32_t tx_bytes;
+	uint32_t tx_packets;
+	uint32_t tx_zlps;
+	/* Writes truncated because the TX ring was full */
+	uint32_t tx_overruns;
+	uint32_t rx_bytes;
+	uint32_t rx_packets;
+	/* Times the OUT endpoint was NAKed because the RX ring was full */
+	uint32_t rx_naks;
+} cdc_stream_stats_t;
+
+/* Holds CLOCK_HIGH and forbids stop from here on, except while the bus is
+ * suspended */
+void cdc_stream_init(void);
+/* Configured by the host and not suspended */
+bool cdc_stream_configured(void);
+
+/* Queues up to `len` bytes, returns the number of bytes accepted */
+uint16_t cdc_stream_write(const void *data, uint16_t len);
+/* Reads up to `len` received bytes, returns the number of bytes copied */
+uint16_t cdc_stream_read(void *data, uint16_t len);
+uint16_t cdc_stream_tx_free(void);
+uint16_t cdc_stream_rx_available(void);
+
+/* Sends `len` bytes on the interrupt endpoint 0x83, split into 16-byte
+ * packets. Returns false if the previous notification is still in flight. */
+bool cdc_stream_notify(const void *data, uint16_t len);
+
+void cdc_stream_get_stats(cdc_stream_stats_t *out);
+
+/* Endpoint hooks called from include/usb.h */
+void cdc_stream_on_config(usbd_device *usbd_dev);
+void cdc_stream_on_rx(usbd_device *usbd_dev);
+void cdc_stream_on_tx(usbd_device *usbd_dev);
+void cdc_stream_on_notify(usbd_device *usbd_dev);
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Clock governor. The core runs from the low power profile while nothing
+ * happens and is boosted to full speed by card and echo events. Drivers
+ * register a listener that recomputes their dividers (timer prescalers, SPI
+ * baud rate, USART BRR) after every switch.
+ * Only types in here so that the host can decode the statistics. */
+
+typedef enum {
+	CLOCK_LOW,
+	CLOCK_HIGH,
+	CLOCK_PROFILES,
+} clock_profile_t;
+
+/* Time the governor stays boosted after the last event */
+#define CLOCK_BOOST_MS 200
+#define CLOCK_MAX_LISTENERS 8
+
+/* Called in thread mode with interrupts masked after the clock tree
+ * changed */
+typedef void (*clock_listener_t)(void);
+
+typedef struct {
+	/* Residency in RTC ticks (see idle.h), the energy proxy */
+	uint32_t ticks[CLOCK_PROFILES];
+	/* Switches into each profile */
+	uint32_t switches[CLOCK_PROFILES];
+	/* PLL relock plus listeners, in microseconds */
+	uint32_t switch_us_last;
+	uint32_t switch_us_max;
+} clock_stats_t;
+
+/* Firmware side, see src/clock.c */
+/* Starts in CLOCK_HIGH, needs idle_init() for the time base */
+void clock_init(void);
+/* Returns false if the table is full. Does not call `fn`. */
+bool clock_register(clock_listener_t fn);
+clock_profile_t clock_profile(void);
+
+/* Input clock of the timers on APB1 and APB2, twice the bus clock whenever
+ * the bus prescaler divides */
+uint32_t clock_apb1_timer_hz(void);
+uint32_t clock_apb2_timer_hz(void);
+
+/* Switches to CLOCK_HIGH for at least CLOCK_BOOST_MS. Safe in interrupts:
+ * there the switch is only requested, the next clock_idle() makes it. */
+void clock_boost(void);
+/* Keeps CLOCK_HIGH while held, e.g. for USB which needs the 72 MHz PLL.
+ * Holds nest. Taken in an interrupt, the switch waits for clock_idle() as
+ * for clock_boost(). */
+void clock_hold(void);
+void clock_release(void);
+/* Governor step from the main loop, between bus transactions: makes a
+ * switch to CLOCK_HIGH requested from an interrupt, and drops to CLOCK_LOW
+ * once the boost has run out and nothing holds the clock */
+void clock_idle(void);
+/* Reapplies the current profile after stop mode left the core on HSI */
+void clock_restore(void);
+
+void clock_get_stats(clock_stats_t *out);
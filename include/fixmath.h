@@ -0,0 +1,136 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Fixed point arithmetic for the Cortex-M3, which has no FPU: float and
+ * double operations go to the libgcc soft-float routines, as does any 64 bit
+ * division. Everything in here is integer multiplies, shifts and compares,
+ * and folds away at compile time when the arguments are constant; the upper
+ * case macros do the same in static initialisers. No target specific code
+ * in here, host/fixmath_test.c checks the results against double (make -C
+ * host fixmath-test) and `make bench` times them.
+ *
+ * q16_t is Q16.16: a signed 32 bit value with 16 fraction bits. Results are
+ * rounded to nearest and saturate instead of wrapping. */
+
+typedef int32_t q16_t;
+
+#define Q16_SHIFT 16
+#define Q16_ONE ((q16_t)1 << Q16_SHIFT)
+#define Q16_MAX INT32_MAX
+#define Q16_MIN INT32_MIN
+
+/* Of a constant only, e.g. Q16(0.606): the compiler does the float math */
+#define Q16(x) ((q16_t)((x) * Q16_ONE + ((x) < 0 ? -0.5 : 0.5)))
+
+/* n / d rounded to nearest, halves away from zero. For constants; at run
+ * time a 64 bit `n` means a libgcc division. */
+#define FIX_ROUND_DIV(n, d)                                                    \
+	((((n) < 0) == ((d) < 0)) ? ((n) + (d) / 2) / (d) : ((n) - (d) / 2) / (d))
+
+/* num / den as Q16.16, rounded */
+#define FIX_RATIO(num, den)                                                    \
+	((q16_t)FIX_ROUND_DIV((int64_t)(num) * Q16_ONE, (int64_t)(den)))
+
+static inline int32_t fix_sat32(int64_t v) {
+	return v > INT32_MAX ? INT32_MAX : v < INT32_MIN ? INT32_MIN : (int32_t)v;
+}
+
+static inline uint16_t fix_sat_u16(int32_t v) {
+	return v < 0 ? 0 : v > UINT16_MAX ? UINT16_MAX : (uint16_t)v;
+}
+
+static inline int32_t fix_sat_add(int32_t a, int32_t b) {
+	int32_t r;
+	if (__builtin_add_overflow(a, b, &r)) {
+		return a < 0 ? INT32_MIN : INT32_MAX;
+	}
+	return r;
+}
+
+static inline int32_t fix_sat_sub(int32_t a, int32_t b) {
+	int32_t r;
+	if (__builtin_sub_overflow(a, b, &r)) {
+		return a < 0 ? INT32_MIN : INT32_MAX;
+	}
+	return r;
+}
+
+static inline q16_t q16_from_int(int32_t v) {
+	return fix_sat32((int64_t)v * Q16_ONE);
+}
+
+/* Rounded to nearest, halves up */
+static inline int32_t q16_to_int(q16_t v) {
+	return (v >> Q16_SHIFT) + ((v >> (Q16_SHIFT - 1)) & 1);
+}
+
+/* 64 bit product of a SMULL, then the shift */
+static inline int32_t q16_mul_int(int64_t product) {
+	return fix_sat32((product + Q16_ONE / 2) >> Q16_SHIFT);
+}
+
+static inline q16_t q16_mul(q16_t a, q16_t b) {
+	return q16_mul_int((int64_t)a * b);
+}
+
+/* An integer scaled by a Q16.16 factor, rounded to an integer */
+static inline int32_t q16_scale(int32_t v, q16_t factor) {
+	return q16_mul_int((int64_t)v * factor);
+}
+
+/* Linear map of [in_lo, in_hi] onto [out_lo, out_hi], a multiply and a
+ * shift. Build the map once with FIX_MAP() in a static const: at run time
+ * its slope is a 64 bit division. The slope is Q16.16, so a result is off
+ * by at most |x - in_lo| / 2^17 of an output step plus the rounding. */
+typedef struct {
+	int32_t in_lo;
+	int32_t out_lo;
+	q16_t slope;
+} fix_map_t;
+
+#define FIX_MAP(in_lo, in_hi, out_lo, out_hi)                                  \
+	{(in_lo), (out_lo),                                                        \
+	 FIX_RATIO((int64_t)(out_hi) - (out_lo), (int64_t)(in_hi) - (in_lo))}
+
+/* Saturates once, on the sum */
+static inline int32_t fix_map(const fix_map_t *m, int32_t x) {
+	int64_t d = (((int64_t)x - m->in_lo) * m->slope + Q16_ONE / 2) >>
+				Q16_SHIFT;
+	return fix_sat32(d + m->out_lo);
+}
+
+/* Division by a divisor that is only known at run time but changes rarely,
+ * such as a clock frequency: a UMULL, a subtract, an add and two shifts,
+ * where UDIV takes 2-12 cycles depending on the operands. The compiler does
+ * the same by itself for a constant divisor. Exact for every 32 bit
+ * dividend (Granlund and Montgomery, "Division by invariant integers using
+ * multiplication"). */
+typedef struct {
+	uint32_t m;
+	uint8_t shift1;
+	uint8_t shift2;
+} fix_div_t;
+
+/* ceil(log2(d)) */
+#define FIX_LOG2_UP(d) ((d) > 1 ? 32 - __builtin_clz((uint32_t)(d) - 1) : 0)
+
+#define FIX_DIV(d)                                                             \
+	{(uint32_t)(((((uint64_t)1 << FIX_LOG2_UP(d)) - (d)) << 32) / (d) + 1),    \
+	 FIX_LOG2_UP(d) > 0, FIX_LOG2_UP(d) > 1 ? FIX_LOG2_UP(d) - 1 : 0}
+
+/* A 64 bit division unless `d` is constant, d > 0 */
+static inline fix_div_t fix_div_init(uint32_t d) {
+	return (fix_div_t)FIX_DIV(d);
+}
+
+static inline uint32_t fix_div(const fix_div_t *r, uint32_t n) {
+	uint32_t t = ((uint64_t)r->m * n) >> 32;
+	return (t + ((n - t) >> r->shift1)) >> r->shift2;
+}
+
+/* Timer prescaler register value for `tick_hz` from `hz`, the nearest
+ * division the 16 bit register holds */
+static inline uint16_t fix_prescaler(uint32_t hz, uint32_t tick_hz) {
+	return fix_sat_u16((int32_t)((hz + tick_hz / 2) / tick_hz) - 1);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Erasing and programming the internal flash of the STM32F1, for the flash
+ * stores (flashlog_port.c, acl_port.c). The controller is unlocked for each
+ * call only, and every half-word is read back. */
+
+#define FLASH_PORT_PAGE_SIZE 1024
+
+/* Erases the page at `address`, page aligned */
+bool flash_port_erase(uint32_t address);
+/* `address` and `len` are even. Half-words of 0xffff are left alone, they
+ * are already there in an erased page. */
+bool flash_port_program(uint32_t address, const void *data, uint32_t len);
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Append-only record store in internal flash pages, for events that have
+ * nowhere to go while the host link is down. No target specific code in
+ * here: the flash and CRC hooks at the end are implemented on the STM32F1
+ * flash controller and CRC unit in src/flashlog_port.c, and by the flash
+ * model in host/flash_sim.c.
+ *
+ * The pages form a log in the order of their page sequence number. Each
+ * one starts with a header, followed by records programmed a half-word at
+ * a time in address order, the CRC last:
+ *
+ *   header: [magic: 4][page seq: 4][seq base: 4][acked: 4][erases: 4][crc: 4]
+ *   record: [len: 2][type: 2][seq: 4][data, padded to 4][crc: 4]
+ *
+ * CRCs are the CRC-32 of the STM32 CRC unit (poly 0x04C11DB7, init ~0, 32
+ * bit words, no reflection) over the words before them. A record cut short
+ * by a power loss fails its CRC and is skipped when the page is read; one
+ * whose length is unreadable closes the page. Records are never moved, a
+ * page is erased once every record in it is acknowledged, so the only
+ * write amplification is the framing (make -C host flashlog-sim).
+ *
+ * Wear levelling: the next page opened is the free or fully acknowledged
+ * page with the fewest erases, the count carried along in the header.
+ *
+ * Delivery is at least once: replay starts after the last acknowledged
+ * sequence number that made it to flash, either in an ACK record or in a
+ * page header.
+ *
+ * Erasing a page takes 20-40 ms and programming a half-word about 50 us,
+ * with code fetches from flash stalled meanwhile. Thread mode only. */
+
+/* STM32F103x8 page size. The pages are reserved by stm32f103c8-stores.ld. */
+#define FLASHLOG_PAGE_SIZE 1024
+#define FLASHLOG_PAGES 8
+#define FLASHLOG_MAX_DATA 64
+
+#define FLASHLOG_MAGIC 0x474f4c46
+#define FLASHLOG_HEADER_SIZE 24
+/* Record framing without the data */
+#define FLASHLOG_RECORD_SIZE 12
+#define FLASHLOG_TYPE_DATA 0x0001
+/* Acknowledgement, the seq field holds the acknowledged sequence number */
+#define FLASHLOG_TYPE_ACK 0x0002
+
+/* No page in use */
+#define FLASHLOG_NONE 0xffff
+
+typedef enum {
+	FLASHLOG_OK,
+	/* Every page holds unacknowledged records */
+	FLASHLOG_FULL,
+	FLASHLOG_TOO_BIG,
+	/* Programming or erasing failed, the page is closed */
+	FLASHLOG_FLASH,
+	/* Nothing more to replay */
+	FLASHLOG_END,
+} flashlog_status_t;
+
+typedef struct {
+	/* 0 for a page without a valid header */
+	uint32_t page_seq;
+	uint32_t erases;
+	/* Sequence numbers of the first and last data record, 0 for none */
+	uint32_t first;
+	uint32_t last;
+} flashlog_page_t;
+
+/* RAM index, rebuilt by flashlog_mount() */
+typedef struct {
+	flashlog_page_t pages[FLASHLOG_PAGES];
+	/* Page appended to and the offset of its free space, FLASHLOG_PAGE_SIZE
+	 * once the page is full or closed */
+	uint16_t head;
+	uint16_t offset;
+	uint32_t next_page_seq;
+	uint32_t next_seq;
+	uint32_t acked;
+	/* Found at mount: records failing their CRC and pages closed early */
+	uint32_t torn;
+	/* The record being appended */
+	uint32_t stage[(FLASHLOG_RECORD_SIZE + FLASHLOG_MAX_DATA) / 4];
+} flashlog_t;
+
+typedef struct {
+	uint16_t page;
+	uint16_t offset;
+	/* Next sequence number wanted */
+	uint32_t seq;
+} flashlog_cursor_t;
+
+/* Reads every page header and record into the index. Nothing is written,
+ * pages without a valid header are erased when they are next used. */
+void flashlog_mount(flashlog_t *log);
+/* O(1) apart from opening a new page. `seq` gets the record's sequence
+ * number, if given. */
+flashlog_status_t flashlog_append(flashlog_t *log, const void *data,
+								  uint16_t len, uint32_t *seq);
+/* Everything up to `seq` may go. Writes an ACK record, the pages it frees
+ * are erased when they are reused. */
+flashlog_status_t flashlog_ack(flashlog_t *log, uint32_t seq);
+/* Number of records after the acknowledged ones */
+uint32_t flashlog_pending(const flashlog_t *log);
+
+/* Replay from the first unacknowledged record: the page is found in the
+ * index, then its records are walked. An append or ack ends the replay. */
+void flashlog_replay(const flashlog_t *log, flashlog_cursor_t *c);
+/* `len` holds the room in `out` on the way in, records that do not fit are
+ * skipped */
+flashlog_status_t flashlog_next(const flashlog_t *log, flashlog_cursor_t *c,
+								void *out, uint16_t *len, uint32_t *seq);
+
+/* Flash hooks. `offset` and `len` are even, programming goes a half-word
+ * at a time and fails on anything but an erased half-word. Pages read back
+ * memory mapped and word aligned. */
+bool flashlog_flash_erase(uint16_t page);
+bool flashlog_flash_program(uint16_t page, uint16_t offset, const void *data,
+							uint16_t len);
+const uint8_t *flashlog_flash_page(uint16_t page);
+/* CRC-32 as the STM32 CRC unit computes it, over `n` words */
+uint32_t flashlog_crc(const void *words, uint16_t n);
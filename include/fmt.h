@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "fixmath.h"
+
+/* Text output without newlib's printf: one call per field, straight into a
+ * sink, no format string to parse and no heap. No target specific code in
+ * here; the firmware sinks are in src/fmt_port.c and src/uart_stream.c.
+ *
+ * Nothing is kept between calls and the stack use is a few dozen bytes, so
+ * the functions are safe from any context, interrupts included, as far as
+ * the sink is. A field reaches the sink in one write, a line in several:
+ * lines from different contexts may interleave field by field. */
+
+typedef struct {
+	/* Takes `len` characters, whatever it does not have room for is lost */
+	void (*write)(void *ctx, const char *data, uint16_t len);
+	void *ctx;
+} fmt_sink_t;
+
+/* A character buffer as a sink, as snprintf() fills one: always
+ * terminated, `len` counts what would have been written */
+typedef struct {
+	char *buf;
+	uint16_t size;
+	uint16_t len;
+} fmt_buf_t;
+
+void fmt_buf_write(void *ctx, const char *data, uint16_t len);
+
+static inline fmt_sink_t fmt_buf(fmt_buf_t *b, char *buf, uint16_t size) {
+	b->buf = buf;
+	b->size = size;
+	b->len = 0;
+	if (size) {
+		buf[0] = '\0';
+	}
+	return (fmt_sink_t){fmt_buf_write, b};
+}
+
+void fmt_str(const fmt_sink_t *s, const char *str);
+void fmt_char(const fmt_sink_t *s, char c);
+void fmt_u32(const fmt_sink_t *s, uint32_t v);
+void fmt_i32(const fmt_sink_t *s, int32_t v);
+/* Lower case, zero padded to `digits`, more digits if `v` needs them */
+void fmt_hex(const fmt_sink_t *s, uint32_t v, uint8_t digits);
+/* v / 10^decimals with `decimals` digits after the point, up to 9, e.g.
+ * fmt_fixed(s, -2150, 2) writes -21.50 */
+void fmt_fixed(const fmt_sink_t *s, int32_t v, uint8_t decimals);
+/* Rounded to `decimals` digits after the point, up to 4 */
+void fmt_q16(const fmt_sink_t *s, q16_t v, uint8_t decimals);
+/* Two hex digits a byte, each after `sep` unless that is 0 */
+void fmt_hex_bytes(const fmt_sink_t *s, const uint8_t *data, uint16_t len,
+				   char sep);
+/* Lines of FMT_DUMP_LINE bytes after their offset: "0010: 5a 00 ...\n" */
+#define FMT_DUMP_LINE 16
+void fmt_hexdump(const fmt_sink_t *s, const uint8_t *data, uint16_t len);
+
+/* Firmware sinks. ITM spins while the stimulus port FIFO is full, the
+ * USART1 ring of uart_stream.c drops what does not fit. The USB CDC link
+ * is left out: it carries the protocol frames, and its TX ring takes one
+ * writer only. */
+void fmt_itm_write(void *ctx, const char *data, uint16_t len);
+#define FMT_ITM(port) ((fmt_sink_t){fmt_itm_write, (void *)(port)})
+void fmt_uart_write(void *ctx, const char *data, uint16_t len);
+#define FMT_UART ((fmt_sink_t){fmt_uart_write, 0})
+/* The log: ITM port 0, or USART1 in a LOG=uart build */
+extern const fmt_sink_t fmt_log;
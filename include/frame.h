@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Framing shared by the firmware and the host client: the raw frame is
+ * followed by a CRC-16/CCITT-FALSE (little endian), COBS encoded and
+ * terminated by a 0x00 delimiter. No target specific code in here. */
+
+#define FRAME_MAX_RAW 256
+/* Raw frame plus CRC, COBS overhead and the delimiter */
+#define FRAME_MAX_ENCODED (FRAME_MAX_RAW + 2 + (FRAME_MAX_RAW + 2) / 254 + 2)
+#define FRAME_DELIMITER 0x00
+
+uint16_t frame_crc16(const uint8_t *data, size_t len);
+
+size_t frame_cobs_encode(const uint8_t *src, size_t len, uint8_t *dst);
+/* Returns the decoded length, 0 on a malformed input */
+size_t frame_cobs_decode(const uint8_t *src, size_t len, uint8_t *dst);
+
+/* Appends the CRC and COBS encodes `raw`, including the trailing delimiter.
+ * `raw` must have two bytes of room past `len` for the CRC.
+ * Returns the number of bytes written to `dst`. */
+size_t frame_pack(uint8_t *raw, size_t len, uint8_t *dst);
+
+/* Decodes an encoded frame without its delimiter and checks the CRC.
+ * Returns the raw length without CRC, 0 if the frame is damaged. */
+size_t frame_unpack(const uint8_t *enc, size_t len, uint8_t *raw);
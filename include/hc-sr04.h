@@ -1,7 +1,26 @@
 #pragma once
-#include <libopencm3/stm32/gpio.h>
-#include <libopencm3/stm32/timer.h>
 
-void init_timers() {}
+#include <stdint.h>
 
-void init_gpio() {}
+#include "fixmath.h"
+
+/* 4 m and back, the range of the module. Without an echo it gives up after
+ * about 38 ms. */
+#define HCSR04_MAX_ECHO_US 25000
+
+/* Speed of sound in air in mm/s, c = 331.3 + 0.606 * T */
+static inline uint32_t hcsr04_sound_speed(int32_t temp_cdeg) {
+	return 331300 + (606 * temp_cdeg) / 100;
+}
+
+/* Converts the echo pulse width in us to the distance in mm, rounded. The
+ * pulse covers the way to the obstacle and back, so the distance is
+ * echo_us * speed / 2000000, here with Q16.16 mm of distance per us of
+ * echo; the division is by a constant, which the compiler turns into a
+ * multiply.
+ * Within 1 mm of the exact value for echoes up to 65 ms. */
+static inline uint32_t hcsr04_echo_to_mm(uint32_t echo_us, int32_t temp_cdeg) {
+	uint32_t mm_per_us =
+		((hcsr04_sound_speed(temp_cdeg) << 12) + 125000 / 2) / 125000;
+	return (echo_us * mm_per_us + Q16_ONE / 2) >> Q16_SHIFT;
+}
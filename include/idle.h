@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Idle manager. The main loop calls idle_wait() with its next deadline and
+ * the deepest low power mode that fits is entered:
+ *
+ *   sleep    core clock stopped, any interrupt wakes up
+ *   stop     all clocks stopped, EXTI lines (RTC alarm, USB wakeup) wake
+ *            up, the clock tree is restored afterwards
+ *   standby  everything off but the RTC, waking up resets the MCU
+ *
+ * Time is kept by the RTC, which keeps running in stop and standby.
+ *
+ * The MFRC522 IRQ is no wake-up source: the chip does not detect a card on
+ * its own, every poll is a REQA sent by the firmware, so card arrivals are
+ * found at the poll deadlines the main loop passes in.
+ * Only types in here so that the host can decode the statistics. */
+
+/* RTC ticks per second */
+#define IDLE_HZ 1024
+#define IDLE_MS(ms) (((uint32_t)(ms) * IDLE_HZ + 999) / 1000)
+#define IDLE_FOREVER UINT32_MAX
+
+/* Leaving stop takes the HSE and PLL restart, shorter waits only sleep */
+#define IDLE_STOP_MIN_TICKS IDLE_MS(5)
+/* Standby costs a full reset and boot */
+#define IDLE_STANDBY_MIN_TICKS IDLE_MS(2000)
+
+typedef enum {
+	IDLE_RUN,
+	IDLE_SLEEP,
+	IDLE_STOP,
+	IDLE_STANDBY,
+	IDLE_MODES,
+} idle_mode_t;
+
+typedef struct {
+	/* Residency in RTC ticks, IDLE_RUN is the time spent awake. Standby ends
+	 * in a reset and is only counted in entries. */
+	uint32_t ticks[IDLE_MODES];
+	uint32_t entries[IDLE_MODES];
+	/* Wake-ups by the RTC alarm, i.e. the deadline was reached */
+	uint32_t deadline_wakeups;
+	/* Clock tree restore after stop, in microseconds */
+	uint32_t wake_us_last;
+	uint32_t wake_us_max;
+	/* Worst RTC wake-up past the deadline, in ticks */
+	uint32_t late_ticks_max;
+} idle_stats_t;
+
+/* Firmware side, see src/idle.c */
+/* Starts the RTC crystal without waiting for it, so that it comes up while
+ * the rest of the firmware initialises. Optional, idle_init() does it too. */
+void idle_start(void);
+/* Waits for the RTC, sets up the time base and the wake-up sources. Until
+ * then idle_now() reads 0 on the first power up. */
+void idle_init(void);
+/* True if the MCU was reset by a wake-up from standby */
+bool idle_woke_from_standby(void);
+/* Current RTC tick count, wraps around */
+uint32_t idle_now(void);
+
+/* Forbids `mode` and every deeper mode until released, e.g. while a timer or
+ * DMA transfer that stops with the clocks is running. Holds nest.
+ * Standby is held once by idle_init(), the application opts in by
+ * releasing it. */
+void idle_hold(idle_mode_t mode);
+void idle_release(idle_mode_t mode);
+
+/* Sleeps until `deadline` (IDLE_FOREVER for none) or an interrupt. `busy`,
+ * if given, is checked with interrupts masked right before sleeping so that
+ * work queued by an interrupt just before cannot be slept through. */
+void idle_wait(uint32_t deadline, bool (*busy)(void));
+
+void idle_get_stats(idle_stats_t *out);
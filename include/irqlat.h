@@ -0,0 +1,58 @@
+#pragma once
+
+#include <libopencm3/cm3/dwt.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Interrupt latency harness, built with the benchmarks (make bench). A TIM4
+ * compare match drives BOARD_IRQLAT_STIMULUS high; wired to the echo input
+ * the edge raises EXTI1 and, in a second pass, TIM2 input capture 2, which
+ * times the echo otherwise, so exti1_isr and the real tim2_isr are measured.
+ * Their first statement is irqlat_stamp(), which takes the DWT cycle count
+ * and returns true when the edge came from the harness, the handler then
+ * returns right away.
+ *
+ * The cycle count of the edge is worked out from a back to back read of
+ * the timer and DWT counters when arming, so every sample carries the same
+ * few cycles of that read. Compare builds rather than trusting the absolute
+ * value. Each source runs once without load and once under every load in
+ * the mask, for IRQLAT_RUNS edges at pseudo random points of the load loop:
+ *   bench irqlat_<source>_<load>         cycles from the edge to the stamp
+ *   bench irqlat_<source>_<load>_jitter  difference between consecutive
+ *                                        latencies
+ * each followed by its hist line, see bench.h. Without the wire every case
+ * has runs=0. */
+
+#define IRQLAT_RUNS 256
+/* Histogram bin width in cycles */
+#define IRQLAT_BIN 4
+/* ITM stimulus port the ITM load writes to */
+#define IRQLAT_ITM_PORT 4
+
+/* Background loads, run from thread mode while waiting for the edge */
+/* MFRC522 register reads back to back */
+#define IRQLAT_LOAD_SPI 0x01
+/* Log lines on IRQLAT_ITM_PORT, the writer spins on a full FIFO */
+#define IRQLAT_LOAD_ITM 0x02
+/* CDC bulk IN traffic, the USB interrupt has the same priority. Only loads
+ * anything once a host has the port open. */
+#define IRQLAT_LOAD_USB 0x04
+#define IRQLAT_LOAD_ALL 0x07
+
+extern volatile bool irqlat_armed;
+extern volatile uint32_t irqlat_entry;
+
+static inline bool irqlat_stamp(void) {
+	uint32_t now = DWT_CYCCNT;
+	if (!irqlat_armed) {
+		return false;
+	}
+	irqlat_entry = now;
+	irqlat_armed = false;
+	return true;
+}
+
+/* Prints the cases for every load in `loads`. Expects the DWT cycle counter,
+ * TIM2 and the MFRC522 to be running, as in bench_suite_run(). */
+void irqlat_run(uint8_t loads);
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+
+/* ISO/IEC 14443-4 half duplex block transmission protocol (ISO-DEP) for a
+ * card selected with a SAK that has bit 6 set: RATS, I-block chaining in
+ * both directions, waiting time extensions and the recovery of lost
+ * frames. No CID and no NAD, one card at a time. No target specific code in
+ * here: frames go through the hooks at the end, implemented on the driver
+ * in src/isodep_port.c and by the host model in host/isodep_sim.c.
+ *
+ * Frames longer than the 64 byte MFRC522 FIFO are streamed through it by
+ * PCD_TransceiveStream(), so we announce the largest frame size, FSD 256. */
+
+/* Largest frame we accept, PCB and CRC_A included */
+#define ISODEP_FSD 256
+#define ISODEP_FSDI 8
+#define ISODEP_ATS_MAX 20
+/* Tries after a timeout or a broken frame, ISO/IEC 14443-4 7.5.6 */
+#define ISODEP_RETRIES 2
+
+/* Same as PICC_CMD_RATS, mfrc522.h needs the target headers */
+#define ISODEP_RATS 0xE0
+#define ISODEP_PCB_I 0x02
+#define ISODEP_PCB_R_ACK 0xA2
+#define ISODEP_PCB_R_NAK 0xB2
+#define ISODEP_PCB_S_DESELECT 0xC2
+#define ISODEP_PCB_S_WTX 0xF2
+/* More I-blocks of the same message follow */
+#define ISODEP_PCB_CHAIN 0x10
+#define ISODEP_PCB_BLOCK_NUM 0x01
+
+/* Frame waiting time before the ATS, FWT_ACTIVATION = 71680/fc */
+#define ISODEP_FWT_ACTIVATION_US 5286
+
+typedef enum {
+	ISODEP_OK,
+	/* A frame exchange failed after the retries, its MFRC522_Status is in
+	 * card */
+	ISODEP_CARD,
+	/* The card sent a block that does not fit the protocol state */
+	ISODEP_PROTOCOL,
+	/* The response does not fit the buffer */
+	ISODEP_NO_ROOM,
+} isodep_status_t;
+
+typedef struct {
+	/* Largest frame the card accepts, PCB and CRC_A included */
+	uint16_t fsc;
+	/* Frame waiting time with ΔFWT, and the guard time after the ATS */
+	uint32_t fwtUs;
+	uint32_t sfgtUs;
+	uint8_t ats[ISODEP_ATS_MAX];
+	uint8_t atsLen;
+	/* Of the next I-block we send */
+	uint8_t blockNum;
+	uint8_t card;
+	/* Since isodep_rats() */
+	uint32_t wtx;
+	uint32_t retries;
+	/* A whole frame each, the CRC_A the hook appends included. Longer than
+	 * a pbuf, see pbuf.h. */
+	uint8_t tx[ISODEP_FSD];
+	uint8_t rx[ISODEP_FSD];
+} isodep_t;
+
+/* Activates the selected card, FSD 256 and CID 0, and waits out its
+ * start-up frame guard time */
+isodep_status_t isodep_rats(isodep_t *d);
+/* Sends `apdu` in as many I-blocks as the card's FSC needs and collects the
+ * chained response. `respLen` holds the room in `resp` on the way in. */
+isodep_status_t isodep_exchange(isodep_t *d, const uint8_t *apdu,
+								uint16_t len, uint8_t *resp,
+								uint16_t *respLen);
+isodep_status_t isodep_deselect(isodep_t *d);
+
+/* Frame hooks. The transceive sends `len` bytes of `frame` with the CRC_A
+ * appended in the two bytes after them, and receives a frame of up to
+ * `backLen` bytes whose CRC_A it checks and strips, waiting `timeoutUs`
+ * for it. Returns an MFRC522_Status value, 0 on success. */
+uint8_t isodep_pcd_transceive(uint8_t *frame, uint16_t len, uint8_t *back,
+							  uint16_t *backLen, uint32_t timeoutUs);
+void isodep_pcd_wait_us(uint32_t us);
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "utils.h"
+
+/* LED pattern engine. Each frame is precomputed as one BSRR word per port
+ * and time slot, TIM1 compare events make DMA stream the words to the GPIO
+ * ports, so refreshing the LEDs costs no CPU time.
+ *
+ * Brightness uses binary code modulation: bit plane b of the level is shown
+ * for 2^b slots, a frame has LEDS_SLOTS slots. */
+
+#define LEDS_BCM_BITS 4
+#define LEDS_MAX_LEVEL ((1 << LEDS_BCM_BITS) - 1)
+#define LEDS_SLOTS LEDS_MAX_LEVEL
+/* 200 Hz frame rate */
+#define LEDS_SLOT_HZ (200 * LEDS_SLOTS)
+
+#define LEDS_MAX 16
+/* Every port needs its own DMA channel */
+#define LEDS_MAX_PORTS 3
+
+/* Configures the pins as outputs and starts streaming an all-off frame.
+ * Sets up and starts TIM1, which nothing else uses. Returns false if the
+ * pins are spread over more than LEDS_MAX_PORTS ports. */
+bool leds_init(const port_pin_t *pins, uint8_t count);
+
+/* Brightness levels only take effect on leds_commit() */
+void leds_set(uint8_t index, uint8_t level);
+/* LED i at full brightness if bit i is set, off otherwise */
+void leds_set_mask(uint32_t mask);
+/* Rebuilds the BSRR words of the frame being streamed */
+void leds_commit(void);
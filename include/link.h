@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Transport of the command protocol, chosen at build time. The default is
+ * USB CDC-ACM (cdc_stream.h); `make LINK=uart` uses USART1 (uart_stream.h)
+ * for readers without USB in the field. */
+
+#ifdef LINK_UART
+
+#include "idle.h"
+#include "uart_stream.h"
+
+#define LINK_CHUNK 64
+/* Whether card events are on by default */
+#define LINK_EVENTS true
+/* Nothing on a UART tells whether a host listens. It counts as there from
+ * its first request on, and as gone once it sent none for this long: a host
+ * that wants its events live keeps polling, e.g. for the flash log. */
+#define LINK_HOST_TIMEOUT_MS 3000
+
+/* RTC time of the last request (idle.h), kept in src/proto.c */
+extern uint32_t link_host_seen_at;
+extern bool link_host_seen;
+
+static inline void link_init(void) { uart_stream_init(UART_STREAM_BAUD); }
+/* A well formed request came in */
+static inline void link_seen(void) {
+	link_host_seen_at = idle_now();
+	link_host_seen = true;
+}
+static inline bool link_ready(void) {
+	return link_host_seen &&
+		   idle_now() - link_host_seen_at < IDLE_MS(LINK_HOST_TIMEOUT_MS);
+}
+static inline uint16_t link_write(const void *data, uint16_t len) {
+	return uart_stream_write(data, len);
+}
+static inline uint16_t link_read(void *data, uint16_t len) {
+	return uart_stream_read(data, len);
+}
+static inline uint16_t link_tx_free(void) { return uart_stream_tx_free(); }
+static inline uint16_t link_rx_available(void) {
+	return uart_stream_rx_available();
+}
+/* No out of band channel, card events go to the flash log (flashlog.h) */
+static inline bool link_notify(const void *data, uint16_t len) {
+	(void)data;
+	(void)len;
+	return false;
+}
+
+#else
+
+#include "cdc_stream.h"
+
+#define LINK_CHUNK CDC_STREAM_PACKET
+#define LINK_EVENTS true
+
+static inline void link_init(void) { cdc_stream_init(); }
+static inline void link_seen(void) {}
+static inline bool link_ready(void) { return cdc_stream_configured(); }
+static inline uint16_t link_write(const void *data, uint16_t len) {
+	return cdc_stream_write(data, len);
+}
+static inline uint16_t link_read(void *data, uint16_t len) {
+	return cdc_stream_read(data, len);
+}
+static inline uint16_t link_tx_free(void) { return cdc_stream_tx_free(); }
+static inline uint16_t link_rx_available(void) {
+	return cdc_stream_rx_available();
+}
+static inline bool link_notify(const void *data, uint16_t len) {
+	return cdc_stream_notify(data, len);
+}
+
+#endif
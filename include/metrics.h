@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fmt.h"
+
+/* Runtime metrics: counters, gauges and log2 histograms, registered at build
+ * time in METRICS below and kept in one array of 32-bit words. No target
+ * specific code in here.
+ *
+ * Every update is one atomic read-modify-write of a word, LDREX/STREX on
+ * the Cortex-M3, so interrupt handlers and thread mode update the same
+ * metric without masking interrupts. They cost a few cycles (metric_inc and
+ * metric_observe in `make bench`) and stay on in every build.
+ *
+ * Readers copy the words while the firmware runs: the METRICS_ITM_PORT
+ * report, PROTO_OP_METRICS, or the debugger reading metrics_words. Each word
+ * is consistent on its own; a histogram copied during an update may be one
+ * sample apart between its buckets and its sum. */
+
+/* ITM stimulus port of the periodic report in main.c */
+#define METRICS_ITM_PORT 5
+/* Longest metrics_format() line */
+#define METRICS_LINE_MAX 256
+
+/* A histogram has a bucket for 0, bucket b for [2^(b-1), 2^b) and the last
+ * one for everything from 2^(METRICS_BUCKETS-2) up, followed by the sum of
+ * all samples */
+#define METRICS_BUCKETS 16
+
+#define METRICS_SIZE_COUNTER 1
+#define METRICS_SIZE_GAUGE 1
+#define METRICS_SIZE_HIST (METRICS_BUCKETS + 1)
+
+/* X(name, kind) */
+#define METRICS(X)                                                             \
+	/* UIDs read by MFRC522_Select() or MFRC522_SelectKnown() */               \
+	X(card_reads, COUNTER)                                                     \
+	/* Frames sent to a card and how they ended. Not counted: REQA and WUPA    \
+	 * in an empty field, and the silence after HLTA. */                       \
+	X(pcd_exchanges, COUNTER)                                                  \
+	X(pcd_crc_wrong, COUNTER)                                                  \
+	X(pcd_timeouts, COUNTER)                                                   \
+	X(pcd_collisions, COUNTER)                                                 \
+	X(pcd_errors, COUNTER)                                                     \
+	/* Address and data bytes of MFRC522 register accesses */                  \
+	X(mfrc522_bus_bytes, COUNTER)                                              \
+	/* HC-SR04 pulses longer than HCSR04_MAX_ECHO_US, nothing in range */      \
+	X(echo_timeouts, COUNTER)                                                  \
+	X(echo_mm, GAUGE)                                                          \
+	X(echo_us, HIST)                                                           \
+	/* From arrival to departure, READ_PICC */                                 \
+	X(card_dwell_ms, HIST)                                                     \
+	/* Arrivals decided by the access list, acl.h */                           \
+	X(acl_allowed, COUNTER)                                                    \
+	X(acl_denied, COUNTER)                                                     \
+	/* Decoded request frames, PROTO_OP_* */                                   \
+	X(proto_request_bytes, HIST)
+
+typedef enum {
+	METRICS_COUNTER,
+	METRICS_GAUGE,
+	METRICS_HIST,
+} metrics_kind_t;
+
+/* METRIC_<name> is the index of the metric's first word */
+enum {
+#define METRICS_OFFSET(name, kind)                                             \
+	METRIC_##name,                                                             \
+		METRIC_##name##_last = METRIC_##name + METRICS_SIZE_##kind - 1,
+	METRICS(METRICS_OFFSET)
+#undef METRICS_OFFSET
+		METRICS_WORDS
+};
+
+enum {
+#define METRICS_INDEX(name, kind) METRICS_INDEX_##name,
+	METRICS(METRICS_INDEX)
+#undef METRICS_INDEX
+		METRICS_COUNT
+};
+
+typedef struct {
+	const char *name;
+	metrics_kind_t kind;
+	uint16_t first;
+} metrics_info_t;
+
+extern uint32_t metrics_words[METRICS_WORDS];
+
+static inline void metric_add(uint16_t metric, uint32_t n) {
+	__atomic_fetch_add(&metrics_words[metric], n, __ATOMIC_RELAXED);
+}
+
+static inline void metric_inc(uint16_t metric) { metric_add(metric, 1); }
+
+static inline void metric_set(uint16_t metric, uint32_t value) {
+	__atomic_store_n(&metrics_words[metric], value, __ATOMIC_RELAXED);
+}
+
+static inline uint8_t metrics_bucket(uint32_t value) {
+	uint8_t b = value ? 32 - __builtin_clz(value) : 0;
+	return b < METRICS_BUCKETS - 1 ? b : METRICS_BUCKETS - 1;
+}
+
+static inline void metric_observe(uint16_t metric, uint32_t value) {
+	metric_inc(metric + metrics_bucket(value));
+	metric_add(metric + METRICS_BUCKETS, value);
+}
+
+/* Metric `i` of METRICS_COUNT, in the order of METRICS */
+const metrics_info_t *metrics_info(uint8_t i);
+/* Copies `count` words from `first` on, one atomic load each */
+void metrics_snapshot(uint32_t *out, uint16_t first, uint16_t count);
+/* One line for metric `i` from a whole snapshot, with the newline:
+ *   metric <name> counter <n>
+ *   metric <name> gauge <n>
+ *   metric <name> hist count=<n> sum=<n> buckets=<n>,<n>,...
+ * False if there is no metric `i`. */
+bool metrics_write(const fmt_sink_t *s, uint8_t i, const uint32_t *words);
+/* The same into `buf`, returns the length as snprintf() does */
+int metrics_format(char *buf, size_t size, uint8_t i, const uint32_t *words);
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* MIFARE Classic value blocks and tear safe purse transactions on top of
+ * them. No target specific code in here: the card is reached through the
+ * hooks at the end, implemented on the driver in src/mf_value_port.c and by
+ * the host model in host/mfclassic_sim.c.
+ *
+ * A purse is a value block plus a backup value block in the same sector,
+ * both with the same access conditions. A debit or credit runs
+ *
+ *   1. INCREMENT/DECREMENT the value block, TRANSFER to the backup block
+ *   2. RESTORE the backup block, TRANSFER to the value block
+ *
+ * The backup TRANSFER is the commit point. A tear before it leaves the
+ * backup unchanged or unreadable and the value block as it was; a tear
+ * after it leaves a valid backup that differs from the value block, and the
+ * next transaction on the purse copies it over before doing anything else.
+ * A transaction reported as failed may still have committed, so a caller
+ * retrying it should compare the balance with tx.before first. */
+
+#define MF_BLOCK_SIZE 16
+#define MF_KEY_SIZE 6
+/* The 4 UID bytes MFAuthent takes, the last 4 of a 7 byte UID */
+#define MF_UID_SIZE 4
+
+/* Same as PICC_CMD_MF_*, mfrc522.h needs the target headers */
+#define MF_AUTH_KEY_A 0x60
+#define MF_AUTH_KEY_B 0x61
+#define MF_OP_DECREMENT 0xC0
+#define MF_OP_INCREMENT 0xC1
+#define MF_OP_RESTORE 0xC2
+
+typedef struct {
+	uint8_t block;
+	uint8_t backup;
+	/* MF_AUTH_KEY_A or MF_AUTH_KEY_B */
+	uint8_t keyType;
+	uint8_t key[MF_KEY_SIZE];
+} mf_purse_t;
+
+typedef enum {
+	MF_VALUE_OK,
+	/* A card exchange failed, its MFRC522_Status is in tx.card */
+	MF_VALUE_CARD,
+	/* Neither block holds a valid value, the purse needs mf_purse_format() */
+	MF_VALUE_CORRUPT,
+	MF_VALUE_FUNDS,
+	/* Amount not positive, or the balance would overflow */
+	MF_VALUE_RANGE,
+} mf_value_status_t;
+
+typedef struct {
+	/* Committed balance before and after the transaction */
+	int32_t before;
+	int32_t after;
+	/* A torn earlier transaction was completed first */
+	bool recovered;
+	uint8_t card;
+} mf_value_tx_t;
+
+/* Value block layout (MF1S50 8.6.2.1): value, ~value, value as little
+ * endian 32-bit words, then addr, ~addr, addr, ~addr */
+void mf_value_encode(uint8_t *block, int32_t value, uint8_t addr);
+/* False if the block is not in value block format. `addr` may be NULL. */
+bool mf_value_decode(const uint8_t *block, int32_t *value, uint8_t *addr);
+
+/* Writes `value` into both blocks, backup first */
+mf_value_status_t mf_purse_format(const mf_purse_t *p, const uint8_t *uid,
+								  int32_t value, mf_value_tx_t *tx);
+/* Committed balance into tx.before, finishing a torn transaction */
+mf_value_status_t mf_purse_balance(const mf_purse_t *p, const uint8_t *uid,
+								   mf_value_tx_t *tx);
+mf_value_status_t mf_purse_debit(const mf_purse_t *p, const uint8_t *uid,
+								 int32_t amount, mf_value_tx_t *tx);
+mf_value_status_t mf_purse_credit(const mf_purse_t *p, const uint8_t *uid,
+								  int32_t amount, mf_value_tx_t *tx);
+
+/* Card hooks for the selected card, each returns an MFRC522_Status value,
+ * 0 on success */
+uint8_t mf_card_auth(uint8_t keyType, uint8_t block, const uint8_t *key,
+					 const uint8_t *uid);
+uint8_t mf_card_read(uint8_t block, uint8_t *data);
+uint8_t mf_card_write(uint8_t block, const uint8_t *data);
+/* Both parts of INCREMENT, DECREMENT or RESTORE */
+uint8_t mf_card_operate(uint8_t op, uint8_t block, int32_t operand);
+uint8_t mf_card_transfer(uint8_t block);
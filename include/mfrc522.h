@@ -4,6 +4,7 @@
 #include <libopencm3/stm32/spi.h>
 #include <stdint.h>
 
+#include "pbuf.h"
 #include "utils.h"
 
 typedef enum {
@@ -15,6 +16,7 @@ typedef enum {
 	STATUS_INTERNAL_ERROR, // Internal error in the code. Should not happen ;-)
 	STATUS_INVALID,		   // Invalid argument.
 	STATUS_CRC_WRONG,	   // The CRC_A does not match
+	STATUS_MISMATCH,	   // Data read back differs from what was written
 	STATUS_MIFARE_NACK = 0xff // A MIFARE PICC responded with NAK.
 } MFRC522_Status;
 
@@ -226,23 +228,68 @@ typedef struct {
 #define PICC_CMD_MF_TRANSFER 0xB0
 // Writes one 4 byte page to the PICC.
 #define PICC_CMD_UL_WRITE 0xA2
-
-void MFRC522_SetBitMask(uint8_t reg, uint8_t mask);
-void MFRC522_ClearBitMask(uint8_t reg, uint8_t mask);
-
-uint8_t MFRC522_ReadCharFromReg(uint8_t reg);
-void MFRC522_ReadArrayFromReg(uint8_t reg, uint8_t length, uint8_t *outArray);
-
-void MFRC522_WriteCharToReg(uint8_t reg, uint8_t value);
-void MFRC522_WriteArrayToReg(uint8_t reg, uint8_t length, uint8_t *array);
+// Product, version and memory size. Ultralight EV1 and NTAG21x only.
+#define PICC_CMD_UL_GET_VERSION 0x60
+// Reads an inclusive range of pages in one frame. Ultralight EV1 and
+// NTAG21x only.
+#define PICC_CMD_UL_FAST_READ 0x3A
+
+// A 4 bit ACK to MIFARE commands, anything else in 4 bits is a NAK
+#define MIFARE_ACK 0x0A
+
+/* The MFRC522 timer set up by MFRC522_Init(): 13.56 MHz / (2 * 0xA9 + 1),
+ * 339 clocks or 25 us a tick */
+#define PCD_TIMER_PRESCALER 0xA9
+#define PCD_TIMER_TICK_US 25
+#define PCD_TIMER_TICK_CLOCKS 339
+/* Longest timeout, 0xffff ticks of the largest prescaler, 0xfff */
+#define PCD_TIMEOUT_MAX_US 39586000
+/* Response timeout of every command */
+#define PCD_TIMEOUT_US 25000
+#define PCD_FIFO_SIZE 64
+/* MFRC522_WaitReady(): the crystal oscillator starts within a few ms of
+ * power up, the main loop used to wait a flat 200 ms */
+#define PCD_READY_TIMEOUT_US 200000
+#define PCD_READY_POLL_US 100
+/* LoAlert with this many bytes left in the FIFO, HiAlert with this much
+ * room left. At 106 kbit/s that is 1.3 ms to react in. */
+#define PCD_WATER_LEVEL 16
+/* Wait for a NAK after the silent second part of INCREMENT, DECREMENT and
+ * RESTORE. A NAK comes within the frame delay time, well below this. */
+#define MIFARE_SILENT_TIMEOUT_US 1000
+/* A card not matching a SELECT stays silent, one that does answers within
+ * the frame delay time */
+#define PICC_SELECT_TIMEOUT_US 1000
+
+/* Register accessors run from SRAM, they are on every hot path */
+RAMFUNC void MFRC522_SetBitMask(uint8_t reg, uint8_t mask);
+RAMFUNC void MFRC522_ClearBitMask(uint8_t reg, uint8_t mask);
+
+RAMFUNC uint8_t MFRC522_ReadCharFromReg(uint8_t reg);
+RAMFUNC void MFRC522_ReadArrayFromReg(uint8_t reg, uint8_t length,
+									  uint8_t *outArray);
+
+RAMFUNC void MFRC522_WriteCharToReg(uint8_t reg, uint8_t value);
+RAMFUNC void MFRC522_WriteArrayToReg(uint8_t reg, uint8_t length,
+									 uint8_t *array);
 
 void MFRC522_Init();
 void MFRC522_Reset();
+/* Polls until the chip answers after a power up: VersionReg reads back a
+ * version and PowerDown in CommandReg is clear. False after `timeoutUs`.
+ * Needs the DWT cycle counter; on the UART bus the first read blocks until
+ * the chip answers. */
+bool MFRC522_WaitReady(uint32_t timeoutUs);
 void MFRC522_AntennaOn();
 void MFRC522_AntennaOff();
 bool MFRC522_SelfTest();
 void MFRC522_RandomId(uint8_t *outId);
 void MFRC522_WaitForFifoLefel(uint8_t fifoSize);
+/* Reloads the timer, the timeout starts at the end of each transmission.
+ * Up to 0xffff ticks of 25 us, about 1.6 s; longer timeouts, e.g. the frame
+ * waiting time of ISO 14443-4 with FWI 14 or a waiting time extension,
+ * take a larger prescaler and coarser ticks, up to PCD_TIMEOUT_MAX_US. */
+void PCD_SetTimeoutUs(uint32_t us);
 
 MFRC522_Status PCD_TransceiveData(
 	// Pointer to the data to transfer to the FIFO.
@@ -263,6 +310,11 @@ MFRC522_Status PCD_TransceiveData(
 	uint8_t rxAlign);
 
 MFRC522_Status MFRC522_Select(MFRC522_UID_t *uid);
+/* Selects a card whose UID is known from an earlier MFRC522_Select():
+ * WUPA and one SELECT per cascade level, no ANTICOLLISION and no CRC on the
+ * MFRC522. If that card does not answer, falls back to WUPA and the full
+ * MFRC522_Select(), so `uid` may come back holding another card. */
+MFRC522_Status MFRC522_SelectKnown(MFRC522_UID_t *uid);
 
 MFRC522_Status PCD_CalculateCRC(uint8_t *data, uint8_t length, uint8_t *result);
 
@@ -302,6 +354,54 @@ MFRC522_Status MIFARE_Read(
 	// STATUS_OK.
 	uint8_t *bufferSize);
 
+/* Zero-copy variants working on pool buffers (see pbuf.h) */
+
+/* Appends the CRC_A of the payload into the tailroom */
+MFRC522_Status PCD_AppendCRC(pbuf_t *p);
+/* Sends the payload of `p` and receives the response into the same buffer,
+ * with the full headroom restored. With `checkCRC` the CRC_A is verified and
+ * dropped, so only the response data is left. */
+MFRC522_Status PCD_TransceivePbuf(pbuf_t *p, uint8_t *validBits,
+								  uint8_t rxAlign, bool checkCRC);
+/* Leaves the 16 data bytes of the block in `p` */
+MFRC522_Status MIFARE_ReadBlock(pbuf_t *p, uint8_t blockAddr);
+
+/* Back-to-back frames for long transfers (see ultralight.h) */
+
+/* CRC_A (ISO/IEC 14443-3) computed on the MCU, low byte first on the air.
+ * Over a frame including its CRC_A it is 0. */
+uint16_t PICC_CRC_A(const uint8_t *data, uint16_t length);
+
+/* Leaves CMD_TRANSCEIVE running for PCD_TransceiveStream() */
+void PCD_StartTransceive(void);
+/* Sends a frame that already carries its CRC_A while the transceive command
+ * keeps running and receives the response. Both may be longer than the
+ * FIFO: it is topped up on LoAlert while sending and drained on HiAlert
+ * while receiving. Nothing is checked beyond the MFRC522 error flags;
+ * `backLen` holds the room in `backData` on the way in. */
+RAMFUNC MFRC522_Status PCD_TransceiveStream(const uint8_t *sendData,
+											uint16_t sendLen,
+											uint8_t *backData,
+											uint16_t *backLen,
+											uint8_t *validBits);
+
+/* MIFARE Classic, see mf_value.h for the value block engine */
+
+/* MFAuthent for the sector of `blockAddr` with PICC_CMD_MF_AUTH_KEY_A or _B
+ * and a 6 byte key. From here on the MFRC522 encrypts the traffic until
+ * PCD_StopCrypto1(). */
+MFRC522_Status PCD_Authenticate(uint8_t command, uint8_t blockAddr,
+								const uint8_t *key, const MFRC522_UID_t *uid);
+void PCD_StopCrypto1();
+/* Writes 16 bytes in the two parts of the WRITE command */
+MFRC522_Status MIFARE_Write(uint8_t blockAddr, const uint8_t *data);
+/* PICC_CMD_MF_INCREMENT, _DECREMENT or _RESTORE of a value block into the
+ * card's transfer buffer. Nothing is stored before MIFARE_Transfer(). */
+MFRC522_Status MIFARE_Operate(uint8_t command, uint8_t blockAddr,
+							  int32_t operand);
+/* Writes the transfer buffer to a value block of the same sector */
+MFRC522_Status MIFARE_Transfer(uint8_t blockAddr);
+
 MFRC522_Status PICC_RequestA(
 	// The buffer to store the ATQA (Answer to request) in
 	uint8_t *bufferATQA,
@@ -309,4 +409,14 @@ MFRC522_Status PICC_RequestA(
 	// STATUS_OK.
 	uint8_t *bufferSize);
 
+MFRC522_Status PICC_WakeupA(
+	// The buffer to store the ATQA (Answer to request) in
+	uint8_t *bufferATQA,
+	// Buffer size, at least two bytes. Also number of bytes returned if
+	// STATUS_OK.
+	uint8_t *bufferSize);
+
+// Instructs a PICC in state ACTIVE(*) to go to state HALT.
+MFRC522_Status PICC_HaltA();
+
 bool PICC_IsNewCardPresent();
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Register access to the MFRC522 over the host interface chosen at build
+ * time, `make MFRC522_BUS=spi|uart|i2c`. Every back-end provides the same
+ * primitives as static inline functions, so the driver compiles down to
+ * direct bus accesses:
+ *
+ *   mfrc522_bus_init()       after power up and after every soft reset
+ *   mfrc522_bus_reset()      right after a soft reset was requested
+ *   mfrc522_bus_read(reg)    mfrc522_bus_write(reg, value)
+ *   mfrc522_bus_read_burst(reg, len, out)
+ *   mfrc522_bus_write_burst(reg, len, data)
+ *
+ * Only the framing is in here, no target specific code. It sits on byte
+ * level hooks that the including port header declares first: the firmware
+ * port in mfrc522_port.h, the host simulator in host/mfrc522_sim.h.
+ *
+ *   spi:  mfrc522_spi_select(), mfrc522_spi_deselect(), mfrc522_spi_xfer()
+ *   uart: mfrc522_uart_put(), mfrc522_uart_get(), mfrc522_uart_set_baud()
+ *   i2c:  mfrc522_i2c_write(), mfrc522_i2c_read(), whole transactions
+ *
+ * The chip picks its interface from the I2C and EA pins at power up. */
+
+/* The MFRC522 register file has 6-bit addresses */
+#define MFRC522_BUS_ADDR_MASK 0x3f
+/* SerialSpeedReg and its value after reset, 9600 baud */
+#define MFRC522_BUS_SERIAL_SPEED_REG 0x1f
+#define MFRC522_BUS_UART_RESET_BAUD 9600
+
+/* UART rate switched to by mfrc522_bus_init() */
+#ifndef MFRC522_UART_BAUD
+#define MFRC522_UART_BAUD 1228800
+#endif
+/* I2C address with the ADR pins as wired on the common modules */
+#define MFRC522_I2C_ADDR 0x28
+
+#if defined(MFRC522_BUS_UART)
+
+#define MFRC522_BUS_NAME "uart"
+
+/* SerialSpeedReg settings from the datasheet, table 10 */
+static inline uint8_t mfrc522_bus_serial_speed(uint32_t baud) {
+	static const struct {
+		uint32_t baud;
+		uint8_t reg;
+	} speeds[] = {
+		{7200, 0xfa},	 {9600, 0xeb},	 {14400, 0xda},	 {19200, 0xcb},
+		{38400, 0xab},	 {57600, 0x9a},	 {115200, 0x7a}, {128000, 0x74},
+		{230400, 0x5a},	 {460800, 0x3a}, {921600, 0x1c}, {1228800, 0x15},
+	};
+	for (uint8_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+		if (speeds[i].baud == baud) {
+			return speeds[i].reg;
+		}
+	}
+	return 0xeb;
+}
+
+/* Address byte: bit 7 set for a read, the address unshifted. There is no
+ * burst mode, the MFRC522 answers every read with one byte and every write
+ * by echoing the address byte. */
+static inline uint8_t mfrc522_bus_read(uint8_t reg) {
+	mfrc522_uart_put(0x80 | (reg & MFRC522_BUS_ADDR_MASK));
+	return mfrc522_uart_get();
+}
+
+static inline void mfrc522_bus_write(uint8_t reg, uint8_t value) {
+	mfrc522_uart_put(reg & MFRC522_BUS_ADDR_MASK);
+	mfrc522_uart_put(value);
+	(void)mfrc522_uart_get();
+}
+
+static inline void mfrc522_bus_read_burst(uint8_t reg, uint8_t len,
+										  uint8_t *out) {
+	for (uint8_t i = 0; i < len; i++) {
+		out[i] = mfrc522_bus_read(reg);
+	}
+}
+
+static inline void mfrc522_bus_write_burst(uint8_t reg, uint8_t len,
+										   const uint8_t *data) {
+	for (uint8_t i = 0; i < len; i++) {
+		mfrc522_bus_write(reg, data[i]);
+	}
+}
+
+/* The chip comes out of reset at 9600 baud. The echo of the SerialSpeedReg
+ * write still comes at the old rate. */
+static inline void mfrc522_bus_init(void) {
+	mfrc522_bus_write(MFRC522_BUS_SERIAL_SPEED_REG,
+					  mfrc522_bus_serial_speed(MFRC522_UART_BAUD));
+	mfrc522_uart_set_baud(MFRC522_UART_BAUD);
+}
+
+static inline void mfrc522_bus_reset(void) {
+	mfrc522_uart_set_baud(MFRC522_BUS_UART_RESET_BAUD);
+}
+
+#elif defined(MFRC522_BUS_I2C)
+
+#define MFRC522_BUS_NAME "i2c"
+
+/* Multi-byte accesses all go to the same register, which is what the FIFO
+ * needs */
+static inline uint8_t mfrc522_bus_read(uint8_t reg) {
+	uint8_t value;
+	mfrc522_i2c_read(reg & MFRC522_BUS_ADDR_MASK, &value, 1);
+	return value;
+}
+
+static inline void mfrc522_bus_write(uint8_t reg, uint8_t value) {
+	mfrc522_i2c_write(reg & MFRC522_BUS_ADDR_MASK, &value, 1);
+}
+
+static inline void mfrc522_bus_read_burst(uint8_t reg, uint8_t len,
+										  uint8_t *out) {
+	if (len) {
+		mfrc522_i2c_read(reg & MFRC522_BUS_ADDR_MASK, out, len);
+	}
+}
+
+static inline void mfrc522_bus_write_burst(uint8_t reg, uint8_t len,
+										   const uint8_t *data) {
+	if (len) {
+		mfrc522_i2c_write(reg & MFRC522_BUS_ADDR_MASK, data, len);
+	}
+}
+
+static inline void mfrc522_bus_init(void) {}
+static inline void mfrc522_bus_reset(void) {}
+
+#else
+
+#define MFRC522_BUS_NAME "spi"
+
+/* Address byte: bit 7 set for a read, the address in bits 6-1. In a burst
+ * read every byte clocked out is the address of the next read, the final
+ * 0x00 ends it. */
+static inline uint8_t mfrc522_bus_read(uint8_t reg) {
+	uint8_t value;
+	mfrc522_spi_select();
+	mfrc522_spi_xfer(0x80 | ((reg & MFRC522_BUS_ADDR_MASK) << 1));
+	value = mfrc522_spi_xfer(0x00);
+	mfrc522_spi_deselect();
+	return value;
+}
+
+static inline void mfrc522_bus_write(uint8_t reg, uint8_t value) {
+	mfrc522_spi_select();
+	mfrc522_spi_xfer((reg & MFRC522_BUS_ADDR_MASK) << 1);
+	mfrc522_spi_xfer(value);
+	mfrc522_spi_deselect();
+}
+
+static inline void mfrc522_bus_read_burst(uint8_t reg, uint8_t len,
+										  uint8_t *out) {
+	if (len == 0) {
+		return;
+	}
+	const uint8_t addr = 0x80 | ((reg & MFRC522_BUS_ADDR_MASK) << 1);
+	mfrc522_spi_select();
+	mfrc522_spi_xfer(addr);
+	uint8_t i = 0;
+	for (; i < len - 1; i++) {
+		out[i] = mfrc522_spi_xfer(addr);
+	}
+	out[i] = mfrc522_spi_xfer(0x00);
+	mfrc522_spi_deselect();
+}
+
+static inline void mfrc522_bus_write_burst(uint8_t reg, uint8_t len,
+										   const uint8_t *data) {
+	mfrc522_spi_select();
+	mfrc522_spi_xfer((reg & MFRC522_BUS_ADDR_MASK) << 1);
+	for (uint8_t i = 0; i < len; i++) {
+		mfrc522_spi_xfer(data[i]);
+	}
+	mfrc522_spi_deselect();
+}
+
+static inline void mfrc522_bus_init(void) {}
+static inline void mfrc522_bus_reset(void) {}
+
+#endif
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "board.h"
+#include "utils.h"
+
+/* Firmware hooks under mfrc522_bus.h, on the pins of the board header. The
+ * SPI and UART byte hooks are register level and inline, so that they end up
+ * inside the RAMFUNC register accessors; I2C goes through libopencm3. */
+
+/* Sets up the peripheral of the selected bus and keeps its clock divider
+ * right across clock profile switches */
+void mfrc522_port_init(void);
+
+#if defined(MFRC522_BUS_UART)
+
+static inline void mfrc522_uart_put(uint8_t byte) {
+	while (!(USART_SR(BOARD_MFRC522_USART) & USART_SR_TXE)) {
+	}
+	USART_DR(BOARD_MFRC522_USART) = byte;
+}
+
+static inline uint8_t mfrc522_uart_get(void) {
+	while (!(USART_SR(BOARD_MFRC522_USART) & USART_SR_RXNE)) {
+	}
+	return USART_DR(BOARD_MFRC522_USART);
+}
+
+void mfrc522_uart_set_baud(uint32_t baud);
+
+#elif defined(MFRC522_BUS_I2C)
+
+void mfrc522_i2c_write(uint8_t reg, const uint8_t *data, uint8_t len);
+void mfrc522_i2c_read(uint8_t reg, uint8_t *out, uint8_t len);
+
+#else
+
+static inline void mfrc522_spi_select(void) {
+	board_pin_clear(BOARD_MFRC522_NSS);
+}
+
+static inline void mfrc522_spi_deselect(void) {
+	board_pin_set(BOARD_MFRC522_NSS);
+}
+
+static inline uint8_t mfrc522_spi_xfer(uint8_t byte) {
+	return spi_transfer(BOARD_MFRC522_SPI, byte);
+}
+
+#endif
+
+#include "mfrc522_bus.h"
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Fixed size frame buffers for PICC transactions. The payload sits between
+ * headroom for the command bytes and tailroom for the CRC_A, so a command is
+ * built around the data in place, sent from the buffer and the response is
+ * read from the FIFO straight back into it. No target specific code in
+ * here. Buffers are taken from a small static pool; allocation is not
+ * interrupt safe, all PICC traffic runs from the main loop.
+ *
+ * A buffer holds what fits into the FIFO. Frames streamed through it with
+ * PCD_TransceiveStream() are longer and keep their own buffers: the FAST_READ
+ * response of ultralight.c and the tx and rx frames of isodep_t. A pool of
+ * 256 byte buffers would cost PBUF_COUNT times that in RAM for every
+ * transaction that needs 18 bytes. */
+
+/* Command and block address */
+#define PBUF_HEADROOM 2
+/* The MFRC522 FIFO */
+#define PBUF_DATA 64
+/* CRC_A */
+#define PBUF_TAILROOM 2
+#define PBUF_SIZE (PBUF_HEADROOM + PBUF_DATA + PBUF_TAILROOM)
+#define PBUF_COUNT 4
+
+typedef struct {
+	/* Payload is buf[off .. off + len) */
+	uint8_t off;
+	uint8_t len;
+	uint8_t buf[PBUF_SIZE];
+} pbuf_t;
+
+/* Returns an empty buffer with the full headroom, NULL if all are in use */
+pbuf_t *pbuf_alloc(void);
+void pbuf_free(pbuf_t *p);
+/* Buffers currently free, for checking leaks */
+uint8_t pbuf_available(void);
+
+/* Empties the buffer and restores the headroom */
+static inline void pbuf_reset(pbuf_t *p) {
+	p->off = PBUF_HEADROOM;
+	p->len = 0;
+}
+
+static inline uint8_t *pbuf_data(pbuf_t *p) { return &p->buf[p->off]; }
+
+static inline uint8_t pbuf_tailroom(const pbuf_t *p) {
+	return PBUF_SIZE - p->off - p->len;
+}
+
+/* Grows the payload by `n` bytes at the front, returns the new start or NULL
+ * without enough headroom */
+static inline uint8_t *pbuf_push(pbuf_t *p, uint8_t n) {
+	if (n > p->off) {
+		return NULL;
+	}
+	p->off -= n;
+	p->len += n;
+	return &p->buf[p->off];
+}
+
+/* Drops `n` bytes from the front */
+static inline uint8_t *pbuf_pull(pbuf_t *p, uint8_t n) {
+	if (n > p->len) {
+		n = p->len;
+	}
+	p->off += n;
+	p->len -= n;
+	return &p->buf[p->off];
+}
+
+/* Grows the payload by `n` bytes at the end, returns the start of the new
+ * bytes or NULL without enough tailroom */
+static inline uint8_t *pbuf_put(pbuf_t *p, uint8_t n) {
+	if (n > pbuf_tailroom(p)) {
+		return NULL;
+	}
+	uint8_t *tail = &p->buf[p->off + p->len];
+	p->len += n;
+	return tail;
+}
+
+/* Drops `n` bytes from the end */
+static inline void pbuf_trim(pbuf_t *p, uint8_t n) {
+	p->len = n > p->len ? 0 : p->len - n;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Binary command/response protocol carried over the CDC data endpoints, or
+ * USART1 in a LINK=uart build (see link.h). Every message is one frame (see
+ * frame.h):
+ *
+ *   request:  [seq][op][payload...]
+ *   response: [seq][op | PROTO_RESPONSE][status][payload...]
+ *
+ * Requests may be pipelined, responses come back in request order. Status
+ * is one of the PROTO_STATUS_* values of MFRC522_Status, or one of the
+ * PROTO_ERR_* codes. */
+
+#define PROTO_RESPONSE 0x80
+
+/* -> [] <- [present] */
+#define PROTO_OP_POLL 0x01
+/* Wakes up and selects a card. -> [] <- [uid size][uid...][sak] */
+#define PROTO_OP_SELECT 0x02
+/* Reads 16-byte blocks of the selected card.
+ * -> [first block][count] <- [data: count * 16] */
+#define PROTO_OP_READ_RANGE 0x03
+/* Selects and halts every card in the field in turn.
+ * -> [max cards] <- [n] n * ([uid size][uid...][sak]) */
+#define PROTO_OP_INVENTORY 0x04
+/* -> [] <- proto_stats_t as little endian 32-bit words */
+#define PROTO_OP_STATS 0x05
+/* Enables card arrival events. -> [enable] <- [] */
+#define PROTO_OP_EVENTS 0x06
+/* Low power residency, see idle.h.
+ * -> [] <- idle_stats_t as little endian 32-bit words */
+#define PROTO_OP_IDLE_STATS 0x07
+/* Clock profile residency, see clock.h.
+ * -> [] <- clock_stats_t as little endian 32-bit words */
+#define PROTO_OP_CLOCK_STATS 0x08
+/* Identifies the selected Ultralight/NTAG21x tag, see ultralight.h. Needed
+ * once after each select before the two ops below.
+ * -> [] <- [type][pages][user first][user last][version: 8] */
+#define PROTO_OP_UL_INFO 0x09
+/* -> [first page][count] <- [data: count * 4] */
+#define PROTO_OP_UL_READ 0x0A
+/* User memory only, STATUS_INVALID for other pages.
+ * -> [first page][verify][data: count * 4] <- [] */
+#define PROTO_OP_UL_WRITE 0x0B
+/* Runtime metrics, see metrics.h: as many little endian words of
+ * metrics_words from `first` on as fit, and the total number of words.
+ * -> [first: 2] <- [total: 2][words...] */
+#define PROTO_OP_METRICS 0x0C
+/* Card arrivals logged to flash while nobody listened for events, see
+ * flashlog.h: as many as fit from the first unacknowledged one on, the same
+ * ones again until acknowledged.
+ * -> [] <- [pending: 4][n] n * ([seq: 4][len][record: len])
+ * record: [RTC ticks: 4][uid size][sak][uid...] */
+#define PROTO_OP_LOG_READ 0x0D
+/* Drops the logged events up to and including `seq`. -> [seq: 4] <- [] */
+#define PROTO_OP_LOG_ACK 0x0E
+/* Replaces the access list, see acl.h: a begin, the keys in ascending order
+ * over as many requests as needed, then a commit. Keys are acl_key() values,
+ * little endian. -> [phase][keys: n * 8] <- [] */
+#define PROTO_OP_ACL_LOAD 0x0F
+/* Changes to the access list, kept as deltas.
+ * -> n * ([op][key: 8]) <- [applied] */
+#define PROTO_OP_ACL_UPDATE 0x10
+/* -> [] <- acl_info_t as little endian 32-bit words */
+#define PROTO_OP_ACL_INFO 0x11
+/* -> [uid size][uid...] <- [allowed] */
+#define PROTO_OP_ACL_CHECK 0x12
+
+#define PROTO_ACL_BEGIN 0
+#define PROTO_ACL_KEYS 1
+#define PROTO_ACL_COMMIT 2
+
+/* MFRC522_Status (mfrc522.h) as the ops return it, for host code without
+ * the driver headers */
+#define PROTO_STATUS_OK 0
+#define PROTO_STATUS_ERROR 1
+#define PROTO_STATUS_COLLISION 2
+#define PROTO_STATUS_TIMEOUT 3
+#define PROTO_STATUS_NO_ROOM 4
+#define PROTO_STATUS_INVALID 6
+#define PROTO_STATUS_CRC_WRONG 7
+#define PROTO_STATUS_MISMATCH 8
+#define PROTO_STATUS_MIFARE_NACK 0xff
+
+#define PROTO_ERR_OP 0xf0
+#define PROTO_ERR_LENGTH 0xf1
+
+#define PROTO_MAX_READ_BLOCKS 15
+#define PROTO_MAX_INVENTORY 8
+#define PROTO_MAX_UL_PAGES 60
+#define PROTO_UL_INFO_SIZE 12
+#define PROTO_MAX_METRIC_WORDS 60
+#define PROTO_LOG_RECORD_MAX 16
+#define PROTO_MAX_ACL_KEYS 30
+#define PROTO_MAX_ACL_UPDATES 27
+
+/* Card arrival is pushed on the interrupt endpoint 0x83, shaped as a CDC
+ * notification so that the host ACM driver skips it:
+ * bmRequestType 0xa1, bNotification PROTO_EVENT_CARD, wValue event sequence
+ * number, wIndex 1 if the access list allows the card, wLength 12, then
+ * [uid size][sak][uid: 10 bytes] */
+#define PROTO_EVENT_CARD 0xc0
+#define PROTO_EVENT_HEADER 8
+#define PROTO_EVENT_SIZE (PROTO_EVENT_HEADER + 12)
+
+typedef struct {
+	uint32_t rx_frames;
+	/* Frames dropped for a bad CRC, COBS encoding or length */
+	uint32_t rx_bad_frames;
+	uint32_t rx_bad_ops;
+	uint32_t tx_frames;
+	uint32_t events;
+	/* Events not sent because the previous one was still in flight, or
+	 * there is no event channel (LINK=uart). They go to the flash log. */
+	uint32_t events_dropped;
+	/* Arrivals logged to flash, and those lost with the log full */
+	uint32_t events_logged;
+	uint32_t events_log_full;
+} proto_stats_t;
+
+/* Firmware side, see src/proto.c */
+void proto_init(void);
+/* Handles buffered requests and, when idle, looks for new cards */
+void proto_poll(void);
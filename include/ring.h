@@ -0,0 +1,82 @@
+#pragma once
+
+#include <libopencm3/cm3/sync.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Single-producer single-consumer byte ring. `head` is only written by the
+ * producer and `tail` only by the consumer, so one side may run in an
+ * interrupt without locking. Indexes run freely and wrap at 2^16; `size` must
+ * be a power of two not larger than 32768. */
+typedef struct {
+	uint8_t *buf;
+	uint16_t size;
+	volatile uint16_t head;
+	volatile uint16_t tail;
+} ring_t;
+
+static inline void ring_init(ring_t *r, uint8_t *buf, uint16_t size) {
+	r->buf = buf;
+	r->size = size;
+	r->head = 0;
+	r->tail = 0;
+}
+
+static inline uint16_t ring_used(const ring_t *r) {
+	return (uint16_t)(r->head - r->tail);
+}
+
+static inline uint16_t ring_free(const ring_t *r) {
+	return r->size - ring_used(r);
+}
+
+static inline uint16_t ring_write(ring_t *r, const uint8_t *data,
+								  uint16_t len) {
+	uint16_t n = ring_free(r);
+	if (len > n) {
+		len = n;
+	}
+	uint16_t at = r->head & (r->size - 1);
+	uint16_t first = r->size - at;
+	if (first > len) {
+		first = len;
+	}
+	memcpy(&r->buf[at], data, first);
+	memcpy(r->buf, data + first, len - first);
+	__dmb();
+	r->head += len;
+	return len;
+}
+
+/* Returns the number of bytes readable without wrapping and points `*data`
+ * at them. Follow up with ring_skip() once they have been consumed. */
+static inline uint16_t ring_peek(const ring_t *r, const uint8_t **data) {
+	uint16_t at = r->tail & (r->size - 1);
+	uint16_t n = ring_used(r);
+	if (n > r->size - at) {
+		n = r->size - at;
+	}
+	*data = &r->buf[at];
+	return n;
+}
+
+static inline void ring_skip(ring_t *r, uint16_t len) {
+	__dmb();
+	r->tail += len;
+}
+
+static inline uint16_t ring_read(ring_t *r, uint8_t *data, uint16_t len) {
+	uint16_t n = ring_used(r);
+	if (len > n) {
+		len = n;
+	}
+	uint16_t at = r->tail & (r->size - 1);
+	uint16_t first = r->size - at;
+	if (first > len) {
+		first = len;
+	}
+	memcpy(data, &r->buf[at], first);
+	memcpy(data + first, r->buf, len - first);
+	ring_skip(r, len);
+	return len;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Stack and RAM usage monitor. Thread mode runs on its own process stack
+ * (PSP) so that interrupt handlers, which always use the main stack (MSP),
+ * are measured separately. Both stacks are painted with STACKMON_PAINT and
+ * the high-water mark is the lowest overwritten word.
+ *
+ * RAM layout: [.data .bss (incl. thread stack)] [heap ->] ... [<- MSP] */
+
+#define STACKMON_THREAD_SIZE 4096
+#define STACKMON_PAINT 0xa5a5a5a5
+/* ITM stimulus port for stackmon_report(), 0-2 are printf and friends */
+#define STACKMON_ITM_PORT 3
+
+typedef struct {
+	uint32_t size;
+	/* High-water mark in bytes */
+	uint32_t used;
+} stackmon_stack_t;
+
+typedef struct {
+	stackmon_stack_t thread;
+	/* Interrupt handlers plus the startup code. The size is whatever the
+	 * heap leaves. */
+	stackmon_stack_t isr;
+	/* .data, .ramtext and .bss without the thread stack */
+	uint32_t static_bytes;
+	uint32_t heap_bytes;
+} stackmon_usage_t;
+
+/* Paints both stacks, switches thread mode to the process stack and runs
+ * `entry`, which must not return. Call first thing in main(). */
+void stackmon_start(void (*entry)(void)) __attribute__((noreturn));
+
+void stackmon_get(stackmon_usage_t *out);
+
+/* Writes one machine readable line to STACKMON_ITM_PORT:
+ *   mem thread=<used>/<size> isr=<used>/<size> static=<n> heap=<n> */
+void stackmon_report(void);
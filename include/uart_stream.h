@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Byte stream over USART1 with DMA in both directions, for when neither USB
+ * nor a debugger is at hand. RX is circular DMA into a ring; the write
+ * position is picked up on the half and full transfer interrupts and on the
+ * IDLE line interrupt, so a burst of any length is readable one character
+ * time after its last byte. TX drains a ring in one DMA transfer per
+ * contiguous run. Baud rates go up to APB2 / 16, 4.5 Mbaud at 72 MHz; rates
+ * the low clock profile cannot reach hold CLOCK_HIGH. See cdc_stream.h for
+ * the USB counterpart. */
+
+#define UART_STREAM_BAUD 2000000
+#define UART_STREAM_TX_SIZE 2048
+#define UART_STREAM_RX_SIZE 512
+
+typedef struct {
+	uint32_t tx_bytes;
+	uint32_t tx_dmas;
+	/* Writes truncated because the TX ring was full */
+	uint32_t tx_overruns;
+	uint32_t rx_bytes;
+	/* IDLE line events, one per received burst */
+	uint32_t rx_idles;
+	/* Times the DMA lapped the reader, the unread data is dropped */
+	uint32_t rx_overruns;
+	/* Framing, noise and USART overrun errors */
+	uint32_t rx_errors;
+} uart_stream_stats_t;
+
+/* Sets up USART1, its pins and DMA channels. Later calls only change the
+ * baud rate. */
+void uart_stream_init(uint32_t baud);
+void uart_stream_set_baud(uint32_t baud);
+
+/* Queues up to `len` bytes, returns the number of bytes accepted. Safe in
+ * interrupts, the copy into the ring runs with interrupts masked. */
+uint16_t uart_stream_write(const void *data, uint16_t len);
+/* Reads up to `len` received bytes, returns the number of bytes copied */
+uint16_t uart_stream_read(void *data, uint16_t len);
+uint16_t uart_stream_tx_free(void);
+uint16_t uart_stream_rx_available(void);
+/* Waits until the TX ring and the shift register are empty */
+void uart_stream_flush(void);
+
+void uart_stream_get_stats(uart_stream_stats_t *out);
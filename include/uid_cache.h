@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Recently seen card UIDs, turning the repeated selects of a card that sits
+ * on the antenna into arrival, dwell and departure events. A fixed number
+ * of slots with open addressing and linear probing; removal shifts the rest
+ * of the probe run back, so there are no tombstones. An entry not seen for
+ * `ttl` has departed. When the table is at its load limit the least
+ * recently seen entry is evicted, found by a scan as that only happens with
+ * more cards around than it was sized for. Times are in any free running
+ * unit that wraps at 2^32, the firmware uses RTC ticks (idle.h). No target
+ * specific code in here. */
+
+/* Same as the uid field of MFRC522_UID_t */
+#define UID_CACHE_UID_MAX 10
+
+typedef struct {
+	uint32_t hash;
+	uint32_t first_seen;
+	uint32_t last_seen;
+	/* Last arrival or dwell event */
+	uint32_t last_event;
+	/* 0 marks a free slot */
+	uint8_t size;
+	uint8_t uid[UID_CACHE_UID_MAX];
+} uid_cache_entry_t;
+
+typedef void (*uid_cache_departed_t)(const uid_cache_entry_t *e, void *ctx);
+
+typedef struct {
+	uid_cache_entry_t *slots;
+	/* Power of two */
+	uint16_t capacity;
+	/* Three quarters of the slots, probe runs stay short */
+	uint16_t limit;
+	uint16_t used;
+	uint32_t ttl;
+	/* Between dwell events of a card that stays */
+	uint32_t dwell_interval;
+	/* Called for every expired or evicted entry, may be NULL */
+	uid_cache_departed_t departed;
+	void *ctx;
+	uint32_t evictions;
+} uid_cache_t;
+
+typedef enum {
+	/* Not seen within the ttl */
+	UID_CACHE_ARRIVAL,
+	/* Still there and dwell_interval passed since the last event */
+	UID_CACHE_DWELL,
+	/* Still there, nothing to report */
+	UID_CACHE_REPEAT,
+} uid_cache_event_t;
+
+void uid_cache_init(uid_cache_t *c, uid_cache_entry_t *slots,
+					uint16_t capacity, uint32_t ttl, uint32_t dwell_interval,
+					uid_cache_departed_t departed, void *ctx);
+/* The entry of a UID, NULL if it is not cached. Expiry is left to the
+ * caller. */
+uid_cache_entry_t *uid_cache_find(const uid_cache_t *c, const uint8_t *uid,
+								  uint8_t size);
+/* Records a sighting at `now` */
+uid_cache_event_t uid_cache_seen(uid_cache_t *c, const uint8_t *uid,
+								 uint8_t size, uint32_t now);
+/* Drops the entries not seen within the ttl, returns how many */
+uint16_t uid_cache_expire(uid_cache_t *c, uint32_t now);
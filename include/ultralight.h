@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mfrc522.h"
+
+/* MIFARE Ultralight and NTAG21x page access for a selected tag. Memory is
+ * addressed in 4 byte pages; user memory starts at page 4 and its end comes
+ * from GET_VERSION. Reads use FAST_READ where the tag has it, the response
+ * streaming through the FIFO, so a range costs one frame per
+ * UL_FAST_READ_PAGES. Writes go out back to back with the transceive
+ * command left running and the CRC_A computed on the MCU. */
+
+#define UL_PAGE_SIZE 4
+#define UL_USER_FIRST 4
+/* Pages per FAST_READ frame, an RF error costs at most this many again */
+#define UL_FAST_READ_PAGES 60
+
+typedef enum {
+	/* No GET_VERSION: Ultralight, Ultralight C, or not a type 2 tag */
+	UL_TYPE_ULTRALIGHT,
+	UL_TYPE_UL_EV1_MF0UL11,
+	UL_TYPE_UL_EV1_MF0UL21,
+	UL_TYPE_NTAG213,
+	UL_TYPE_NTAG215,
+	UL_TYPE_NTAG216,
+	/* Answers GET_VERSION with a storage size not in the table */
+	UL_TYPE_UNKNOWN,
+} UL_Type;
+
+typedef struct {
+	UL_Type type;
+	/* GET_VERSION response, zero for UL_TYPE_ULTRALIGHT */
+	uint8_t version[8];
+	/* Total pages including the configuration pages */
+	uint8_t pages;
+	/* Inclusive range of user memory */
+	uint8_t userFirst;
+	uint8_t userLast;
+	bool fastRead;
+} UL_Info_t;
+
+static inline uint8_t UL_UserPages(const UL_Info_t *info) {
+	return info->userLast - info->userFirst + 1;
+}
+
+static inline bool UL_InUser(const UL_Info_t *info, uint8_t first,
+							 uint8_t count) {
+	return count && first >= info->userFirst &&
+		   first + count - 1 <= info->userLast;
+}
+
+/* Fills in `info` from GET_VERSION. A tag without GET_VERSION NAKs it and
+ * falls back to IDLE; it is woken up and selected again into `uid` and
+ * reported as a plain Ultralight. */
+MFRC522_Status UL_Detect(UL_Info_t *info, MFRC522_UID_t *uid);
+
+/* `count` pages from `first` into `out` (count * 4 bytes) */
+MFRC522_Status UL_ReadPages(const UL_Info_t *info, uint8_t first,
+							uint8_t count, uint8_t *out);
+
+/* Writes `count` pages of user memory from `data`, STATUS_INVALID for a
+ * range reaching outside it: the UID, lock, OTP and configuration pages
+ * can only have bits set, one way, and are left alone. With `verify` the
+ * range is read back afterwards and STATUS_MISMATCH returned if it
+ * differs. */
+MFRC522_Status UL_WritePages(const UL_Info_t *info, uint8_t first,
+							 uint8_t count, const uint8_t *data, bool verify);
@@ -4,6 +4,8 @@
 #include <libopencm3/usb/usbd.h>
 #include <stddef.h>
 
+#include "cdc_stream.h"
+
 static const struct usb_device_descriptor dev = {
 	.bLength = USB_DT_DEVICE_SIZE,
 	.bDescriptorType = USB_DT_DEVICE,
@@ -184,13 +186,17 @@ static enum usbd_request_return_codes cdcacm_control_request(
 
 static void cdcacm_data_rx_cb(usbd_device *usbd_dev, uint8_t ep) {
 	(void)ep;
+	cdc_stream_on_rx(usbd_dev);
+}
 
-	char buf[64];
-	int len = usbd_ep_read_packet(usbd_dev, 0x01, buf, 64);
+static void cdcacm_data_tx_cb(usbd_device *usbd_dev, uint8_t ep) {
+	(void)ep;
+	cdc_stream_on_tx(usbd_dev);
+}
 
-	if (len) {
-		usbd_ep_write_packet(usbd_dev, 0x82, buf, len);
-	}
+static void cdcacm_comm_tx_cb(usbd_device *usbd_dev, uint8_t ep) {
+	(void)ep;
+	cdc_stream_on_notify(usbd_dev);
 }
 
 static void cdcacm_set_config(usbd_device *usbd_dev, uint16_t wValue) {
@@ -198,10 +204,14 @@ static void cdcacm_set_config(usbd_device *usbd_dev, uint16_t wValue) {
 
 	usbd_ep_setup(usbd_dev, 0x01, USB_ENDPOINT_ATTR_BULK, 64,
 				  cdcacm_data_rx_cb);
-	usbd_ep_setup(usbd_dev, 0x82, USB_ENDPOINT_ATTR_BULK, 64, NULL);
-	usbd_ep_setup(usbd_dev, 0x83, USB_ENDPOINT_ATTR_INTERRUPT, 16, NULL);
+	usbd_ep_setup(usbd_dev, 0x82, USB_ENDPOINT_ATTR_BULK, 64,
+				  cdcacm_data_tx_cb);
+	usbd_ep_setup(usbd_dev, 0x83, USB_ENDPOINT_ATTR_INTERRUPT, 16,
+				  cdcacm_comm_tx_cb);
 
 	usbd_register_control_callback(
 		usbd_dev, USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE,
 		USB_REQ_TYPE_TYPE | USB_REQ_TYPE_RECIPIENT, cdcacm_control_request);
+
+	cdc_stream_on_config(usbd_dev);
 }
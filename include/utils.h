@@ -1,41 +1,67 @@
 #pragma once
 
 #include <libopencm3/cm3/common.h>
+#include <libopencm3/cm3/dwt.h>
 #include <libopencm3/cm3/itm.h>
 #include <libopencm3/cm3/memorymap.h>
 #include <libopencm3/cm3/scs.h>
 #include <libopencm3/cm3/systick.h>
 #include <libopencm3/cm3/tpiu.h>
+#include <libopencm3/stm32/dbgmcu.h>
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/spi.h>
+#include <stdbool.h>
 #include <stdint.h>
-#include <stdio.h>
 
-// TODO: shall be included from <stdio.h>
-extern int dprintf(int fd, const char *restrict format, ...);
 
-#define printf(...) (dprintf(0, __VA_ARGS__))
-#define wprintf(...) (dprintf(1, __VA_ARGS__))
-#define eprintf(...) (dprintf(2, __VA_ARGS__))
 #define LEN(array) (sizeof(array) / sizeof(array[0]))
 
+/* Runs a function from SRAM instead of flash, which needs 2 wait states at
+ * 72 MHz. The libopencm3 linker script keeps .ramtext in the initialised
+ * data, so the reset handler copies it together with .data. long_call lets
+ * flash code reach it, as SRAM is out of range for a plain BL. Build with
+ * RAMFUNCS=0 to keep everything in flash for comparison. */
+#ifdef RAMFUNC_FLASH
+#define RAMFUNC
+#else
+#define RAMFUNC __attribute__((section(".ramtext"), long_call, noinline))
+#endif
+
 typedef struct {
 	uint32_t port;
 	uint16_t pin;
 } port_pin_t;
 
-static inline float mix(float x, float a, float b, float c, float d) {
-	return (x * d - x * c - a * d + b * c) / (b - a);
+static inline bool debugger_attached() { return (DBGMCU_CR & 0x07); }
+
+static inline uint8_t itm_send_char(uint32_t channel, uint8_t ch) {
+	while (!(ITM_STIM8(channel) & ITM_STIM_FIFOREADY)) {
+	}
+	ITM_STIM8(channel) = ch;
+	return ch;
 }
 
 /* SysTick based delay */
 static inline void delay(uint32_t ms) {
-	uint32_t n = (rcc_ahb_frequency * 0.0005) * ms;
+	uint32_t n = rcc_ahb_frequency / 2000 * ms;
 	while (n--) {
 	}
 }
 
+/* Busy waits on the DWT cycle counter, which has to be enabled */
+static inline void delay_us(uint32_t us) {
+	uint32_t start = DWT_CYCCNT;
+	uint32_t n = rcc_ahb_frequency / 1000000 * us;
+	while (DWT_CYCCNT - start < n) {
+	}
+}
+
+/* Register level so that it is inlined into RAMFUNC code, rather than calling
+ * into libopencm3 in flash. Full duplex: once RXNE is set the data register
+ * is empty again. */
 static inline uint8_t spi_transfer(uint32_t spi, uint8_t data) {
-	spi_send(spi, data);
-	return spi_read(spi);
+	SPI_DR(spi) = data;
+	while (!(SPI_SR(spi) & SPI_SR_RXNE)) {
+	}
+	return SPI_DR(spi);
 }
@@ -0,0 +1,404 @@
+#include <string.h>
+
+#include "acl.h"
+
+/* Of a delta record, the check last */
+#define DELTA_WORDS (ACL_DELTA_SIZE / 4)
+/* Bits of the bank generation a delta record carries above its op */
+#define DELTA_GENERATION 0xffffff
+
+/* Murmur3 finaliser */
+static uint32_t mix(uint32_t h) {
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+uint32_t acl_check_words(const uint32_t *words, uint8_t n) {
+	uint32_t h = ACL_MAGIC;
+	for (uint8_t i = 0; i < n; i++) {
+		h = mix(h ^ words[i]);
+	}
+	return h;
+}
+
+static bool key_valid(uint64_t key) {
+	uint8_t size = key;
+	return size == 7 || (size == 4 && !(key & 0xffffff00));
+}
+
+/* Two hashes, the k bit positions are h1 + i * h2 */
+static void bloom_hashes(uint64_t key, uint32_t *h1, uint32_t *h2) {
+	*h1 = mix((uint32_t)(key >> 32) ^ mix((uint32_t)key));
+	*h2 = mix(*h1 ^ 0x9e3779b9) | 1;
+}
+
+static void bloom_build(acl_t *a) {
+	uint32_t h1, h2;
+
+	memset(a->bloom, 0, (a->bloom_mask + 1) / 8);
+	for (uint32_t i = 0; i < a->count; i++) {
+		bloom_hashes(a->keys[i], &h1, &h2);
+		for (uint8_t k = 0; k < a->bloom_hashes; k++) {
+			uint32_t bit = (h1 + k * h2) & a->bloom_mask;
+			a->bloom[bit / 32] |= 1u << (bit % 32);
+		}
+	}
+}
+
+bool acl_bloom_test(const acl_t *a, uint64_t key) {
+	uint32_t h1, h2;
+
+	bloom_hashes(key, &h1, &h2);
+	for (uint8_t k = 0; k < a->bloom_hashes; k++) {
+		uint32_t bit = (h1 + k * h2) & a->bloom_mask;
+		if (!(a->bloom[bit / 32] & 1u << (bit % 32))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Where `key` should be in [lo, last] going by the top words of the keys.
+ * The difference is shifted down to 16 bits, so the product with the index
+ * range fits 32 bits and the division is a single UDIV. */
+static uint32_t guess_index(const uint64_t *keys, uint32_t lo, uint32_t last,
+							uint64_t key) {
+	uint32_t a = keys[lo] >> 32, b = keys[last] >> 32, t = key >> 32;
+
+	if (t <= a) {
+		return lo;
+	}
+	if (t >= b) {
+		return last;
+	}
+	uint32_t span = b - a, d = t - a;
+	uint8_t shift = span >> 16 ? 16 - __builtin_clz(span) : 0;
+	span >>= shift;
+	d >>= shift;
+	return lo + d * (last - lo) / span;
+}
+
+int32_t acl_search(const uint64_t *keys, uint32_t count, uint64_t key,
+				   bool interpolate, uint32_t *probes) {
+	uint32_t lo = 0, hi = count;
+	/* Guesses land close on random UIDs but may crawl on a skewed list,
+	 * after ACL_SEARCH_GUESSES of them the search halves */
+	uint8_t guesses = interpolate ? ACL_SEARCH_GUESSES : 0;
+
+	if (count > ACL_SEARCH_MAX) {
+		return -1;
+	}
+	/* Invariant: the key, if there, is in [lo, hi) */
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (guesses && hi - lo > 2) {
+			mid = guess_index(keys, lo, hi - 1, key);
+			guesses--;
+		}
+		(*probes)++;
+		if (keys[mid] == key) {
+			return mid;
+		}
+		if (keys[mid] < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return -1;
+}
+
+/* Index of `key` in the delta table, or -1 - where it would go */
+static int32_t delta_find(const acl_t *a, uint64_t key) {
+	uint16_t lo = 0, hi = a->delta_count;
+
+	while (lo < hi) {
+		uint16_t mid = lo + (hi - lo) / 2;
+		if (a->deltas[mid].key == key) {
+			return mid;
+		}
+		if (a->deltas[mid].key < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return -1 - lo;
+}
+
+static bool in_bank(const acl_t *a, uint64_t key) {
+	uint32_t probes = 0;
+	return acl_search(a->keys, a->count, key, true, &probes) >= 0;
+}
+
+static bool allowed(const acl_t *a, uint64_t key) {
+	int32_t d = delta_find(a, key);
+	return d >= 0 ? a->deltas[d].op == ACL_ADD : in_bank(a, key);
+}
+
+/* Applies a change to the delta table. One that the bank already agrees
+ * with takes no entry. False when the table is full. */
+static bool delta_put(acl_t *a, uint64_t key, acl_op_t op) {
+	int32_t d = delta_find(a, key);
+	bool needed = in_bank(a, key) != (op == ACL_ADD);
+
+	if (d >= 0) {
+		if (needed) {
+			a->deltas[d].op = op;
+		} else {
+			a->delta_count--;
+			memmove(&a->deltas[d], &a->deltas[d + 1],
+					(a->delta_count - d) * sizeof(a->deltas[0]));
+		}
+		return true;
+	}
+	if (!needed) {
+		return true;
+	}
+	if (a->delta_count == a->delta_max) {
+		return false;
+	}
+	d = -1 - d;
+	memmove(&a->deltas[d + 1], &a->deltas[d],
+			(a->delta_count - d) * sizeof(a->deltas[0]));
+	a->deltas[d].key = key;
+	a->deltas[d].op = op;
+	a->delta_count++;
+	return true;
+}
+
+void acl_init(acl_t *a, uint32_t *bloom, uint32_t bloom_words,
+			  uint8_t bloom_hashes, acl_delta_t *deltas, uint16_t delta_max) {
+	memset(a, 0, sizeof(*a));
+	a->bank = ACL_NONE;
+	a->bloom = bloom;
+	a->bloom_mask = bloom_words * 32 - 1;
+	a->bloom_hashes = bloom_hashes;
+	a->deltas = deltas;
+	a->delta_max = delta_max;
+	memset(bloom, 0, bloom_words * 4);
+}
+
+void acl_set_keys(acl_t *a, const uint64_t *keys, uint32_t count) {
+	a->keys = keys;
+	a->count = count;
+	bloom_build(a);
+}
+
+static bool header_valid(const uint32_t *h) {
+	return h[0] == ACL_MAGIC && h[2] <= ACL_MAX_KEYS &&
+		   h[3] == acl_check_words(h, 3);
+}
+
+void acl_mount(acl_t *a) {
+	a->bank = ACL_NONE;
+	a->keys = NULL;
+	a->count = 0;
+	a->generation = 0;
+	a->delta_count = 0;
+	a->loading = false;
+	for (uint8_t bank = 0; bank < 2; bank++) {
+		const uint32_t *h = (const uint32_t *)acl_flash_bank(bank);
+		if (header_valid(h) && (a->bank == ACL_NONE ||
+								(int32_t)(h[1] - a->generation) > 0)) {
+			a->bank = bank;
+			a->generation = h[1];
+			a->count = h[2];
+			a->keys = (const uint64_t *)(acl_flash_bank(bank) +
+										 ACL_HEADER_SIZE);
+		}
+	}
+
+	const uint8_t *page = acl_flash_bank(ACL_DELTA_BANK);
+	uint16_t offset = 0;
+	for (; offset < ACL_PAGE_SIZE; offset += ACL_DELTA_SIZE) {
+		uint32_t rec[DELTA_WORDS];
+		memcpy(rec, page + offset, sizeof(rec));
+		if ((rec[0] & rec[1] & rec[2] & rec[3]) == 0xffffffff) {
+			break;
+		}
+		uint64_t key = (uint64_t)rec[1] << 32 | rec[0];
+		uint8_t op = rec[2];
+		if (rec[3] != acl_check_words(rec, 3) || op > ACL_ADD) {
+			a->torn++;
+			continue;
+		}
+		/* Made for an older bank, left by a cut before the erase of the
+		 * page: merged already, or dropped by a load */
+		if (rec[2] >> 8 != (a->generation & DELTA_GENERATION)) {
+			continue;
+		}
+		delta_put(a, key, op);
+	}
+	a->delta_offset = offset;
+	bloom_build(a);
+}
+
+bool acl_lookup(acl_t *a, uint64_t key) {
+	int32_t d = delta_find(a, key);
+	bool allow;
+
+	a->lookups++;
+	if (d >= 0) {
+		allow = a->deltas[d].op == ACL_ADD;
+	} else if (!acl_bloom_test(a, key)) {
+		a->bloom_rejects++;
+		allow = false;
+	} else {
+		allow = acl_search(a->keys, a->count, key, true, &a->probes) >= 0;
+	}
+	a->allowed += allow;
+	return allow;
+}
+
+void acl_get_info(const acl_t *a, acl_info_t *info) {
+	info->count = a->count;
+	info->generation = a->generation;
+	info->deltas = a->delta_count;
+	info->lookups = a->lookups;
+	info->bloom_rejects = a->bloom_rejects;
+	info->probes = a->probes;
+	info->allowed = a->allowed;
+}
+
+static uint8_t spare_bank(const acl_t *a) { return a->bank == 0 ? 1 : 0; }
+
+/* Makes `bank` with `count` keys programmed the active one */
+static acl_status_t commit(acl_t *a, uint8_t bank, uint32_t count) {
+	uint32_t h[ACL_HEADER_SIZE / 4] = {ACL_MAGIC, a->generation + 1, count};
+
+	h[3] = acl_check_words(h, 3);
+	if (!acl_flash_program(bank, 0, h, sizeof(h))) {
+		return ACL_FLASH;
+	}
+	a->bank = bank;
+	a->generation++;
+	a->count = count;
+	a->keys = (const uint64_t *)(acl_flash_bank(bank) + ACL_HEADER_SIZE);
+	a->delta_count = 0;
+	bloom_build(a);
+	/* The old deltas carry the old generation and are skipped at mount,
+	 * but take up the page. Failing that, the next update tries again. */
+	if (!acl_flash_erase(ACL_DELTA_BANK)) {
+		a->delta_offset = ACL_PAGE_SIZE;
+		return ACL_FLASH;
+	}
+	a->delta_offset = 0;
+	return ACL_OK;
+}
+
+static bool program_key(uint8_t bank, uint32_t i, uint64_t key) {
+	return acl_flash_program(bank, ACL_HEADER_SIZE + 8 * i, &key, sizeof(key));
+}
+
+acl_status_t acl_compact(acl_t *a) {
+	uint8_t bank = spare_bank(a);
+	uint32_t i = 0, n = 0;
+	uint16_t j = 0;
+
+	if (a->loading) {
+		return ACL_BUSY;
+	}
+	if (!acl_flash_erase(bank)) {
+		return ACL_FLASH;
+	}
+	/* Merge of the two sorted runs, deltas win */
+	while (i < a->count || j < a->delta_count) {
+		uint64_t key;
+		if (j == a->delta_count ||
+			(i < a->count && a->keys[i] < a->deltas[j].key)) {
+			key = a->keys[i++];
+		} else {
+			key = a->deltas[j].key;
+			i += i < a->count && a->keys[i] == key;
+			if (a->deltas[j++].op != ACL_ADD) {
+				continue;
+			}
+		}
+		if (n == ACL_MAX_KEYS) {
+			return ACL_FULL;
+		}
+		if (!program_key(bank, n++, key)) {
+			return ACL_FLASH;
+		}
+	}
+	return commit(a, bank, n);
+}
+
+acl_status_t acl_update(acl_t *a, uint64_t key, acl_op_t op) {
+	uint32_t rec[DELTA_WORDS] = {(uint32_t)key, key >> 32};
+
+	if (!key_valid(key) || op > ACL_ADD) {
+		return ACL_INVALID;
+	}
+	if (a->loading) {
+		return ACL_BUSY;
+	}
+	if (allowed(a, key) == (op == ACL_ADD)) {
+		return ACL_OK;
+	}
+	if (a->delta_offset == ACL_PAGE_SIZE ||
+		(a->delta_count == a->delta_max && delta_find(a, key) < 0)) {
+		acl_status_t status = acl_compact(a);
+		if (status != ACL_OK) {
+			return status;
+		}
+		/* The merge may have settled it */
+		if (allowed(a, key) == (op == ACL_ADD)) {
+			return ACL_OK;
+		}
+	}
+	rec[2] = op | (a->generation & DELTA_GENERATION) << 8;
+	rec[3] = acl_check_words(rec, 3);
+	uint16_t offset = a->delta_offset;
+	/* A failed record is skipped at mount, so is its slot here */
+	a->delta_offset += ACL_DELTA_SIZE;
+	if (!acl_flash_program(ACL_DELTA_BANK, offset, rec, sizeof(rec))) {
+		return ACL_FLASH;
+	}
+	delta_put(a, key, op);
+	return ACL_OK;
+}
+
+acl_status_t acl_load_begin(acl_t *a) {
+	a->loading = false;
+	if (!acl_flash_erase(spare_bank(a))) {
+		return ACL_FLASH;
+	}
+	a->loading = true;
+	a->load_count = 0;
+	a->load_last = 0;
+	return ACL_OK;
+}
+
+acl_status_t acl_load_keys(acl_t *a, const uint64_t *keys, uint16_t n) {
+	if (!a->loading) {
+		return ACL_BUSY;
+	}
+	for (uint16_t i = 0; i < n; i++) {
+		if (!key_valid(keys[i]) || keys[i] <= a->load_last) {
+			return ACL_INVALID;
+		}
+		if (a->load_count == ACL_MAX_KEYS) {
+			return ACL_FULL;
+		}
+		if (!program_key(spare_bank(a), a->load_count, keys[i])) {
+			return ACL_FLASH;
+		}
+		a->load_count++;
+		a->load_last = keys[i];
+	}
+	return ACL_OK;
+}
+
+acl_status_t acl_load_commit(acl_t *a) {
+	if (!a->loading) {
+		return ACL_BUSY;
+	}
+	a->loading = false;
+	return commit(a, spare_bank(a), a->load_count);
+}
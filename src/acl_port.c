@@ -0,0 +1,42 @@
+#include "acl.h"
+#include "flash_port.h"
+
+/* Firmware hooks under acl.h, on the flash controller */
+
+/* Both banks and the delta page, the .acl section of stm32f103c8-stores.ld
+ * next to the flashlog_port.c pages, outside the image */
+extern const volatile uint8_t _acl_start[];
+extern const volatile uint8_t _acl_end[];
+
+static uint32_t address(uint8_t bank, uint16_t offset) {
+	return (uint32_t)&_acl_start[bank * ACL_BANK_SIZE + offset];
+}
+
+/* Nothing past the section is touched, should it be smaller than the
+ * store */
+static bool inside(uint8_t bank, uint16_t offset, uint16_t len) {
+	return address(bank, offset) + len <= (uint32_t)_acl_end;
+}
+
+bool acl_flash_erase(uint8_t bank) {
+	uint8_t pages = bank == ACL_DELTA_BANK ? 1 : ACL_BANK_PAGES;
+	bool ok = true;
+
+	if (!inside(bank, 0, pages * ACL_PAGE_SIZE)) {
+		return false;
+	}
+	for (uint8_t i = 0; i < pages; i++) {
+		ok = flash_port_erase(address(bank, i * ACL_PAGE_SIZE)) && ok;
+	}
+	return ok;
+}
+
+bool acl_flash_program(uint8_t bank, uint16_t offset, const void *data,
+					   uint16_t len) {
+	return inside(bank, offset, len) &&
+		   flash_port_program(address(bank, offset), data, len);
+}
+
+const uint8_t *acl_flash_bank(uint8_t bank) {
+	return (const uint8_t *)&_acl_start[bank * ACL_BANK_SIZE];
+}
@@ -0,0 +1,202 @@
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/sync.h>
+#include <libopencm3/stm32/adc.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/rcc.h>
+
+#include "adc_sampler.h"
+#include "idle.h"
+#include "utils.h"
+
+/* Two halves, each holding ADC_SAMPLER_OVERSAMPLE full scans. A one-shot
+ * round fills the first half only. */
+static uint16_t dma_buf[2 * ADC_SAMPLER_OVERSAMPLE * ADC_SAMPLER_MAX_CHANNELS];
+static uint8_t n_channels;
+static adc_sampler_mode_t mode;
+static adc_sampler_cb_t callback;
+/* A one-shot round is running, set by adc_sampler_update(), cleared by the
+ * DMA interrupt */
+static volatile bool busy;
+
+/* Seqlock protecting `latest`: odd while the DMA interrupt is writing */
+static volatile uint32_t latest_seq;
+static volatile uint16_t latest[ADC_SAMPLER_MAX_CHANNELS];
+
+/* Powers up, calibrates and starts the scan */
+static void start(void) {
+	adc_power_on(ADC1);
+	/* tSTAB before calibrating, 1 us at most. The calibration is redone
+	 * after every power up. */
+#ifdef BOOT_FIXED_DELAYS
+	delay(1);
+#else
+	delay_us(1);
+#endif
+	adc_reset_calibration(ADC1);
+	adc_calibrate(ADC1);
+
+	/* With ADON already set, setting it again starts the conversions */
+	adc_start_conversion_direct(ADC1);
+}
+
+void adc_sampler_init(const uint8_t *ext_channels, uint8_t n_ext,
+					  adc_sampler_mode_t sampler_mode) {
+	uint8_t channels[ADC_SAMPLER_MAX_CHANNELS] = {ADC_CHANNEL_TEMP,
+												  ADC_CHANNEL_VREF};
+
+	if (n_ext > ADC_SAMPLER_MAX_EXT) {
+		n_ext = ADC_SAMPLER_MAX_EXT;
+	}
+	for (uint8_t i = 0; i < n_ext; i++) {
+		channels[ADC_SAMPLER_EXT(i)] = ext_channels[i];
+	}
+	n_channels = 2 + n_ext;
+	mode = sampler_mode;
+
+	rcc_periph_clock_enable(RCC_ADC1);
+	rcc_periph_clock_enable(RCC_DMA1);
+	/* ADCPRE is set to /6 (12 MHz) by rcc_clock_setup_pll() */
+
+	dma_channel_reset(DMA1, DMA_CHANNEL1);
+	dma_set_peripheral_address(DMA1, DMA_CHANNEL1, (uint32_t)&ADC_DR(ADC1));
+	dma_set_memory_address(DMA1, DMA_CHANNEL1, (uint32_t)dma_buf);
+	dma_set_read_from_peripheral(DMA1, DMA_CHANNEL1);
+	dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL1);
+	dma_set_peripheral_size(DMA1, DMA_CHANNEL1, DMA_CCR_PSIZE_16BIT);
+	dma_set_memory_size(DMA1, DMA_CHANNEL1, DMA_CCR_MSIZE_16BIT);
+	dma_set_priority(DMA1, DMA_CHANNEL1, DMA_CCR_PL_HIGH);
+	dma_enable_transfer_complete_interrupt(DMA1, DMA_CHANNEL1);
+	if (mode == ADC_SAMPLER_CONTINUOUS) {
+		dma_set_number_of_data(DMA1, DMA_CHANNEL1,
+							   2 * ADC_SAMPLER_OVERSAMPLE * n_channels);
+		dma_enable_circular_mode(DMA1, DMA_CHANNEL1);
+		dma_enable_half_transfer_interrupt(DMA1, DMA_CHANNEL1);
+		dma_enable_channel(DMA1, DMA_CHANNEL1);
+	}
+	nvic_enable_irq(NVIC_DMA1_CHANNEL1_IRQ);
+
+	adc_power_off(ADC1);
+	adc_enable_scan_mode(ADC1);
+	adc_set_continuous_conversion_mode(ADC1);
+	adc_disable_external_trigger_regular(ADC1);
+	adc_set_right_aligned(ADC1);
+	adc_enable_temperature_sensor();
+	/* The temperature sensor needs a sampling time of at least 17.1 us */
+	adc_set_sample_time_on_all_channels(ADC1, ADC_SMPR_SMP_239DOT5CYC);
+	adc_set_regular_sequence(ADC1, n_channels, channels);
+	adc_enable_dma(ADC1);
+
+	if (mode == ADC_SAMPLER_CONTINUOUS) {
+		start();
+		/* Sampling never ends, and neither the ADC nor DMA run in stop */
+		idle_hold(IDLE_STOP);
+	}
+}
+
+void adc_sampler_set_callback(adc_sampler_cb_t cb) { callback = cb; }
+
+void adc_sampler_update(void) {
+	/* Only the interrupt clears it, and only while it is set */
+	if (mode != ADC_SAMPLER_ONESHOT || busy) {
+		return;
+	}
+	busy = true;
+	/* Neither the ADC nor DMA run in stop */
+	idle_hold(IDLE_STOP);
+
+	dma_disable_channel(DMA1, DMA_CHANNEL1);
+	dma_set_number_of_data(DMA1, DMA_CHANNEL1,
+						   ADC_SAMPLER_OVERSAMPLE * n_channels);
+	dma_enable_channel(DMA1, DMA_CHANNEL1);
+	start();
+}
+
+static void decimate(const uint16_t *samples) {
+	uint32_t acc[ADC_SAMPLER_MAX_CHANNELS] = {0};
+
+	for (uint8_t s = 0; s < ADC_SAMPLER_OVERSAMPLE; s++) {
+		for (uint8_t c = 0; c < n_channels; c++) {
+			acc[c] += *samples++;
+		}
+	}
+
+	latest_seq++;
+	__dmb();
+	for (uint8_t c = 0; c < n_channels; c++) {
+		latest[c] = acc[c] >> ADC_SAMPLER_OVERSAMPLE_BITS;
+	}
+	__dmb();
+	latest_seq++;
+}
+
+void dma1_channel1_isr(void) {
+	const uint16_t half_len = ADC_SAMPLER_OVERSAMPLE * n_channels;
+
+	if (dma_get_interrupt_flag(DMA1, DMA_CHANNEL1, DMA_HTIF)) {
+		dma_clear_interrupt_flags(DMA1, DMA_CHANNEL1, DMA_HTIF);
+		decimate(&dma_buf[0]);
+		if (callback) {
+			callback(true);
+		}
+	}
+	if (dma_get_interrupt_flag(DMA1, DMA_CHANNEL1, DMA_TCIF)) {
+		dma_clear_interrupt_flags(DMA1, DMA_CHANNEL1, DMA_TCIF);
+		if (mode == ADC_SAMPLER_ONESHOT) {
+			/* Ends the continuous scan, the DMA has all it wants */
+			adc_power_off(ADC1);
+			decimate(&dma_buf[0]);
+			busy = false;
+			idle_release(IDLE_STOP);
+		} else {
+			decimate(&dma_buf[half_len]);
+		}
+		if (callback) {
+			callback(false);
+		}
+	}
+}
+
+void adc_sampler_snapshot(adc_snapshot_t *out) {
+	uint32_t seq;
+
+	do {
+		seq = latest_seq;
+		__dmb();
+		out->count = n_channels;
+		for (uint8_t c = 0; c < n_channels; c++) {
+			out->value[c] = latest[c];
+		}
+		__dmb();
+	} while ((seq & 1) || seq != latest_seq);
+	out->seq = seq >> 1;
+}
+
+uint32_t adc_sampler_vdda_mv(void) {
+	adc_snapshot_t s;
+	adc_sampler_snapshot(&s);
+	if (!s.seq || !s.value[ADC_SAMPLER_VREF]) {
+		return 0;
+	}
+	return adc_sampler_vdda_from(s.value[ADC_SAMPLER_VREF]);
+}
+
+uint32_t adc_sampler_ext_mv(uint8_t n) {
+	adc_snapshot_t s;
+	adc_sampler_snapshot(&s);
+	if (!s.seq || ADC_SAMPLER_EXT(n) >= s.count ||
+		!s.value[ADC_SAMPLER_VREF]) {
+		return 0;
+	}
+	return adc_sampler_mv_from(s.value[ADC_SAMPLER_EXT(n)],
+							   s.value[ADC_SAMPLER_VREF]);
+}
+
+int32_t adc_sampler_temperature_cdeg(void) {
+	adc_snapshot_t s;
+	adc_sampler_snapshot(&s);
+	if (!s.seq || !s.value[ADC_SAMPLER_VREF]) {
+		return 2000;
+	}
+	return adc_sampler_cdeg_from(s.value[ADC_SAMPLER_TEMP],
+								 s.value[ADC_SAMPLER_VREF]);
+}
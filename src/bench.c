@@ -0,0 +1,122 @@
+#include <string.h>
+
+#include "bench.h"
+
+uint32_t bench_overhead(bench_clock_t clock) {
+	uint32_t best = UINT32_MAX;
+
+	for (uint8_t i = 0; i < 8; i++) {
+		uint32_t start = clock();
+		uint32_t ticks = clock() - start;
+		if (ticks < best) {
+			best = ticks;
+		}
+	}
+	return best;
+}
+
+void bench_add_sample(bench_result_t *r, uint32_t ticks) {
+	if (!r->runs || ticks < r->min) {
+		r->min = ticks;
+	}
+	if (!r->runs || ticks > r->max) {
+		r->max = ticks;
+	}
+	r->total += ticks;
+	r->runs++;
+}
+
+void bench_measure(bench_result_t *r, const char *name, void (*fn)(void),
+				   uint32_t runs, bench_clock_t clock, uint32_t overhead) {
+	r->name = name;
+	r->runs = 0;
+	r->total = 0;
+
+	/* Warm up caches, prefetch buffers and lazily initialised state */
+	fn();
+
+	for (uint32_t i = 0; i < runs; i++) {
+		uint32_t start = clock();
+		fn();
+		uint32_t ticks = clock() - start;
+		bench_add_sample(r, ticks > overhead ? ticks - overhead : 0);
+	}
+}
+
+void bench_write(const fmt_sink_t *s, const bench_result_t *r,
+				 const char *unit) {
+	fmt_str(s, "bench ");
+	fmt_str(s, r->name);
+	fmt_str(s, " runs=");
+	fmt_u32(s, r->runs);
+	fmt_str(s, " min=");
+	fmt_u32(s, r->min);
+	fmt_str(s, " mean=");
+	fmt_u32(s, r->runs ? r->total / r->runs : 0);
+	fmt_str(s, " max=");
+	fmt_u32(s, r->max);
+	fmt_str(s, " unit=");
+	fmt_str(s, unit);
+	fmt_char(s, '\n');
+}
+
+int bench_format(char *buf, size_t size, const bench_result_t *r,
+				 const char *unit) {
+	fmt_buf_t b;
+	fmt_sink_t s = fmt_buf(&b, buf, size);
+	bench_write(&s, r, unit);
+	return b.len;
+}
+
+void bench_hist_init(bench_hist_t *h, const char *name, uint32_t lo,
+					 uint32_t width) {
+	memset(h, 0, sizeof(*h));
+	h->name = name;
+	h->lo = lo;
+	h->width = width ? width : 1;
+}
+
+void bench_hist_add(bench_hist_t *h, uint32_t ticks) {
+	if (ticks < h->lo) {
+		h->below++;
+		return;
+	}
+	uint32_t bin = (ticks - h->lo) / h->width;
+	if (bin < BENCH_HIST_BINS) {
+		h->bins[bin]++;
+	} else {
+		h->above++;
+	}
+}
+
+void bench_hist_write(const fmt_sink_t *s, const bench_hist_t *h,
+					  const char *unit) {
+	fmt_str(s, "hist ");
+	fmt_str(s, h->name);
+	fmt_str(s, " lo=");
+	fmt_u32(s, h->lo);
+	fmt_str(s, " width=");
+	fmt_u32(s, h->width);
+	fmt_str(s, " below=");
+	fmt_u32(s, h->below);
+	fmt_str(s, " above=");
+	fmt_u32(s, h->above);
+	fmt_str(s, " bins=");
+	for (uint8_t i = 0; i < BENCH_HIST_BINS; i++) {
+		if (i) {
+			fmt_char(s, ',');
+		}
+		fmt_u32(s, h->bins[i]);
+	}
+	fmt_str(s, " unit=");
+	fmt_str(s, unit);
+	fmt_char(s, '\n');
+}
+
+int bench_hist_format(char *buf, size_t size, const bench_hist_t *h,
+					  const char *unit) {
+	fmt_buf_t b;
+	fmt_sink_t s = fmt_buf(&b, buf, size);
+	bench_hist_write(&s, h, unit);
+	return b.len;
+}
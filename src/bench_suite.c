@@ -0,0 +1,528 @@
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/scb.h>
+#include <libopencm3/stm32/gpio.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "acl.h"
+#include "bench.h"
+#include "board.h"
+#include "fixmath.h"
+#include "fmt.h"
+#include "frame.h"
+#include "hc-sr04.h"
+#include "irqlat.h"
+#include "leds.h"
+#include "metrics.h"
+#include "mfrc522.h"
+#include "mfrc522_port.h"
+#include "uart_stream.h"
+#include "uid_cache.h"
+#include "ultralight.h"
+#include "utils.h"
+
+/* Firmware variant of the benchmarks, built by `make bench`. Times are in
+ * core cycles from the DWT cycle counter and reported over ITM channel 0. */
+
+static uint8_t data[64];
+static uint8_t enc[FRAME_MAX_ENCODED];
+static char text[32];
+static volatile uint32_t sink;
+
+static uint32_t cycles(void) { return dwt_read_cycle_counter(); }
+
+static void bench_spi_read_reg(void) {
+	sink = MFRC522_ReadCharFromReg(VersionReg);
+}
+
+static void bench_spi_write_reg(void) {
+	MFRC522_WriteCharToReg(FIFOLevelReg, 0x80);
+}
+
+static void bench_spi_read_fifo(void) {
+	MFRC522_ReadArrayFromReg(FIFODataReg, 16, data);
+}
+
+static void bench_pcd_crc(void) {
+	uint8_t crc[2];
+	sink = PCD_CalculateCRC(data, 16, crc);
+}
+
+static void bench_frame_crc16(void) { sink = frame_crc16(data, sizeof(data)); }
+
+static void bench_frame_pack(void) { sink = frame_pack(data, 32, enc); }
+
+/* Without a card in the field this times the full timeout path */
+static void bench_select(void) {
+	MFRC522_UID_t uid = {0};
+	uint8_t atqa[2];
+	uint8_t atqaLen = sizeof(atqa);
+
+	if (PICC_WakeupA(atqa, &atqaLen) != STATUS_TIMEOUT) {
+		sink = MFRC522_Select(&uid);
+	}
+	PICC_HaltA();
+}
+
+static void bench_metric_inc(void) { metric_inc(METRIC_card_reads); }
+
+/* Spread over the buckets */
+static void bench_metric_observe(void) {
+	metric_observe(METRIC_echo_us, sink++ * 97);
+}
+
+/* The log lines through newlib's snprintf() and through fmt.h, both into
+ * a buffer to leave the sink out */
+static const uint8_t uid7[7] = {0x04, 0x9a, 0x3c, 0x52, 0xe1, 0x6f, 0x80};
+
+static void bench_format_distance(void) {
+	sink = snprintf(text, sizeof(text), "Distance: %lu mm.\n",
+					(unsigned long)(sink & 0xfff));
+}
+
+static void bench_fmt_distance(void) {
+	fmt_buf_t b;
+	fmt_sink_t s = fmt_buf(&b, text, sizeof(text));
+	fmt_str(&s, "Distance: ");
+	fmt_u32(&s, sink & 0xfff);
+	fmt_str(&s, " mm.\n");
+	sink = b.len;
+}
+
+static void bench_format_uid(void) {
+	int len = 0;
+	for (uint8_t i = 0; i < sizeof(uid7); i++) {
+		len += snprintf(text + len, sizeof(text) - len, " %02x", uid7[i]);
+	}
+	sink = len;
+}
+
+static void bench_fmt_uid(void) {
+	fmt_buf_t b;
+	fmt_sink_t s = fmt_buf(&b, text, sizeof(text));
+	fmt_hex_bytes(&s, uid7, sizeof(uid7), ' ');
+	sink = b.len;
+}
+
+/* 64 bytes as by the old MFRC522_SelfTest(), to a sink that drops them */
+static void drop(void *ctx, const char *chars, uint16_t len) {
+	(void)ctx;
+	(void)chars;
+	sink += len;
+}
+
+static void bench_format_dump(void) {
+	for (uint8_t i = 0; i < sizeof(data); i++) {
+		sink += snprintf(text, sizeof(text), "0x%02X ", data[i]);
+	}
+}
+
+static void bench_fmt_dump(void) {
+	const fmt_sink_t s = {drop, 0};
+	fmt_hexdump(&s, data, sizeof(data));
+}
+
+/* The float linear map fix_map() replaced, soft-float on the M3 */
+static __attribute__((noinline)) float mix_float(float x, float a, float b,
+												 float c, float d) {
+	return (x * d - x * c - a * d + b * c) / (b - a);
+}
+
+static void bench_mix_float(void) {
+	sink = mix_float(sink & 0xfff, 0, 4095, -4000, 12500);
+}
+
+static const fix_map_t adc_to_cdeg = FIX_MAP(0, 4095, -4000, 12500);
+
+static void bench_fix_map(void) { sink = fix_map(&adc_to_cdeg, sink & 0xfff); }
+
+static void bench_q16_mul(void) { sink = q16_mul(sink + 0x12345, Q16(-1.75)); }
+
+/* A divisor only known at run time, as a clock frequency */
+static volatile uint32_t divisor = 72000000 / 1356;
+static fix_div_t by_divisor;
+
+static void bench_udiv(void) { sink = (sink + 0x9e3779b9) / divisor; }
+
+static void bench_fix_div(void) {
+	sink = fix_div(&by_divisor, sink + 0x9e3779b9);
+}
+
+static void bench_echo_to_mm(void) {
+	sink = hcsr04_echo_to_mm(sink & 0x7fff, 2150);
+}
+
+/* UID cache at the load limit of each capacity. find looks up a cached UID,
+ * insert adds a new one and so includes the scan for the entry to evict. */
+static const uint16_t uid_capacities[] = {8, 32, 128};
+static uid_cache_entry_t uid_slots[128];
+static uid_cache_t uid_cache;
+static uint32_t uid_next;
+static uint32_t uid_hit;
+
+static void make_uid(uint32_t n, uint8_t *uid) {
+	uint32_t v = n * 2654435761u;
+	for (uint8_t i = 0; i < 4; i++) {
+		uid[i] = v >> (8 * i);
+	}
+}
+
+static void uid_setup(uint16_t capacity) {
+	uint8_t uid[4];
+
+	uid_cache_init(&uid_cache, uid_slots, capacity, 1u << 30, 1u << 30, NULL,
+				   NULL);
+	for (uid_next = 0; uid_next < uid_cache.limit; uid_next++) {
+		make_uid(uid_next, uid);
+		uid_cache_seen(&uid_cache, uid, sizeof(uid), uid_next);
+	}
+	uid_hit = 0;
+}
+
+static void bench_uid_find(void) {
+	uint8_t uid[4];
+	make_uid(uid_next - 1 - uid_hit++ % uid_cache.limit, uid);
+	sink = uid_cache_find(&uid_cache, uid, sizeof(uid)) != NULL;
+}
+
+static void bench_uid_insert(void) {
+	uint8_t uid[4];
+	make_uid(uid_next, uid);
+	sink = uid_cache_seen(&uid_cache, uid, sizeof(uid), uid_next++);
+}
+
+static void bench_uid_cache(bench_result_t *r, uint8_t i, bool insert,
+							uint32_t overhead) {
+	/* Still referenced by r when it is reported */
+	static char name[24];
+	fmt_buf_t b;
+	fmt_sink_t s = fmt_buf(&b, name, sizeof(name));
+
+	uid_setup(uid_capacities[i]);
+	fmt_str(&s, insert ? "uid_cache_insert_" : "uid_cache_find_");
+	fmt_u32(&s, uid_capacities[i]);
+	bench_measure(r, name, insert ? bench_uid_insert : bench_uid_find,
+				  BENCH_RUNS, cycles, overhead);
+}
+
+/* Access list of ACL_MAX_KEYS in RAM, so no flash is written; a bank in
+ * flash adds its wait states to every key read. Even keys are on it, odd
+ * ones not. */
+static uint64_t acl_keys[ACL_MAX_KEYS];
+static uint32_t acl_bloom[ACL_BLOOM_WORDS];
+static acl_delta_t acl_deltas[ACL_DELTA_MAX];
+static acl_t acl;
+static uint32_t acl_next;
+static uint32_t acl_probes;
+
+static uint64_t acl_bench_key(uint32_t n) {
+	uint8_t uid[7];
+	uint32_t v = (n / 2) * 2654435761u;
+	for (uint8_t i = 0; i < 4; i++) {
+		uid[i] = v >> (24 - 8 * i);
+	}
+	uid[4] = n;
+	uid[5] = n >> 8;
+	uid[6] = n & 1;
+	return acl_key(uid, sizeof(uid));
+}
+
+static int compare_keys(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void acl_setup(void) {
+	for (uint16_t i = 0; i < ACL_MAX_KEYS; i++) {
+		acl_keys[i] = acl_bench_key(2 * i);
+	}
+	qsort(acl_keys, ACL_MAX_KEYS, sizeof(acl_keys[0]), compare_keys);
+	acl_init(&acl, acl_bloom, LEN(acl_bloom), ACL_BLOOM_HASHES, acl_deltas,
+			 LEN(acl_deltas));
+	acl_set_keys(&acl, acl_keys, ACL_MAX_KEYS);
+}
+
+static void bench_acl_binary(void) {
+	sink = acl_search(acl_keys, ACL_MAX_KEYS,
+					  acl_bench_key(2 * (acl_next++ % ACL_MAX_KEYS)), false,
+					  &acl_probes);
+}
+
+static void bench_acl_hit(void) {
+	sink = acl_lookup(&acl, acl_bench_key(2 * (acl_next++ % ACL_MAX_KEYS)));
+}
+
+static void bench_acl_miss(void) {
+	sink = acl_lookup(&acl, acl_bench_key(2 * acl_next++ + 1));
+}
+
+static volatile uint32_t pend_start;
+static volatile uint32_t pend_latency;
+
+RAMFUNC void pend_sv_handler(void) {
+	pend_latency = cycles() - pend_start;
+}
+
+/* Cycles from pending PendSV until its handler reads the counter */
+static void bench_isr_entry(bench_result_t *r, uint32_t overhead) {
+	r->name = "isr_entry";
+	r->runs = 0;
+	r->total = 0;
+	for (uint32_t i = 0; i < BENCH_RUNS; i++) {
+		pend_latency = 0;
+		pend_start = cycles();
+		SCB_ICSR = SCB_ICSR_PENDSVSET;
+		__asm__ volatile("dsb\n\tisb" ::: "memory");
+		while (!pend_latency) {
+		}
+		bench_add_sample(r, pend_latency - overhead);
+	}
+}
+
+/* USART1 loopback with TX (PA9) wired to RX (PA10): cycles from queuing the
+ * bytes until all of them have been read back. A run that takes longer than
+ * 100 ms or echoes wrong data is left out, so a missing wire shows up as
+ * runs=0. Throughput in bytes/s is len * hz / mean. */
+#define LOOPBACK_BLOCK 256
+
+static const struct {
+	const char *name;
+	uint16_t len;
+	uint32_t baud;
+} loopback[] = {
+	{"uart_rtt1_921k6", 1, 921600},
+	{"uart_block256_921k6", LOOPBACK_BLOCK, 921600},
+	{"uart_rtt1_2m", 1, 2000000},
+	{"uart_block256_2m", LOOPBACK_BLOCK, 2000000},
+	{"uart_rtt1_4m5", 1, 4500000},
+	{"uart_block256_4m5", LOOPBACK_BLOCK, 4500000},
+};
+
+static uint8_t block[LOOPBACK_BLOCK];
+static uint8_t echo[LOOPBACK_BLOCK];
+
+static uint32_t loopback_once(uint16_t len) {
+	uint32_t start = cycles();
+	uint16_t got = 0;
+
+	uart_stream_write(block, len);
+	while (got < len) {
+		got += uart_stream_read(&echo[got], len - got);
+		if (cycles() - start > rcc_ahb_frequency / 10) {
+			return 0;
+		}
+	}
+	uint32_t ticks = cycles() - start;
+	return memcmp(block, echo, len) ? 0 : ticks;
+}
+
+static void bench_uart_loopback(bench_result_t *r, uint8_t i,
+								uint32_t overhead) {
+	r->name = loopback[i].name;
+	r->runs = 0;
+	r->total = 0;
+
+	uart_stream_init(loopback[i].baud);
+	uart_stream_flush();
+	while (uart_stream_read(echo, sizeof(echo))) {
+	}
+	for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+		uint32_t ticks = loopback_once(loopback[i].len);
+		if (ticks) {
+			bench_add_sample(r, ticks - overhead);
+		}
+	}
+}
+
+/* Ultralight/NTAG21x on the antenna: the whole user memory with FAST_READ
+ * (where the tag has it) and with 4 page READs, then UL_WRITE_PAGES user
+ * pages rewritten with their own content, without and with read-back.
+ * Without a tag every case has runs=0. Pages/s is pages * hz / mean, with
+ * the page counts on the bench-info line. Writes do few runs to spare the
+ * tag's write endurance. */
+#define UL_WRITE_PAGES 16
+#define UL_WRITE_RUNS 8
+
+static UL_Info_t ul;
+static bool ul_present;
+/* NTAG216, the largest in the table */
+static uint8_t ul_mem[231 * UL_PAGE_SIZE];
+
+static const struct {
+	const char *name;
+	bool fastRead;
+	bool write;
+	bool verify;
+} ul_cases[] = {
+	{"ul_read_user_fast", true, false, false},
+	{"ul_read_user_read4", false, false, false},
+	{"ul_write16", true, true, false},
+	{"ul_write16_verify", true, true, true},
+};
+
+static void ul_setup(void) {
+	MFRC522_UID_t uid = {0};
+	uint8_t atqa[2];
+	uint8_t atqaLen = sizeof(atqa);
+
+	MFRC522_Status status = PICC_WakeupA(atqa, &atqaLen);
+	if (status == STATUS_OK || status == STATUS_COLLISION) {
+		status = MFRC522_Select(&uid);
+	}
+	if (status == STATUS_OK) {
+		status = UL_Detect(&ul, &uid);
+	}
+	ul_present = status == STATUS_OK && ul.pages &&
+				 ul.pages * UL_PAGE_SIZE <= sizeof(ul_mem) &&
+				 UL_UserPages(&ul) >= UL_WRITE_PAGES &&
+				 UL_ReadPages(&ul, ul.userFirst, UL_WRITE_PAGES, ul_mem) ==
+					 STATUS_OK;
+	fmt_str(&fmt_log, "bench-info ul type=");
+	fmt_u32(&fmt_log, ul_present ? ul.type : 0);
+	fmt_str(&fmt_log, " user_pages=");
+	fmt_u32(&fmt_log, ul_present ? UL_UserPages(&ul) : 0);
+	fmt_str(&fmt_log, " write_pages=");
+	fmt_u32(&fmt_log, UL_WRITE_PAGES);
+	fmt_char(&fmt_log, '\n');
+}
+
+static void bench_ul(bench_result_t *r, uint8_t i, uint32_t overhead) {
+	UL_Info_t info = ul;
+	uint32_t runs = ul_cases[i].write ? UL_WRITE_RUNS : BENCH_RUNS;
+
+	r->name = ul_cases[i].name;
+	r->runs = 0;
+	r->total = 0;
+	info.fastRead = ul.fastRead && ul_cases[i].fastRead;
+	for (uint32_t run = 0; ul_present && run < runs; run++) {
+		MFRC522_Status status;
+		uint32_t start = cycles();
+		if (ul_cases[i].write) {
+			status = UL_WritePages(&info, info.userFirst, UL_WRITE_PAGES,
+								   ul_mem, ul_cases[i].verify);
+		} else {
+			status = UL_ReadPages(&info, info.userFirst, UL_UserPages(&info),
+								  ul_mem);
+		}
+		uint32_t ticks = cycles() - start;
+		if (status == STATUS_OK) {
+			bench_add_sample(r, ticks - overhead);
+		}
+	}
+}
+
+/* As many pins on as many ports as board_leds, which overlaps SPI1: the
+ * two board LEDs and pins that no bench uses */
+static const port_pin_t bench_leds[] = {
+	{GPIOC, GPIO13}, {GPIOB, GPIO11}, {GPIOA, GPIO8},  {GPIOB, GPIO5},
+	{GPIOB, GPIO9},	 {GPIOB, GPIO10}, {GPIOB, GPIO12}, {GPIOB, GPIO13},
+	{GPIOB, GPIO14}, {GPIOB, GPIO15},
+};
+static uint16_t led_pattern;
+
+/* A new pattern as update_leds() in main.c shows it, the frame rebuilt */
+static void bench_leds_commit(void) {
+	leds_set_mask(led_pattern++);
+	leds_commit();
+}
+
+/* The loop update_leds() had before leds.c, one pin at a time */
+static void bench_leds_gpio(void) {
+	for (uint8_t i = 0; i < LEN(bench_leds); i++) {
+		if ((led_pattern >> i) & 1) {
+			gpio_set(bench_leds[i].port, bench_leds[i].pin);
+		} else {
+			gpio_clear(bench_leds[i].port, bench_leds[i].pin);
+		}
+	}
+	led_pattern++;
+}
+
+static void report(const bench_result_t *r) {
+	bench_write(&fmt_log, r, "cycles");
+}
+
+static const struct {
+	const char *name;
+	void (*fn)(void);
+} cases[] = {
+	{"spi_read_reg", bench_spi_read_reg},
+	{"spi_write_reg", bench_spi_write_reg},
+	{"spi_read_fifo16", bench_spi_read_fifo},
+	{"pcd_crc16", bench_pcd_crc},
+	{"frame_crc16_64", bench_frame_crc16},
+	{"frame_pack_32", bench_frame_pack},
+	{"select", bench_select},
+	{"format_distance", bench_format_distance},
+	{"fmt_distance", bench_fmt_distance},
+	{"format_uid7", bench_format_uid},
+	{"fmt_uid7", bench_fmt_uid},
+	{"format_dump64", bench_format_dump},
+	{"fmt_dump64", bench_fmt_dump},
+	{"metric_inc", bench_metric_inc},
+	{"metric_observe", bench_metric_observe},
+	{"mix_float", bench_mix_float},
+	{"fix_map", bench_fix_map},
+	{"q16_mul", bench_q16_mul},
+	{"udiv", bench_udiv},
+	{"fix_div", bench_fix_div},
+	{"echo_to_mm", bench_echo_to_mm},
+	{"leds_commit", bench_leds_commit},
+	{"leds_gpio_loop", bench_leds_gpio},
+};
+
+void bench_suite_run(void) {
+	bench_result_t r;
+
+	dwt_enable_cycle_counter();
+	uint32_t overhead = bench_overhead(cycles);
+
+	for (uint8_t i = 0; i < sizeof(data); i++) {
+		data[i] = i * 37 + 1;
+	}
+	for (uint16_t i = 0; i < sizeof(block); i++) {
+		block[i] = i * 13 + 7;
+	}
+	by_divisor = fix_div_init(divisor);
+	leds_init(bench_leds, LEN(bench_leds));
+
+	/* Marks the start of a run so captures can be split */
+	fmt_str(&fmt_log, "bench-begin board=" BOARD_NAME " hz=");
+	fmt_u32(&fmt_log, rcc_ahb_frequency);
+	fmt_str(&fmt_log, " bus=" MFRC522_BUS_NAME "\n");
+	for (uint8_t i = 0; i < LEN(cases); i++) {
+		bench_measure(&r, cases[i].name, cases[i].fn, BENCH_RUNS, cycles,
+					  overhead);
+		report(&r);
+	}
+	for (uint8_t i = 0; i < LEN(uid_capacities); i++) {
+		bench_uid_cache(&r, i, false, overhead);
+		report(&r);
+		bench_uid_cache(&r, i, true, overhead);
+		report(&r);
+	}
+	acl_setup();
+	bench_measure(&r, "acl_hit_binary", bench_acl_binary, BENCH_RUNS, cycles,
+				  overhead);
+	report(&r);
+	bench_measure(&r, "acl_hit", bench_acl_hit, BENCH_RUNS, cycles, overhead);
+	report(&r);
+	bench_measure(&r, "acl_miss", bench_acl_miss, BENCH_RUNS, cycles,
+				  overhead);
+	report(&r);
+	bench_isr_entry(&r, overhead);
+	report(&r);
+	irqlat_run(IRQLAT_LOAD_ALL);
+	for (uint8_t i = 0; i < LEN(loopback); i++) {
+		bench_uart_loopback(&r, i, overhead);
+		report(&r);
+	}
+	ul_setup();
+	for (uint8_t i = 0; i < LEN(ul_cases); i++) {
+		bench_ul(&r, i, overhead);
+		report(&r);
+	}
+	fmt_str(&fmt_log, "bench-end\n");
+}
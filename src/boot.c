@@ -0,0 +1,76 @@
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/stm32/rcc.h>
+
+#include <stdbool.h>
+
+#include "bench.h"
+#include "board.h"
+#include "boot.h"
+#include "fmt.h"
+#include "utils.h"
+
+typedef struct {
+	const char *name;
+	uint32_t us;
+} stage_t;
+
+static stage_t stages[BOOT_MAX_STAGES];
+static uint8_t n_stages;
+static uint32_t last_cycles;
+/* Core clock at the start of the current stage */
+static uint32_t last_hz;
+static bool reported;
+
+void boot_start(void) {
+	dwt_enable_cycle_counter();
+	last_cycles = dwt_read_cycle_counter();
+	last_hz = rcc_ahb_frequency;
+}
+
+void boot_mark(const char *stage) {
+	uint32_t now = dwt_read_cycle_counter();
+	if (reported || n_stages == BOOT_MAX_STAGES) {
+		return;
+	}
+	stages[n_stages++] =
+		(stage_t){stage, (now - last_cycles) / (last_hz / 1000000)};
+	last_cycles = now;
+	last_hz = rcc_ahb_frequency;
+}
+
+static void report(const char *stage, uint32_t us) {
+	char name[32];
+	fmt_buf_t b;
+	fmt_sink_t s = fmt_buf(&b, name, sizeof(name));
+	bench_result_t r = {.name = name};
+
+	fmt_str(&s, "boot_");
+	fmt_str(&s, stage);
+	bench_add_sample(&r, us);
+	bench_write(&fmt_log, &r, "us");
+}
+
+void boot_report(void) {
+	if (reported) {
+		return;
+	}
+	reported = true;
+
+#ifdef BOOT_FIXED_DELAYS
+	const unsigned fixed_delays = 1;
+#else
+	const unsigned fixed_delays = 0;
+#endif
+	fmt_str(&fmt_log, "bench-begin board=" BOARD_NAME " hz=");
+	fmt_u32(&fmt_log, rcc_ahb_frequency);
+	fmt_str(&fmt_log, " timeline=boot fixed_delays=");
+	fmt_u32(&fmt_log, fixed_delays);
+	fmt_char(&fmt_log, '\n');
+	uint32_t total = 0;
+	for (uint8_t i = 0; i < n_stages; i++) {
+		report(stages[i].name, stages[i].us);
+		total += stages[i].us;
+	}
+	report("total", total);
+	fmt_str(&fmt_log, "bench-end\n");
+}
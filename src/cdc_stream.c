@@ -0,0 +1,238 @@
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/st_usbfs.h>
+
+#include "board.h"
+#include "cdc_stream.h"
+#include "clock.h"
+#include "idle.h"
+#include "ring.h"
+#include "usb.h"
+#include "utils.h"
+
+static usbd_device *usb_device;
+
+static uint8_t tx_buf[CDC_STREAM_TX_SIZE];
+static uint8_t rx_buf[CDC_STREAM_RX_SIZE];
+static ring_t tx_ring;
+static ring_t rx_ring;
+
+static volatile bool configured;
+/* The bus has been idle for 3 ms: the host suspended us or, as the bluepill
+ * cannot sense VBUS, the cable is out */
+static volatile bool suspended;
+/* An IN packet is armed on 0x82, its completion callback will send the next */
+static volatile bool tx_busy;
+static volatile bool rx_nak;
+static uint8_t last_tx_len;
+static cdc_stream_stats_t stats;
+
+static uint8_t notify_buf[CDC_STREAM_NOTIFY_SIZE];
+static uint8_t notify_len;
+static uint8_t notify_off;
+static volatile bool notify_busy;
+
+/* The USB peripheral needs its 48 MHz clock, i.e. the 72 MHz PLL, from the
+ * first reset on: enumeration and every bus reset included. It is given up
+ * while suspended only, the wake-up detection runs without it. From the
+ * reset and resume callbacks, which run in the USB interrupt, the switch
+ * itself is left to clock_idle() in the main loop. */
+static void link_hold(void) {
+	idle_hold(IDLE_STOP);
+	clock_hold();
+}
+
+static void link_release(void) {
+	idle_release(IDLE_STOP);
+	clock_release();
+}
+
+static void cdc_stream_suspend(void) {
+	if (!suspended) {
+		suspended = true;
+		SET_REG(USB_CNTR_REG, GET_REG(USB_CNTR_REG) | USB_CNTR_FSUSP);
+		link_release();
+	}
+}
+
+static void cdc_stream_resume(void) {
+	if (suspended) {
+		link_hold();
+		SET_REG(USB_CNTR_REG, GET_REG(USB_CNTR_REG) & ~USB_CNTR_FSUSP);
+		suspended = false;
+	}
+}
+
+static void cdc_stream_reset(void) {
+	/* A reset is bus activity, the wake-up may not have been seen */
+	cdc_stream_resume();
+	configured = false;
+	notify_busy = false;
+}
+
+void cdc_stream_init(void) {
+	ring_init(&tx_ring, tx_buf, sizeof(tx_buf));
+	ring_init(&rx_ring, rx_buf, sizeof(rx_buf));
+	link_hold();
+
+	/* Pull D+ low for a moment so that the host re-enumerates the device
+	 * after a reset without unplugging the cable */
+	gpio_set_mode(BOARD_USB_DP.port, GPIO_MODE_OUTPUT_2_MHZ,
+				  GPIO_CNF_OUTPUT_PUSHPULL, BOARD_USB_DP.pin);
+	board_pin_clear(BOARD_USB_DP);
+	delay(5);
+	gpio_set_mode(BOARD_USB_DP.port, GPIO_MODE_INPUT, GPIO_CNF_INPUT_FLOAT,
+				  BOARD_USB_DP.pin);
+
+	usb_device = usbd_init(&st_usbfs_v1_usb_driver, &dev, &config, usb_strings,
+						   LEN(usb_strings), usbd_control_buffer,
+						   sizeof(usbd_control_buffer));
+	usbd_register_set_config_callback(usb_device, cdcacm_set_config);
+	usbd_register_reset_callback(usb_device, cdc_stream_reset);
+	usbd_register_suspend_callback(usb_device, cdc_stream_suspend);
+	usbd_register_resume_callback(usb_device, cdc_stream_resume);
+	nvic_enable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+}
+
+void usb_lp_can_rx0_isr(void) { usbd_poll(usb_device); }
+
+bool cdc_stream_configured(void) { return configured && !suspended; }
+
+/* Arms the next IN packet. Runs in the USB interrupt or with it masked. */
+static void tx_next(void) {
+	uint8_t packet[CDC_STREAM_PACKET];
+	const uint8_t *data;
+	uint16_t len = ring_used(&tx_ring);
+
+	if (len == 0) {
+		/* A transfer that ends on a packet boundary has to be terminated
+		 * with a zero-length packet, otherwise the host keeps waiting */
+		if (last_tx_len == CDC_STREAM_PACKET) {
+			usbd_ep_write_packet(usb_device, 0x82, NULL, 0);
+			last_tx_len = 0;
+			stats.tx_zlps++;
+			tx_busy = true;
+		} else {
+			tx_busy = false;
+		}
+		return;
+	}
+	if (len > CDC_STREAM_PACKET) {
+		len = CDC_STREAM_PACKET;
+	}
+	/* Send straight from the ring unless the packet wraps around */
+	uint16_t first = ring_peek(&tx_ring, &data);
+	if (first < len) {
+		memcpy(packet, data, first);
+		memcpy(&packet[first], tx_buf, len - first);
+		data = packet;
+	}
+	tx_busy = true;
+	if (!usbd_ep_write_packet(usb_device, 0x82, data, len)) {
+		/* Endpoint still busy, retried from the completion callback */
+		return;
+	}
+	ring_skip(&tx_ring, len);
+	last_tx_len = len;
+	stats.tx_bytes += len;
+	stats.tx_packets++;
+}
+
+uint16_t cdc_stream_write(const void *data, uint16_t len) {
+	uint16_t n = ring_write(&tx_ring, data, len);
+	if (n < len) {
+		stats.tx_overruns++;
+	}
+	if (configured && !tx_busy) {
+		nvic_disable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+		if (!tx_busy) {
+			tx_next();
+		}
+		nvic_enable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+	}
+	return n;
+}
+
+uint16_t cdc_stream_read(void *data, uint16_t len) {
+	uint16_t n = ring_read(&rx_ring, data, len);
+	if (rx_nak && ring_free(&rx_ring) >= CDC_STREAM_PACKET) {
+		nvic_disable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+		rx_nak = false;
+		usbd_ep_nak_set(usb_device, 0x01, 0);
+		nvic_enable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+	}
+	return n;
+}
+
+uint16_t cdc_stream_tx_free(void) { return ring_free(&tx_ring); }
+
+uint16_t cdc_stream_rx_available(void) { return ring_used(&rx_ring); }
+
+static void notify_next(void) {
+	uint8_t len = notify_len - notify_off;
+
+	if (len == 0) {
+		notify_busy = false;
+		return;
+	}
+	if (len > 16) {
+		len = 16;
+	}
+	if (usbd_ep_write_packet(usb_device, 0x83, &notify_buf[notify_off], len)) {
+		notify_off += len;
+	}
+}
+
+bool cdc_stream_notify(const void *data, uint16_t len) {
+	if (!configured || notify_busy || len > sizeof(notify_buf)) {
+		return false;
+	}
+	memcpy(notify_buf, data, len);
+	notify_len = len;
+	notify_off = 0;
+	nvic_disable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+	notify_busy = true;
+	notify_next();
+	nvic_enable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+	return true;
+}
+
+void cdc_stream_get_stats(cdc_stream_stats_t *out) { *out = stats; }
+
+void cdc_stream_on_config(usbd_device *usbd_dev) {
+	(void)usbd_dev;
+	tx_busy = false;
+	rx_nak = false;
+	notify_busy = false;
+	last_tx_len = 0;
+	configured = true;
+	tx_next();
+}
+
+void cdc_stream_on_rx(usbd_device *usbd_dev) {
+	uint8_t packet[CDC_STREAM_PACKET];
+	uint16_t len = usbd_ep_read_packet(usbd_dev, 0x01, packet, sizeof(packet));
+
+	ring_write(&rx_ring, packet, len);
+	stats.rx_bytes += len;
+	stats.rx_packets++;
+
+	/* Keep NAKing OUT tokens until the consumer has made room for a full
+	 * packet, so nothing is ever dropped */
+	if (ring_free(&rx_ring) < CDC_STREAM_PACKET) {
+		usbd_ep_nak_set(usbd_dev, 0x01, 1);
+		rx_nak = true;
+		stats.rx_naks++;
+	}
+}
+
+void cdc_stream_on_tx(usbd_device *usbd_dev) {
+	(void)usbd_dev;
+	tx_next();
+}
+
+void cdc_stream_on_notify(usbd_device *usbd_dev) {
+	(void)usbd_dev;
+	notify_next();
+}
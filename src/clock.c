@@ -0,0 +1,148 @@
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/scb.h>
+#include <libopencm3/stm32/rcc.h>
+
+#include "board.h"
+#include "clock.h"
+#include "idle.h"
+#include "utils.h"
+
+/* rcc_clock_setup_pll() runs the core from HSI while the PLL relocks */
+#define HSI_MHZ 8
+
+static const struct rcc_clock_scale *const profiles[CLOCK_PROFILES] = {
+	[CLOCK_LOW] = BOARD_CLOCK_LOW,
+	[CLOCK_HIGH] = BOARD_CLOCK_HIGH,
+};
+
+static clock_listener_t listeners[CLOCK_MAX_LISTENERS];
+static uint8_t n_listeners;
+static volatile clock_profile_t current;
+static uint8_t holds;
+/* RTC tick until which a boost lasts */
+static volatile uint32_t boost_until;
+/* RTC tick of the last switch, for the residency */
+static uint32_t last_change;
+static clock_stats_t stats;
+
+void clock_init(void) {
+	rcc_clock_setup_pll(profiles[CLOCK_HIGH]);
+	current = CLOCK_HIGH;
+	last_change = idle_now();
+	boost_until = last_change + IDLE_MS(CLOCK_BOOST_MS);
+}
+
+bool clock_register(clock_listener_t fn) {
+	if (n_listeners == CLOCK_MAX_LISTENERS) {
+		return false;
+	}
+	listeners[n_listeners++] = fn;
+	return true;
+}
+
+clock_profile_t clock_profile(void) { return current; }
+
+/* PPREx values below 4 do not divide */
+uint32_t clock_apb1_timer_hz(void) {
+	return (RCC_CFGR & (4 << 8)) ? 2 * rcc_apb1_frequency : rcc_apb1_frequency;
+}
+
+uint32_t clock_apb2_timer_hz(void) {
+	return (RCC_CFGR & (4 << 11)) ? 2 * rcc_apb2_frequency
+								  : rcc_apb2_frequency;
+}
+
+static void account(void) {
+	uint32_t now = idle_now();
+	stats.ticks[current] += now - last_change;
+	last_change = now;
+}
+
+/* PLLMUL and PLLSRC are read only while PLLON is set, and
+ * rcc_clock_setup_pll() never clears it: the core goes to HSI and the PLL
+ * is stopped first, or the new profile only changes the flash latency and
+ * the rcc_*_frequency values */
+static void pll_off(void) {
+	rcc_osc_on(RCC_HSI);
+	rcc_wait_for_osc_ready(RCC_HSI);
+	rcc_set_sysclk_source(RCC_CFGR_SW_SYSCLKSEL_HSICLK);
+	while (rcc_system_clock_source() != RCC_CFGR_SWS_SYSCLKSEL_HSICLK) {
+	}
+	rcc_osc_off(RCC_PLL);
+	while (RCC_CR & RCC_CR_PLLRDY) {
+	}
+}
+
+static void switch_to(clock_profile_t profile) {
+	uint32_t mask = cm_mask_interrupts(1);
+	if (profile == current) {
+		cm_mask_interrupts(mask);
+		return;
+	}
+	account();
+
+	uint32_t start = dwt_read_cycle_counter();
+	pll_off();
+	rcc_clock_setup_pll(profiles[profile]);
+	uint32_t pll = dwt_read_cycle_counter();
+	for (uint8_t i = 0; i < n_listeners; i++) {
+		listeners[i]();
+	}
+	uint32_t end = dwt_read_cycle_counter();
+
+	uint32_t us =
+		(pll - start) / HSI_MHZ + (end - pll) / (rcc_ahb_frequency / 1000000);
+	stats.switch_us_last = us;
+	if (us > stats.switch_us_max) {
+		stats.switch_us_max = us;
+	}
+	stats.switches[profile]++;
+	current = profile;
+	cm_mask_interrupts(mask);
+}
+
+/* The listeners reprogram SPI, I2C and USART dividers, which must not
+ * happen in the middle of a transfer of the main loop */
+static bool in_interrupt(void) { return SCB_ICSR & SCB_ICSR_VECTACTIVE; }
+
+void clock_boost(void) {
+	boost_until = idle_now() + IDLE_MS(CLOCK_BOOST_MS);
+	if (!in_interrupt()) {
+		switch_to(CLOCK_HIGH);
+	}
+}
+
+void clock_hold(void) {
+	uint32_t mask = cm_mask_interrupts(1);
+	holds++;
+	cm_mask_interrupts(mask);
+	if (!in_interrupt()) {
+		switch_to(CLOCK_HIGH);
+	}
+}
+
+void clock_release(void) {
+	uint32_t mask = cm_mask_interrupts(1);
+	if (holds) {
+		holds--;
+	}
+	cm_mask_interrupts(mask);
+}
+
+void clock_idle(void) {
+	/* Masked so that a boost from an interrupt cannot be undone */
+	uint32_t mask = cm_mask_interrupts(1);
+	bool boosted = (int32_t)(idle_now() - boost_until) < 0;
+	switch_to(holds || boosted ? CLOCK_HIGH : CLOCK_LOW);
+	cm_mask_interrupts(mask);
+}
+
+void clock_restore(void) { rcc_clock_setup_pll(profiles[current]); }
+
+void clock_get_stats(clock_stats_t *out) {
+	uint32_t mask = cm_mask_interrupts(1);
+	account();
+	*out = stats;
+	cm_mask_interrupts(mask);
+}
@@ -0,0 +1,37 @@
+#include <libopencm3/stm32/flash.h>
+
+#include <string.h>
+
+#include "flash_port.h"
+
+static bool flash_ok(void) {
+	bool ok = !(FLASH_SR & (FLASH_SR_PGERR | FLASH_SR_WRPRTERR));
+	flash_clear_status_flags();
+	return ok;
+}
+
+bool flash_port_erase(uint32_t address) {
+	flash_unlock();
+	flash_erase_page(address);
+	bool ok = flash_ok();
+	flash_lock();
+	return ok;
+}
+
+bool flash_port_program(uint32_t address, const void *data, uint32_t len) {
+	const uint8_t *bytes = data;
+	bool ok = true;
+
+	flash_unlock();
+	for (uint32_t i = 0; ok && i < len; i += 2) {
+		uint16_t half;
+		memcpy(&half, bytes + i, sizeof(half));
+		if (half == 0xffff) {
+			continue;
+		}
+		flash_program_half_word(address + i, half);
+		ok = flash_ok() && *(volatile uint16_t *)(address + i) == half;
+	}
+	flash_lock();
+	return ok;
+}
@@ -0,0 +1,313 @@
+#include <string.h>
+
+#include "flashlog.h"
+
+typedef enum {
+	REC_VALID,
+	/* Failed its CRC, skipped */
+	REC_TORN,
+	/* Erased space follows */
+	REC_END,
+	/* No room for another record */
+	REC_FULL,
+	/* The length cannot be trusted, nothing after it can be used */
+	REC_BAD,
+} record_t;
+
+static uint16_t record_size(uint16_t len) {
+	return FLASHLOG_RECORD_SIZE + ((len + 3) & ~3u);
+}
+
+static uint16_t get16(const uint8_t *p) {
+	uint16_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t get32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static record_t read_record(const uint8_t *page, uint16_t offset,
+							uint16_t *len, uint16_t *type, uint32_t *seq) {
+	if (offset + FLASHLOG_RECORD_SIZE > FLASHLOG_PAGE_SIZE) {
+		return REC_FULL;
+	}
+	*len = get16(page + offset);
+	*type = get16(page + offset + 2);
+	/* Records are programmed in address order, a cut in the length or type
+	 * half-word leaves anything but an erased or a valid pair */
+	if (*len == 0xffff && *type == 0xffff) {
+		return REC_END;
+	}
+	uint16_t size = record_size(*len);
+	if ((*type != FLASHLOG_TYPE_DATA && *type != FLASHLOG_TYPE_ACK) ||
+		*len > FLASHLOG_MAX_DATA || offset + size > FLASHLOG_PAGE_SIZE) {
+		return REC_BAD;
+	}
+	*seq = get32(page + offset + 4);
+	if (flashlog_crc(page + offset, size / 4 - 1) !=
+		get32(page + offset + size - 4)) {
+		return REC_TORN;
+	}
+	return REC_VALID;
+}
+
+/* Rebuilds the index entry of a page with a valid header, returns the
+ * offset of its free space */
+static uint16_t scan_page(flashlog_t *log, uint16_t p) {
+	const uint8_t *page = flashlog_flash_page(p);
+	flashlog_page_t *pg = &log->pages[p];
+	uint16_t offset = FLASHLOG_HEADER_SIZE;
+
+	while (1) {
+		uint16_t len, type;
+		uint32_t seq;
+		switch (read_record(page, offset, &len, &type, &seq)) {
+		case REC_VALID:
+			if (type == FLASHLOG_TYPE_ACK) {
+				if (seq > log->acked) {
+					log->acked = seq;
+				}
+			} else {
+				if (!pg->first) {
+					pg->first = seq;
+				}
+				pg->last = seq;
+				if (seq >= log->next_seq) {
+					log->next_seq = seq + 1;
+				}
+			}
+			offset += record_size(len);
+			break;
+		case REC_TORN:
+			log->torn++;
+			offset += record_size(len);
+			break;
+		case REC_END:
+			return offset;
+		case REC_BAD:
+			log->torn++;
+			return FLASHLOG_PAGE_SIZE;
+		case REC_FULL:
+			return FLASHLOG_PAGE_SIZE;
+		}
+	}
+}
+
+void flashlog_mount(flashlog_t *log) {
+	uint32_t max_erases = 0;
+	uint32_t oldest = UINT32_MAX;
+	uint32_t oldest_base = 0;
+
+	memset(log, 0, sizeof(*log));
+	log->head = FLASHLOG_NONE;
+	log->offset = FLASHLOG_PAGE_SIZE;
+	log->next_page_seq = 1;
+	log->next_seq = 1;
+
+	for (uint16_t p = 0; p < FLASHLOG_PAGES; p++) {
+		const uint8_t *page = flashlog_flash_page(p);
+		flashlog_page_t *pg = &log->pages[p];
+		if (get32(page) != FLASHLOG_MAGIC ||
+			flashlog_crc(page, 5) != get32(page + 20)) {
+			continue;
+		}
+		pg->page_seq = get32(page + 4);
+		uint32_t base = get32(page + 8);
+		uint32_t acked = get32(page + 12);
+		pg->erases = get32(page + 16);
+
+		if (pg->erases > max_erases) {
+			max_erases = pg->erases;
+		}
+		if (base > log->next_seq) {
+			log->next_seq = base;
+		}
+		if (acked > log->acked) {
+			log->acked = acked;
+		}
+		if (pg->page_seq < oldest) {
+			oldest = pg->page_seq;
+			oldest_base = base;
+		}
+		uint16_t offset = scan_page(log, p);
+		if (pg->page_seq >= log->next_page_seq) {
+			log->next_page_seq = pg->page_seq + 1;
+			log->head = p;
+			log->offset = offset;
+		}
+	}
+
+	/* Every page before the oldest one was erased, so acknowledged */
+	if (oldest_base && oldest_base - 1 > log->acked) {
+		log->acked = oldest_base - 1;
+	}
+	if (log->acked >= log->next_seq) {
+		log->acked = log->next_seq - 1;
+	}
+	/* Count lost with a torn erase, assume the worst */
+	for (uint16_t p = 0; p < FLASHLOG_PAGES; p++) {
+		if (!log->pages[p].page_seq) {
+			log->pages[p].erases = max_erases;
+		}
+	}
+}
+
+/* Erases the least worn page that holds nothing unacknowledged and makes
+ * it the head */
+static flashlog_status_t open_page(flashlog_t *log) {
+	uint16_t best = FLASHLOG_NONE;
+
+	for (uint16_t p = 0; p < FLASHLOG_PAGES; p++) {
+		const flashlog_page_t *pg = &log->pages[p];
+		if (p == log->head || (pg->page_seq && pg->last > log->acked)) {
+			continue;
+		}
+		if (best == FLASHLOG_NONE || pg->erases < log->pages[best].erases) {
+			best = p;
+		}
+	}
+	if (best == FLASHLOG_NONE) {
+		return FLASHLOG_FULL;
+	}
+
+	flashlog_page_t *pg = &log->pages[best];
+	*pg = (flashlog_page_t){.erases = pg->erases + 1};
+	log->head = best;
+	log->offset = FLASHLOG_PAGE_SIZE;
+	if (!flashlog_flash_erase(best)) {
+		return FLASHLOG_FLASH;
+	}
+	uint32_t header[FLASHLOG_HEADER_SIZE / 4] = {
+		FLASHLOG_MAGIC, log->next_page_seq, log->next_seq, log->acked,
+		pg->erases};
+	header[5] = flashlog_crc(header, 5);
+	if (!flashlog_flash_program(best, 0, header, sizeof(header))) {
+		return FLASHLOG_FLASH;
+	}
+	pg->page_seq = log->next_page_seq++;
+	log->offset = FLASHLOG_HEADER_SIZE;
+	return FLASHLOG_OK;
+}
+
+static flashlog_status_t put(flashlog_t *log, uint16_t type, uint32_t seq,
+							 const void *data, uint16_t len) {
+	uint16_t size = record_size(len);
+	uint8_t *stage = (uint8_t *)log->stage;
+
+	if (log->head == FLASHLOG_NONE || log->offset + size > FLASHLOG_PAGE_SIZE) {
+		flashlog_status_t status = open_page(log);
+		if (status != FLASHLOG_OK) {
+			return status;
+		}
+	}
+
+	memset(stage, 0xff, size);
+	memcpy(stage, &len, 2);
+	memcpy(stage + 2, &type, 2);
+	memcpy(stage + 4, &seq, 4);
+	if (len) {
+		memcpy(stage + 8, data, len);
+	}
+	uint32_t crc = flashlog_crc(stage, size / 4 - 1);
+	memcpy(stage + size - 4, &crc, 4);
+
+	if (!flashlog_flash_program(log->head, log->offset, stage, size)) {
+		log->offset = FLASHLOG_PAGE_SIZE;
+		return FLASHLOG_FLASH;
+	}
+	log->offset += size;
+	return FLASHLOG_OK;
+}
+
+flashlog_status_t flashlog_append(flashlog_t *log, const void *data,
+								  uint16_t len, uint32_t *seq) {
+	if (len > FLASHLOG_MAX_DATA) {
+		return FLASHLOG_TOO_BIG;
+	}
+	flashlog_status_t status =
+		put(log, FLASHLOG_TYPE_DATA, log->next_seq, data, len);
+	if (status != FLASHLOG_OK) {
+		return status;
+	}
+	flashlog_page_t *pg = &log->pages[log->head];
+	if (!pg->first) {
+		pg->first = log->next_seq;
+	}
+	pg->last = log->next_seq;
+	if (seq) {
+		*seq = log->next_seq;
+	}
+	log->next_seq++;
+	return FLASHLOG_OK;
+}
+
+flashlog_status_t flashlog_ack(flashlog_t *log, uint32_t seq) {
+	if (seq >= log->next_seq) {
+		seq = log->next_seq - 1;
+	}
+	if (seq <= log->acked) {
+		return FLASHLOG_OK;
+	}
+	/* Before the record goes out, the pages it frees may take it */
+	log->acked = seq;
+	return put(log, FLASHLOG_TYPE_ACK, seq, NULL, 0);
+}
+
+uint32_t flashlog_pending(const flashlog_t *log) {
+	return log->next_seq - 1 - log->acked;
+}
+
+/* The oldest page with data records from `seq` on */
+static uint16_t find_page(const flashlog_t *log, uint32_t after,
+						  uint32_t seq) {
+	uint16_t best = FLASHLOG_NONE;
+
+	for (uint16_t p = 0; p < FLASHLOG_PAGES; p++) {
+		const flashlog_page_t *pg = &log->pages[p];
+		if (pg->page_seq <= after || pg->last < seq) {
+			continue;
+		}
+		if (best == FLASHLOG_NONE ||
+			pg->page_seq < log->pages[best].page_seq) {
+			best = p;
+		}
+	}
+	return best;
+}
+
+void flashlog_replay(const flashlog_t *log, flashlog_cursor_t *c) {
+	c->seq = log->acked + 1;
+	c->page = find_page(log, 0, c->seq);
+	c->offset = FLASHLOG_HEADER_SIZE;
+}
+
+flashlog_status_t flashlog_next(const flashlog_t *log, flashlog_cursor_t *c,
+								void *out, uint16_t *len, uint32_t *seq) {
+	while (c->page != FLASHLOG_NONE) {
+		const uint8_t *page = flashlog_flash_page(c->page);
+		uint16_t rlen, type;
+		uint32_t rseq;
+		record_t r = read_record(page, c->offset, &rlen, &type, &rseq);
+
+		if (r != REC_VALID && r != REC_TORN) {
+			c->page = find_page(log, log->pages[c->page].page_seq, c->seq);
+			c->offset = FLASHLOG_HEADER_SIZE;
+			continue;
+		}
+		uint16_t data = c->offset + 8;
+		c->offset += record_size(rlen);
+		if (r == REC_VALID && type == FLASHLOG_TYPE_DATA && rseq >= c->seq &&
+			rlen <= *len) {
+			memcpy(out, page + data, rlen);
+			*len = rlen;
+			*seq = rseq;
+			c->seq = rseq + 1;
+			return FLASHLOG_OK;
+		}
+	}
+	return FLASHLOG_END;
+}
@@ -0,0 +1,48 @@
+#include <libopencm3/stm32/crc.h>
+#include <libopencm3/stm32/rcc.h>
+
+#include "flash_port.h"
+#include "flashlog.h"
+
+/* Firmware hooks under flashlog.h, on the flash controller and CRC unit */
+
+/* The log pages, the .flashlog section of stm32f103c8-stores.ld at the end
+ * of flash, outside the image. Read through the volatile qualifier, the
+ * contents change under the compiler. */
+extern const volatile uint8_t _flashlog_start[];
+extern const volatile uint8_t _flashlog_end[];
+
+static bool crc_on;
+
+static uint32_t address(uint16_t page, uint16_t offset) {
+	return (uint32_t)&_flashlog_start[page * FLASHLOG_PAGE_SIZE + offset];
+}
+
+/* Nothing past the section is touched, should it be smaller than the log */
+static bool inside(uint16_t page, uint16_t offset, uint16_t len) {
+	return address(page, offset) + len <= (uint32_t)_flashlog_end;
+}
+
+bool flashlog_flash_erase(uint16_t page) {
+	return inside(page, 0, FLASHLOG_PAGE_SIZE) &&
+		   flash_port_erase(address(page, 0));
+}
+
+bool flashlog_flash_program(uint16_t page, uint16_t offset, const void *data,
+							uint16_t len) {
+	return inside(page, offset, len) &&
+		   flash_port_program(address(page, offset), data, len);
+}
+
+const uint8_t *flashlog_flash_page(uint16_t page) {
+	return (const uint8_t *)&_flashlog_start[page * FLASHLOG_PAGE_SIZE];
+}
+
+uint32_t flashlog_crc(const void *words, uint16_t n) {
+	if (!crc_on) {
+		rcc_periph_clock_enable(RCC_CRC);
+		crc_on = true;
+	}
+	crc_reset();
+	return n ? crc_calculate_block((uint32_t *)words, n) : CRC_DR;
+}
@@ -0,0 +1,120 @@
+#include <string.h>
+
+#include "fmt.h"
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static const uint32_t powers10[] = {
+	1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+	1000000000};
+
+/* Writes `v` with at least `digits` digits backwards from `end`, returns
+ * the number written. The division by 10 is a multiply. */
+static uint8_t put_dec(char *end, uint32_t v, uint8_t digits) {
+	uint8_t n = 0;
+
+	do {
+		*--end = '0' + v % 10;
+		v /= 10;
+		n++;
+	} while (v || n < digits);
+	return n;
+}
+
+void fmt_buf_write(void *ctx, const char *data, uint16_t len) {
+	fmt_buf_t *b = ctx;
+
+	if (b->len + 1 < b->size) {
+		uint16_t n = b->size - 1 - b->len;
+		n = len < n ? len : n;
+		memcpy(&b->buf[b->len], data, n);
+		b->buf[b->len + n] = '\0';
+	}
+	b->len += len;
+}
+
+void fmt_str(const fmt_sink_t *s, const char *str) {
+	s->write(s->ctx, str, strlen(str));
+}
+
+void fmt_char(const fmt_sink_t *s, char c) { s->write(s->ctx, &c, 1); }
+
+void fmt_u32(const fmt_sink_t *s, uint32_t v) {
+	char text[10];
+	uint8_t n = put_dec(text + sizeof(text), v, 1);
+	s->write(s->ctx, text + sizeof(text) - n, n);
+}
+
+void fmt_i32(const fmt_sink_t *s, int32_t v) {
+	char text[11];
+	char *end = text + sizeof(text);
+	uint8_t n = put_dec(end, v < 0 ? -(uint32_t)v : (uint32_t)v, 1);
+	if (v < 0) {
+		end[-++n] = '-';
+	}
+	s->write(s->ctx, end - n, n);
+}
+
+void fmt_hex(const fmt_sink_t *s, uint32_t v, uint8_t digits) {
+	char text[8];
+	uint8_t n = 0;
+
+	do {
+		text[sizeof(text) - ++n] = hex_digits[v & 0xf];
+		v >>= 4;
+	} while ((v || n < digits) && n < sizeof(text));
+	s->write(s->ctx, text + sizeof(text) - n, n);
+}
+
+void fmt_fixed(const fmt_sink_t *s, int32_t v, uint8_t decimals) {
+	/* Sign, 10 digits, the point and 9 more */
+	char text[21];
+	char *end = text + sizeof(text);
+	uint32_t mag = v < 0 ? -(uint32_t)v : (uint32_t)v;
+	uint8_t n = 0;
+
+	if (decimals > 9) {
+		decimals = 9;
+	}
+	if (decimals) {
+		n = put_dec(end, mag % powers10[decimals], decimals);
+		end[-++n] = '.';
+	}
+	n += put_dec(end - n, mag / powers10[decimals], 1);
+	if (v < 0) {
+		end[-++n] = '-';
+	}
+	s->write(s->ctx, end - n, n);
+}
+
+void fmt_q16(const fmt_sink_t *s, q16_t v, uint8_t decimals) {
+	if (decimals > 4) {
+		decimals = 4;
+	}
+	/* Half away from zero; at most 2^31 * 10^4 / 2^16, no overflow */
+	int64_t scaled = (int64_t)v * powers10[decimals];
+	int32_t r = scaled < 0 ? -(int32_t)((-scaled + Q16_ONE / 2) >> Q16_SHIFT)
+						   : (int32_t)((scaled + Q16_ONE / 2) >> Q16_SHIFT);
+	fmt_fixed(s, r, decimals);
+}
+
+void fmt_hex_bytes(const fmt_sink_t *s, const uint8_t *data, uint16_t len,
+				   char sep) {
+	char text[3] = {sep};
+
+	for (uint16_t i = 0; i < len; i++) {
+		text[1] = hex_digits[data[i] >> 4];
+		text[2] = hex_digits[data[i] & 0xf];
+		s->write(s->ctx, sep ? text : text + 1, sep ? 3 : 2);
+	}
+}
+
+void fmt_hexdump(const fmt_sink_t *s, const uint8_t *data, uint16_t len) {
+	for (uint16_t i = 0; i < len; i += FMT_DUMP_LINE) {
+		uint16_t n = len - i < FMT_DUMP_LINE ? len - i : FMT_DUMP_LINE;
+		fmt_hex(s, i, 4);
+		fmt_char(s, ':');
+		fmt_hex_bytes(s, data + i, n, ' ');
+		fmt_char(s, '\n');
+	}
+}
@@ -0,0 +1,17 @@
+#include <stdint.h>
+
+#include "fmt.h"
+#include "utils.h"
+
+void fmt_itm_write(void *ctx, const char *data, uint16_t len) {
+	uintptr_t port = (uintptr_t)ctx;
+	for (uint16_t i = 0; i < len; i++) {
+		itm_send_char(port, data[i]);
+	}
+}
+
+#ifdef LOG_UART
+const fmt_sink_t fmt_log = {fmt_uart_write, 0};
+#else
+const fmt_sink_t fmt_log = {fmt_itm_write, 0};
+#endif
@@ -0,0 +1,81 @@
+#include "frame.h"
+
+static const uint16_t crc16_nibble[16] = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+	0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+};
+
+uint16_t frame_crc16(const uint8_t *data, size_t len) {
+	uint16_t crc = 0xffff;
+	while (len--) {
+		crc = (crc << 4) ^ crc16_nibble[(crc >> 12) ^ (*data >> 4)];
+		crc = (crc << 4) ^ crc16_nibble[(crc >> 12) ^ (*data & 0x0f)];
+		data++;
+	}
+	return crc;
+}
+
+size_t frame_cobs_encode(const uint8_t *src, size_t len, uint8_t *dst) {
+	size_t code_at = 0, out = 1;
+	uint8_t code = 1;
+
+	for (size_t i = 0; i < len; i++) {
+		if (src[i] == 0) {
+			dst[code_at] = code;
+			code_at = out++;
+			code = 1;
+			continue;
+		}
+		dst[out++] = src[i];
+		if (++code == 0xff) {
+			dst[code_at] = code;
+			code_at = out++;
+			code = 1;
+		}
+	}
+	dst[code_at] = code;
+	return out;
+}
+
+size_t frame_cobs_decode(const uint8_t *src, size_t len, uint8_t *dst) {
+	size_t in = 0, out = 0;
+
+	while (in < len) {
+		uint8_t code = src[in++];
+		if (code == 0 || in + code - 1 > len) {
+			return 0;
+		}
+		for (uint8_t i = 1; i < code; i++) {
+			if (src[in] == 0) {
+				return 0;
+			}
+			dst[out++] = src[in++];
+		}
+		if (code != 0xff && in < len) {
+			dst[out++] = 0;
+		}
+	}
+	return out;
+}
+
+size_t frame_pack(uint8_t *raw, size_t len, uint8_t *dst) {
+	uint16_t crc = frame_crc16(raw, len);
+	raw[len] = crc & 0xff;
+	raw[len + 1] = crc >> 8;
+	size_t n = frame_cobs_encode(raw, len + 2, dst);
+	dst[n++] = FRAME_DELIMITER;
+	return n;
+}
+
+size_t frame_unpack(const uint8_t *enc, size_t len, uint8_t *raw) {
+	size_t n = frame_cobs_decode(enc, len, raw);
+	if (n < 2) {
+		return 0;
+	}
+	n -= 2;
+	uint16_t crc = raw[n] | (raw[n + 1] << 8);
+	if (crc != frame_crc16(raw, n)) {
+		return 0;
+	}
+	return n;
+}
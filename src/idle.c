@@ -0,0 +1,199 @@
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/scb.h>
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/stm32/pwr.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/rtc.h>
+
+#include "board.h"
+#include "clock.h"
+#include "idle.h"
+#include "utils.h"
+
+/* EXTI lines internally wired to the RTC alarm and the USB wakeup event */
+#define EXTI_RTC_ALARM EXTI17
+#define EXTI_USB_WAKEUP EXTI18
+
+/* The core runs from HSI when leaving stop */
+#define HSI_MHZ 8
+
+static uint8_t holds[IDLE_MODES];
+static idle_stats_t stats;
+/* RTC tick of the last mode change, for the residency */
+static uint32_t last_change;
+static bool standby_reset;
+
+void idle_start(void) {
+	rcc_periph_clock_enable(RCC_PWR);
+	rcc_periph_clock_enable(RCC_BKP);
+	/* The LSE takes up to seconds after a power up. Once the RTC runs it
+	 * sits in the backup domain and is left alone. */
+	if (!(RCC_BDCR & RCC_BDCR_RTCEN)) {
+		pwr_disable_backup_domain_write_protect();
+		rcc_osc_on(BOARD_RTC_CLOCK);
+	}
+}
+
+void idle_init(void) {
+	idle_start();
+
+	/* Only configures the RTC on the first power up, so the time base
+	 * survives a wake-up from standby */
+	rtc_auto_awake(BOARD_RTC_CLOCK, BOARD_RTC_HZ / IDLE_HZ - 1);
+	rtc_clear_flag(RTC_ALR);
+	rtc_interrupt_enable(RTC_ALR);
+
+	exti_set_trigger(EXTI_RTC_ALARM | EXTI_USB_WAKEUP, EXTI_TRIGGER_RISING);
+	exti_enable_request(EXTI_RTC_ALARM | EXTI_USB_WAKEUP);
+	nvic_enable_irq(NVIC_RTC_ALARM_IRQ);
+	nvic_enable_irq(NVIC_USB_WAKEUP_IRQ);
+
+	if (pwr_get_standby_flag()) {
+		standby_reset = true;
+		pwr_clear_standby_flag();
+	}
+
+	dwt_enable_cycle_counter();
+	holds[IDLE_STANDBY] = 1;
+	last_change = idle_now();
+}
+
+bool idle_woke_from_standby(void) { return standby_reset; }
+
+uint32_t idle_now(void) { return rtc_get_counter_val(); }
+
+void rtc_alarm_isr(void) {
+	exti_reset_request(EXTI_RTC_ALARM);
+	rtc_clear_flag(RTC_ALR);
+}
+
+void usb_wakeup_isr(void) { exti_reset_request(EXTI_USB_WAKEUP); }
+
+void idle_hold(idle_mode_t mode) {
+	uint32_t mask = cm_mask_interrupts(1);
+	holds[mode]++;
+	cm_mask_interrupts(mask);
+}
+
+void idle_release(idle_mode_t mode) {
+	uint32_t mask = cm_mask_interrupts(1);
+	if (holds[mode]) {
+		holds[mode]--;
+	}
+	cm_mask_interrupts(mask);
+}
+
+static bool allowed(idle_mode_t mode) {
+	for (uint8_t m = IDLE_SLEEP; m <= mode; m++) {
+		if (holds[m]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static idle_mode_t choose(uint32_t remaining) {
+	if (remaining >= IDLE_STANDBY_MIN_TICKS && allowed(IDLE_STANDBY)) {
+		return IDLE_STANDBY;
+	}
+	if (remaining >= IDLE_STOP_MIN_TICKS && allowed(IDLE_STOP)) {
+		return IDLE_STOP;
+	}
+	return allowed(IDLE_SLEEP) ? IDLE_SLEEP : IDLE_RUN;
+}
+
+static void account(idle_mode_t mode) {
+	uint32_t now = idle_now();
+	stats.ticks[mode] += now - last_change;
+	last_change = now;
+}
+
+/* Brings the clock tree back after stop. The regulator wake-up before the
+ * first instruction (a few us, see the datasheet) is not included. */
+static void restore_clocks(void) {
+	uint32_t start = dwt_read_cycle_counter();
+	clock_restore();
+	uint32_t pll = dwt_read_cycle_counter();
+	/* The RTC registers have to resync to APB1 before they can be read */
+	RTC_CRL &= ~RTC_CRL_RSF;
+	while (!(RTC_CRL & RTC_CRL_RSF)) {
+	}
+	uint32_t end = dwt_read_cycle_counter();
+
+	uint32_t us =
+		(pll - start) / HSI_MHZ + (end - pll) / (rcc_ahb_frequency / 1000000);
+	stats.wake_us_last = us;
+	if (us > stats.wake_us_max) {
+		stats.wake_us_max = us;
+	}
+}
+
+void idle_wait(uint32_t deadline, bool (*busy)(void)) {
+	cm_disable_interrupts();
+
+	uint32_t now = idle_now();
+	uint32_t remaining = IDLE_FOREVER;
+	if (deadline != IDLE_FOREVER) {
+		remaining = deadline - now;
+		if ((int32_t)remaining <= 0) {
+			cm_enable_interrupts();
+			return;
+		}
+	}
+	idle_mode_t mode = choose(remaining);
+	if (mode == IDLE_RUN || (busy && busy())) {
+		cm_enable_interrupts();
+		return;
+	}
+
+	/* Without a deadline the alarm is moved a full counter period away */
+	rtc_clear_flag(RTC_ALR);
+	exti_reset_request(EXTI_RTC_ALARM);
+	rtc_set_alarm_time(deadline == IDLE_FOREVER ? now - 1 : deadline);
+	/* The alarm only matches the counter equal to it. Should the deadline
+	 * have passed while it was written, it is a counter period away. */
+	if (deadline != IDLE_FOREVER && (int32_t)(deadline - idle_now()) <= 0) {
+		cm_enable_interrupts();
+		return;
+	}
+
+	account(IDLE_RUN);
+	stats.entries[mode]++;
+	if (mode == IDLE_STANDBY) {
+		pwr_set_standby_mode();
+		pwr_clear_wakeup_flag();
+		SCB_SCR |= SCB_SCR_SLEEPDEEP;
+	} else if (mode == IDLE_STOP) {
+		pwr_set_stop_mode();
+		pwr_voltage_regulator_low_power_in_stop();
+		SCB_SCR |= SCB_SCR_SLEEPDEEP;
+	}
+
+	/* A pending interrupt wakes the core even while masked, its handler
+	 * runs only after the clocks are back */
+	__asm__ volatile("dsb\n\twfi" ::: "memory");
+	SCB_SCR &= ~SCB_SCR_SLEEPDEEP;
+
+	if (mode == IDLE_STOP) {
+		restore_clocks();
+	}
+	account(mode);
+
+	if (rtc_check_flag(RTC_ALR) && deadline != IDLE_FOREVER) {
+		uint32_t late = idle_now() - deadline;
+		stats.deadline_wakeups++;
+		if (late > stats.late_ticks_max) {
+			stats.late_ticks_max = late;
+		}
+	}
+	cm_enable_interrupts();
+}
+
+void idle_get_stats(idle_stats_t *out) {
+	uint32_t mask = cm_mask_interrupts(1);
+	account(IDLE_RUN);
+	*out = stats;
+	cm_mask_interrupts(mask);
+}
@@ -0,0 +1,235 @@
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
+
+#include "bench.h"
+#include "board.h"
+#include "cdc_stream.h"
+#include "clock.h"
+#include "fmt.h"
+#include "irqlat.h"
+#include "mfrc522.h"
+#include "mfrc522_port.h"
+#include "utils.h"
+
+/* Timer ticks from arming to the edge: enough to finish arming, and a
+ * spread so that the edge lands anywhere in the load loop */
+#define IRQLAT_LEAD 512
+#define IRQLAT_SPREAD 4096
+/* How long USB gets to enumerate before its load runs anyway */
+#define IRQLAT_USB_WAIT_MS 2000
+
+volatile bool irqlat_armed;
+volatile uint32_t irqlat_entry;
+
+typedef enum {
+	SOURCE_EXTI1,
+	SOURCE_TIM2,
+	SOURCES,
+} source_t;
+
+static const char *const source_names[] = {"exti1", "tim2"};
+
+static uint16_t samples[IRQLAT_RUNS];
+static uint8_t usb_block[CDC_STREAM_PACKET];
+static uint32_t random_state = 1;
+static uint32_t log_line;
+static volatile uint32_t sink;
+
+static uint32_t next_random(void) {
+	random_state = random_state * 1664525 + 1013904223;
+	return random_state >> 16;
+}
+
+static void load_none(void) {}
+
+static void load_bus(void) { sink = MFRC522_ReadCharFromReg(VersionReg); }
+
+static void load_itm(void) {
+	const fmt_sink_t itm = FMT_ITM(IRQLAT_ITM_PORT);
+	fmt_str(&itm, "irqlat load line ");
+	fmt_u32(&itm, log_line++);
+	fmt_char(&itm, '\n');
+}
+
+static void load_usb(void) {
+	if (cdc_stream_configured()) {
+		cdc_stream_write(usb_block, sizeof(usb_block));
+	}
+}
+
+static const struct {
+	const char *name;
+	uint8_t mask;
+	void (*fn)(void);
+} loads[] = {
+	{"idle", 0, load_none},
+	{MFRC522_BUS_NAME, IRQLAT_LOAD_SPI, load_bus},
+	{"itm", IRQLAT_LOAD_ITM, load_itm},
+	{"usb", IRQLAT_LOAD_USB, load_usb},
+};
+
+/* Free running at the timer clock, the channel output low until armed */
+static void stimulus_init(void) {
+	rcc_periph_clock_enable(BOARD_IRQLAT_TIMER_RCC);
+	timer_set_mode(BOARD_IRQLAT_TIMER, TIM_CR1_CKD_CK_INT, TIM_CR1_CMS_EDGE,
+				   TIM_CR1_DIR_UP);
+	timer_set_prescaler(BOARD_IRQLAT_TIMER, 0);
+	timer_set_period(BOARD_IRQLAT_TIMER, 0xffff);
+	timer_set_oc_mode(BOARD_IRQLAT_TIMER, BOARD_IRQLAT_OC, TIM_OCM_FORCE_LOW);
+	timer_enable_oc_output(BOARD_IRQLAT_TIMER, BOARD_IRQLAT_OC);
+	gpio_set_mode(BOARD_IRQLAT_STIMULUS.port, GPIO_MODE_OUTPUT_50_MHZ,
+				  GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, BOARD_IRQLAT_STIMULUS.pin);
+	timer_generate_event(BOARD_IRQLAT_TIMER, TIM_EGR_UG);
+	timer_enable_counter(BOARD_IRQLAT_TIMER);
+}
+
+/* Rising edges only, the harness pulls the wire low again in between. The
+ * echo capture is off meanwhile, the harness pulses are no echoes. */
+static void source_start(source_t source) {
+	timer_disable_irq(BOARD_ECHO_TIMER, TIM_DIER_CC1IE);
+	if (source == SOURCE_EXTI1) {
+		exti_set_trigger(BOARD_ECHO_EXTI, EXTI_TRIGGER_RISING);
+		exti_reset_request(BOARD_ECHO_EXTI);
+		exti_enable_request(BOARD_ECHO_EXTI);
+		nvic_enable_irq(BOARD_ECHO_IRQ);
+		return;
+	}
+	timer_clear_flag(BOARD_ECHO_TIMER, TIM_SR_CC2IF);
+	timer_enable_irq(BOARD_ECHO_TIMER, TIM_DIER_CC2IE);
+}
+
+/* Back to how setup_gpio() and setup_timers() left the echo input */
+static void source_stop(void) {
+	nvic_disable_irq(BOARD_ECHO_IRQ);
+	exti_disable_request(BOARD_ECHO_EXTI);
+	timer_disable_irq(BOARD_ECHO_TIMER, TIM_DIER_CC2IE);
+	timer_clear_flag(BOARD_ECHO_TIMER, TIM_SR_CC1IF);
+	timer_enable_irq(BOARD_ECHO_TIMER, TIM_DIER_CC1IE);
+}
+
+/* One edge while running `load`, false if it never reached the handler.
+ * `ratio` is core cycles per timer tick. */
+static bool sample(void (*load)(void), uint32_t ratio, uint32_t *latency) {
+	uint32_t lead = IRQLAT_LEAD + next_random() % IRQLAT_SPREAD;
+	uint32_t timeout = rcc_ahb_frequency / 1000;
+
+	timer_set_oc_mode(BOARD_IRQLAT_TIMER, BOARD_IRQLAT_OC, TIM_OCM_FORCE_LOW);
+
+	/* The compare matches `lead` ticks after this counter read. The new
+	 * value goes in before the output leaves FORCE_LOW, so a match on the
+	 * old one cannot raise the edge early. */
+	cm_disable_interrupts();
+	uint16_t count = TIM_CNT(BOARD_IRQLAT_TIMER);
+	uint32_t start = DWT_CYCCNT;
+	timer_set_oc_value(BOARD_IRQLAT_TIMER, BOARD_IRQLAT_OC,
+					   (uint16_t)(count + lead));
+	timer_set_oc_mode(BOARD_IRQLAT_TIMER, BOARD_IRQLAT_OC, TIM_OCM_ACTIVE);
+	irqlat_armed = true;
+	cm_enable_interrupts();
+
+	while (irqlat_armed && DWT_CYCCNT - start < timeout) {
+		load();
+	}
+	if (irqlat_armed) {
+		irqlat_armed = false;
+		return false;
+	}
+	int32_t ticks = irqlat_entry - (start + lead * ratio);
+	*latency = ticks > 0 ? ticks : 0;
+	return true;
+}
+
+static void report(const bench_result_t *r, const bench_hist_t *h) {
+	bench_write(&fmt_log, r, "cycles");
+	bench_hist_write(&fmt_log, h, "cycles");
+}
+
+static void run_case(source_t source, uint8_t load, uint32_t ratio) {
+	/* Still referenced by the results when they are reported */
+	static char name[32];
+	static char jitter_name[40];
+	bench_result_t r = {.name = name};
+	bench_hist_t h;
+	fmt_buf_t b;
+	fmt_sink_t s;
+	uint16_t n = 0;
+	uint16_t lo = UINT16_MAX;
+
+	s = fmt_buf(&b, name, sizeof(name));
+	fmt_str(&s, "irqlat_");
+	fmt_str(&s, source_names[source]);
+	fmt_char(&s, '_');
+	fmt_str(&s, loads[load].name);
+	s = fmt_buf(&b, jitter_name, sizeof(jitter_name));
+	fmt_str(&s, name);
+	fmt_str(&s, "_jitter");
+	for (uint16_t i = 0; i < IRQLAT_RUNS; i++) {
+		uint32_t latency;
+		if (sample(loads[load].fn, ratio, &latency)) {
+			samples[n++] = latency < UINT16_MAX ? latency : UINT16_MAX;
+		}
+	}
+
+	for (uint16_t i = 0; i < n; i++) {
+		bench_add_sample(&r, samples[i]);
+		if (samples[i] < lo) {
+			lo = samples[i];
+		}
+	}
+	bench_hist_init(&h, name, n ? lo - lo % IRQLAT_BIN : 0, IRQLAT_BIN);
+	for (uint16_t i = 0; i < n; i++) {
+		bench_hist_add(&h, samples[i]);
+	}
+	report(&r, &h);
+
+	r = (bench_result_t){.name = jitter_name};
+	bench_hist_init(&h, jitter_name, 0, IRQLAT_BIN);
+	for (uint16_t i = 1; i < n; i++) {
+		uint16_t d = samples[i] > samples[i - 1] ? samples[i] - samples[i - 1]
+												 : samples[i - 1] - samples[i];
+		bench_add_sample(&r, d);
+		bench_hist_add(&h, d);
+	}
+	report(&r, &h);
+}
+
+void irqlat_run(uint8_t mask) {
+	uint32_t ratio = rcc_ahb_frequency / clock_apb1_timer_hz();
+
+	stimulus_init();
+	if (mask & IRQLAT_LOAD_USB) {
+		for (uint16_t i = 0; i < sizeof(usb_block); i++) {
+			usb_block[i] = 'a' + i % 26;
+		}
+		cdc_stream_init();
+		for (uint32_t ms = 0;
+			 ms < IRQLAT_USB_WAIT_MS && !cdc_stream_configured(); ms++) {
+			delay(1);
+		}
+	}
+	fmt_str(&fmt_log, "bench-info irqlat timer_hz=");
+	fmt_u32(&fmt_log, clock_apb1_timer_hz());
+	fmt_str(&fmt_log, " runs=");
+	fmt_u32(&fmt_log, IRQLAT_RUNS);
+	fmt_str(&fmt_log, " bin=");
+	fmt_u32(&fmt_log, IRQLAT_BIN);
+	fmt_str(&fmt_log, " usb=");
+	fmt_u32(&fmt_log, cdc_stream_configured());
+	fmt_char(&fmt_log, '\n');
+
+	for (source_t source = 0; source < SOURCES; source++) {
+		source_start(source);
+		for (uint8_t i = 0; i < LEN(loads); i++) {
+			if (!loads[i].mask || (mask & loads[i].mask)) {
+				run_case(source, i, ratio);
+			}
+		}
+		source_stop();
+	}
+	timer_disable_counter(BOARD_IRQLAT_TIMER);
+}
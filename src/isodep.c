@@ -0,0 +1,213 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "fixmath.h"
+#include "isodep.h"
+
+/* Frame size for FSCI 0 to 8, later values are read as 8 */
+static const uint16_t fsc_table[] = {16, 24, 32, 40, 48, 64, 96, 128, 256};
+
+/* Q16.16 microseconds per carrier period, 1/13.56 MHz, rounded up */
+#define CARRIER_US_Q16 ((100 * Q16_ONE + 1356 - 1) / 1356)
+
+/* 2^x * 4096/fc in microseconds, the unit of FWI and SFGI, with `extra`
+ * carrier periods more. Rounded up, never short, and a UMULL instead of
+ * the libgcc 64 bit division. */
+static uint32_t etu_time(uint8_t x, uint32_t extra) {
+	uint64_t carriers = ((uint32_t)4096 << x) + extra;
+	return (carriers * CARRIER_US_Q16 + Q16_ONE - 1) >> Q16_SHIFT;
+}
+
+static isodep_status_t card(isodep_t *d, uint8_t status) {
+	d->card = status;
+	return status ? ISODEP_CARD : ISODEP_OK;
+}
+
+static bool is_i_block(uint8_t pcb) { return (pcb & 0xE2) == ISODEP_PCB_I; }
+
+static bool is_r_ack(uint8_t pcb) {
+	return (pcb & 0xFE) == ISODEP_PCB_R_ACK;
+}
+
+/* Sends `len` bytes of d->tx and leaves the answer in d->rx, after
+ * answering any waiting time extension. On a timeout or a broken frame it
+ * asks for the answer again: R(NAK) after an I-block, else the R(ACK) of
+ * receive chaining or the S-block once more (rules 4 and 5). A card asking
+ * for our I-block again with an R(ACK) of the other block number gets it
+ * (rule 6). */
+static isodep_status_t block(isodep_t *d, uint16_t len, uint16_t *rxLen) {
+	uint8_t ctrl[2 + 2];
+	uint8_t *out = d->tx;
+	uint16_t outLen = len;
+	uint32_t timeout = d->fwtUs;
+	uint8_t tries = 0;
+
+	for (;;) {
+		*rxLen = sizeof(d->rx);
+		uint8_t status =
+			isodep_pcd_transceive(out, outLen, d->rx, rxLen, timeout);
+		timeout = d->fwtUs;
+		if (status == 0 && *rxLen) {
+			uint8_t pcb = d->rx[0];
+			if (pcb == ISODEP_PCB_S_WTX && *rxLen == 2) {
+				// The answer takes WTXM frame waiting times, this once
+				uint8_t wtxm = d->rx[1] & 0x3F;
+				if (!wtxm || wtxm > 59) {
+					return ISODEP_PROTOCOL;
+				}
+				ctrl[0] = ISODEP_PCB_S_WTX;
+				ctrl[1] = wtxm;
+				out = ctrl;
+				outLen = 2;
+				timeout = d->fwtUs * wtxm;
+				d->wtx++;
+				continue;
+			}
+			if (is_i_block(d->tx[0]) && is_r_ack(pcb) &&
+				(pcb & ISODEP_PCB_BLOCK_NUM) != d->blockNum &&
+				tries++ < ISODEP_RETRIES) {
+				out = d->tx;
+				outLen = len;
+				d->retries++;
+				continue;
+			}
+			return ISODEP_OK;
+		}
+		if (status == 0) {
+			// STATUS_ERROR, an empty frame
+			status = 1;
+		}
+		if (tries++ >= ISODEP_RETRIES) {
+			return card(d, status);
+		}
+		d->retries++;
+		if (is_i_block(d->tx[0])) {
+			ctrl[0] = ISODEP_PCB_R_NAK | d->blockNum;
+			out = ctrl;
+			outLen = 1;
+		} else {
+			out = d->tx;
+			outLen = len;
+		}
+	}
+}
+
+isodep_status_t isodep_rats(isodep_t *d) {
+	uint8_t frame[2 + 2];
+	uint16_t len = sizeof(d->ats);
+	uint8_t fsci = 2, fwi = 4, sfgi = 0;
+
+	d->wtx = 0;
+	d->retries = 0;
+	d->blockNum = 0;
+	frame[0] = ISODEP_RATS;
+	frame[1] = ISODEP_FSDI << 4;
+	isodep_status_t status = card(
+		d, isodep_pcd_transceive(frame, 2, d->ats, &len,
+								 ISODEP_FWT_ACTIVATION_US));
+	if (status != ISODEP_OK) {
+		return status;
+	}
+	// TL counts itself
+	if (!len || d->ats[0] != len) {
+		return ISODEP_PROTOCOL;
+	}
+	d->atsLen = len;
+	if (len > 1) {
+		uint8_t t0 = d->ats[1];
+		uint8_t i = 2;
+		fsci = t0 & 0x0F;
+		// TA(1) holds the bit rates, only 106 kbit/s here
+		if (t0 & 0x10) {
+			i++;
+		}
+		if ((t0 & 0x20) && i < len) {
+			fwi = d->ats[i] >> 4;
+			sfgi = d->ats[i] & 0x0F;
+		}
+	}
+	// 15 is RFU for both and means the default
+	if (fwi == 15) {
+		fwi = 4;
+	}
+	if (sfgi == 15) {
+		sfgi = 0;
+	}
+	d->fsc = fsc_table[fsci < 8 ? fsci : 8];
+	// ΔFWT = 49152/fc
+	d->fwtUs = etu_time(fwi, 49152);
+	// ΔSFGT = 384/fc * 2^SFGI, no guard time for SFGI 0
+	d->sfgtUs = sfgi ? etu_time(sfgi, (uint32_t)384 << sfgi) : 0;
+	if (d->sfgtUs) {
+		isodep_pcd_wait_us(d->sfgtUs);
+	}
+	return ISODEP_OK;
+}
+
+isodep_status_t isodep_exchange(isodep_t *d, const uint8_t *apdu,
+								uint16_t len, uint8_t *resp,
+								uint16_t *respLen) {
+	uint16_t fs = d->fsc < ISODEP_FSD ? d->fsc : ISODEP_FSD;
+	// PCB and CRC_A
+	uint16_t maxInf = fs - 3;
+	uint16_t off = 0, got = 0, rxLen;
+	isodep_status_t status;
+
+	// Command, chained if it does not fit one frame
+	for (;;) {
+		uint16_t n = len - off < maxInf ? len - off : maxInf;
+		bool chain = off + n < len;
+		d->tx[0] = ISODEP_PCB_I | d->blockNum | (chain ? ISODEP_PCB_CHAIN : 0);
+		memcpy(&d->tx[1], &apdu[off], n);
+		status = block(d, 1 + n, &rxLen);
+		if (status != ISODEP_OK) {
+			return status;
+		}
+		if (!chain) {
+			break;
+		}
+		if (rxLen != 1 || !is_r_ack(d->rx[0]) ||
+			(d->rx[0] & ISODEP_PCB_BLOCK_NUM) != d->blockNum) {
+			return ISODEP_PROTOCOL;
+		}
+		d->blockNum ^= 1;
+		off += n;
+	}
+
+	// Response, every chained I-block acknowledged
+	for (;;) {
+		uint8_t pcb = d->rx[0];
+		if (!is_i_block(pcb) || (pcb & 0x0C) ||
+			(pcb & ISODEP_PCB_BLOCK_NUM) != d->blockNum) {
+			return ISODEP_PROTOCOL;
+		}
+		d->blockNum ^= 1;
+		if (got + rxLen - 1 > *respLen) {
+			return ISODEP_NO_ROOM;
+		}
+		memcpy(&resp[got], &d->rx[1], rxLen - 1);
+		got += rxLen - 1;
+		if (!(pcb & ISODEP_PCB_CHAIN)) {
+			break;
+		}
+		d->tx[0] = ISODEP_PCB_R_ACK | d->blockNum;
+		status = block(d, 1, &rxLen);
+		if (status != ISODEP_OK) {
+			return status;
+		}
+	}
+	*respLen = got;
+	return ISODEP_OK;
+}
+
+isodep_status_t isodep_deselect(isodep_t *d) {
+	uint16_t rxLen;
+
+	d->tx[0] = ISODEP_PCB_S_DESELECT;
+	isodep_status_t status = block(d, 1, &rxLen);
+	if (status == ISODEP_OK &&
+		(rxLen != 1 || d->rx[0] != ISODEP_PCB_S_DESELECT)) {
+		return ISODEP_PROTOCOL;
+	}
+	return status;
+}
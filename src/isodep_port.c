@@ -0,0 +1,33 @@
+#include "isodep.h"
+#include "mfrc522.h"
+#include "utils.h"
+
+/* Firmware hooks under isodep.h, on the driver */
+
+uint8_t isodep_pcd_transceive(uint8_t *frame, uint16_t len, uint8_t *back,
+							  uint16_t *backLen, uint32_t timeoutUs) {
+	uint16_t crc = PICC_CRC_A(frame, len);
+	uint8_t validBits;
+
+	frame[len] = crc;
+	frame[len + 1] = crc >> 8;
+	PCD_SetTimeoutUs(timeoutUs);
+	PCD_StartTransceive();
+	MFRC522_Status status =
+		PCD_TransceiveStream(frame, len + 2, back, backLen, &validBits);
+	PCD_SetTimeoutUs(PCD_TIMEOUT_US);
+	if (status != STATUS_OK) {
+		return status;
+	}
+	// Whole bytes, a PCB and the CRC_A at least
+	if (*backLen < 3 || validBits) {
+		return STATUS_ERROR;
+	}
+	if (PICC_CRC_A(back, *backLen)) {
+		return STATUS_CRC_WRONG;
+	}
+	*backLen -= 2;
+	return STATUS_OK;
+}
+
+void isodep_pcd_wait_us(uint32_t us) { delay((us + 999) / 1000); }
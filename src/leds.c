@@ -0,0 +1,141 @@
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
+
+#include "clock.h"
+#include "fixmath.h"
+#include "idle.h"
+#include "leds.h"
+
+/* TIM1 compare channels and the DMA1 channels they request on. DMA1
+ * channel 1 (ADC1) and 4/5 (USART1) are left alone; 2/3 are SPI1's, which
+ * is only ever polled. */
+static const struct {
+	enum tim_oc_id oc;
+	uint32_t dier;
+	uint8_t dma;
+} streams[LEDS_MAX_PORTS] = {
+	{TIM_OC1, TIM_DIER_CC1DE, DMA_CHANNEL2},
+	{TIM_OC2, TIM_DIER_CC2DE, DMA_CHANNEL3},
+	{TIM_OC3, TIM_DIER_CC3DE, DMA_CHANNEL6},
+};
+
+static const port_pin_t *leds;
+static uint8_t n_leds;
+static uint8_t levels[LEDS_MAX];
+
+static uint32_t ports[LEDS_MAX_PORTS];
+static uint8_t n_ports;
+/* One BSRR word per port and slot, read by DMA in circular mode */
+static uint32_t frame[LEDS_MAX_PORTS][LEDS_SLOTS];
+
+static void start_stream(uint8_t s) {
+	uint8_t ch = streams[s].dma;
+
+	dma_channel_reset(DMA1, ch);
+	dma_set_peripheral_address(DMA1, ch, (uint32_t)&GPIO_BSRR(ports[s]));
+	dma_set_memory_address(DMA1, ch, (uint32_t)frame[s]);
+	dma_set_number_of_data(DMA1, ch, LEDS_SLOTS);
+	dma_set_read_from_memory(DMA1, ch);
+	dma_enable_memory_increment_mode(DMA1, ch);
+	dma_set_peripheral_size(DMA1, ch, DMA_CCR_PSIZE_32BIT);
+	dma_set_memory_size(DMA1, ch, DMA_CCR_MSIZE_32BIT);
+	dma_set_priority(DMA1, ch, DMA_CCR_PL_LOW);
+	dma_enable_circular_mode(DMA1, ch);
+	dma_enable_channel(DMA1, ch);
+
+	/* Frozen compare at 0: a DMA request at the start of every slot
+	 * without driving the TIM1 pins */
+	timer_set_oc_mode(TIM1, streams[s].oc, TIM_OCM_FROZEN);
+	timer_set_oc_value(TIM1, streams[s].oc, 0);
+	timer_enable_irq(TIM1, streams[s].dier);
+}
+
+/* 1 MHz timer tick whatever the clock profile, the new prescaler is loaded
+ * at the next slot boundary */
+static void leds_on_clock(void) {
+	timer_set_prescaler(TIM1, fix_prescaler(clock_apb2_timer_hz(), 1000000));
+}
+
+bool leds_init(const port_pin_t *pins, uint8_t count) {
+	if (count > LEDS_MAX) {
+		return false;
+	}
+	n_ports = 0;
+	for (uint8_t i = 0; i < count; i++) {
+		uint8_t p = 0;
+		while (p < n_ports && ports[p] != pins[i].port) {
+			p++;
+		}
+		if (p == n_ports) {
+			if (n_ports == LEDS_MAX_PORTS) {
+				return false;
+			}
+			ports[n_ports++] = pins[i].port;
+		}
+		gpio_set_mode(pins[i].port, GPIO_MODE_OUTPUT_2_MHZ,
+					  GPIO_CNF_OUTPUT_PUSHPULL, pins[i].pin);
+	}
+	/* Refresh is driven by TIM1 and DMA, both halt in stop mode */
+	if (!leds) {
+		idle_hold(IDLE_STOP);
+		clock_register(leds_on_clock);
+	}
+	leds = pins;
+	n_leds = count;
+	leds_set_mask(0);
+	leds_commit();
+
+	rcc_periph_clock_enable(RCC_DMA1);
+	rcc_periph_clock_enable(RCC_TIM1);
+	timer_set_mode(TIM1, TIM_CR1_CKD_CK_INT, TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
+	leds_on_clock();
+	timer_set_period(TIM1, 1000000 / LEDS_SLOT_HZ - 1);
+	for (uint8_t s = 0; s < n_ports; s++) {
+		start_stream(s);
+	}
+	timer_enable_counter(TIM1);
+	return true;
+}
+
+void leds_set(uint8_t index, uint8_t level) {
+	if (index < n_leds) {
+		levels[index] = level > LEDS_MAX_LEVEL ? LEDS_MAX_LEVEL : level;
+	}
+}
+
+void leds_set_mask(uint32_t mask) {
+	for (uint8_t i = 0; i < n_leds; i++) {
+		levels[i] = (mask >> i) & 1 ? LEDS_MAX_LEVEL : 0;
+	}
+}
+
+void leds_commit(void) {
+	for (uint8_t p = 0; p < n_ports; p++) {
+		/* BSRR words for each bit plane: set the pins whose level has the
+		 * bit, reset the other LED pins, leave the rest of the port alone */
+		uint32_t planes[LEDS_BCM_BITS];
+		for (uint8_t b = 0; b < LEDS_BCM_BITS; b++) {
+			uint16_t on = 0, off = 0;
+			for (uint8_t i = 0; i < n_leds; i++) {
+				if (leds[i].port != ports[p]) {
+					continue;
+				}
+				if ((levels[i] >> b) & 1) {
+					on |= leds[i].pin;
+				} else {
+					off |= leds[i].pin;
+				}
+			}
+			planes[b] = ((uint32_t)off << 16) | on;
+		}
+		/* Bit plane b is shown for slots [2^b - 1, 2^(b+1) - 1) */
+		uint8_t slot = 0;
+		for (uint8_t b = 0; b < LEDS_BCM_BITS; b++) {
+			for (uint8_t k = 0; k < (1 << b); k++) {
+				frame[p][slot++] = planes[b];
+			}
+		}
+	}
+}
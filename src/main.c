@@ -5,13 +5,30 @@
 #include <libopencm3/stm32/exti.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/rcc.h>
-#include <libopencm3/stm32/spi.h>
 #include <libopencm3/stm32/timer.h>
-#include <libopencm3/stm32/usart.h>
 
 #include <stdbool.h>
-
+#include <string.h>
+
+#include "acl.h"
+#include "adc_sampler.h"
+#include "bench.h"
+#include "board.h"
+#include "boot.h"
+#include "clock.h"
+#include "fmt.h"
+#include "hc-sr04.h"
+#include "idle.h"
+#include "irqlat.h"
+#include "leds.h"
+#include "link.h"
 #include "mfrc522.h"
+#include "mfrc522_port.h"
+#include "metrics.h"
+#include "proto.h"
+#include "stackmon.h"
+#include "uart_stream.h"
+#include "uid_cache.h"
 #include "utils.h"
 
 /* MFRC522 onboard pinouts:
@@ -20,46 +37,10 @@
  * MOSI - UART MX
  * MISO - UART TX */
 
-/* if (((ITM_TCR & ITM_TCR_ITMENA) != 0UL) && ((*ITM_TER & 1UL) != 0UL)) {
- */
-/* 	while (!(ITM_STIM32(0) & ITM_STIM_FIFOREADY)) { */
-/* 	} */
-/* 	ITM_STIM8(channel) = ch; */
-/* } */
-
-static inline bool debugger_attached() { return (DBGMCU_CR & 0x07); }
-
-static inline uint8_t itm_send_char(uint32_t channel, uint8_t ch) {
-	while (!(ITM_STIM8(0) & ITM_STIM_FIFOREADY)) {
-	}
-	ITM_STIM8(channel) = ch;
-	return ch;
-}
-
-int _write(int fd, char *ptr, int len) {
-	(void)fd;
-	int i = 0;
-	for (; i < len && ptr[i]; i++) {
-		itm_send_char(fd, ptr[i]);
-	}
-	return i;
-}
-
-static const port_pin_t leds[] = {
-	{GPIOC, GPIO13}, {GPIOA, GPIO0}, {GPIOA, GPIO1}, {GPIOA, GPIO2},
-	{GPIOA, GPIO3},	 {GPIOA, GPIO4}, {GPIOA, GPIO5}, {GPIOA, GPIO6},
-	{GPIOB, GPIO0},	 {GPIOB, GPIO1},
-};
-
-static uint8_t cur = 0;
+static uint16_t cur = 0;
 static void update_leds() {
-	for (uint8_t i = 0; i < LEN(leds); i++) {
-		if ((cur >> i) & 1) {
-			gpio_set(leds[i].port, leds[i].pin);
-		} else {
-			gpio_clear(leds[i].port, leds[i].pin);
-		}
-	}
+	leds_set_mask(cur);
+	leds_commit();
 	cur = (cur + 1) & 0x03ff;
 }
 
@@ -70,10 +51,6 @@ void sys_tick_handler() {
 	/* } */
 }
 
-static void setup_clocks() {
-	rcc_clock_setup_pll(&rcc_hse_configs[RCC_CLOCK_HSE8_72MHZ]);
-}
-
 static void setup_gpio() {
 	rcc_periph_clock_enable(RCC_GPIOA);
 	rcc_periph_clock_enable(RCC_GPIOB);
@@ -99,31 +76,28 @@ static void setup_gpio() {
 	/* 			  GPIO_SPI1_MISO); */
 
 	/* Green LED */
-	gpio_set_mode(GPIOC, GPIO_MODE_OUTPUT_2_MHZ, GPIO_CNF_OUTPUT_PUSHPULL,
-				  GPIO13);
+	gpio_set_mode(BOARD_LED_GREEN.port, GPIO_MODE_OUTPUT_2_MHZ,
+				  GPIO_CNF_OUTPUT_PUSHPULL, BOARD_LED_GREEN.pin);
 
 	/* On-board LED */
-	gpio_set_mode(GPIOB, GPIO_MODE_OUTPUT_2_MHZ, GPIO_CNF_OUTPUT_PUSHPULL,
-				  GPIO11);
+	gpio_set_mode(BOARD_LED_ONBOARD.port, GPIO_MODE_OUTPUT_2_MHZ,
+				  GPIO_CNF_OUTPUT_PUSHPULL, BOARD_LED_ONBOARD.pin);
 
-	/* Echo pin */
-	gpio_set_mode(GPIOA, GPIO_MODE_INPUT, GPIO_CNF_INPUT_PULL_UPDOWN,
-				  GPIO_TIM2_CH2);
-
-	nvic_enable_irq(NVIC_EXTI1_IRQ);
-	exti_select_source(EXTI1, GPIOA);
-	exti_set_trigger(EXTI1, EXTI_TRIGGER_BOTH);
-	exti_enable_request(EXTI1);
+	/* Echo pin, TIM2 input capture 2. Its EXTI line is only set up for the
+	 * latency harness. */
+	gpio_set_mode(BOARD_ECHO.port, GPIO_MODE_INPUT, GPIO_CNF_INPUT_PULL_UPDOWN,
+				  BOARD_ECHO.pin);
+	exti_select_source(BOARD_ECHO_EXTI, BOARD_ECHO.port);
 
 	/* Trigger pin */
-	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_50_MHZ,
-				  GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO_TIM3_CH1);
+	gpio_set_mode(BOARD_TRIGGER.port, GPIO_MODE_OUTPUT_50_MHZ,
+				  GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, BOARD_TRIGGER.pin);
 
 	/* Slave select must be 1 by default */
-	gpio_set(GPIOA, GPIO_SPI1_NSS);
-	/* gpio_set(GPIOC, GPIO13); */
+	board_pin_set(BOARD_MFRC522_NSS);
+	/* board_pin_set(BOARD_LED_GREEN); */
 	/* Turn off on-board led */
-	gpio_set(GPIOB, GPIO11);
+	board_pin_set(BOARD_LED_ONBOARD);
 
 	/* gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_2_MHZ, GPIO_CNF_OUTPUT_PUSHPULL, */
 	/* 			  GPIO0 | GPIO1 | GPIO2 | GPIO3 | GPIO4 | GPIO5 | GPIO6); */
@@ -136,176 +110,383 @@ static void setup_gpio() {
 	/* 			  GPIO13); */
 }
 
-void exti1_isr() {
-	exti_reset_request(EXTI1);
-	if (gpio_get(GPIOA, GPIO1)) {
-		timer_set_counter(TIM2, 0);
-	} else {
-		uint32_t distance = timer_get_counter(TIM2) / 58;
-		printf("Distance: %d cm.\n", distance);
-	}
+#ifdef BENCH
+/* Only the latency harness raises EXTI1, see irqlat.h */
+RAMFUNC void board_echo_isr() {
+	irqlat_stamp();
+	exti_reset_request(BOARD_ECHO_EXTI);
 }
+#endif
 
 static void setup_systick() {
 	systick_set_clocksource(STK_CSR_CLKSOURCE_AHB);
 	systick_set_reload(0xffffff);
 }
 
+/* An echo was running while the timer clock changed, its width is off */
+static volatile bool echo_skewed;
+
+/* Both ultrasonic timers tick at 1 MHz in every clock profile. The update
+ * event loads the new prescaler right away instead of at the next overflow.
+ * The echo timer gets none: it would clear the counter under a running echo,
+ * the next rising edge resets the counter and loads the prescaler anyway. */
+static void timers_on_clock(void) {
+	uint16_t prescaler = fix_prescaler(clock_apb1_timer_hz(), 1000000);
+
+	echo_skewed = board_pin_get(BOARD_ECHO);
+	timer_set_prescaler(BOARD_ECHO_TIMER, prescaler);
+	timer_set_prescaler(BOARD_TRIGGER_TIMER, prescaler);
+	timer_generate_event(BOARD_TRIGGER_TIMER, TIM_EGR_UG);
+}
+
 static void setup_timers() {
 	/* Ultrasonic echo timer setup */
-	rcc_periph_clock_enable(RCC_TIM2);
+	rcc_periph_clock_enable(BOARD_ECHO_TIMER_RCC);
 	/* nvic_enable_irq(NVIC_TIM2_IRQ); */
-	timer_set_mode(TIM2, TIM_CR1_CKD_CK_INT, TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
-	timer_set_prescaler(TIM2, (rcc_apb1_frequency * 0.000001 * 2) - 1);
-	timer_set_period(TIM2, 0xffff - 1);
-	/* timer_ic_set_input(TIM2, TIM_IC2, TIM_IC_IN_TI1); */
-	/* timer_enable_irq(TIM2, TIM_DIER_UIE); */
-	/* timer_ic_enable(TIM2, TIM_IC2); */
+	timer_set_mode(BOARD_ECHO_TIMER, TIM_CR1_CKD_CK_INT, TIM_CR1_CMS_EDGE,
+				   TIM_CR1_DIR_UP);
+	timer_set_period(BOARD_ECHO_TIMER, 0xffff - 1);
+	/* PWM input: the rising edge of the echo resets the counter, the falling
+	 * edge captures it into CCR1, the echo width without any interrupt
+	 * latency in it */
+	timer_ic_set_input(BOARD_ECHO_TIMER, TIM_IC2, TIM_IC_IN_TI2);
+	timer_ic_set_polarity(BOARD_ECHO_TIMER, TIM_IC2, TIM_IC_RISING);
+	timer_ic_set_input(BOARD_ECHO_TIMER, TIM_IC1, TIM_IC_IN_TI2);
+	timer_ic_set_polarity(BOARD_ECHO_TIMER, TIM_IC1, TIM_IC_FALLING);
+	timer_slave_set_trigger(BOARD_ECHO_TIMER, TIM_SMCR_TS_TI2FP2);
+	timer_slave_set_mode(BOARD_ECHO_TIMER, TIM_SMCR_SMS_RM);
+	timer_ic_enable(BOARD_ECHO_TIMER, TIM_IC1);
+	timer_ic_enable(BOARD_ECHO_TIMER, TIM_IC2);
+	timer_enable_irq(BOARD_ECHO_TIMER, TIM_DIER_CC1IE);
+	nvic_enable_irq(BOARD_ECHO_TIMER_IRQ);
 
 	/* Ultrasonic trigger timer setup */
-	rcc_periph_clock_enable(RCC_TIM3);
-	timer_set_mode(TIM3, TIM_CR1_CKD_CK_INT, TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
-	timer_set_prescaler(TIM3, (rcc_apb1_frequency * 0.000001) - 1);
-	timer_set_period(TIM3, 0xffff - 1);
-	timer_set_oc_mode(TIM3, TIM_OC1, TIM_OCM_PWM1);
-	timer_set_oc_value(TIM3, TIM_OC1, 10 - 1);
-	timer_enable_oc_output(TIM3, TIM_OC1);
+	rcc_periph_clock_enable(BOARD_TRIGGER_TIMER_RCC);
+	timer_set_mode(BOARD_TRIGGER_TIMER, TIM_CR1_CKD_CK_INT, TIM_CR1_CMS_EDGE,
+				   TIM_CR1_DIR_UP);
+	timer_set_period(BOARD_TRIGGER_TIMER, 0xffff - 1);
+	timer_set_oc_mode(BOARD_TRIGGER_TIMER, TIM_OC1, TIM_OCM_PWM1);
+	timer_set_oc_value(BOARD_TRIGGER_TIMER, TIM_OC1, 10 - 1);
+	timer_enable_oc_output(BOARD_TRIGGER_TIMER, TIM_OC1);
+
+	timers_on_clock();
+	clock_register(timers_on_clock);
 }
 
-void tim2_isr(void) {
-	if (timer_get_flag(TIM2, TIM_SR_CC2IF)) {
+RAMFUNC void tim2_isr(void) {
+#ifdef BENCH
+	if (irqlat_stamp()) {
 		timer_clear_flag(TIM2, TIM_SR_CC2IF);
-		printf("INPUT CAPTURE interrupt; tim2 = %u/2000\n",
-			   timer_get_counter(TIM2));
+		return;
 	}
-	/* if (timer_get_flag(TIM2, TIM_SR_TIF)) { */
-	/* 	timer_clear_flag(TIM2, TIM_SR_TIF); */
-	/* 	printf("TRIGGER trigger interrupt; tim2 = %u/2000\n", */
-	/* 		   timer_get_counter(TIM2)); */
-	/* } */
-	/* if (timer_get_flag(TIM2, TIM_SR_UIF)) { */
-	/* 	timer_clear_flag(TIM2, TIM_SR_UIF); */
-	/* 	printf("UPDATE interrupt; tim2 = %u/2000\n", timer_get_counter(TIM2));
-	 */
-	/* } */
+#endif
+	if (!timer_get_flag(BOARD_ECHO_TIMER, TIM_SR_CC1IF)) {
+		return;
+	}
+	/* Reading the capture clears the flag */
+	uint32_t echo_us = TIM_CCR1(BOARD_ECHO_TIMER);
+	if (echo_skewed) {
+		echo_skewed = false;
+		return;
+	}
+	uint32_t distance =
+		hcsr04_echo_to_mm(echo_us, adc_sampler_temperature_cdeg());
+	if (echo_us > HCSR04_MAX_ECHO_US) {
+		metric_inc(METRIC_echo_timeouts);
+	} else {
+		metric_set(METRIC_echo_mm, distance);
+		metric_observe(METRIC_echo_us, echo_us);
+	}
+	fmt_str(&fmt_log, "Distance: ");
+	fmt_u32(&fmt_log, distance);
+	fmt_str(&fmt_log, " mm.\n");
+}
+
+/* Sleep between card polls, adds at most this much to the arrival latency */
+#define CARD_POLL_MS 20
+
+static bool rx_pending(void) { return link_rx_available() != 0; }
+
+/* Between the rounds that select the cached cards by UID to see which are
+ * still on the antenna */
+#define CARD_CHECK_MS 250
+/* A card missing from two checks has left */
+#define CARD_TTL_MS (CARD_CHECK_MS * 5 / 2)
+#define CARD_DWELL_MS 2000
+/* Between the metrics snapshots on METRICS_ITM_PORT */
+#define METRICS_REPORT_MS 10000
+
+static uid_cache_entry_t card_slots[16];
+static uid_cache_t card_cache;
+/* Decides on arrivals, loaded by a USB_PROTO build */
+static acl_t access_list;
+static uint32_t acl_bloom[ACL_BLOOM_WORDS];
+static acl_delta_t acl_deltas[ACL_DELTA_MAX];
+
+static void print_uid(const char *event, const uint8_t *uid, uint8_t size) {
+	fmt_str(&fmt_log, event);
+	fmt_hex_bytes(&fmt_log, uid, size, ' ');
+}
+
+static void print_ms(uint32_t ms) {
+	fmt_char(&fmt_log, ' ');
+	fmt_u32(&fmt_log, ms);
+	fmt_str(&fmt_log, " ms\n");
+}
+
+static uint32_t dwell_ms(const uid_cache_entry_t *e) {
+	return (uint64_t)(e->last_seen - e->first_seen) * 1000 / IDLE_HZ;
 }
 
-static void setup_usart() {
-	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_50_MHZ,
-				  GPIO_CNF_OUTPUT_ALTFN_PUSHPULL,
-				  GPIO_USART1_TX | GPIO_USART1_RX);
-	usart_set_baudrate(USART1, 9600);
-	usart_set_databits(USART1, 8);
-	usart_set_stopbits(USART1, USART_STOPBITS_1);
-	usart_set_mode(USART1, USART_MODE_TX_RX);
-	usart_set_parity(USART1, USART_PARITY_NONE);
-	usart_set_flow_control(USART1, USART_FLOWCONTROL_NONE);
-	usart_enable(USART1);
+static void card_departed(const uid_cache_entry_t *e, void *ctx) {
+	(void)ctx;
+	metric_observe(METRIC_card_dwell_ms, dwell_ms(e));
+	print_uid("departure", e->uid, e->size);
+	print_ms(dwell_ms(e));
 }
 
-static void setup_spi() {
-	rcc_periph_clock_enable(RCC_SPI1);
-	spi_reset(SPI1);
-	spi_init_master(
-		SPI1, SPI_CR1_BAUDRATE_FPCLK_DIV_32, SPI_CR1_CPOL_CLK_TO_0_WHEN_IDLE,
-		SPI_CR1_CPHA_CLK_TRANSITION_1, SPI_CR1_DFF_8BIT, SPI_CR1_MSBFIRST);
-	spi_enable_software_slave_management(SPI1);
-	spi_set_nss_high(SPI1);
-	spi_enable(SPI1);
+static void metrics_report(void) {
+	static uint32_t words[METRICS_WORDS];
+	const fmt_sink_t itm = FMT_ITM(METRICS_ITM_PORT);
+
+	metrics_snapshot(words, 0, METRICS_WORDS);
+	for (uint8_t i = 0; i < METRICS_COUNT; i++) {
+		metrics_write(&itm, i, words);
+	}
+
+	/* Time in stop since boot on the log, non zero once nothing holds it */
+	idle_stats_t idle;
+	idle_get_stats(&idle);
+	fmt_str(&fmt_log, "idle stop entries=");
+	fmt_u32(&fmt_log, idle.entries[IDLE_STOP]);
+	fmt_str(&fmt_log, " ms=");
+	fmt_u32(&fmt_log, (uint64_t)idle.ticks[IDLE_STOP] * 1000 / IDLE_HZ);
+	fmt_char(&fmt_log, '\n');
 }
 
-void setup_temp_sensor() {
-	rcc_periph_clock_enable(RCC_ADC1);
-	adc_power_off(ADC1);
-	adc_disable_scan_mode(ADC1);
-	adc_set_single_conversion_mode(ADC1);
-	adc_disable_external_trigger_regular(ADC1);
-	adc_set_right_aligned(ADC1);
-	adc_enable_temperature_sensor();
-	adc_set_sample_time_on_all_channels(ADC1, ADC_SMPR_SMP_28DOT5CYC);
-	adc_power_on(ADC1);
-	delay(100);
-	adc_reset_calibration(ADC1);
-	adc_calibrate(ADC1);
+/* Reports the card and halts it, from then on it only answers WUPA */
+static void card_seen(const MFRC522_UID_t *uid) {
+	switch (uid_cache_seen(&card_cache, uid->uid, uid->size, idle_now())) {
+	case UID_CACHE_ARRIVAL: {
+		bool allowed = acl_allows(&access_list, uid->uid, uid->size);
+		metric_inc(allowed ? METRIC_acl_allowed : METRIC_acl_denied);
+		print_uid("arrival", uid->uid, uid->size);
+		fmt_str(&fmt_log, allowed ? " allow\n" : " deny\n");
+		break;
+	}
+	case UID_CACHE_DWELL:
+		print_uid("dwell", uid->uid, uid->size);
+		print_ms(dwell_ms(uid_cache_find(&card_cache, uid->uid, uid->size)));
+		break;
+	case UID_CACHE_REPEAT:
+		break;
+	}
+	PICC_HaltA();
+}
+
+/* Selects the cached cards by their UID to see which are still there.
+ * Copied out first, seeing a card may move the entries around. */
+static void card_check(void) {
+	MFRC522_UID_t known[LEN(card_slots)];
+	uint8_t n = 0;
+
+	for (uint8_t i = 0; i < LEN(card_slots); i++) {
+		if (card_slots[i].size) {
+			known[n].size = card_slots[i].size;
+			memcpy(known[n].uid, card_slots[i].uid, card_slots[i].size);
+			n++;
+		}
+	}
+	for (uint8_t i = 0; i < n; i++) {
+		if (MFRC522_SelectKnown(&known[i]) == STATUS_OK) {
+			card_seen(&known[i]);
+		}
+	}
 }
 
 /* #define RUN_SELFTEST */
 /* #define READ_PICC */
+/* #define USB_PROTO */
+/* #define LED_DEMO */
 
-int main() {
+#if defined(RUN_SELFTEST) || defined(BENCH) || defined(USB_PROTO) ||          \
+	defined(READ_PICC)
+#define USE_MFRC522
+#endif
+
+/* The HC-SR04 and the ADC temperature its echo is compensated with. The card
+ * readers leave both off: the trigger keeps the ultrasonic timers running,
+ * which halt in stop, and the readers sleep in stop between polls. */
+#if !defined(USB_PROTO) && !defined(READ_PICC)
+#define USE_ULTRASONIC
+#endif
+
+/* Ends the boot timeline once the application is up, e.g. after the first
+ * card poll. The RTC crystal has been starting since main(), idle_wait()
+ * needs it from here on. */
+static void boot_done(const char *stage) {
+	static bool done;
+	if (done) {
+		return;
+	}
+	done = true;
+	boot_mark(stage);
+#ifndef BOOT_FIXED_DELAYS
+	idle_init();
+	boot_mark("rtc");
+#endif
+	boot_report();
+}
+
+/* Runs on the process stack, see stackmon_start() */
+static void app_main(void) {
 	/* while (!debugger_attached()) { */
 	/* 	__asm("nop"); */
 	/* } */
 
-	setup_clocks();
+	boot_mark("stack_paint");
+#ifdef BOOT_FIXED_DELAYS
+	/* The boot order before the timeline, for comparison */
+	idle_init();
+	boot_mark("rtc");
+	clock_init();
+	boot_mark("clocks");
+#endif
+#ifdef USE_MFRC522
+	mfrc522_port_init();
+#endif
+#ifdef USE_ULTRASONIC
 	setup_timers();
+#endif
 	setup_gpio();
-	/* setup_spi(); */
+#ifdef LOG_UART
+	uart_stream_init(UART_STREAM_BAUD);
+#endif
+	boot_mark("peripherals");
+#ifdef USE_ULTRASONIC
+	adc_sampler_init(NULL, 0, ADC_SAMPLER_CONTINUOUS);
+	boot_mark("adc");
+#endif
 
+#ifdef BOOT_FIXED_DELAYS
 	delay(200);
-	timer_enable_counter(TIM1);
-	timer_enable_counter(TIM2);
-	timer_enable_counter(TIM3);
+	boot_mark("delay");
+#endif
+#ifdef USE_ULTRASONIC
+	timer_enable_counter(BOARD_ECHO_TIMER);
+	timer_enable_counter(BOARD_TRIGGER_TIMER);
+	/* The trigger fires for as long as the demo runs, and the trigger and
+	 * echo timers halt in stop mode */
+	idle_hold(IDLE_STOP);
+#endif
 
-#ifdef RUN_SELFTEST
+#ifdef USE_MFRC522
+	/* Its oscillator has been starting since power up, the init above ran
+	 * in the meantime */
+	if (!MFRC522_WaitReady(PCD_READY_TIMEOUT_US)) {
+		fmt_str(&fmt_log, "MFRC522 not ready\n");
+	}
+	boot_mark("mfrc522_ready");
 	MFRC522_Init();
+	boot_mark("mfrc522_init");
+#endif
+
+#ifdef LED_DEMO
+	leds_init(board_leds, LEN(board_leds));
+	update_leds();
+#endif
+
+#ifdef RUN_SELFTEST
 	MFRC522_SelfTest();
 	MFRC522_Reset();
+	stackmon_report();
 #endif
 
-#ifdef READ_PICC
-	MFRC522_Init();
+#ifdef BENCH
+	boot_done("ready");
+	bench_suite_run();
+	stackmon_report();
 
-	MFRC522_UID_t uid = {0};
-	/* uint8_t buffer[64]; */
-	/* uint8_t bufLen; */
-
-	/* uint8_t id[10]; */
-	/* for (uint8_t i = 0; i < 255; i++) { */
-	/* 	MFRC522_RandomId(id); */
-	/* 	printf("%dth ID: ", i); */
-	/* 	for (uint8_t j = 0; j < LEN(id); j++) { */
-	/* 		printf("%02x ", id[j]); */
-	/* 	} */
-	/* 	printf("\n"); */
-	/* } */
+	while (1) {
+		__asm("nop");
+	}
+
+#elif defined(USB_PROTO)
+	proto_init();
 
 	while (1) {
-		/* MFRC522_Status status = MIFARE_Read(0x00, buffer, &bufLen); */
-		while (!PICC_IsNewCardPresent()) {
-		}
-		printf("Some card detected! Trying to read...\n");
-		MFRC522_Status status = MFRC522_Select(&uid);
-		printf("Status: %d\n", status);
-		if (status != STATUS_OK) {
-			continue;
-		}
-		printf("Card detected\n");
+		proto_poll();
+		boot_done("first_poll");
+		clock_idle();
+		idle_wait(idle_now() + IDLE_MS(CARD_POLL_MS), rx_pending);
+	}
 
-		/* 		printf("UID size: %u\n", bufLen); */
-		/* 		for (uint8_t i = 0; i < bufLen; i++) { */
-		/* 			printf("%02x ", buffer[i]); */
-		/* 		} */
+#elif defined(READ_PICC)
+	uid_cache_init(&card_cache, card_slots, LEN(card_slots),
+				   IDLE_MS(CARD_TTL_MS), IDLE_MS(CARD_DWELL_MS), card_departed,
+				   NULL);
+	acl_init(&access_list, acl_bloom, LEN(acl_bloom), ACL_BLOOM_HASHES,
+			 acl_deltas, LEN(acl_deltas));
+	acl_mount(&access_list);
+	uint32_t next_check = idle_now();
+	uint32_t next_report = idle_now() + IDLE_MS(METRICS_REPORT_MS);
 
-		printf("UID size: %u\n", uid.size);
-		for (uint8_t i = 0; i < uid.size; i++) {
-			printf("%02x ", uid.uid[i]);
+	while (1) {
+		/* A card that stays is selected once per check instead of on
+		 * every poll, REQA only finds the ones not read yet */
+		if ((int32_t)(idle_now() - next_check) >= 0) {
+			next_check = idle_now() + IDLE_MS(CARD_CHECK_MS);
+			clock_boost();
+			card_check();
 		}
-
-		printf("\n");
+		while (PICC_IsNewCardPresent()) {
+			clock_boost();
+			MFRC522_UID_t uid = {0};
+			if (MFRC522_Select(&uid) != STATUS_OK) {
+				break;
+			}
+			card_seen(&uid);
+		}
+		boot_done("first_poll");
+		if (uid_cache_expire(&card_cache, idle_now())) {
+			stackmon_report();
+		}
+		if ((int32_t)(idle_now() - next_report) >= 0) {
+			next_report += IDLE_MS(METRICS_REPORT_MS);
+			metrics_report();
+		}
+		clock_idle();
+		idle_wait(idle_now() + IDLE_MS(CARD_POLL_MS), NULL);
 	}
 
 #else
+	boot_done("ready");
 
-	printf("AHB frequency = %d Hz\n", rcc_ahb_frequency);
-	printf("APB1 frequency = %d Hz\n", rcc_apb1_frequency);
-	printf("APB2 frequency = %d Hz\n", rcc_apb2_frequency);
+	fmt_str(&fmt_log, "AHB frequency = ");
+	fmt_u32(&fmt_log, rcc_ahb_frequency);
+	fmt_str(&fmt_log, " Hz\nAPB1 frequency = ");
+	fmt_u32(&fmt_log, rcc_apb1_frequency);
+	fmt_str(&fmt_log, " Hz\nAPB2 frequency = ");
+	fmt_u32(&fmt_log, rcc_apb2_frequency);
+	fmt_str(&fmt_log, " Hz\n");
+	stackmon_report();
 
 	while (1) {
-		__asm("nop");
+		clock_idle();
+		idle_wait(IDLE_FOREVER, NULL);
 	}
 
 #endif
+}
 
-	return 0;
+int main() {
+	boot_start();
+#ifndef BOOT_FIXED_DELAYS
+	/* The PLL before painting the stacks, everything after runs at full
+	 * speed. The RTC crystal starts in the background until boot_done(). */
+	idle_start();
+	clock_init();
+	boot_mark("clocks");
+#endif
+	stackmon_start(app_main);
 }
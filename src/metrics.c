@@ -0,0 +1,59 @@
+#include "metrics.h"
+
+uint32_t metrics_words[METRICS_WORDS];
+
+static const metrics_info_t infos[] = {
+#define METRICS_INFO(name, kind) {#name, METRICS_##kind, METRIC_##name},
+	METRICS(METRICS_INFO)
+#undef METRICS_INFO
+};
+
+const metrics_info_t *metrics_info(uint8_t i) {
+	return i < METRICS_COUNT ? &infos[i] : NULL;
+}
+
+void metrics_snapshot(uint32_t *out, uint16_t first, uint16_t count) {
+	for (uint16_t i = 0; i < count && first + i < METRICS_WORDS; i++) {
+		out[i] = __atomic_load_n(&metrics_words[first + i], __ATOMIC_RELAXED);
+	}
+}
+
+bool metrics_write(const fmt_sink_t *s, uint8_t i, const uint32_t *words) {
+	const metrics_info_t *m = metrics_info(i);
+	if (!m) {
+		return false;
+	}
+	const uint32_t *w = &words[m->first];
+
+	fmt_str(s, "metric ");
+	fmt_str(s, m->name);
+	if (m->kind == METRICS_COUNTER || m->kind == METRICS_GAUGE) {
+		fmt_str(s, m->kind == METRICS_COUNTER ? " counter " : " gauge ");
+		fmt_u32(s, w[0]);
+		fmt_char(s, '\n');
+		return true;
+	}
+	uint32_t count = 0;
+	for (uint8_t b = 0; b < METRICS_BUCKETS; b++) {
+		count += w[b];
+	}
+	fmt_str(s, " hist count=");
+	fmt_u32(s, count);
+	fmt_str(s, " sum=");
+	fmt_u32(s, w[METRICS_BUCKETS]);
+	fmt_str(s, " buckets=");
+	for (uint8_t b = 0; b < METRICS_BUCKETS; b++) {
+		if (b) {
+			fmt_char(s, ',');
+		}
+		fmt_u32(s, w[b]);
+	}
+	fmt_char(s, '\n');
+	return true;
+}
+
+int metrics_format(char *buf, size_t size, uint8_t i, const uint32_t *words) {
+	fmt_buf_t b;
+	fmt_sink_t s = fmt_buf(&b, buf, size);
+	return metrics_write(&s, i, words) ? b.len : -1;
+}
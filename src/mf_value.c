@@ -0,0 +1,158 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mf_value.h"
+
+void mf_value_encode(uint8_t *block, int32_t value, uint8_t addr) {
+	uint32_t v = value;
+
+	for (uint8_t i = 0; i < 4; i++) {
+		block[i] = v >> (8 * i);
+		block[4 + i] = ~block[i];
+		block[8 + i] = block[i];
+	}
+	block[12] = addr;
+	block[13] = ~addr;
+	block[14] = addr;
+	block[15] = ~addr;
+}
+
+bool mf_value_decode(const uint8_t *block, int32_t *value, uint8_t *addr) {
+	uint32_t v = 0;
+
+	for (uint8_t i = 0; i < 4; i++) {
+		if (block[8 + i] != block[i] || (block[4 + i] ^ block[i]) != 0xff) {
+			return false;
+		}
+		v |= (uint32_t)block[i] << (8 * i);
+	}
+	if (block[14] != block[12] || block[15] != block[13] ||
+		(block[13] ^ block[12]) != 0xff) {
+		return false;
+	}
+	*value = v;
+	if (addr) {
+		*addr = block[12];
+	}
+	return true;
+}
+
+static mf_value_status_t card(mf_value_tx_t *tx, uint8_t status) {
+	tx->card = status;
+	return status ? MF_VALUE_CARD : MF_VALUE_OK;
+}
+
+/* Copies the backup block over the value block */
+static mf_value_status_t sync(const mf_purse_t *p, mf_value_tx_t *tx) {
+	mf_value_status_t status =
+		card(tx, mf_card_operate(MF_OP_RESTORE, p->backup, 0));
+	if (status == MF_VALUE_OK) {
+		status = card(tx, mf_card_transfer(p->block));
+	}
+	return status;
+}
+
+/* Authenticates, reads both blocks and finishes a transaction torn after
+ * its commit point. Leaves the committed balance in tx->before. */
+static mf_value_status_t recover(const mf_purse_t *p, const uint8_t *uid,
+								 mf_value_tx_t *tx) {
+	uint8_t block[MF_BLOCK_SIZE];
+	int32_t value, backup;
+
+	tx->recovered = false;
+	mf_value_status_t status =
+		card(tx, mf_card_auth(p->keyType, p->block, p->key, uid));
+	if (status == MF_VALUE_OK) {
+		status = card(tx, mf_card_read(p->backup, block));
+	}
+	if (status != MF_VALUE_OK) {
+		return status;
+	}
+	bool backupOk = mf_value_decode(block, &backup, NULL);
+	status = card(tx, mf_card_read(p->block, block));
+	if (status != MF_VALUE_OK) {
+		return status;
+	}
+	bool valueOk = mf_value_decode(block, &value, NULL);
+
+	if (!backupOk) {
+		/* Torn before the commit point, the value block still holds the
+		 * balance and the next commit rewrites the backup */
+		if (!valueOk) {
+			return MF_VALUE_CORRUPT;
+		}
+		tx->before = tx->after = value;
+		return MF_VALUE_OK;
+	}
+	tx->before = tx->after = backup;
+	if (valueOk && value == backup) {
+		return MF_VALUE_OK;
+	}
+	tx->recovered = true;
+	return sync(p, tx);
+}
+
+static mf_value_status_t commit(const mf_purse_t *p, const uint8_t *uid,
+								uint8_t op, int32_t amount,
+								mf_value_tx_t *tx) {
+	if (amount <= 0) {
+		return MF_VALUE_RANGE;
+	}
+	mf_value_status_t status = recover(p, uid, tx);
+	if (status != MF_VALUE_OK) {
+		return status;
+	}
+	if (op == MF_OP_DECREMENT) {
+		if (tx->before < amount) {
+			return MF_VALUE_FUNDS;
+		}
+		tx->after = tx->before - amount;
+	} else {
+		if (tx->before > INT32_MAX - amount) {
+			return MF_VALUE_RANGE;
+		}
+		tx->after = tx->before + amount;
+	}
+
+	status = card(tx, mf_card_operate(op, p->block, amount));
+	if (status == MF_VALUE_OK) {
+		status = card(tx, mf_card_transfer(p->backup));
+	}
+	if (status == MF_VALUE_OK) {
+		status = sync(p, tx);
+	}
+	return status;
+}
+
+mf_value_status_t mf_purse_format(const mf_purse_t *p, const uint8_t *uid,
+								  int32_t value, mf_value_tx_t *tx) {
+	uint8_t block[MF_BLOCK_SIZE];
+
+	tx->recovered = false;
+	tx->before = tx->after = value;
+	mf_value_encode(block, value, p->block);
+	mf_value_status_t status =
+		card(tx, mf_card_auth(p->keyType, p->block, p->key, uid));
+	if (status == MF_VALUE_OK) {
+		status = card(tx, mf_card_write(p->backup, block));
+	}
+	if (status == MF_VALUE_OK) {
+		status = card(tx, mf_card_write(p->block, block));
+	}
+	return status;
+}
+
+mf_value_status_t mf_purse_balance(const mf_purse_t *p, const uint8_t *uid,
+								   mf_value_tx_t *tx) {
+	return recover(p, uid, tx);
+}
+
+mf_value_status_t mf_purse_debit(const mf_purse_t *p, const uint8_t *uid,
+								 int32_t amount, mf_value_tx_t *tx) {
+	return commit(p, uid, MF_OP_DECREMENT, amount, tx);
+}
+
+mf_value_status_t mf_purse_credit(const mf_purse_t *p, const uint8_t *uid,
+								  int32_t amount, mf_value_tx_t *tx) {
+	return commit(p, uid, MF_OP_INCREMENT, amount, tx);
+}
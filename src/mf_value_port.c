@@ -0,0 +1,40 @@
+#include <string.h>
+
+#include "mf_value.h"
+#include "mfrc522.h"
+#include "pbuf.h"
+
+/* Firmware hooks under mf_value.h, on the driver */
+
+uint8_t mf_card_auth(uint8_t keyType, uint8_t block, const uint8_t *key,
+					 const uint8_t *uid) {
+	MFRC522_UID_t id = {.size = MF_UID_SIZE};
+	memcpy(id.uid, uid, MF_UID_SIZE);
+	return PCD_Authenticate(keyType, block, key, &id);
+}
+
+uint8_t mf_card_read(uint8_t block, uint8_t *data) {
+	pbuf_t *p = pbuf_alloc();
+	if (!p) {
+		return STATUS_NO_ROOM;
+	}
+	MFRC522_Status status = MIFARE_ReadBlock(p, block);
+	if (status == STATUS_OK && p->len != MF_BLOCK_SIZE) {
+		status = STATUS_ERROR;
+	}
+	if (status == STATUS_OK) {
+		memcpy(data, pbuf_data(p), MF_BLOCK_SIZE);
+	}
+	pbuf_free(p);
+	return status;
+}
+
+uint8_t mf_card_write(uint8_t block, const uint8_t *data) {
+	return MIFARE_Write(block, data);
+}
+
+uint8_t mf_card_operate(uint8_t op, uint8_t block, int32_t operand) {
+	return MIFARE_Operate(op, block, operand);
+}
+
+uint8_t mf_card_transfer(uint8_t block) { return MIFARE_Transfer(block); }
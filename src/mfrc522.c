@@ -1,24 +1,20 @@
-#include "mfrc522.h"
-
-#define SPI_MANUAL_CC
+#include <string.h>
 
-#ifdef SPI_MANUAL_CC
-#define SELECT_SLAVE() gpio_clear(GPIOA, GPIO_SPI1_NSS)
-#else
-#define SELECT_SLAVE()
-#endif
+#include "board.h"
+#include "fmt.h"
+#include "mfrc522.h"
+#include "mfrc522_port.h"
+#include "metrics.h"
 
-#ifdef SPI_MANUAL_CC
-#define UNSELECT_SLAVE() gpio_set(GPIOA, GPIO_SPI1_NSS)
-#else
-#define UNSELECT_SLAVE()
-#endif
+// TPrescaler the timer runs with, PCD_SetTimeoutUs() only changes it for
+// the long timeouts
+static uint16_t timerPrescaler;
 
-void MFRC522_SetBitMask(uint8_t reg, uint8_t mask) {
+RAMFUNC void MFRC522_SetBitMask(uint8_t reg, uint8_t mask) {
 	MFRC522_WriteCharToReg(reg, MFRC522_ReadCharFromReg(reg) | mask);
 }
 
-void MFRC522_ClearBitMask(uint8_t reg, uint8_t mask) {
+RAMFUNC void MFRC522_ClearBitMask(uint8_t reg, uint8_t mask) {
 	MFRC522_WriteCharToReg(reg, MFRC522_ReadCharFromReg(reg) & ~mask);
 }
 
@@ -32,63 +28,115 @@ void MFRC522_AntennaOn() {
 void MFRC522_AntennaOff() { MFRC522_ClearBitMask(TxControlReg, 0x03); }
 
 void MFRC522_Init() {
+	mfrc522_bus_init();
 	MFRC522_WriteCharToReg(TxModeReg, 0x00);
 	MFRC522_WriteCharToReg(RxModeReg, 0x00);
 	MFRC522_WriteCharToReg(ModWidthReg, 0x26);
 
-	MFRC522_WriteCharToReg(TModeReg, 0x80);
-	MFRC522_WriteCharToReg(TPrescalerReg, 0xA9);
-	MFRC522_WriteCharToReg(TReloadReg1, 0x03);
-	MFRC522_WriteCharToReg(TReloadReg1, 0xE8);
+	// TAuto=1, the timer starts at the end of every transmission, with
+	// 13.56 MHz / (2 * 0xA9 + 1) = 40 kHz ticks
+	MFRC522_WriteCharToReg(TModeReg, 0x80 | PCD_TIMER_PRESCALER >> 8);
+	MFRC522_WriteCharToReg(TPrescalerReg, PCD_TIMER_PRESCALER);
+	timerPrescaler = PCD_TIMER_PRESCALER;
+	PCD_SetTimeoutUs(PCD_TIMEOUT_US);
+	// LoAlert and HiAlert for PCD_TransceiveStream()
+	MFRC522_WriteCharToReg(WaterLevelReg, PCD_WATER_LEVEL);
 	MFRC522_WriteCharToReg(TxASKReg, 0x40);
 	MFRC522_WriteCharToReg(ModeReg, 0x3D);
 	MFRC522_AntennaOn();
 }
 
+void PCD_SetTimeoutUs(uint32_t us) {
+	uint16_t prescaler = PCD_TIMER_PRESCALER;
+
+	if (us > PCD_TIMEOUT_MAX_US) {
+		us = PCD_TIMEOUT_MAX_US;
+	}
+	// In 13.56 MHz clocks, under 2^30 for PCD_TIMEOUT_MAX_US
+	uint32_t clocks = us / PCD_TIMER_TICK_US * PCD_TIMER_TICK_CLOCKS +
+					  us % PCD_TIMER_TICK_US * PCD_TIMER_TICK_CLOCKS /
+						  PCD_TIMER_TICK_US;
+	// Past 0xffff ticks of 25 us the ticks get longer instead: 2 *
+	// prescaler + 1 clocks, as many as it takes to stay in 0xffff
+	if (clocks / PCD_TIMER_TICK_CLOCKS > 0xffff) {
+		prescaler = (clocks + 0xfffe) / 0xffff / 2;
+	}
+	if (prescaler != timerPrescaler) {
+		MFRC522_WriteCharToReg(TModeReg, 0x80 | prescaler >> 8);
+		MFRC522_WriteCharToReg(TPrescalerReg, prescaler);
+		timerPrescaler = prescaler;
+	}
+	uint32_t ticks = clocks / (2 * prescaler + 1);
+	MFRC522_WriteCharToReg(TReloadReg1, ticks >> 8);
+	MFRC522_WriteCharToReg(TReloadReg2, ticks);
+}
+
 void MFRC522_Reset() {
 	MFRC522_WriteCharToReg(CommandReg, CMD_SOFT_RESET);
+	/* The reset also drops a UART link back to 9600 baud */
+	mfrc522_bus_reset();
 	while (MFRC522_ReadCharFromReg(CommandReg) & (1 << 4)) {
 	}
+	mfrc522_bus_init();
 }
 
-uint8_t MFRC522_ReadCharFromReg(uint8_t reg) {
-	uint8_t value;
-	SELECT_SLAVE();
-	spi_transfer(SPI1, (reg << 1) | 0x80);
-	value = spi_transfer(SPI1, 0x00);
-	UNSELECT_SLAVE();
-	return value;
+bool MFRC522_WaitReady(uint32_t timeoutUs) {
+	for (uint32_t us = 0;; us += PCD_READY_POLL_US) {
+		uint8_t version = MFRC522_ReadCharFromReg(VersionReg);
+		if (version != 0x00 && version != 0xff &&
+			!(MFRC522_ReadCharFromReg(CommandReg) & (1 << 4))) {
+			return true;
+		}
+		if (us >= timeoutUs) {
+			return false;
+		}
+		delay_us(PCD_READY_POLL_US);
+	}
 }
 
-void MFRC522_ReadArrayFromReg(uint8_t reg, uint8_t length, uint8_t *outArray) {
-	if (length == 0) {
-		return;
-	}
-	SELECT_SLAVE();
-	const uint8_t addr = (reg << 1) | 0x80;
-	spi_transfer(SPI1, addr);
-	uint8_t i = 0;
-	for (; i < length - 1; i++) {
-		outArray[i] = spi_transfer(SPI1, addr);
-	}
-	outArray[i] = spi_transfer(SPI1, 0x00);
-	UNSELECT_SLAVE();
+/* The bus primitives are inline, see mfrc522_bus.h */
+RAMFUNC uint8_t MFRC522_ReadCharFromReg(uint8_t reg) {
+	metric_add(METRIC_mfrc522_bus_bytes, 2);
+	return mfrc522_bus_read(reg);
 }
 
-void MFRC522_WriteCharToReg(uint8_t reg, uint8_t data) {
-	SELECT_SLAVE();
-	spi_transfer(SPI1, (reg << 1) & 0x7E);
-	spi_transfer(SPI1, data);
-	UNSELECT_SLAVE();
+RAMFUNC void MFRC522_ReadArrayFromReg(uint8_t reg, uint8_t length,
+									  uint8_t *outArray) {
+	metric_add(METRIC_mfrc522_bus_bytes, 1 + length);
+	mfrc522_bus_read_burst(reg, length, outArray);
 }
 
-void MFRC522_WriteArrayToReg(uint8_t reg, uint8_t length, uint8_t *array) {
-	SELECT_SLAVE();
-	spi_transfer(SPI1, (reg << 1) & 0x7E);
-	for (uint8_t i = 0; i < length; i++) {
-		spi_transfer(SPI1, array[i]);
+RAMFUNC void MFRC522_WriteCharToReg(uint8_t reg, uint8_t data) {
+	metric_add(METRIC_mfrc522_bus_bytes, 2);
+	mfrc522_bus_write(reg, data);
+}
+
+RAMFUNC void MFRC522_WriteArrayToReg(uint8_t reg, uint8_t length,
+									 uint8_t *array) {
+	metric_add(METRIC_mfrc522_bus_bytes, 1 + length);
+	mfrc522_bus_write_burst(reg, length, array);
+}
+
+/* Counts a card exchange by how it ended */
+static inline MFRC522_Status PCD_Count(MFRC522_Status status) {
+	metric_inc(METRIC_pcd_exchanges);
+	switch (status) {
+	case STATUS_OK:
+		break;
+	case STATUS_CRC_WRONG:
+		metric_inc(METRIC_pcd_crc_wrong);
+		break;
+	case STATUS_TIMEOUT:
+		metric_inc(METRIC_pcd_timeouts);
+		break;
+	case STATUS_COLLISION:
+		metric_inc(METRIC_pcd_collisions);
+		break;
+	default:
+		metric_inc(METRIC_pcd_errors);
+		break;
 	}
-	UNSELECT_SLAVE();
+	return status;
 }
 
 const uint8_t SELF_TEST_OUTPUT[] = {
@@ -131,21 +179,22 @@ bool MFRC522_SelfTest() {
 	uint8_t result[64];
 	MFRC522_ReadArrayFromReg(FIFODataReg, 64, result);
 	uint8_t version = MFRC522_ReadCharFromReg(VersionReg);
-	printf("version code: 0x%02x\n", version);
-	for (uint8_t i = 0; i < LEN(result); i++) {
-		if (i % 8 == 0 && i > 0) {
-			printf("\n");
-		}
-		printf("0x%02X ", result[i]);
-	}
+	const fmt_sink_t *log = &fmt_log;
+	fmt_str(log, "version code: 0x");
+	fmt_hex(log, version, 2);
+	fmt_char(log, '\n');
+	fmt_hexdump(log, result, sizeof(result));
 	for (uint8_t i = 0; i < LEN(result); i++) {
 		if (SELF_TEST_OUTPUT[i] != result[i]) {
-			printf("Test failed (0x%02X != 0x%02X)\n", SELF_TEST_OUTPUT[i],
-				   result[i]);
+			fmt_str(log, "Test failed (0x");
+			fmt_hex(log, SELF_TEST_OUTPUT[i], 2);
+			fmt_str(log, " != 0x");
+			fmt_hex(log, result[i], 2);
+			fmt_str(log, ")\n");
 			return false;
 		}
 	}
-	printf("\nSelf-test passed!\n");
+	fmt_str(log, "Self-test passed!\n");
 
 	MFRC522_WriteCharToReg(0x36, 0x00);
 	return true;
@@ -155,7 +204,9 @@ void MFRC522_RandomId(uint8_t *outId) {
 	/* uint8_t zeros[64] = {0}; */
 	/* MFRC522_WriteArrayToReg(FIFODataReg, LEN(zeros), zeros); */
 	MFRC522_WriteCharToReg(FIFOLevelReg, 0x80);
-	printf("FIFO size = %u\n", MFRC522_ReadCharFromReg(FIFOLevelReg));
+	fmt_str(&fmt_log, "FIFO size = ");
+	fmt_u32(&fmt_log, MFRC522_ReadCharFromReg(FIFOLevelReg));
+	fmt_char(&fmt_log, '\n');
 	MFRC522_WriteCharToReg(CommandReg, CMD_GEN_RANDOM_ID);
 	MFRC522_WriteCharToReg(CommandReg, CMD_MEM);
 	/* MFRC522_WaitForFifoLefel(10); */
@@ -181,7 +232,11 @@ MFRC522_Status PCD_TransceiveData(uint8_t *sendData, uint8_t sendLen,
 									false);
 }
 
-MFRC522_Status MFRC522_Select(MFRC522_UID_t *uid) {
+/* The SELECT/ANTICOLLISION commands uses a 7 byte standard frame + 2 bytes
+ * CRC_A */
+#define SELECT_FRAME 9
+
+static MFRC522_Status PICC_Select(MFRC522_UID_t *uid, uint8_t *buffer) {
 	bool complete = false, selectDone = false, useCascadeTag = false;
 	uint8_t cascadeLevel = 1;
 	MFRC522_Status result;
@@ -194,9 +249,6 @@ MFRC522_Status MFRC522_Select(MFRC522_UID_t *uid) {
 	/* The number of known UID bits in the current
 	 * Cascade Level. */
 	int8_t currentLevelKnownBits;
-	/* The SELECT/ANTICOLLISION commands uses a 7 byte
-	 * standard frame + 2 bytes CRC_A */
-	uint8_t buffer[9];
 	/* The number of bytes used in the buffer, ie the number
 	 * of bytes to transfer to the FIFO. */
 	uint8_t bufferUsed;
@@ -302,7 +354,7 @@ MFRC522_Status MFRC522_Select(MFRC522_UID_t *uid) {
 				bufferUsed = index + (txLastBits ? 1 : 0);
 				// Store response in the unused part of buffer
 				responseBuffer = &buffer[index];
-				responseLength = sizeof(buffer) - index;
+				responseLength = SELECT_FRAME - index;
 			}
 
 			// Set bit adjustments
@@ -392,6 +444,7 @@ MFRC522_Status MFRC522_Select(MFRC522_UID_t *uid) {
 		}
 		if ((buffer[2] != responseBuffer[1]) ||
 			(buffer[3] != responseBuffer[2])) {
+			metric_inc(METRIC_pcd_crc_wrong);
 			return STATUS_CRC_WRONG;
 		}
 		if (responseBuffer[0] &
@@ -405,10 +458,105 @@ MFRC522_Status MFRC522_Select(MFRC522_UID_t *uid) {
 
 	// Set correct uid->size
 	uid->size = 3 * cascadeLevel + 1;
+	metric_inc(METRIC_card_reads);
 
 	return STATUS_OK;
 }
 
+MFRC522_Status MFRC522_Select(MFRC522_UID_t *uid) {
+	pbuf_t *frame = pbuf_alloc();
+	if (!frame) {
+		return STATUS_NO_ROOM;
+	}
+	MFRC522_Status status = PICC_Select(uid, pbuf_data(frame));
+	pbuf_free(frame);
+	return status;
+}
+
+/* SELECT of cascade level `level` (0 to 2) with the UID bytes from `uid` */
+static MFRC522_Status PICC_SelectLevel(const MFRC522_UID_t *uid, uint8_t level,
+									   uint8_t *sak) {
+	static const uint8_t sel[] = {PICC_CMD_SEL_CL1, PICC_CMD_SEL_CL2,
+								  PICC_CMD_SEL_CL3};
+	uint8_t frame[SELECT_FRAME];
+	uint8_t back[3];
+	uint16_t backLen = sizeof(back);
+	uint8_t validBits;
+	uint8_t uidIndex = 3 * level;
+	// More levels follow, this one starts with the cascade tag
+	bool cascade = uid->size > uidIndex + 4;
+
+	frame[0] = sel[level];
+	frame[1] = 0x70;
+	if (cascade) {
+		frame[2] = PICC_CMD_CT;
+		memcpy(&frame[3], &uid->uid[uidIndex], 3);
+	} else {
+		memcpy(&frame[2], &uid->uid[uidIndex], 4);
+	}
+	frame[6] = frame[2] ^ frame[3] ^ frame[4] ^ frame[5];
+	uint16_t crc = PICC_CRC_A(frame, 7);
+	frame[7] = crc;
+	frame[8] = crc >> 8;
+
+	PCD_StartTransceive();
+	MFRC522_Status status =
+		PCD_TransceiveStream(frame, SELECT_FRAME, back, &backLen, &validBits);
+	if (status != STATUS_OK) {
+		return status;
+	}
+	// SAK and CRC_A
+	if (backLen != sizeof(back) || validBits != 0) {
+		return STATUS_ERROR;
+	}
+	if (PICC_CRC_A(back, sizeof(back))) {
+		metric_inc(METRIC_pcd_crc_wrong);
+		return STATUS_CRC_WRONG;
+	}
+	// The cascade bit has to agree with the UID size
+	if (!(back[0] & 0x04) != !cascade) {
+		return STATUS_MISMATCH;
+	}
+	*sak = back[0];
+	return STATUS_OK;
+}
+
+MFRC522_Status MFRC522_SelectKnown(MFRC522_UID_t *uid) {
+	uint8_t atqa[2];
+	uint8_t atqaLen = sizeof(atqa);
+	uint8_t sak = 0;
+
+	MFRC522_Status status = PICC_WakeupA(atqa, &atqaLen);
+	if (status != STATUS_OK && status != STATUS_COLLISION) {
+		return status;
+	}
+	if (uid->size == 4 || uid->size == 7 || uid->size == 10) {
+		// Only the card with this UID answers, whatever else is around
+		PCD_SetTimeoutUs(PICC_SELECT_TIMEOUT_US);
+		for (uint8_t level = 0; level < uid->size / 3; level++) {
+			status = PICC_SelectLevel(uid, level, &sak);
+			if (status != STATUS_OK) {
+				break;
+			}
+		}
+		PCD_SetTimeoutUs(PCD_TIMEOUT_US);
+		if (status == STATUS_OK) {
+			uid->sak = sak;
+			metric_inc(METRIC_card_reads);
+			return STATUS_OK;
+		}
+	}
+
+	// Gone, or a mismatch left the cards in IDLE. WUPA gets every card in
+	// the field back to READY for the anticollision.
+	atqaLen = sizeof(atqa);
+	status = PICC_WakeupA(atqa, &atqaLen);
+	if (status != STATUS_OK && status != STATUS_COLLISION) {
+		return status;
+	}
+	return MFRC522_Select(uid);
+}
+
 MFRC522_Status PCD_CalculateCRC(uint8_t *data, uint8_t length,
 								uint8_t *result) {
 	MFRC522_WriteCharToReg(CommandReg, CMD_IDLE);
@@ -436,23 +584,51 @@ MFRC522_Status PCD_CalculateCRC(uint8_t *data, uint8_t length,
 		if (n & 0x04) {
 			// Stop calculating CRC for new content in the FIFO.
 			MFRC522_WriteCharToReg(CommandReg, CMD_IDLE);
-			// Transfer the result from the registers to the result buffer
-			result[0] = MFRC522_ReadCharFromReg(CRCResultReg1);
-			result[1] = MFRC522_ReadCharFromReg(CRCResultReg2);
+			// Transfer the result from the registers to the result buffer,
+			// low byte first as CRC_A goes on the air. CRCResultReg2 has
+			// the LSB.
+			result[0] = MFRC522_ReadCharFromReg(CRCResultReg2);
+			result[1] = MFRC522_ReadCharFromReg(CRCResultReg1);
 			return STATUS_OK;
 		}
 	}
-	printf("CRC timeout\n");
+	fmt_str(&fmt_log, "CRC timeout\n");
 	// 89ms passed and nothing happend. Communication with the MFRC522 might be
 	// down.
 	return STATUS_TIMEOUT;
 }
 
-MFRC522_Status MFRC522_Communicate_PICC(uint8_t command, uint8_t waitIRq,
-										uint8_t *sendData, uint8_t sendLen,
-										uint8_t *backData, uint8_t *backLen,
-										uint8_t *validBits, uint8_t rxAlign,
-										bool checkCRC) {
+/* The transceive poll loop, kept in SRAM next to the register accessors */
+static RAMFUNC MFRC522_Status PCD_WaitForIrq(uint8_t waitIRq) {
+	// Wait for the command to complete.
+	// In PCD_Init() we set the TAuto flag in TModeReg. This means the timer
+	// automatically starts when the PCD stops transmitting. Each iteration of
+	// the do-while-loop takes 17.86μs.
+	// TODO check/modify for other architectures than Arduino Uno 16bit
+	for (uint32_t i = 0xffffff; i > 0; i--) {
+		// ComIrqReg[7..0] bits are: Set1 TxIRq RxIRq IdleIRq
+		// HiAlertIRq LoAlertIRq ErrIRq TimerIRq
+		uint8_t n = MFRC522_ReadCharFromReg(ComIrqReg);
+
+		// One of the interrupts that signal success has been set.
+		if (n & waitIRq) {
+			return STATUS_OK;
+		}
+		// Timer interrupt - nothing received in 25ms
+		if (n & 0x01) {
+			return STATUS_TIMEOUT;
+		}
+	}
+	// 35.7ms and nothing happend. Communication with the MFRC522 might be down.
+	return STATUS_TIMEOUT;
+}
+
+/* MFRC522_Communicate_PICC() without counting the outcome */
+static MFRC522_Status PCD_Communicate(uint8_t command, uint8_t waitIRq,
+									  uint8_t *sendData, uint8_t sendLen,
+									  uint8_t *backData, uint8_t *backLen,
+									  uint8_t *validBits, uint8_t rxAlign,
+									  bool checkCRC) {
 
 	// Prepare values for BitFramingReg
 	uint8_t txLastBits = validBits ? *validBits : 0;
@@ -478,29 +654,9 @@ MFRC522_Status MFRC522_Communicate_PICC(uint8_t command, uint8_t waitIRq,
 		MFRC522_SetBitMask(BitFramingReg, 0x80);
 	}
 
-	// Wait for the command to complete.
-	// In PCD_Init() we set the TAuto flag in TModeReg. This means the timer
-	// automatically starts when the PCD stops transmitting. Each iteration of
-	// the do-while-loop takes 17.86μs.
-	// TODO check/modify for other architectures than Arduino Uno 16bit
-	uint32_t i;
-	for (i = 0xffffff; i > 0; i--) {
-		// ComIrqReg[7..0] bits are: Set1 TxIRq RxIRq IdleIRq
-		// HiAlertIRq LoAlertIRq ErrIRq TimerIRq
-		uint8_t n = MFRC522_ReadCharFromReg(ComIrqReg);
-
-		// One of the interrupts that signal success has been set.
-		if (n & waitIRq) {
-			break;
-		}
-		// Timer interrupt - nothing received in 25ms
-		if (n & 0x01) {
-			return STATUS_TIMEOUT;
-		}
-	}
-	// 35.7ms and nothing happend. Communication with the MFRC522 might be down.
-	if (i == 0) {
-		return STATUS_TIMEOUT;
+	MFRC522_Status status = PCD_WaitForIrq(waitIRq);
+	if (status != STATUS_OK) {
+		return status;
 	}
 
 	// Stop now if any errors except collisions were detected.
@@ -555,7 +711,7 @@ MFRC522_Status MFRC522_Communicate_PICC(uint8_t command, uint8_t waitIRq,
 		// Verify CRC_A - do our own calculation and store the control in
 		// controlBuffer.
 		uint8_t controlBuffer[2] = {0};
-		MFRC522_Status status =
+		status =
 			PCD_CalculateCRC(&backData[0], *backLen - 2, &controlBuffer[0]);
 		if (status != STATUS_OK) {
 			return status;
@@ -569,6 +725,264 @@ MFRC522_Status MFRC522_Communicate_PICC(uint8_t command, uint8_t waitIRq,
 	return STATUS_OK;
 }
 
+MFRC522_Status MFRC522_Communicate_PICC(uint8_t command, uint8_t waitIRq,
+										uint8_t *sendData, uint8_t sendLen,
+										uint8_t *backData, uint8_t *backLen,
+										uint8_t *validBits, uint8_t rxAlign,
+										bool checkCRC) {
+	return PCD_Count(PCD_Communicate(command, waitIRq, sendData, sendLen,
+									 backData, backLen, validBits, rxAlign,
+									 checkCRC));
+}
+
+MFRC522_Status PCD_AppendCRC(pbuf_t *p) {
+	uint8_t *crc = pbuf_put(p, 2);
+	if (!crc) {
+		return STATUS_NO_ROOM;
+	}
+	return PCD_CalculateCRC(pbuf_data(p), p->len - 2, crc);
+}
+
+MFRC522_Status PCD_TransceivePbuf(pbuf_t *p, uint8_t *validBits,
+								  uint8_t rxAlign, bool checkCRC) {
+	uint8_t backLen = PBUF_SIZE - PBUF_HEADROOM;
+
+	// The whole request is in the FIFO before anything is received, so the
+	// response may overwrite it.
+	MFRC522_Status status = MFRC522_Communicate_PICC(
+		CMD_TRANSCEIVE, 0x30, pbuf_data(p), p->len, &p->buf[PBUF_HEADROOM],
+		&backLen, validBits, rxAlign, checkCRC);
+
+	pbuf_reset(p);
+	if (status == STATUS_OK || status == STATUS_COLLISION) {
+		p->len = backLen;
+	}
+	if (status == STATUS_OK && checkCRC) {
+		pbuf_trim(p, 2);
+	}
+	return status;
+}
+
+uint16_t PICC_CRC_A(const uint8_t *data, uint16_t length) {
+	uint16_t crc = 0x6363;
+	while (length--) {
+		uint8_t b = *data++ ^ (uint8_t)crc;
+		b ^= b << 4;
+		crc = (crc >> 8) ^ ((uint16_t)b << 8) ^ ((uint16_t)b << 3) ^ (b >> 4);
+	}
+	return crc;
+}
+
+void PCD_StartTransceive(void) {
+	MFRC522_WriteCharToReg(CommandReg, CMD_IDLE);
+	MFRC522_WriteCharToReg(CommandReg, CMD_TRANSCEIVE);
+}
+
+static RAMFUNC MFRC522_Status PCD_Stream(const uint8_t *sendData,
+										 uint16_t sendLen, uint8_t *backData,
+										 uint16_t *backLen,
+										 uint8_t *validBits) {
+	uint16_t sent = sendLen < PCD_FIFO_SIZE ? sendLen : PCD_FIFO_SIZE;
+	uint16_t got = 0;
+	uint32_t i = 0xffffff;
+	uint8_t irq;
+
+	// Clear all seven interrupt request bits
+	MFRC522_WriteCharToReg(ComIrqReg, 0x7F);
+	// FlushBuffer = 1, FIFO initialization
+	MFRC522_WriteCharToReg(FIFOLevelReg, 0x80);
+	MFRC522_WriteArrayToReg(FIFODataReg, sent, (uint8_t *)sendData);
+	// StartSend=1 with all bits of the last byte, the command is running
+	MFRC522_WriteCharToReg(BitFramingReg, 0x80);
+
+	// Until TxIRq the FIFO still holds the request. LoAlertIRq: it ran down
+	// to PCD_WATER_LEVEL bytes, top it up.
+	for (;;) {
+		irq = MFRC522_ReadCharFromReg(ComIrqReg);
+		if (irq & 0x40) {
+			break;
+		}
+		if (sent < sendLen && (irq & 0x04)) {
+			// Set1=0, clears the bits written as 1
+			MFRC522_WriteCharToReg(ComIrqReg, 0x04);
+			uint16_t n =
+				PCD_FIFO_SIZE - (MFRC522_ReadCharFromReg(FIFOLevelReg) & 0x7F);
+			if (n > sendLen - sent) {
+				n = sendLen - sent;
+			}
+			MFRC522_WriteArrayToReg(FIFODataReg, n, (uint8_t *)&sendData[sent]);
+			sent += n;
+		}
+		if (!--i) {
+			return STATUS_TIMEOUT;
+		}
+	}
+	// The FIFO ran empty before the end, the frame went out cut short
+	if (sent < sendLen) {
+		return STATUS_ERROR;
+	}
+
+	for (; i > 0; i--) {
+		irq = MFRC522_ReadCharFromReg(ComIrqReg);
+		// HiAlertIRq: PCD_WATER_LEVEL bytes of room left, RxIRq: end of the
+		// frame. Read before the level: once RxIRq is seen, the level read
+		// after it covers the rest of the frame.
+		if (irq & 0x28) {
+			if (irq & 0x08) {
+				MFRC522_WriteCharToReg(ComIrqReg, 0x08);
+			}
+			uint8_t n = MFRC522_ReadCharFromReg(FIFOLevelReg) & 0x7F;
+			if (got + n > *backLen) {
+				return STATUS_NO_ROOM;
+			}
+			MFRC522_ReadArrayFromReg(FIFODataReg, n, &backData[got]);
+			got += n;
+		}
+		if (irq & 0x20) {
+			break;
+		}
+		// Timer interrupt - nothing received in time
+		if (irq & 0x01) {
+			return STATUS_TIMEOUT;
+		}
+	}
+	if (!i) {
+		return STATUS_TIMEOUT;
+	}
+
+	// BufferOvfl here means the FIFO was not drained fast enough
+	uint8_t errorRegValue = MFRC522_ReadCharFromReg(ErrorReg);
+	if (errorRegValue & 0x13) {
+		return STATUS_ERROR;
+	}
+	if (errorRegValue & 0x08) {
+		return STATUS_COLLISION;
+	}
+	*backLen = got;
+	if (validBits) {
+		*validBits = MFRC522_ReadCharFromReg(ControlReg) & 0x07;
+	}
+	return STATUS_OK;
+}
+
+RAMFUNC MFRC522_Status PCD_TransceiveStream(const uint8_t *sendData,
+											uint16_t sendLen,
+											uint8_t *backData,
+											uint16_t *backLen,
+											uint8_t *validBits) {
+	return PCD_Count(
+		PCD_Stream(sendData, sendLen, backData, backLen, validBits));
+}
+
+MFRC522_Status MIFARE_ReadBlock(pbuf_t *p, uint8_t blockAddr) {
+	pbuf_reset(p);
+	uint8_t *cmd = pbuf_push(p, 2);
+	cmd[0] = PICC_CMD_MF_READ;
+	cmd[1] = blockAddr;
+	MFRC522_Status result = PCD_AppendCRC(p);
+	if (result != STATUS_OK) {
+		return result;
+	}
+	return PCD_TransceivePbuf(p, NULL, 0, true);
+}
+
+MFRC522_Status PCD_Authenticate(uint8_t command, uint8_t blockAddr,
+								const uint8_t *key, const MFRC522_UID_t *uid) {
+	uint8_t sendData[12];
+
+	// Command, block, the 6 byte key and the last 4 bytes of the UID
+	sendData[0] = command;
+	sendData[1] = blockAddr;
+	memcpy(&sendData[2], key, 6);
+	memcpy(&sendData[8], &uid->uid[uid->size - 4], 4);
+
+	// The command is done when the MFRC522 goes idle (IdleIRq)
+	MFRC522_Status status = MFRC522_Communicate_PICC(
+		CMD_MFAUTHENT, 0x10, sendData, sizeof(sendData), NULL, NULL, NULL, 0,
+		false);
+	if (status != STATUS_OK) {
+		return status;
+	}
+	// MFCrypto1On is only set after a successful authentication
+	if (!(MFRC522_ReadCharFromReg(Status2Reg) & 0x08)) {
+		return STATUS_ERROR;
+	}
+	return STATUS_OK;
+}
+
+void PCD_StopCrypto1() { MFRC522_ClearBitMask(Status2Reg, 0x08); }
+
+/* Sends `frame` with its CRC_A appended into the two bytes after it and
+ * checks for the 4 bit ACK. A silent frame, the second part of INCREMENT,
+ * DECREMENT and RESTORE, is only answered with a NAK, so there the timeout
+ * is the success and it is cut short. */
+static MFRC522_Status MIFARE_SendForAck(uint8_t *frame, uint8_t length,
+										bool silent) {
+	uint16_t crc = PICC_CRC_A(frame, length);
+	uint8_t ack;
+	uint16_t ackLen = 1;
+	uint8_t validBits;
+
+	frame[length] = crc;
+	frame[length + 1] = crc >> 8;
+	if (silent) {
+		PCD_SetTimeoutUs(MIFARE_SILENT_TIMEOUT_US);
+	}
+	PCD_StartTransceive();
+	MFRC522_Status status =
+		PCD_TransceiveStream(frame, length + 2, &ack, &ackLen, &validBits);
+	if (silent) {
+		PCD_SetTimeoutUs(PCD_TIMEOUT_US);
+		if (status == STATUS_TIMEOUT) {
+			return STATUS_OK;
+		}
+		return status == STATUS_OK ? STATUS_MIFARE_NACK : status;
+	}
+	if (status != STATUS_OK) {
+		return status;
+	}
+	if (ackLen != 1 || validBits != 4) {
+		return STATUS_ERROR;
+	}
+	return (ack & 0x0F) == MIFARE_ACK ? STATUS_OK : STATUS_MIFARE_NACK;
+}
+
+MFRC522_Status MIFARE_Write(uint8_t blockAddr, const uint8_t *data) {
+	uint8_t frame[16 + 2];
+
+	frame[0] = PICC_CMD_MF_WRITE;
+	frame[1] = blockAddr;
+	MFRC522_Status status = MIFARE_SendForAck(frame, 2, false);
+	if (status != STATUS_OK) {
+		return status;
+	}
+	memcpy(frame, data, 16);
+	return MIFARE_SendForAck(frame, 16, false);
+}
+
+MFRC522_Status MIFARE_Operate(uint8_t command, uint8_t blockAddr,
+							  int32_t operand) {
+	uint8_t frame[4 + 2];
+	uint32_t value = operand;
+
+	frame[0] = command;
+	frame[1] = blockAddr;
+	MFRC522_Status status = MIFARE_SendForAck(frame, 2, false);
+	if (status != STATUS_OK) {
+		return status;
+	}
+	// Little endian, RESTORE takes any 4 bytes
+	for (uint8_t i = 0; i < 4; i++) {
+		frame[i] = value >> (8 * i);
+	}
+	return MIFARE_SendForAck(frame, 4, true);
+}
+
+MFRC522_Status MIFARE_Transfer(uint8_t blockAddr) {
+	uint8_t frame[2 + 2] = {PICC_CMD_MF_TRANSFER, blockAddr};
+	return MIFARE_SendForAck(frame, 2, false);
+}
+
 MFRC522_Status MIFARE_Read(uint8_t blockAddr, uint8_t *buffer,
 						   uint8_t *bufferSize) {
 	MFRC522_Status result;
@@ -591,8 +1005,8 @@ MFRC522_Status MIFARE_Read(uint8_t blockAddr, uint8_t *buffer,
 	return PCD_TransceiveData(buffer, 4, buffer, bufferSize, 0, 0);
 }
 
-MFRC522_Status PICC_RequestA(uint8_t *bufferATQA, uint8_t *bufferSize) {
-	uint8_t command = PICC_CMD_REQA;
+static MFRC522_Status PICC_REQA_or_WUPA(uint8_t command, uint8_t *bufferATQA,
+										uint8_t *bufferSize) {
 	uint8_t validBits;
 	MFRC522_Status status;
 
@@ -605,8 +1019,12 @@ MFRC522_Status PICC_RequestA(uint8_t *bufferATQA, uint8_t *bufferSize) {
 	// For REQA and WUPA we need the short frame format - transmit only 7 bits
 	// of the last (and only) byte. TxLastBits = BitFramingReg[2..0]
 	validBits = 7;
-	status =
-		PCD_TransceiveData(&command, 1, bufferATQA, bufferSize, &validBits, 0);
+	status = PCD_Communicate(CMD_TRANSCEIVE, 0x30, &command, 1, bufferATQA,
+							 bufferSize, &validBits, 0, false);
+	// No answer is the normal case without a card in the field
+	if (status != STATUS_TIMEOUT) {
+		PCD_Count(status);
+	}
 	if (status != STATUS_OK) {
 		return status;
 	}
@@ -617,6 +1035,48 @@ MFRC522_Status PICC_RequestA(uint8_t *bufferATQA, uint8_t *bufferSize) {
 	return STATUS_OK;
 }
 
+MFRC522_Status PICC_RequestA(uint8_t *bufferATQA, uint8_t *bufferSize) {
+	return PICC_REQA_or_WUPA(PICC_CMD_REQA, bufferATQA, bufferSize);
+}
+
+MFRC522_Status PICC_WakeupA(uint8_t *bufferATQA, uint8_t *bufferSize) {
+	return PICC_REQA_or_WUPA(PICC_CMD_WUPA, bufferATQA, bufferSize);
+}
+
+MFRC522_Status PICC_HaltA() {
+	pbuf_t *p = pbuf_alloc();
+	if (!p) {
+		return STATUS_NO_ROOM;
+	}
+
+	// Build command buffer
+	uint8_t *cmd = pbuf_push(p, 2);
+	cmd[0] = PICC_CMD_HLTA;
+	cmd[1] = 0;
+	// Calculate CRC_A
+	MFRC522_Status result = PCD_AppendCRC(p);
+
+	// Send the command.
+	// The standard says: If the PICC responds with any modulation during a
+	// period of 1 ms after the end of the frame containing the HLTA command,
+	// this response shall be interpreted as 'not acknowledge'.
+	// We interpret that this way: Only STATUS_TIMEOUT is a success.
+	if (result == STATUS_OK) {
+		result = PCD_Communicate(CMD_TRANSCEIVE, 0x30, pbuf_data(p), p->len,
+								 NULL, NULL, NULL, 0, false);
+	}
+	pbuf_free(p);
+	if (result == STATUS_TIMEOUT) {
+		return STATUS_OK;
+	}
+	PCD_Count(result);
+	if (result == STATUS_OK) {
+		// That is ironically NOT ok in this case ;-)
+		return STATUS_ERROR;
+	}
+	return result;
+}
+
 bool PICC_IsNewCardPresent() {
 	uint8_t bufferATQA[2];
 	uint8_t bufferSize = sizeof(bufferATQA);
@@ -0,0 +1,112 @@
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/i2c.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/spi.h>
+#include <libopencm3/stm32/usart.h>
+
+#include <string.h>
+
+#include "clock.h"
+#include "mfrc522_port.h"
+
+#if defined(MFRC522_BUS_UART)
+
+static uint32_t uart_baud = MFRC522_BUS_UART_RESET_BAUD;
+
+/* usart_set_baudrate() derives BRR from the current APB1 frequency */
+static void uart_on_clock(void) {
+	usart_set_baudrate(BOARD_MFRC522_USART, uart_baud);
+}
+
+void mfrc522_uart_set_baud(uint32_t baud) {
+	/* Lets the last byte out at the old rate, and drops whatever arrived
+	 * while the two sides disagreed */
+	while (!(USART_SR(BOARD_MFRC522_USART) & USART_SR_TC)) {
+	}
+	uart_baud = baud;
+	uart_on_clock();
+	(void)USART_DR(BOARD_MFRC522_USART);
+}
+
+void mfrc522_port_init(void) {
+	rcc_periph_clock_enable(BOARD_MFRC522_USART_RCC);
+	gpio_set_mode(BOARD_MFRC522_USART_TX.port, GPIO_MODE_OUTPUT_50_MHZ,
+				  GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, BOARD_MFRC522_USART_TX.pin);
+	gpio_set_mode(BOARD_MFRC522_USART_RX.port, GPIO_MODE_INPUT,
+				  GPIO_CNF_INPUT_PULL_UPDOWN, BOARD_MFRC522_USART_RX.pin);
+	board_pin_set(BOARD_MFRC522_USART_RX);
+
+	usart_set_databits(BOARD_MFRC522_USART, 8);
+	usart_set_stopbits(BOARD_MFRC522_USART, USART_STOPBITS_1);
+	usart_set_mode(BOARD_MFRC522_USART, USART_MODE_TX_RX);
+	usart_set_parity(BOARD_MFRC522_USART, USART_PARITY_NONE);
+	usart_set_flow_control(BOARD_MFRC522_USART, USART_FLOWCONTROL_NONE);
+	uart_on_clock();
+	clock_register(uart_on_clock);
+	usart_enable(BOARD_MFRC522_USART);
+}
+
+#elif defined(MFRC522_BUS_I2C)
+
+/* Fast mode, timings derived from the APB1 frequency. PE has to be clear
+ * while they change. */
+static void i2c_on_clock(void) {
+	i2c_peripheral_disable(BOARD_MFRC522_I2C);
+	i2c_set_speed(BOARD_MFRC522_I2C, i2c_speed_fm_400k,
+				  rcc_apb1_frequency / 1000000);
+	i2c_peripheral_enable(BOARD_MFRC522_I2C);
+}
+
+void mfrc522_port_init(void) {
+	rcc_periph_clock_enable(BOARD_MFRC522_I2C_RCC);
+	gpio_set_mode(BOARD_MFRC522_I2C_PINS.port, GPIO_MODE_OUTPUT_50_MHZ,
+				  GPIO_CNF_OUTPUT_ALTFN_OPENDRAIN, BOARD_MFRC522_I2C_PINS.pin);
+	i2c_reset(BOARD_MFRC522_I2C);
+	i2c_on_clock();
+	clock_register(i2c_on_clock);
+}
+
+void mfrc522_i2c_write(uint8_t reg, const uint8_t *data, uint8_t len) {
+	/* Register address and data go out in one write transfer */
+	uint8_t buf[1 + 64];
+
+	if (len > sizeof(buf) - 1) {
+		len = sizeof(buf) - 1;
+	}
+	buf[0] = reg;
+	memcpy(&buf[1], data, len);
+	i2c_transfer7(BOARD_MFRC522_I2C, MFRC522_I2C_ADDR, buf, 1 + len, NULL, 0);
+}
+
+void mfrc522_i2c_read(uint8_t reg, uint8_t *out, uint8_t len) {
+	i2c_transfer7(BOARD_MFRC522_I2C, MFRC522_I2C_ADDR, &reg, 1, out, len);
+}
+
+#else
+
+/* Fastest SPI baud rate prescaler (2 << br) that stays within the rate the
+ * MFRC522 wiring is good for. SPE has to be clear while BR changes. */
+static void spi_on_clock(void) {
+	uint8_t br = 0;
+	while (br < 7 && (rcc_apb2_frequency >> (br + 1)) > BOARD_MFRC522_SPI_HZ) {
+		br++;
+	}
+	spi_disable(BOARD_MFRC522_SPI);
+	spi_set_baudrate_prescaler(BOARD_MFRC522_SPI, br);
+	spi_enable(BOARD_MFRC522_SPI);
+}
+
+void mfrc522_port_init(void) {
+	rcc_periph_clock_enable(BOARD_MFRC522_SPI_RCC);
+	spi_reset(BOARD_MFRC522_SPI);
+	spi_init_master(BOARD_MFRC522_SPI, SPI_CR1_BAUDRATE_FPCLK_DIV_32,
+					SPI_CR1_CPOL_CLK_TO_0_WHEN_IDLE,
+					SPI_CR1_CPHA_CLK_TRANSITION_1, SPI_CR1_DFF_8BIT,
+					SPI_CR1_MSBFIRST);
+	spi_enable_software_slave_management(BOARD_MFRC522_SPI);
+	spi_set_nss_high(BOARD_MFRC522_SPI);
+	spi_on_clock();
+	clock_register(spi_on_clock);
+}
+
+#endif
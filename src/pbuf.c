@@ -0,0 +1,30 @@
+#include "pbuf.h"
+
+static pbuf_t pool[PBUF_COUNT];
+/* Bit n set while pool[n] is free */
+static uint8_t free_mask = (1 << PBUF_COUNT) - 1;
+
+pbuf_t *pbuf_alloc(void) {
+	for (uint8_t i = 0; i < PBUF_COUNT; i++) {
+		if (free_mask & (1 << i)) {
+			free_mask &= ~(1 << i);
+			pbuf_reset(&pool[i]);
+			return &pool[i];
+		}
+	}
+	return NULL;
+}
+
+void pbuf_free(pbuf_t *p) {
+	if (p) {
+		free_mask |= 1 << (p - pool);
+	}
+}
+
+uint8_t pbuf_available(void) {
+	uint8_t n = 0;
+	for (uint8_t i = 0; i < PBUF_COUNT; i++) {
+		n += (free_mask >> i) & 1;
+	}
+	return n;
+}
@@ -0,0 +1,551 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "acl.h"
+#include "clock.h"
+#include "flashlog.h"
+#include "frame.h"
+#include "idle.h"
+#include "link.h"
+#include "metrics.h"
+#include "mfrc522.h"
+#include "proto.h"
+#include "ultralight.h"
+#include "utils.h"
+
+/* Offsets in the raw request and response frames */
+#define REQ_SEQ 0
+#define REQ_OP 1
+#define REQ_PAYLOAD 2
+#define RESP_STATUS 2
+#define RESP_PAYLOAD 3
+
+/* Does not build if the PROTO_STATUS_* values of proto.h drift */
+typedef char proto_status_check[(
+	PROTO_STATUS_OK == STATUS_OK &&
+	PROTO_STATUS_ERROR == STATUS_ERROR &&
+	PROTO_STATUS_COLLISION == STATUS_COLLISION &&
+	PROTO_STATUS_TIMEOUT == STATUS_TIMEOUT &&
+	PROTO_STATUS_NO_ROOM == STATUS_NO_ROOM &&
+	PROTO_STATUS_INVALID == STATUS_INVALID &&
+	PROTO_STATUS_CRC_WRONG == STATUS_CRC_WRONG &&
+	PROTO_STATUS_MISMATCH == STATUS_MISMATCH &&
+	PROTO_STATUS_MIFARE_NACK == STATUS_MIFARE_NACK) ? 1 : -1];
+
+static uint8_t rx_enc[FRAME_MAX_ENCODED];
+static uint16_t rx_enc_len;
+/* Set when a frame did not fit into rx_enc, skips to the next delimiter */
+static bool rx_discard;
+
+/* A decoded frame is always shorter than its encoding */
+static uint8_t req[FRAME_MAX_ENCODED];
+/* Leaves room for the CRC appended by frame_pack() */
+static uint8_t resp[FRAME_MAX_RAW + 2];
+static uint8_t tx_enc[FRAME_MAX_ENCODED];
+
+static bool events_enabled = LINK_EVENTS;
+#ifdef LINK_UART
+uint32_t link_host_seen_at;
+bool link_host_seen;
+#endif
+static uint16_t event_seq;
+static proto_stats_t stats;
+/* From PROTO_OP_UL_INFO, dropped whenever another tag may be selected */
+static UL_Info_t ul_info;
+static bool ul_valid;
+/* Card arrivals nobody listened for, until the host picks them up */
+static flashlog_t event_log;
+/* Decides on arrivals, the host keeps it up to date */
+static acl_t access_list;
+static uint32_t acl_bloom[ACL_BLOOM_WORDS];
+static acl_delta_t acl_deltas[ACL_DELTA_MAX];
+
+void proto_init(void) {
+	flashlog_mount(&event_log);
+	acl_init(&access_list, acl_bloom, LEN(acl_bloom), ACL_BLOOM_HASHES,
+			 acl_deltas, LEN(acl_deltas));
+	acl_mount(&access_list);
+	link_init();
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+	uint64_t v = 0;
+	for (uint8_t i = 0; i < 8; i++) {
+		v |= (uint64_t)p[i] << (8 * i);
+	}
+	return v;
+}
+
+static uint8_t put_uid(uint8_t *p, const MFRC522_UID_t *uid) {
+	p[0] = uid->size;
+	memcpy(&p[1], uid->uid, uid->size);
+	p[1 + uid->size] = uid->sak;
+	return uid->size + 2;
+}
+
+static void respond(uint8_t status, uint16_t payloadLen) {
+	resp[RESP_STATUS] = status;
+	size_t n = frame_pack(resp, RESP_PAYLOAD + payloadLen, tx_enc);
+
+	/* Pipelined requests must not lose their responses, so wait for the
+	 * host to drain the TX ring rather than dropping the frame */
+	while (link_tx_free() < n) {
+		if (!link_ready()) {
+			return;
+		}
+	}
+	link_write(tx_enc, n);
+	stats.tx_frames++;
+}
+
+static void op_select(uint8_t *payload) {
+	MFRC522_UID_t uid = {0};
+	uint8_t atqa[2];
+	uint8_t atqaLen = sizeof(atqa);
+
+	ul_valid = false;
+	MFRC522_Status status = PICC_WakeupA(atqa, &atqaLen);
+	if (status == STATUS_OK || status == STATUS_COLLISION) {
+		status = MFRC522_Select(&uid);
+	}
+	if (status != STATUS_OK) {
+		respond(status, 0);
+		return;
+	}
+	respond(STATUS_OK, put_uid(payload, &uid));
+}
+
+static void op_read_range(const uint8_t *args, uint16_t argsLen,
+						  uint8_t *payload) {
+	if (argsLen != 2 || args[1] == 0 || args[1] > PROTO_MAX_READ_BLOCKS) {
+		respond(PROTO_ERR_LENGTH, 0);
+		return;
+	}
+	pbuf_t *block = pbuf_alloc();
+	if (!block) {
+		respond(STATUS_NO_ROOM, 0);
+		return;
+	}
+	for (uint8_t i = 0; i < args[1]; i++) {
+		MFRC522_Status status = MIFARE_ReadBlock(block, args[0] + i);
+		if (status != STATUS_OK || block->len != 16) {
+			pbuf_free(block);
+			respond(status != STATUS_OK ? status : STATUS_ERROR, 0);
+			return;
+		}
+		memcpy(&payload[16 * i], pbuf_data(block), 16);
+	}
+	pbuf_free(block);
+	respond(STATUS_OK, 16 * args[1]);
+}
+
+static void op_inventory(const uint8_t *args, uint16_t argsLen,
+						 uint8_t *payload) {
+	uint8_t max = argsLen ? args[0] : PROTO_MAX_INVENTORY;
+	if (max > PROTO_MAX_INVENTORY) {
+		max = PROTO_MAX_INVENTORY;
+	}
+
+	/* Every selected card is halted, so the next REQA is only answered by
+	 * the cards not seen yet */
+	uint8_t n = 0;
+	uint16_t len = 1;
+	ul_valid = false;
+	while (n < max && PICC_IsNewCardPresent()) {
+		MFRC522_UID_t uid = {0};
+		if (MFRC522_Select(&uid) != STATUS_OK) {
+			break;
+		}
+		len += put_uid(&payload[len], &uid);
+		n++;
+		PICC_HaltA();
+	}
+	payload[0] = n;
+	respond(STATUS_OK, len);
+}
+
+static void op_ul_info(uint8_t *payload) {
+	MFRC522_UID_t uid = {0};
+
+	MFRC522_Status status = UL_Detect(&ul_info, &uid);
+	ul_valid = status == STATUS_OK;
+	if (!ul_valid) {
+		respond(status, 0);
+		return;
+	}
+	payload[0] = ul_info.type;
+	payload[1] = ul_info.pages;
+	payload[2] = ul_info.userFirst;
+	payload[3] = ul_info.userLast;
+	memcpy(&payload[4], ul_info.version, sizeof(ul_info.version));
+	respond(STATUS_OK, PROTO_UL_INFO_SIZE);
+}
+
+static void op_ul_read(const uint8_t *args, uint16_t argsLen,
+					   uint8_t *payload) {
+	if (argsLen != 2 || args[1] == 0 || args[1] > PROTO_MAX_UL_PAGES) {
+		respond(PROTO_ERR_LENGTH, 0);
+		return;
+	}
+	if (!ul_valid) {
+		respond(STATUS_INVALID, 0);
+		return;
+	}
+	MFRC522_Status status = UL_ReadPages(&ul_info, args[0], args[1], payload);
+	respond(status, status == STATUS_OK ? args[1] * UL_PAGE_SIZE : 0);
+}
+
+static void op_ul_write(const uint8_t *args, uint16_t argsLen) {
+	uint16_t bytes = argsLen - 2;
+	if (argsLen < 2 + UL_PAGE_SIZE || bytes % UL_PAGE_SIZE ||
+		bytes > PROTO_MAX_UL_PAGES * UL_PAGE_SIZE) {
+		respond(PROTO_ERR_LENGTH, 0);
+		return;
+	}
+	/* User memory only, the rest locks the tag for good */
+	if (!ul_valid || !UL_InUser(&ul_info, args[0], bytes / UL_PAGE_SIZE)) {
+		respond(STATUS_INVALID, 0);
+		return;
+	}
+	respond(UL_WritePages(&ul_info, args[0], bytes / UL_PAGE_SIZE, &args[2],
+						  args[1]),
+			0);
+}
+
+static void respond_words(uint8_t *payload, const void *data, uint16_t size) {
+	const uint32_t *words = data;
+	for (uint8_t i = 0; i < size / 4; i++) {
+		put_u32(&payload[4 * i], words[i]);
+	}
+	respond(STATUS_OK, size);
+}
+
+static void op_idle_stats(uint8_t *payload) {
+	idle_stats_t idle;
+	idle_get_stats(&idle);
+	respond_words(payload, &idle, sizeof(idle));
+}
+
+static void op_clock_stats(uint8_t *payload) {
+	clock_stats_t clock;
+	clock_get_stats(&clock);
+	respond_words(payload, &clock, sizeof(clock));
+}
+
+static void op_metrics(const uint8_t *args, uint16_t argsLen,
+					   uint8_t *payload) {
+	uint32_t words[PROTO_MAX_METRIC_WORDS];
+
+	if (argsLen != 2) {
+		respond(PROTO_ERR_LENGTH, 0);
+		return;
+	}
+	uint16_t first = args[0] | args[1] << 8;
+	uint16_t n = first < METRICS_WORDS ? METRICS_WORDS - first : 0;
+	if (n > PROTO_MAX_METRIC_WORDS) {
+		n = PROTO_MAX_METRIC_WORDS;
+	}
+	metrics_snapshot(words, first, n);
+	payload[0] = METRICS_WORDS & 0xff;
+	payload[1] = METRICS_WORDS >> 8;
+	for (uint16_t i = 0; i < n; i++) {
+		put_u32(&payload[2 + 4 * i], words[i]);
+	}
+	respond(STATUS_OK, 2 + 4 * n);
+}
+
+static void op_log_read(uint8_t *payload) {
+	flashlog_cursor_t c;
+	uint16_t len = 5;
+	uint8_t n = 0;
+
+	put_u32(payload, flashlog_pending(&event_log));
+	flashlog_replay(&event_log, &c);
+	while (len + 5 + PROTO_LOG_RECORD_MAX <= FRAME_MAX_RAW - RESP_PAYLOAD) {
+		uint16_t recordLen = PROTO_LOG_RECORD_MAX;
+		uint32_t seq;
+		if (flashlog_next(&event_log, &c, &payload[len + 5], &recordLen,
+						  &seq) != FLASHLOG_OK) {
+			break;
+		}
+		put_u32(&payload[len], seq);
+		payload[len + 4] = recordLen;
+		len += 5 + recordLen;
+		n++;
+	}
+	payload[4] = n;
+	respond(STATUS_OK, len);
+}
+
+static void op_log_ack(const uint8_t *args, uint16_t argsLen) {
+	if (argsLen != 4) {
+		respond(PROTO_ERR_LENGTH, 0);
+		return;
+	}
+	uint32_t seq = args[0] | args[1] << 8 | args[2] << 16 |
+				   (uint32_t)args[3] << 24;
+	respond(flashlog_ack(&event_log, seq) == FLASHLOG_OK ? STATUS_OK
+														 : STATUS_ERROR,
+			0);
+}
+
+static uint8_t acl_status(acl_status_t status) {
+	switch (status) {
+	case ACL_OK:
+		return STATUS_OK;
+	case ACL_FULL:
+		return STATUS_NO_ROOM;
+	case ACL_INVALID:
+	case ACL_BUSY:
+		return STATUS_INVALID;
+	default:
+		return STATUS_ERROR;
+	}
+}
+
+static void op_acl_load(const uint8_t *args, uint16_t argsLen) {
+	uint64_t keys[PROTO_MAX_ACL_KEYS];
+	uint16_t n = (argsLen - 1) / 8;
+
+	if (!argsLen || (argsLen - 1) % 8 || n > PROTO_MAX_ACL_KEYS ||
+		(args[0] != PROTO_ACL_KEYS && n)) {
+		respond(PROTO_ERR_LENGTH, 0);
+		return;
+	}
+	switch (args[0]) {
+	case PROTO_ACL_BEGIN:
+		respond(acl_status(acl_load_begin(&access_list)), 0);
+		break;
+	case PROTO_ACL_KEYS:
+		for (uint16_t i = 0; i < n; i++) {
+			keys[i] = get_u64(&args[1 + 8 * i]);
+		}
+		respond(acl_status(acl_load_keys(&access_list, keys, n)), 0);
+		break;
+	case PROTO_ACL_COMMIT:
+		respond(acl_status(acl_load_commit(&access_list)), 0);
+		break;
+	default:
+		respond(STATUS_INVALID, 0);
+		break;
+	}
+}
+
+/* Stops at the first change that fails, the ones before it stay */
+static void op_acl_update(const uint8_t *args, uint16_t argsLen,
+						  uint8_t *payload) {
+	acl_status_t status = ACL_OK;
+	uint8_t n = 0;
+
+	if (!argsLen || argsLen % 9 || argsLen / 9 > PROTO_MAX_ACL_UPDATES) {
+		respond(PROTO_ERR_LENGTH, 0);
+		return;
+	}
+	for (; n < argsLen / 9; n++) {
+		const uint8_t *u = &args[9 * n];
+		status = acl_update(&access_list, get_u64(&u[1]), u[0]);
+		if (status != ACL_OK) {
+			break;
+		}
+	}
+	payload[0] = n;
+	respond(acl_status(status), 1);
+}
+
+static void op_acl_info(uint8_t *payload) {
+	acl_info_t info;
+	acl_get_info(&access_list, &info);
+	respond_words(payload, &info, sizeof(info));
+}
+
+static void op_acl_check(const uint8_t *args, uint16_t argsLen,
+						 uint8_t *payload) {
+	if (!argsLen || argsLen != 1 + args[0]) {
+		respond(PROTO_ERR_LENGTH, 0);
+		return;
+	}
+	payload[0] = acl_allows(&access_list, &args[1], args[0]);
+	respond(STATUS_OK, 1);
+}
+
+static void dispatch(uint16_t len) {
+	const uint8_t *args = &req[REQ_PAYLOAD];
+	uint16_t argsLen = len - REQ_PAYLOAD;
+	uint8_t *payload = &resp[RESP_PAYLOAD];
+
+	resp[REQ_SEQ] = req[REQ_SEQ];
+	resp[REQ_OP] = req[REQ_OP] | PROTO_RESPONSE;
+
+	switch (req[REQ_OP]) {
+	case PROTO_OP_POLL:
+		ul_valid = false;
+		payload[0] = PICC_IsNewCardPresent();
+		respond(STATUS_OK, 1);
+		break;
+	case PROTO_OP_SELECT:
+		op_select(payload);
+		break;
+	case PROTO_OP_READ_RANGE:
+		op_read_range(args, argsLen, payload);
+		break;
+	case PROTO_OP_INVENTORY:
+		op_inventory(args, argsLen, payload);
+		break;
+	case PROTO_OP_STATS:
+		respond_words(payload, &stats, sizeof(stats));
+		break;
+	case PROTO_OP_IDLE_STATS:
+		op_idle_stats(payload);
+		break;
+	case PROTO_OP_CLOCK_STATS:
+		op_clock_stats(payload);
+		break;
+	case PROTO_OP_UL_INFO:
+		op_ul_info(payload);
+		break;
+	case PROTO_OP_UL_READ:
+		op_ul_read(args, argsLen, payload);
+		break;
+	case PROTO_OP_UL_WRITE:
+		op_ul_write(args, argsLen);
+		break;
+	case PROTO_OP_METRICS:
+		op_metrics(args, argsLen, payload);
+		break;
+	case PROTO_OP_LOG_READ:
+		op_log_read(payload);
+		break;
+	case PROTO_OP_LOG_ACK:
+		op_log_ack(args, argsLen);
+		break;
+	case PROTO_OP_ACL_LOAD:
+		op_acl_load(args, argsLen);
+		break;
+	case PROTO_OP_ACL_UPDATE:
+		op_acl_update(args, argsLen, payload);
+		break;
+	case PROTO_OP_ACL_INFO:
+		op_acl_info(payload);
+		break;
+	case PROTO_OP_ACL_CHECK:
+		op_acl_check(args, argsLen, payload);
+		break;
+	case PROTO_OP_EVENTS:
+		if (argsLen != 1) {
+			respond(PROTO_ERR_LENGTH, 0);
+			break;
+		}
+		events_enabled = args[0];
+		respond(STATUS_OK, 0);
+		break;
+	default:
+		stats.rx_bad_ops++;
+		respond(PROTO_ERR_OP, 0);
+		break;
+	}
+}
+
+/* Keeps an arrival nobody listened for in flash. A full log keeps the
+ * oldest ones. */
+static void log_event(const MFRC522_UID_t *uid) {
+	uint8_t record[PROTO_LOG_RECORD_MAX];
+
+	put_u32(record, idle_now());
+	record[4] = uid->size;
+	record[5] = uid->sak;
+	memcpy(&record[6], uid->uid, uid->size);
+	if (flashlog_append(&event_log, record, 6 + uid->size, NULL) ==
+		FLASHLOG_OK) {
+		stats.events_logged++;
+	} else {
+		stats.events_log_full++;
+	}
+}
+
+static void card_event(const MFRC522_UID_t *uid) {
+	uint8_t event[PROTO_EVENT_SIZE] = {0};
+	bool allowed = acl_allows(&access_list, uid->uid, uid->size);
+
+	metric_inc(allowed ? METRIC_acl_allowed : METRIC_acl_denied);
+	if (!link_ready()) {
+		log_event(uid);
+		return;
+	}
+
+	event[0] = 0xa1;
+	event[1] = PROTO_EVENT_CARD;
+	event[2] = event_seq;
+	event[3] = event_seq >> 8;
+	event[4] = allowed;
+	event[6] = PROTO_EVENT_SIZE - PROTO_EVENT_HEADER;
+	event[8] = uid->size;
+	event[9] = uid->sak;
+	memcpy(&event[10], uid->uid, uid->size);
+
+	if (link_notify(event, sizeof(event))) {
+		event_seq++;
+		stats.events++;
+	} else {
+		stats.events_dropped++;
+		log_event(uid);
+	}
+}
+
+/* Reports cards entering the field, or logs them with the host away. The
+ * card is halted afterwards, so it is not reported again while it stays on
+ * the antenna. */
+static void poll_card_arrival(void) {
+	MFRC522_UID_t uid = {0};
+
+	if (!PICC_IsNewCardPresent()) {
+		return;
+	}
+	ul_valid = false;
+	if (MFRC522_Select(&uid) == STATUS_OK) {
+		card_event(&uid);
+	}
+	PICC_HaltA();
+}
+
+void proto_poll(void) {
+	uint8_t chunk[LINK_CHUNK];
+	uint16_t n = link_read(chunk, sizeof(chunk));
+
+	/* Several frames may arrive in one transfer, each is handled as soon as
+	 * its delimiter is seen */
+	for (uint16_t i = 0; i < n; i++) {
+		if (chunk[i] != FRAME_DELIMITER) {
+			if (rx_enc_len < sizeof(rx_enc)) {
+				rx_enc[rx_enc_len++] = chunk[i];
+			} else {
+				rx_discard = true;
+			}
+			continue;
+		}
+		uint16_t len = 0;
+		if (!rx_discard && rx_enc_len) {
+			len = frame_unpack(rx_enc, rx_enc_len, req);
+		}
+		if (len >= REQ_PAYLOAD && len <= FRAME_MAX_RAW) {
+			stats.rx_frames++;
+			link_seen();
+			metric_observe(METRIC_proto_request_bytes, len);
+			dispatch(len);
+		} else if (rx_enc_len || rx_discard) {
+			stats.rx_bad_frames++;
+		}
+		rx_enc_len = 0;
+		rx_discard = false;
+	}
+
+	if (!n && !rx_enc_len && (events_enabled || !link_ready())) {
+		poll_card_arrival();
+	}
+}
@@ -0,0 +1,87 @@
+#include <stddef.h>
+
+#include "fmt.h"
+#include "stackmon.h"
+#include "utils.h"
+
+/* From the libopencm3 linker script */
+extern uint32_t _data, _ebss, _stack;
+/* From libnosys, returns the current heap break for 0 */
+extern void *_sbrk(ptrdiff_t incr);
+
+static uint32_t thread_stack[STACKMON_THREAD_SIZE / 4]
+	__attribute__((aligned(8)));
+
+static void paint(uint32_t *from, uint32_t *to) {
+	while (from < to) {
+		*from++ = STACKMON_PAINT;
+	}
+}
+
+/* Bytes above the lowest overwritten word of [bottom, top) */
+static uint32_t high_water(const uint32_t *bottom, const uint32_t *top) {
+	while (bottom < top && *bottom == STACKMON_PAINT) {
+		bottom++;
+	}
+	return (top - bottom) * 4;
+}
+
+static uint32_t *heap_end(void) {
+	uintptr_t brk = (uintptr_t)_sbrk(0);
+	return (uint32_t *)((brk + 3) & ~3u);
+}
+
+/* Thread mode switches to PSP at `top` and jumps to `entry`. Naked, as no
+ * frame may be left on the main stack that would be popped from the
+ * process stack. */
+static __attribute__((naked, noreturn)) void
+enter_thread(__attribute__((unused)) void (*entry)(void),
+			 __attribute__((unused)) uint32_t *top) {
+	__asm__ volatile("msr psp, r1\n\t"
+					 "movs r1, #2\n\t"
+					 "msr control, r1\n\t"
+					 "isb\n\t"
+					 "bx r0\n\t");
+}
+
+void stackmon_start(void (*entry)(void)) {
+	uint32_t *msp;
+	__asm__ volatile("mrs %0, msp" : "=r"(msp));
+
+	paint(thread_stack, &thread_stack[LEN(thread_stack)]);
+	/* Stops short of the frames already on the main stack */
+	paint(heap_end(), msp - 16);
+
+	enter_thread(entry, &thread_stack[LEN(thread_stack)]);
+}
+
+void stackmon_get(stackmon_usage_t *out) {
+	uint32_t *heap = heap_end();
+
+	out->thread.size = sizeof(thread_stack);
+	out->thread.used =
+		high_water(thread_stack, &thread_stack[LEN(thread_stack)]);
+	out->isr.size = (&_stack - heap) * 4;
+	out->isr.used = high_water(heap, &_stack);
+	out->static_bytes = (&_ebss - &_data) * 4 - sizeof(thread_stack);
+	out->heap_bytes = (heap - &_ebss) * 4;
+}
+
+void stackmon_report(void) {
+	stackmon_usage_t u;
+	stackmon_get(&u);
+	const fmt_sink_t itm = FMT_ITM(STACKMON_ITM_PORT);
+	fmt_str(&itm, "mem thread=");
+	fmt_u32(&itm, u.thread.used);
+	fmt_char(&itm, '/');
+	fmt_u32(&itm, u.thread.size);
+	fmt_str(&itm, " isr=");
+	fmt_u32(&itm, u.isr.used);
+	fmt_char(&itm, '/');
+	fmt_u32(&itm, u.isr.size);
+	fmt_str(&itm, " static=");
+	fmt_u32(&itm, u.static_bytes);
+	fmt_str(&itm, " heap=");
+	fmt_u32(&itm, u.heap_bytes);
+	fmt_char(&itm, '\n');
+}
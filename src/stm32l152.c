@@ -1,54 +1,38 @@
 #include <libopencm3/cm3/nvic.h>
 #include <libopencm3/cm3/systick.h>
-#include <libopencm3/stm32/adc.h>
-#include <libopencm3/stm32/dbgmcu.h>
 #include <libopencm3/stm32/exti.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/rcc.h>
-#include <libopencm3/stm32/spi.h>
 #include <libopencm3/stm32/timer.h>
-#include <libopencm3/stm32/usart.h>
 
 #include <stdbool.h>
 
+#include "board.h"
+#include "fmt.h"
+#include "stackmon.h"
 #include "utils.h"
 
-/* MFRC522 onboard pinouts:
- * SDA - UART RX
- * SCK - UART DTRQ
- * MOSI - UART MX
- * MISO - UART TX */
-
-static inline bool debugger_attached() { return (DBGMCU_CR & 0x07); }
-
-int _write(int fd, char *ptr, int len) {
-	(void)fd;
-	int i = 0;
-	for (; i < len && ptr[i]; i++) {
-		itm_send_char(fd, ptr[i]);
-	}
-	return i;
-}
-
 static void setup_gpio() {
 	nvic_enable_irq(NVIC_SYSTICK_IRQ);
-	nvic_enable_irq(NVIC_EXTI0_IRQ);
+	nvic_enable_irq(BOARD_BUTTON_IRQ);
 	rcc_periph_clock_enable(RCC_GPIOA);
 	rcc_periph_clock_enable(RCC_GPIOB);
-	gpio_mode_setup(GPIOA, GPIO_MODE_INPUT, GPIO_PUPD_NONE, GPIO0);
-	gpio_mode_setup(GPIOB, GPIO_MODE_OUTPUT, GPIO_PUPD_PULLDOWN, GPIO6 | GPIO7);
-	gpio_set(GPIOB, GPIO6);
-	/* gpio_set(GPIOB, GPIO7); */
-
-	exti_enable_request(EXTI0);
-	exti_select_source(EXTI0, GPIOA);
-	exti_set_trigger(EXTI0, EXTI_TRIGGER_RISING);
+	gpio_mode_setup(BOARD_BUTTON.port, GPIO_MODE_INPUT, GPIO_PUPD_NONE,
+					BOARD_BUTTON.pin);
+	gpio_mode_setup(BOARD_LED_BLUE.port, GPIO_MODE_OUTPUT, GPIO_PUPD_PULLDOWN,
+					BOARD_LED_BLUE.pin | BOARD_LED_GREEN.pin);
+	board_pin_set(BOARD_LED_BLUE);
+	/* board_pin_set(BOARD_LED_GREEN); */
+
+	exti_enable_request(BOARD_BUTTON_EXTI);
+	exti_select_source(BOARD_BUTTON_EXTI, BOARD_BUTTON.port);
+	exti_set_trigger(BOARD_BUTTON_EXTI, EXTI_TRIGGER_RISING);
 }
 
-void exti0_isr() {
-	printf("EXTI0 interrupted\n");
-	exti_reset_request(EXTI0);
-	gpio_toggle(GPIOB, GPIO6);
+void board_button_isr() {
+	fmt_str(&fmt_log, "EXTI0 interrupted\n");
+	exti_reset_request(BOARD_BUTTON_EXTI);
+	gpio_toggle(BOARD_LED_BLUE.port, BOARD_LED_BLUE.pin);
 }
 
 static void setup_systick() {
@@ -62,7 +46,7 @@ void sys_tick_handler() {}
 static void setup_timers() {
 	rcc_periph_clock_enable(RCC_TIM2);
 	nvic_enable_irq(NVIC_TIM2_IRQ);
-	timer_set_prescaler(TIM2, (rcc_apb1_frequency / 1000) - 1);
+	timer_set_prescaler(TIM2, fix_prescaler(rcc_apb1_frequency, 1000));
 	timer_set_period(TIM2, 2000 - 1);
 	timer_enable_irq(TIM2, TIM_DIER_UIE);
 }
@@ -72,21 +56,26 @@ static void setup_timers() {
 /* 	return; */
 /* } */
 
-int main() {
+/* Runs on the process stack, see stackmon_start() */
+static void app_main(void) {
+	board_setup_clocks();
+	setup_systick();
+	systick_counter_enable();
+
+	/* Sleeps between SysTick interrupts rather than spinning */
 	while (!debugger_attached()) {
-		__asm("nop");
+		__asm("wfi");
 	}
 
-	rcc_clock_setup_pll(&rcc_clock_config[RCC_CLOCK_VRANGE1_HSI_PLL_32MHZ]);
-	setup_systick();
 	/* setup_timers(); */
 	setup_gpio();
 	/* setup_temp_sensor(); */
-
-	systick_counter_enable();
 	/* timer_enable_counter(TIM2); */
 
-	printf("AHB frequency = %dHz\n", rcc_ahb_frequency);
+	fmt_str(&fmt_log, "AHB frequency = ");
+	fmt_u32(&fmt_log, rcc_ahb_frequency);
+	fmt_str(&fmt_log, "Hz\n");
+	stackmon_report();
 
 	/* uint8_t id[10]; */
 	/* for (uint8_t i = 0; i < 255; i++) { */
@@ -98,9 +87,10 @@ int main() {
 	/* 	printf("\n"); */
 	/* } */
 
+	/* Everything is interrupt driven, sleep until the next one */
 	while (1) {
-		__asm("nop");
+		__asm("wfi");
 	}
-
-	return 0;
 }
+
+int main() { stackmon_start(app_main); }
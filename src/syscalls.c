@@ -0,0 +1,23 @@
+#include "utils.h"
+#ifdef LOG_UART
+#include "uart_stream.h"
+#endif
+
+/* newlib output hook, for whatever newlib prints itself: the firmware logs
+ * through fmt.h. Everything goes to the ITM stimulus port matching the file
+ * descriptor. In a LOG=uart build fd 0 goes to USART1 instead, as fmt_log
+ * does; what does not fit into the TX ring is dropped rather than blocking,
+ * as the caller may be an interrupt handler. */
+int _write(int fd, char *ptr, int len) {
+#ifdef LOG_UART
+	if (fd == 0) {
+		uart_stream_write(ptr, len);
+		return len;
+	}
+#endif
+	int i = 0;
+	for (; i < len && ptr[i]; i++) {
+		itm_send_char(fd, ptr[i]);
+	}
+	return i;
+}
@@ -0,0 +1,247 @@
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/usart.h>
+
+#include "board.h"
+#include "clock.h"
+#include "fmt.h"
+#include "idle.h"
+#include "ring.h"
+#include "uart_stream.h"
+#include "utils.h"
+
+static uint8_t tx_buf[UART_STREAM_TX_SIZE];
+/* Written by the RX DMA channel in circular mode */
+static uint8_t rx_buf[UART_STREAM_RX_SIZE];
+static ring_t tx_ring;
+static ring_t rx_ring;
+
+static bool initialised;
+static uint32_t baud;
+static bool clock_held;
+/* A TX DMA transfer of `tx_len` bytes from the ring is running */
+static volatile bool tx_busy;
+static uint16_t tx_len;
+/* RX DMA write position at the last update */
+static uint16_t rx_pos;
+static uart_stream_stats_t stats;
+
+/* usart_set_baudrate() derives BRR from the current APB2 frequency */
+static void uart_on_clock(void) { usart_set_baudrate(BOARD_USART, baud); }
+
+void uart_stream_set_baud(uint32_t rate) {
+	/* The USART needs at least 16 APB2 clocks per bit */
+	bool high = rate * 16 > BOARD_CLOCK_LOW->apb2_frequency;
+
+	if (high && !clock_held) {
+		clock_hold();
+	} else if (!high && clock_held) {
+		clock_release();
+	}
+	clock_held = high;
+	baud = rate;
+	uart_on_clock();
+}
+
+static void setup_rx_dma(void) {
+	uint8_t ch = BOARD_USART_DMA_RX;
+
+	dma_channel_reset(DMA1, ch);
+	dma_set_peripheral_address(DMA1, ch, (uint32_t)&USART_DR(BOARD_USART));
+	dma_set_memory_address(DMA1, ch, (uint32_t)rx_buf);
+	dma_set_number_of_data(DMA1, ch, sizeof(rx_buf));
+	dma_set_read_from_peripheral(DMA1, ch);
+	dma_enable_memory_increment_mode(DMA1, ch);
+	dma_set_peripheral_size(DMA1, ch, DMA_CCR_PSIZE_8BIT);
+	dma_set_memory_size(DMA1, ch, DMA_CCR_MSIZE_8BIT);
+	/* A byte every 2.2 us at 4.5 Mbaud, ahead of the ADC and the LEDs */
+	dma_set_priority(DMA1, ch, DMA_CCR_PL_VERY_HIGH);
+	dma_enable_circular_mode(DMA1, ch);
+	dma_enable_half_transfer_interrupt(DMA1, ch);
+	dma_enable_transfer_complete_interrupt(DMA1, ch);
+	nvic_enable_irq(BOARD_USART_DMA_RX_IRQ);
+	dma_enable_channel(DMA1, ch);
+}
+
+/* Armed for every transfer by tx_next() */
+static void setup_tx_dma(void) {
+	uint8_t ch = BOARD_USART_DMA_TX;
+
+	dma_channel_reset(DMA1, ch);
+	dma_set_peripheral_address(DMA1, ch, (uint32_t)&USART_DR(BOARD_USART));
+	dma_set_read_from_memory(DMA1, ch);
+	dma_enable_memory_increment_mode(DMA1, ch);
+	dma_set_peripheral_size(DMA1, ch, DMA_CCR_PSIZE_8BIT);
+	dma_set_memory_size(DMA1, ch, DMA_CCR_MSIZE_8BIT);
+	dma_set_priority(DMA1, ch, DMA_CCR_PL_MEDIUM);
+	dma_enable_transfer_complete_interrupt(DMA1, ch);
+	nvic_enable_irq(BOARD_USART_DMA_TX_IRQ);
+}
+
+void uart_stream_init(uint32_t rate) {
+	if (initialised) {
+		uart_stream_set_baud(rate);
+		return;
+	}
+	initialised = true;
+	ring_init(&tx_ring, tx_buf, sizeof(tx_buf));
+	ring_init(&rx_ring, rx_buf, sizeof(rx_buf));
+
+	rcc_periph_clock_enable(BOARD_USART_RCC);
+	rcc_periph_clock_enable(RCC_DMA1);
+
+	gpio_set_mode(BOARD_USART_TX.port, GPIO_MODE_OUTPUT_50_MHZ,
+				  GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, BOARD_USART_TX.pin);
+	/* Pulled up, so that an open line reads idle rather than breaks */
+	gpio_set_mode(BOARD_USART_RX.port, GPIO_MODE_INPUT,
+				  GPIO_CNF_INPUT_PULL_UPDOWN, BOARD_USART_RX.pin);
+	board_pin_set(BOARD_USART_RX);
+
+	usart_set_databits(BOARD_USART, 8);
+	usart_set_stopbits(BOARD_USART, USART_STOPBITS_1);
+	usart_set_mode(BOARD_USART, USART_MODE_TX_RX);
+	usart_set_parity(BOARD_USART, USART_PARITY_NONE);
+	usart_set_flow_control(BOARD_USART, USART_FLOWCONTROL_NONE);
+	uart_stream_set_baud(rate);
+	clock_register(uart_on_clock);
+
+	setup_rx_dma();
+	setup_tx_dma();
+	usart_enable_rx_dma(BOARD_USART);
+	usart_enable_tx_dma(BOARD_USART);
+	/* EIE reports framing, noise and overrun errors while DMAR is set */
+	USART_CR1(BOARD_USART) |= USART_CR1_IDLEIE;
+	USART_CR3(BOARD_USART) |= USART_CR3_EIE;
+	nvic_enable_irq(BOARD_USART_IRQ);
+	usart_enable(BOARD_USART);
+
+	/* Neither the USART nor DMA run in stop mode */
+	idle_hold(IDLE_STOP);
+}
+
+/* Moves the RX ring head up to the DMA write position. Runs in the USART
+ * and DMA interrupts, which do not preempt each other, or with both
+ * masked. */
+static void rx_update(void) {
+	uint16_t pos = (UART_STREAM_RX_SIZE -
+					DMA_CNDTR(DMA1, BOARD_USART_DMA_RX)) &
+				   (UART_STREAM_RX_SIZE - 1);
+	uint16_t n = (pos - rx_pos) & (UART_STREAM_RX_SIZE - 1);
+
+	rx_pos = pos;
+	rx_ring.head += n;
+	stats.rx_bytes += n;
+}
+
+void board_usart_isr(void) {
+	uint32_t sr = USART_SR(BOARD_USART);
+
+	if (sr & (USART_SR_ORE | USART_SR_NE | USART_SR_FE)) {
+		stats.rx_errors++;
+	}
+	if (sr & USART_SR_IDLE) {
+		stats.rx_idles++;
+	}
+	/* The flags clear by reading SR then DR. Only done while DR is empty,
+	 * otherwise the read would steal a byte from the DMA; the interrupt
+	 * fires again once the DMA took it. */
+	if (!(sr & USART_SR_RXNE)) {
+		(void)USART_DR(BOARD_USART);
+	}
+	rx_update();
+}
+
+void board_usart_dma_rx_isr(void) {
+	dma_clear_interrupt_flags(DMA1, BOARD_USART_DMA_RX, DMA_HTIF | DMA_TCIF);
+	rx_update();
+}
+
+/* Starts a transfer of the contiguous run at the ring tail. Runs in the TX
+ * DMA interrupt or with interrupts masked. */
+static void tx_next(void) {
+	const uint8_t *data;
+	uint16_t n = ring_peek(&tx_ring, &data);
+
+	dma_disable_channel(DMA1, BOARD_USART_DMA_TX);
+	tx_len = n;
+	if (n == 0) {
+		tx_busy = false;
+		return;
+	}
+	dma_set_memory_address(DMA1, BOARD_USART_DMA_TX, (uint32_t)data);
+	dma_set_number_of_data(DMA1, BOARD_USART_DMA_TX, n);
+	dma_enable_channel(DMA1, BOARD_USART_DMA_TX);
+	tx_busy = true;
+	stats.tx_dmas++;
+}
+
+void board_usart_dma_tx_isr(void) {
+	dma_clear_interrupt_flags(DMA1, BOARD_USART_DMA_TX, DMA_TCIF);
+	ring_skip(&tx_ring, tx_len);
+	stats.tx_bytes += tx_len;
+	tx_next();
+}
+
+uint16_t uart_stream_write(const void *data, uint16_t len) {
+	uint32_t mask = cm_mask_interrupts(1);
+	uint16_t n = ring_write(&tx_ring, data, len);
+
+	if (n < len) {
+		stats.tx_overruns++;
+	}
+	if (!tx_busy) {
+		tx_next();
+	}
+	cm_mask_interrupts(mask);
+	return n;
+}
+
+void fmt_uart_write(void *ctx, const char *data, uint16_t len) {
+	(void)ctx;
+	uart_stream_write(data, len);
+}
+
+static void rx_lock(void) {
+	nvic_disable_irq(BOARD_USART_IRQ);
+	nvic_disable_irq(BOARD_USART_DMA_RX_IRQ);
+	/* Picks up what arrived since the last interrupt */
+	rx_update();
+}
+
+static void rx_unlock(void) {
+	nvic_enable_irq(BOARD_USART_DMA_RX_IRQ);
+	nvic_enable_irq(BOARD_USART_IRQ);
+}
+
+uint16_t uart_stream_read(void *data, uint16_t len) {
+	rx_lock();
+	if (ring_used(&rx_ring) > UART_STREAM_RX_SIZE) {
+		/* Part of the unread data has been overwritten already */
+		ring_skip(&rx_ring, ring_used(&rx_ring));
+		stats.rx_overruns++;
+	}
+	uint16_t n = ring_read(&rx_ring, data, len);
+	rx_unlock();
+	return n;
+}
+
+uint16_t uart_stream_tx_free(void) { return ring_free(&tx_ring); }
+
+uint16_t uart_stream_rx_available(void) {
+	rx_lock();
+	uint16_t n = ring_used(&rx_ring);
+	rx_unlock();
+	return n > UART_STREAM_RX_SIZE ? UART_STREAM_RX_SIZE : n;
+}
+
+void uart_stream_flush(void) {
+	while (tx_busy) {
+	}
+	while (!(USART_SR(BOARD_USART) & USART_SR_TC)) {
+	}
+}
+
+void uart_stream_get_stats(uart_stream_stats_t *out) { *out = stats; }
@@ -0,0 +1,149 @@
+#include <string.h>
+
+#include "uid_cache.h"
+
+/* FNV-1a over the size and the UID bytes */
+static uint32_t hash_uid(const uint8_t *uid, uint8_t size) {
+	uint32_t h = (2166136261u ^ size) * 16777619u;
+	for (uint8_t i = 0; i < size; i++) {
+		h = (h ^ uid[i]) * 16777619u;
+	}
+	return h;
+}
+
+void uid_cache_init(uid_cache_t *c, uid_cache_entry_t *slots,
+					uint16_t capacity, uint32_t ttl, uint32_t dwell_interval,
+					uid_cache_departed_t departed, void *ctx) {
+	c->slots = slots;
+	c->capacity = capacity;
+	c->limit = capacity - capacity / 4;
+	c->used = 0;
+	c->ttl = ttl;
+	c->dwell_interval = dwell_interval;
+	c->departed = departed;
+	c->ctx = ctx;
+	c->evictions = 0;
+	memset(slots, 0, capacity * sizeof(*slots));
+}
+
+/* Slot holding the UID, or the free slot ending its probe run */
+static uint16_t probe(const uid_cache_t *c, const uint8_t *uid, uint8_t size,
+					  uint32_t hash) {
+	uint16_t mask = c->capacity - 1;
+	uint16_t i = hash & mask;
+
+	for (;;) {
+		const uid_cache_entry_t *e = &c->slots[i];
+		if (!e->size || (e->hash == hash && e->size == size &&
+						 !memcmp(e->uid, uid, size))) {
+			return i;
+		}
+		i = (i + 1) & mask;
+	}
+}
+
+uid_cache_entry_t *uid_cache_find(const uid_cache_t *c, const uint8_t *uid,
+								  uint8_t size) {
+	uid_cache_entry_t *e = &c->slots[probe(c, uid, size, hash_uid(uid, size))];
+	return e->size ? e : NULL;
+}
+
+/* Empties slot i and moves later entries of the run back into the gap
+ * where that keeps them reachable from their home slot */
+static void remove_at(uid_cache_t *c, uint16_t i) {
+	uint16_t mask = c->capacity - 1;
+	uint16_t j = i;
+
+	c->used--;
+	for (;;) {
+		c->slots[i].size = 0;
+		for (;;) {
+			j = (j + 1) & mask;
+			if (!c->slots[j].size) {
+				return;
+			}
+			/* An entry whose home is cyclically in (i, j] has to stay */
+			uint16_t home = c->slots[j].hash & mask;
+			if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) {
+				continue;
+			}
+			break;
+		}
+		c->slots[i] = c->slots[j];
+		i = j;
+	}
+}
+
+static void depart(uid_cache_t *c, uint16_t i) {
+	if (c->departed) {
+		c->departed(&c->slots[i], c->ctx);
+	}
+	remove_at(c, i);
+}
+
+static void evict_oldest(uid_cache_t *c, uint32_t now) {
+	uint16_t oldest = 0;
+	uint32_t age = 0;
+
+	for (uint16_t i = 0; i < c->capacity; i++) {
+		if (c->slots[i].size && now - c->slots[i].last_seen >= age) {
+			age = now - c->slots[i].last_seen;
+			oldest = i;
+		}
+	}
+	c->evictions++;
+	depart(c, oldest);
+}
+
+uid_cache_event_t uid_cache_seen(uid_cache_t *c, const uint8_t *uid,
+								 uint8_t size, uint32_t now) {
+	if (size > UID_CACHE_UID_MAX) {
+		size = UID_CACHE_UID_MAX;
+	}
+	uint32_t hash = hash_uid(uid, size);
+	uint16_t i = probe(c, uid, size, hash);
+	uid_cache_entry_t *e = &c->slots[i];
+
+	if (e->size) {
+		if (now - e->last_seen <= c->ttl) {
+			e->last_seen = now;
+			if (now - e->last_event < c->dwell_interval) {
+				return UID_CACHE_REPEAT;
+			}
+			e->last_event = now;
+			return UID_CACHE_DWELL;
+		}
+		/* Gone and back before the next uid_cache_expire() */
+		depart(c, i);
+		i = probe(c, uid, size, hash);
+		e = &c->slots[i];
+	}
+	if (c->used >= c->limit) {
+		evict_oldest(c, now);
+		i = probe(c, uid, size, hash);
+		e = &c->slots[i];
+	}
+
+	e->hash = hash;
+	e->size = size;
+	memcpy(e->uid, uid, size);
+	e->first_seen = e->last_seen = e->last_event = now;
+	c->used++;
+	return UID_CACHE_ARRIVAL;
+}
+
+uint16_t uid_cache_expire(uid_cache_t *c, uint32_t now) {
+	uint16_t n = 0;
+
+	/* A removal may shift the next entry into slot i, so look again */
+	for (uint16_t i = 0; i < c->capacity && c->used;) {
+		const uid_cache_entry_t *e = &c->slots[i];
+		if (e->size && now - e->last_seen > c->ttl) {
+			depart(c, i);
+			n++;
+		} else {
+			i++;
+		}
+	}
+	return n;
+}
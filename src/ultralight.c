@@ -0,0 +1,199 @@
+#include <string.h>
+
+#include "ultralight.h"
+
+static const struct {
+	/* GET_VERSION product type and storage size bytes */
+	uint8_t product;
+	uint8_t storage;
+	UL_Type type;
+	uint8_t pages;
+	uint8_t userLast;
+} models[] = {
+	{0x03, 0x0B, UL_TYPE_UL_EV1_MF0UL11, 20, 15},
+	{0x03, 0x0E, UL_TYPE_UL_EV1_MF0UL21, 41, 35},
+	{0x04, 0x0F, UL_TYPE_NTAG213, 45, 39},
+	{0x04, 0x11, UL_TYPE_NTAG215, 135, 129},
+	{0x04, 0x13, UL_TYPE_NTAG216, 231, 225},
+};
+
+/* Largest response: a FAST_READ chunk and its CRC_A. Longer than a pbuf,
+ * see pbuf.h. */
+static uint8_t rx[UL_FAST_READ_PAGES * UL_PAGE_SIZE + 2];
+
+static void append_crc(uint8_t *frame, uint8_t length) {
+	uint16_t crc = PICC_CRC_A(frame, length);
+	frame[length] = crc;
+	frame[length + 1] = crc >> 8;
+}
+
+/* Sends `frame` (CRC_A appended here) and expects `expect` data bytes with
+ * their CRC_A back in rx */
+static MFRC522_Status exchange(uint8_t *frame, uint8_t length,
+							   uint16_t expect) {
+	uint16_t backLen = sizeof(rx);
+	uint8_t validBits;
+
+	append_crc(frame, length);
+	MFRC522_Status status =
+		PCD_TransceiveStream(frame, length + 2, rx, &backLen, &validBits);
+	if (status != STATUS_OK) {
+		return status;
+	}
+	if (backLen == 1 && validBits == 4) {
+		return STATUS_MIFARE_NACK;
+	}
+	if (backLen != expect + 2 || validBits != 0) {
+		return STATUS_ERROR;
+	}
+	if (PICC_CRC_A(rx, backLen) != 0) {
+		return STATUS_CRC_WRONG;
+	}
+	return STATUS_OK;
+}
+
+MFRC522_Status UL_Detect(UL_Info_t *info, MFRC522_UID_t *uid) {
+	uint8_t frame[3] = {PICC_CMD_UL_GET_VERSION};
+
+	memset(info, 0, sizeof(*info));
+	info->userFirst = UL_USER_FIRST;
+
+	PCD_StartTransceive();
+	MFRC522_Status status = exchange(frame, 1, sizeof(info->version));
+	if (status == STATUS_MIFARE_NACK || status == STATUS_TIMEOUT) {
+		uint8_t atqa[2];
+		uint8_t atqaLen = sizeof(atqa);
+
+		info->type = UL_TYPE_ULTRALIGHT;
+		info->pages = 16;
+		info->userLast = 15;
+		status = PICC_WakeupA(atqa, &atqaLen);
+		if (status == STATUS_OK || status == STATUS_COLLISION) {
+			status = MFRC522_Select(uid);
+		}
+		return status;
+	}
+	if (status != STATUS_OK) {
+		return status;
+	}
+
+	memcpy(info->version, rx, sizeof(info->version));
+	info->type = UL_TYPE_UNKNOWN;
+	info->fastRead = true;
+	for (uint8_t i = 0; i < LEN(models); i++) {
+		if (models[i].product == info->version[2] &&
+			models[i].storage == info->version[6]) {
+			info->type = models[i].type;
+			info->pages = models[i].pages;
+			info->userLast = models[i].userLast;
+			return STATUS_OK;
+		}
+	}
+	/* Storage size is 2^(n/2) bytes, rounded down if n is odd. Only the
+	 * user memory is known to be there, assume no configuration pages. */
+	uint16_t bytes = 1u << (info->version[6] >> 1);
+	uint16_t pages = UL_USER_FIRST + bytes / UL_PAGE_SIZE;
+	info->pages = pages > 0xff ? 0xff : pages;
+	info->userLast = info->pages - 1;
+	return STATUS_OK;
+}
+
+static MFRC522_Status check_range(const UL_Info_t *info, uint8_t first,
+								  uint8_t count) {
+	if (!count || first + count > info->pages) {
+		return STATUS_INVALID;
+	}
+	return STATUS_OK;
+}
+
+/* Up to UL_FAST_READ_PAGES pages from `first` into rx */
+static MFRC522_Status read_chunk(const UL_Info_t *info, uint8_t first,
+								 uint8_t count) {
+	uint8_t frame[5];
+
+	if (info->fastRead) {
+		frame[0] = PICC_CMD_UL_FAST_READ;
+		frame[1] = first;
+		frame[2] = first + count - 1;
+		return exchange(frame, 3, count * UL_PAGE_SIZE);
+	}
+	/* READ returns 4 pages whatever is asked for */
+	frame[0] = PICC_CMD_MF_READ;
+	frame[1] = first;
+	return exchange(frame, 2, 4 * UL_PAGE_SIZE);
+}
+
+static uint8_t chunk_pages(const UL_Info_t *info, uint8_t count) {
+	uint8_t max = info->fastRead ? UL_FAST_READ_PAGES : 4;
+	return count < max ? count : max;
+}
+
+MFRC522_Status UL_ReadPages(const UL_Info_t *info, uint8_t first,
+							uint8_t count, uint8_t *out) {
+	MFRC522_Status status = check_range(info, first, count);
+
+	PCD_StartTransceive();
+	while (status == STATUS_OK && count) {
+		uint8_t n = chunk_pages(info, count);
+		status = read_chunk(info, first, n);
+		if (status == STATUS_OK) {
+			memcpy(out, rx, n * UL_PAGE_SIZE);
+			out += n * UL_PAGE_SIZE;
+			first += n;
+			count -= n;
+		}
+	}
+	return status;
+}
+
+MFRC522_Status UL_WritePages(const UL_Info_t *info, uint8_t first,
+							 uint8_t count, const uint8_t *data, bool verify) {
+	MFRC522_Status status;
+
+	if (!UL_InUser(info, first, count)) {
+		return STATUS_INVALID;
+	}
+
+	PCD_StartTransceive();
+	for (uint8_t i = 0; i < count; i++) {
+		uint8_t frame[2 + UL_PAGE_SIZE + 2];
+		uint8_t ack;
+		uint16_t ackLen = 1;
+		uint8_t validBits;
+
+		frame[0] = PICC_CMD_UL_WRITE;
+		frame[1] = first + i;
+		memcpy(&frame[2], &data[i * UL_PAGE_SIZE], UL_PAGE_SIZE);
+		append_crc(frame, 2 + UL_PAGE_SIZE);
+		status = PCD_TransceiveStream(frame, sizeof(frame), &ack, &ackLen,
+									  &validBits);
+		if (status != STATUS_OK) {
+			return status;
+		}
+		if (ackLen != 1 || validBits != 4) {
+			return STATUS_ERROR;
+		}
+		if ((ack & 0x0F) != MIFARE_ACK) {
+			return STATUS_MIFARE_NACK;
+		}
+	}
+	if (!verify) {
+		return STATUS_OK;
+	}
+
+	/* One read per chunk instead of one per page */
+	while (count) {
+		uint8_t n = chunk_pages(info, count);
+		status = read_chunk(info, first, n);
+		if (status != STATUS_OK) {
+			return status;
+		}
+		if (memcmp(rx, data, n * UL_PAGE_SIZE)) {
+			return STATUS_MISMATCH;
+		}
+		data += n * UL_PAGE_SIZE;
+		first += n;
+		count -= n;
+	}
+	return STATUS_OK;
+}